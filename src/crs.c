@@ -0,0 +1,308 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "crs_file_io.h"
+#include "crs_spec_io.h"
+#include "crs_engine.h"
+#include "crs_thread_pool.h"
+#include "crs_erasure_codes.h"
+#include "crs.h"
+
+/**
+ * The geometry, coding matrix and thread pool of an object, the schedules are cached between contexts
+ */
+struct crs_context {
+	struct crs_encoding_spec spec;
+	struct crs_thread_pool *pool; /* NULL to code in the calling thread */
+};
+
+/**
+ * Allocates a context with an empty spec and its thread pool.
+ * @param threads The number of threads to code with
+ * @return The context, or NULL if unsuccessful
+ */
+static struct crs_context *new_context(int threads) {
+	struct crs_context *ctx;
+
+	if (threads <= 0 || threads > MAX_THREADS) {
+		errno = EINVAL;
+		return NULL;
+	}
+	ctx = (struct crs_context *) calloc(1, sizeof(struct crs_context));
+	if (ctx == NULL) {
+		return NULL;
+	}
+	if (threads > 1) {
+		ctx->pool = thread_pool_create(threads);
+		if (ctx->pool == NULL) {
+			free(ctx);
+			return NULL;
+		}
+	}
+	return ctx;
+}
+
+/**
+ * Marks the fragments which are not erased.
+ * @param spec The encoding specification
+ * @param erasures A -1 terminated array of erased fragment indices
+ * @param present The k + m flags to fill (0 for erased, 1 for present)
+ * @return The number of erasures, or -1 (errno is EINVAL) if an index is out of range or repeated, or there are more
+ * than m
+ */
+static int mark_erasures(struct crs_encoding_spec *spec, int *erasures, int *present) {
+	int i;
+
+	for (i = 0; i < spec->k + spec->m; i++) {
+		present[i] = 1;
+	}
+	for (i = 0; erasures[i] != -1; i++) {
+		if (i == spec->m || erasures[i] < 0 || erasures[i] >= spec->k + spec->m || present[erasures[i]] == 0) {
+			errno = EINVAL;
+			return -1;
+		}
+		present[erasures[i]] = 0;
+	}
+	return i;
+}
+
+/**
+ * Creates a context encoding objects of objectSize bytes.
+ * @param k The number of data fragments
+ * @param m The number of coding fragments, at most k
+ * @param engine "crs" (cauchy reed-solomon with XOR schedules) or "rs8" (reed-solomon over GF(2^8), k + m <= 256),
+ * NULL for "crs"
+ * @param objectSize The size of the object
+ * @param packetsize The packet size, a multiple of sizeof(long), or 0 to size it to the cache
+ * @param threads The number of threads to code with
+ * @return The context, or NULL if unsuccessful
+ */
+struct crs_context *crs_create(int k, int m, const char *engine, size_t objectSize, int packetsize, int threads) {
+	struct crs_context *ctx;
+	struct crs_encoding_spec *spec;
+	struct crs_options opts;
+
+	if (k <= 0 || k > MAX_K || m <= 0 || m > k || packetsize < 0 || packetsize % sizeof(long) != 0
+			|| find_engine((engine == NULL) ? "crs" : engine) < 0) {
+		errno = EINVAL;
+		return NULL;
+	}
+	ctx = new_context(threads);
+	if (ctx == NULL) {
+		return NULL;
+	}
+	spec = &(ctx->spec);
+	spec->k = k;
+	spec->m = m;
+	spec->engine = find_engine((engine == NULL) ? "crs" : engine);
+	spec->packetsize = packetsize;
+	if (packetsize == 0) {
+		init_options(&opts);
+		opts.threads = threads;
+		spec->packetsize = choose_packetsize(spec, objectSize, &opts);
+	}
+	if (spec->packetsize < 0 || fill_encoding_spec(spec, objectSize) < 0) {
+		crs_destroy(ctx);
+		errno = EINVAL;
+		return NULL;
+	}
+	if (engine_setup(spec) < 0) {
+		crs_destroy(ctx);
+		return NULL;
+	}
+	return ctx;
+}
+
+/**
+ * Opens a context decoding the fragments described by a spec.
+ * @param spec The spec, from crs_export_spec or a spec file
+ * @param specSize The size of the spec
+ * @param threads The number of threads to code with
+ * @return The context, or NULL if unsuccessful
+ */
+struct crs_context *crs_open(const void *spec, size_t specSize, int threads) {
+	int res;
+	unsigned char *buf;
+	struct crs_context *ctx;
+
+	ctx = new_context(threads);
+	buf = (unsigned char *) malloc(specSize + 1);
+	if (ctx == NULL || buf == NULL) {
+		crs_destroy(ctx);
+		free(buf);
+		return NULL;
+	}
+	memcpy(buf, spec, specSize);
+	res = parse_spec(buf, specSize, &(ctx->spec));
+	free(buf);
+	if (res < 0) {
+		ctx->spec.bitmatrix = NULL;
+		ctx->spec.checksums = NULL;
+		crs_destroy(ctx);
+		errno = EINVAL;
+		return NULL;
+	}
+	return ctx;
+}
+
+/**
+ * Frees a context.
+ * @param ctx The context, may be NULL
+ */
+void crs_destroy(struct crs_context *ctx) {
+	if (ctx == NULL) {
+		return;
+	}
+	if (ctx->pool != NULL) {
+		thread_pool_destroy(ctx->pool);
+	}
+	free_spec(&(ctx->spec));
+	free(ctx);
+}
+
+/**
+ * Gives the size of the object.
+ * @param ctx The context
+ * @return The size of the object
+ */
+size_t crs_object_size(struct crs_context *ctx) {
+	return (size_t) ctx->spec.k * ctx->spec.width - ctx->spec.endPadding;
+}
+
+/**
+ * Gives the size of the fragments.
+ * @param ctx The context
+ * @return The size of every fragment buffer
+ */
+size_t crs_fragment_size(struct crs_context *ctx) {
+	return ctx->spec.width;
+}
+
+/**
+ * Gives the number of bytes of a fragment worth storing: the last data fragment ends with the object, the rest of its
+ * buffer being zero padding, every other fragment is crs_fragment_size bytes. The spec checksums cover these bytes, and
+ * fragment buffers filled from stored fragments must be zero padded back to crs_fragment_size.
+ * @param ctx The context
+ * @param index The fragment index (0 = d1, ..., k = c1, ...)
+ * @return The number of bytes to store
+ */
+size_t crs_stored_size(struct crs_context *ctx, int index) {
+	return fragment_size(&(ctx->spec), index);
+}
+
+/**
+ * Gives the size of the spec.
+ * @param ctx The context
+ * @return The size of the spec
+ */
+size_t crs_spec_size(struct crs_context *ctx) {
+	return spec_size(&(ctx->spec));
+}
+
+/**
+ * Exports the spec, including the fragment checksums once an object has been encoded.
+ * @param ctx The context
+ * @param buf The crs_spec_size bytes to fill
+ */
+void crs_export_spec(struct crs_context *ctx, void *buf) {
+	pack_spec(&(ctx->spec), (unsigned char *) buf);
+}
+
+/**
+ * Encodes an object into its data and coding fragments and records the fragment checksums in the spec.
+ * @param ctx The context
+ * @param object The crs_object_size bytes of the object
+ * @param fragments The k data then m coding fragment buffers of crs_fragment_size bytes to fill
+ * @return 0 if successful, otherwise -1
+ */
+int crs_encode(struct crs_context *ctx, const char *object, char **fragments) {
+	int row;
+	size_t done, piece, column;
+	size_t size = crs_object_size(ctx);
+	struct crs_encoding_spec *spec = &(ctx->spec);
+
+	/* Lay the object out over the data fragments, zero padded, as the encode of a file would */
+	for (done = 0; done < (size_t) spec->k * spec->width; done += piece) {
+		piece = locate_byte(spec, done, &row, &column);
+		if (done < size) {
+			piece = (piece < size - done) ? piece : size - done;
+			memcpy(fragments[row] + column, object + done, piece);
+		} else {
+			memset(fragments[row] + column, 0, piece);
+		}
+	}
+
+	if (engine_encode(spec, fragments, fragments + spec->k, spec->width, ctx->pool) < 0) {
+		return -1;
+	}
+	free(spec->checksums);
+	spec->checksums = NULL;
+	return update_checksums(spec, fragments, fragments + spec->k, 0, ctx->pool);
+}
+
+/**
+ * Rebuilds erased fragments from the others.
+ * @param ctx The context
+ * @param fragments The k data then m coding fragment buffers of crs_fragment_size bytes, the erased ones are filled
+ * @param erasures A -1 terminated array of at most m erased fragment indices (0 = d1, ..., k = c1, ...)
+ * @return 0 if successful, otherwise -1
+ */
+int crs_decode(struct crs_context *ctx, char **fragments, int *erasures) {
+	int res;
+	int *present;
+	struct crs_encoding_spec *spec = &(ctx->spec);
+
+	present = (int *) malloc((spec->k + spec->m) * sizeof(int));
+	if (present == NULL) {
+		return -1;
+	}
+	res = mark_erasures(spec, erasures, present);
+	free(present);
+	if (res <= 0) {
+		return res;
+	}
+	return engine_decode(spec, erasures, fragments, fragments + spec->k, spec->width, ctx->pool);
+}
+
+/**
+ * Rebuilds the object from the fragments. Only the erased data fragments are decoded, reading the fewest fragments
+ * possible: the erased ones and the unused coding ones may be scratch buffers, their contents are undefined after.
+ * @param ctx The context
+ * @param fragments The k data then m coding fragment buffers of crs_fragment_size bytes
+ * @param erasures A -1 terminated array of at most m erased fragment indices (0 = d1, ..., k = c1, ...)
+ * @param object The crs_object_size bytes to fill
+ * @return 0 if successful, otherwise -1
+ */
+int crs_reconstruct(struct crs_context *ctx, char **fragments, int *erasures, char *object) {
+	int res, row;
+	int *present, *needed;
+	size_t done, piece, column;
+	size_t size = crs_object_size(ctx);
+	struct crs_encoding_spec *spec = &(ctx->spec);
+
+	present = (int *) malloc((spec->k + spec->m) * sizeof(int));
+	needed = (int *) malloc((spec->k + spec->m + 1) * sizeof(int));
+	if (present == NULL || needed == NULL) {
+		res = -1;
+	} else {
+		res = mark_erasures(spec, erasures, present);
+	}
+	if (res > 0) {
+		res = data_erasures(spec, present, needed);
+	}
+	if (res > 0) {
+		res = engine_decode(spec, needed, fragments, fragments + spec->k, spec->width, ctx->pool);
+	}
+	free(present);
+	free(needed);
+	if (res < 0) {
+		return -1;
+	}
+
+	for (done = 0; done < size; done += piece) {
+		piece = locate_byte(spec, done, &row, &column);
+		piece = (piece < size - done) ? piece : size - done;
+		memcpy(object + done, fragments[row] + column, piece);
+	}
+	return 0;
+}
@@ -0,0 +1,122 @@
+#ifndef CRS_H_
+#define CRS_H_
+
+#include <stddef.h>
+
+/*
+ * libcrs: erasure codes over buffers in memory.
+ *
+ * An object of n bytes is split into k data fragments and m coding fragments of crs_fragment_size bytes each: data
+ * fragment i holds bytes [i * fragment size, (i + 1) * fragment size) of the object, the last one zero padded. Any k
+ * of the k + m fragments rebuild the object. The spec (crs_export_spec) describes the layout, the coding matrix and
+ * the fragment checksums, a context decoding the fragments is opened from it (crs_open). Stored (crs_stored_size) as
+ * files d1 ... dk, c1 ... cm and spec in one directory, the fragments can be decoded by the crs-erasure-codes program.
+ *
+ * Functions returning int give 0 if successful, otherwise -1 with errno set. A context may be used by one thread at a
+ * time, different contexts by different threads.
+ */
+
+#define CRS_API __attribute__((visibility("default")))
+
+/**
+ * The geometry, coding matrix and thread pool of an object, the schedules are cached between contexts
+ */
+struct crs_context;
+
+/**
+ * Creates a context encoding objects of objectSize bytes.
+ * @param k The number of data fragments
+ * @param m The number of coding fragments, at most k
+ * @param engine "crs" (cauchy reed-solomon with XOR schedules) or "rs8" (reed-solomon over GF(2^8), k + m <= 256),
+ * NULL for "crs"
+ * @param objectSize The size of the object
+ * @param packetsize The packet size, a multiple of sizeof(long), or 0 to size it to the cache
+ * @param threads The number of threads to code with
+ * @return The context, or NULL if unsuccessful
+ */
+CRS_API struct crs_context *crs_create(int k, int m, const char *engine, size_t objectSize, int packetsize,
+		int threads);
+
+/**
+ * Opens a context decoding the fragments described by a spec.
+ * @param spec The spec, from crs_export_spec or a spec file
+ * @param specSize The size of the spec
+ * @param threads The number of threads to code with
+ * @return The context, or NULL if unsuccessful
+ */
+CRS_API struct crs_context *crs_open(const void *spec, size_t specSize, int threads);
+
+/**
+ * Frees a context.
+ * @param ctx The context, may be NULL
+ */
+CRS_API void crs_destroy(struct crs_context *ctx);
+
+/**
+ * Gives the size of the object.
+ * @param ctx The context
+ * @return The size of the object
+ */
+CRS_API size_t crs_object_size(struct crs_context *ctx);
+
+/**
+ * Gives the size of the fragments.
+ * @param ctx The context
+ * @return The size of every fragment buffer
+ */
+CRS_API size_t crs_fragment_size(struct crs_context *ctx);
+
+/**
+ * Gives the number of bytes of a fragment worth storing: the last data fragment ends with the object, the rest of its
+ * buffer being zero padding, every other fragment is crs_fragment_size bytes. The spec checksums cover these bytes, and
+ * fragment buffers filled from stored fragments must be zero padded back to crs_fragment_size.
+ * @param ctx The context
+ * @param index The fragment index (0 = d1, ..., k = c1, ...)
+ * @return The number of bytes to store
+ */
+CRS_API size_t crs_stored_size(struct crs_context *ctx, int index);
+
+/**
+ * Gives the size of the spec.
+ * @param ctx The context
+ * @return The size of the spec
+ */
+CRS_API size_t crs_spec_size(struct crs_context *ctx);
+
+/**
+ * Exports the spec, including the fragment checksums once an object has been encoded.
+ * @param ctx The context
+ * @param buf The crs_spec_size bytes to fill
+ */
+CRS_API void crs_export_spec(struct crs_context *ctx, void *buf);
+
+/**
+ * Encodes an object into its data and coding fragments and records the fragment checksums in the spec.
+ * @param ctx The context
+ * @param object The crs_object_size bytes of the object
+ * @param fragments The k data then m coding fragment buffers of crs_fragment_size bytes to fill
+ * @return 0 if successful, otherwise -1
+ */
+CRS_API int crs_encode(struct crs_context *ctx, const char *object, char **fragments);
+
+/**
+ * Rebuilds erased fragments from the others.
+ * @param ctx The context
+ * @param fragments The k data then m coding fragment buffers of crs_fragment_size bytes, the erased ones are filled
+ * @param erasures A -1 terminated array of at most m erased fragment indices (0 = d1, ..., k = c1, ...)
+ * @return 0 if successful, otherwise -1
+ */
+CRS_API int crs_decode(struct crs_context *ctx, char **fragments, int *erasures);
+
+/**
+ * Rebuilds the object from the fragments. Only the erased data fragments are decoded, reading the fewest fragments
+ * possible: the erased ones and the unused coding ones may be scratch buffers, their contents are undefined after.
+ * @param ctx The context
+ * @param fragments The k data then m coding fragment buffers of crs_fragment_size bytes
+ * @param erasures A -1 terminated array of at most m erased fragment indices (0 = d1, ..., k = c1, ...)
+ * @param object The crs_object_size bytes to fill
+ * @return 0 if successful, otherwise -1
+ */
+CRS_API int crs_reconstruct(struct crs_context *ctx, char **fragments, int *erasures, char *object);
+
+#endif /* CRS_H_ */
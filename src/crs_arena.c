@@ -0,0 +1,113 @@
+#include <stdlib.h>
+#include <sys/mman.h>
+#include "crs_arena.h"
+
+/**
+ * Initialises an empty arena.
+ * @param arena The arena
+ */
+void arena_init(struct crs_arena *arena) {
+	arena->base = NULL;
+	arena->capacity = 0;
+	arena->mapped = 0;
+	arena->rows = NULL;
+	arena->maxRows = 0;
+}
+
+/**
+ * Frees the block, keeping the row pointers.
+ * @param arena The arena
+ */
+static void release_block(struct crs_arena *arena) {
+	if (arena->mapped) {
+		munmap(arena->base, arena->capacity);
+	} else {
+		free(arena->base);
+	}
+	arena->base = NULL;
+	arena->capacity = 0;
+	arena->mapped = 0;
+}
+
+/**
+ * Allocates a block of at least size bytes. Large blocks are mapped on huge page boundaries and advised to use
+ * transparent huge pages, the rest are ARENA_ALIGNMENT aligned.
+ * @param arena The empty arena
+ * @param size The number of bytes required
+ * @return 0 if successful, otherwise -1
+ */
+static int allocate_block(struct crs_arena *arena, size_t size) {
+	void *block;
+
+	if (size >= HUGE_PAGE_SIZE) {
+		size = (size + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+		block = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (block == MAP_FAILED) {
+			return -1;
+		}
+#ifdef MADV_HUGEPAGE
+		madvise(block, size, MADV_HUGEPAGE);
+#endif
+		arena->mapped = 1;
+	} else {
+		if (posix_memalign(&block, ARENA_ALIGNMENT, size) != 0) {
+			return -1;
+		}
+		arena->mapped = 0;
+	}
+	arena->base = (char *) block;
+	arena->capacity = size;
+	return 0;
+}
+
+/**
+ * Carves the arena into rows of columns bytes, each starting on an ARENA_ALIGNMENT boundary, growing it if required.
+ * The contents of the rows are undefined; any previous matrix carved from the arena is invalidated.
+ * @param arena The arena
+ * @param rows The number of rows
+ * @param columns The size of each row
+ * @return The row pointers (owned by the arena), or NULL if unsuccessful
+ */
+char **arena_matrix(struct crs_arena *arena, int rows, size_t columns) {
+	int i;
+	char **rowPtrs;
+	size_t stride = (columns + ARENA_ALIGNMENT - 1) / ARENA_ALIGNMENT * ARENA_ALIGNMENT;
+
+	if (rows <= 0) {
+		return NULL;
+	}
+	if (stride == 0) {
+		stride = ARENA_ALIGNMENT;
+	}
+
+	if (rows > arena->maxRows) {
+		rowPtrs = (char **) realloc(arena->rows, rows * sizeof(char *));
+		if (rowPtrs == NULL) {
+			return NULL;
+		}
+		arena->rows = rowPtrs;
+		arena->maxRows = rows;
+	}
+
+	if (stride * rows > arena->capacity) {
+		release_block(arena);
+		if (allocate_block(arena, stride * rows) < 0) {
+			return NULL;
+		}
+	}
+
+	for (i = 0; i < rows; i++) {
+		arena->rows[i] = arena->base + i * stride;
+	}
+	return arena->rows;
+}
+
+/**
+ * Frees the memory held by the arena, leaving it empty.
+ * @param arena The arena
+ */
+void arena_free(struct crs_arena *arena) {
+	release_block(arena);
+	free(arena->rows);
+	arena_init(arena);
+}
@@ -0,0 +1,46 @@
+#ifndef CRS_ARENA_H_
+#define CRS_ARENA_H_
+
+#include <stddef.h>
+
+/* Alignment of every row, suitable for aligned vector loads */
+#define ARENA_ALIGNMENT 64
+
+/* Arenas at least this large are mapped on huge page boundaries */
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+/**
+ * A single block of memory carved into equally sized, aligned rows. The block is kept between uses and only
+ * reallocated when a larger matrix is requested.
+ */
+struct crs_arena {
+	char *base; /* Start of the block */
+	size_t capacity; /* Size of the block in bytes */
+	int mapped; /* The block was allocated with mmap rather than posix_memalign */
+	char **rows; /* Row pointers into the block */
+	int maxRows; /* Number of row pointers allocated */
+};
+
+/**
+ * Initialises an empty arena.
+ * @param arena The arena
+ */
+void arena_init(struct crs_arena *arena);
+
+/**
+ * Carves the arena into rows of columns bytes, each starting on an ARENA_ALIGNMENT boundary, growing it if required.
+ * The contents of the rows are undefined; any previous matrix carved from the arena is invalidated.
+ * @param arena The arena
+ * @param rows The number of rows
+ * @param columns The size of each row
+ * @return The row pointers (owned by the arena), or NULL if unsuccessful
+ */
+char **arena_matrix(struct crs_arena *arena, int rows, size_t columns);
+
+/**
+ * Frees the memory held by the arena, leaving it empty.
+ * @param arena The arena
+ */
+void arena_free(struct crs_arena *arena);
+
+#endif /* CRS_ARENA_H_ */
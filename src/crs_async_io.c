@@ -0,0 +1,490 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include "crs_file_io.h"
+#include "crs_thread_pool.h"
+#include "crs_async_io.h"
+
+#if defined(__NR_io_uring_setup) && !defined(CRS_NO_IO_URING)
+#define CRS_IO_URING
+#include <linux/io_uring.h>
+
+/**
+ * The rings shared with the kernel, set up through the raw system calls
+ */
+struct crs_uring {
+	int fd;
+	unsigned entries;
+	unsigned *sqHead;
+	unsigned *sqTail;
+	unsigned *sqMask;
+	unsigned *sqArray;
+	unsigned *cqHead;
+	unsigned *cqTail;
+	unsigned *cqMask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	void *sqRing;
+	size_t sqRingSize;
+	void *cqRing;
+	size_t cqRingSize;
+	size_t sqesSize;
+};
+
+/**
+ * Sets up an io_uring with room for entries submissions.
+ * @param ring The ring to set up
+ * @param entries The submission queue depth
+ * @return 0 if successful, otherwise -1 (io_uring unsupported or disabled, ring->fd is then -1)
+ */
+static int uring_init(struct crs_uring *ring, unsigned entries) {
+	struct io_uring_params params;
+	char *sq, *cq;
+
+	memset(&params, 0, sizeof(params));
+	ring->fd = (int) syscall(__NR_io_uring_setup, entries, &params);
+	if (ring->fd < 0) {
+		return -1;
+	}
+	ring->entries = params.sq_entries;
+	ring->sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	ring->cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	ring->sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+
+	ring->sqRing = mmap(NULL, ring->sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd,
+			IORING_OFF_SQ_RING);
+	ring->cqRing = mmap(NULL, ring->cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd,
+			IORING_OFF_CQ_RING);
+	ring->sqes = (struct io_uring_sqe *) mmap(NULL, ring->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+			ring->fd, IORING_OFF_SQES);
+	if (ring->sqRing == MAP_FAILED || ring->cqRing == MAP_FAILED || ring->sqes == MAP_FAILED) {
+		if (ring->sqRing != MAP_FAILED) {
+			munmap(ring->sqRing, ring->sqRingSize);
+		}
+		if (ring->cqRing != MAP_FAILED) {
+			munmap(ring->cqRing, ring->cqRingSize);
+		}
+		if (ring->sqes != MAP_FAILED) {
+			munmap(ring->sqes, ring->sqesSize);
+		}
+		close(ring->fd);
+		ring->fd = -1;
+		return -1;
+	}
+
+	sq = (char *) ring->sqRing;
+	ring->sqHead = (unsigned *) (sq + params.sq_off.head);
+	ring->sqTail = (unsigned *) (sq + params.sq_off.tail);
+	ring->sqMask = (unsigned *) (sq + params.sq_off.ring_mask);
+	ring->sqArray = (unsigned *) (sq + params.sq_off.array);
+	cq = (char *) ring->cqRing;
+	ring->cqHead = (unsigned *) (cq + params.cq_off.head);
+	ring->cqTail = (unsigned *) (cq + params.cq_off.tail);
+	ring->cqMask = (unsigned *) (cq + params.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe *) (cq + params.cq_off.cqes);
+	return 0;
+}
+
+/**
+ * Unmaps and closes the ring, unless it was already.
+ * @param ring The ring
+ */
+static void uring_free(struct crs_uring *ring) {
+	if (ring->fd < 0) {
+		return;
+	}
+	munmap(ring->sqes, ring->sqesSize);
+	munmap(ring->cqRing, ring->cqRingSize);
+	munmap(ring->sqRing, ring->sqRingSize);
+	close(ring->fd);
+	ring->fd = -1;
+}
+
+/**
+ * Waits out the requests in flight on a ring io_uring_enter failed on, so the kernel no longer uses their buffers nor
+ * descriptors when they are released. The submissions the kernel has not consumed are taken back, the completions of
+ * the others are waited for and discarded (their requests are left incomplete). If even waiting fails the ring is torn
+ * down, which cancels the requests.
+ * @param ring The ring
+ * @param inFlight The number of requests queued and not completed
+ */
+static void uring_drain(struct crs_uring *ring, unsigned inFlight) {
+	unsigned head, tail;
+	long res;
+
+	head = __atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE);
+	tail = *(ring->sqTail);
+	inFlight -= tail - head;
+	__atomic_store_n(ring->sqTail, head, __ATOMIC_RELEASE);
+
+	while (inFlight > 0) {
+		res = syscall(__NR_io_uring_enter, ring->fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+		if (res < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+			uring_free(ring);
+			return;
+		}
+		head = *(ring->cqHead);
+		while (head != __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE) && inFlight > 0) {
+			head++;
+			inFlight--;
+		}
+		__atomic_store_n(ring->cqHead, head, __ATOMIC_RELEASE);
+	}
+}
+
+/**
+ * Queues a read or write of the part of request i not yet transferred.
+ * @param ring The ring
+ * @param requests The requests, the result of each holds the bytes transferred so far
+ * @param i The request to queue
+ * @param fd The open file of the request
+ * @param iov The request's io vector, it must stay valid until completion
+ */
+static void uring_queue(struct crs_uring *ring, struct crs_io_request *requests, int i, int fd, struct iovec *iov) {
+	unsigned tail, index;
+	struct io_uring_sqe *sqe;
+
+	tail = *(ring->sqTail);
+	index = tail & *(ring->sqMask);
+	sqe = &(ring->sqes[index]);
+	memset(sqe, 0, sizeof(struct io_uring_sqe));
+
+	iov->iov_base = requests[i].buf + requests[i].result;
+	iov->iov_len = requests[i].nrBytes - (size_t) requests[i].result;
+	sqe->opcode = (requests[i].op == IO_READ) ? IORING_OP_READV : IORING_OP_WRITEV;
+	sqe->fd = fd;
+	sqe->addr = (unsigned long) iov;
+	sqe->len = 1;
+	sqe->off = (unsigned long long) (requests[i].offset + requests[i].result);
+	sqe->user_data = (unsigned long long) i;
+
+	ring->sqArray[index] = index;
+	__atomic_store_n(ring->sqTail, tail + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Performs the ring's share of the requests (all but IO_COPY), keeping up to ring->entries of them in flight. Short
+ * transfers are resubmitted for the remainder, a read completes at the end of the file. If the ring fails the requests
+ * in flight are waited out (see uring_drain) before their files are closed, the incomplete ones failing.
+ * @param ring The ring
+ * @param requests The requests
+ * @param nrRequests The number of requests
+ */
+static void uring_perform(struct crs_uring *ring, struct crs_io_request *requests, int nrRequests) {
+	int i, flags;
+	int nrTodo = 0;
+	unsigned inFlight = 0;
+	unsigned head, toSubmit;
+	long res;
+	int *fds;
+	int *todo;
+	struct iovec *iovs;
+	struct io_uring_cqe *cqe;
+
+	fds = (int *) malloc(nrRequests * sizeof(int));
+	todo = (int *) malloc(nrRequests * sizeof(int));
+	iovs = (struct iovec *) malloc(nrRequests * sizeof(struct iovec));
+	if (fds == NULL || todo == NULL || iovs == NULL) {
+		for (i = 0; i < nrRequests; i++) {
+			if (requests[i].op != IO_COPY) {
+				requests[i].result = -1;
+			}
+		}
+		free(fds);
+		free(todo);
+		free(iovs);
+		return;
+	}
+
+	for (i = 0; i < nrRequests; i++) {
+		fds[i] = -1;
+		if (requests[i].op == IO_COPY) {
+			continue;
+		}
+		flags = (requests[i].op == IO_READ) ? O_RDONLY : (O_WRONLY | O_CREAT | O_TRUNC);
+		fds[i] = (requests[i].op == IO_WRITE_AT) ? requests[i].fd : open(requests[i].filePath, flags, 0666);
+		if (fds[i] < 0) {
+			requests[i].result = -1;
+		} else if (requests[i].nrBytes == 0) {
+			requests[i].result = 0;
+			if (requests[i].op != IO_WRITE_AT) {
+				close(fds[i]);
+			}
+			fds[i] = -1;
+		} else {
+			requests[i].result = 0;
+			todo[nrTodo] = i;
+			nrTodo++;
+		}
+	}
+
+	while (nrTodo > 0 || inFlight > 0) {
+		while (nrTodo > 0 && inFlight < ring->entries) {
+			nrTodo--;
+			uring_queue(ring, requests, todo[nrTodo], fds[todo[nrTodo]], &(iovs[todo[nrTodo]]));
+			inFlight++;
+		}
+
+		/* Submit whatever the kernel has not consumed yet and wait for at least one completion */
+		toSubmit = *(ring->sqTail) - __atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE);
+		res = syscall(__NR_io_uring_enter, ring->fd, toSubmit, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+		if (res < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+			uring_drain(ring, inFlight);
+			break;
+		}
+
+		head = *(ring->cqHead);
+		while (head != __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE)) {
+			cqe = &(ring->cqes[head & *(ring->cqMask)]);
+			i = (int) cqe->user_data;
+			res = cqe->res;
+			head++;
+			inFlight--;
+
+			if (res == -EINTR || res == -EAGAIN) {
+				todo[nrTodo] = i;
+				nrTodo++;
+				continue;
+			}
+			if (res < 0 || (res == 0 && requests[i].op != IO_READ)) {
+				requests[i].result = -1;
+			} else if (res > 0) {
+				requests[i].result += res;
+				if ((size_t) requests[i].result < requests[i].nrBytes) {
+					todo[nrTodo] = i;
+					nrTodo++;
+					continue;
+				}
+			}
+			/* Complete, the file of an IO_WRITE_AT belongs to the caller */
+			if (requests[i].op != IO_WRITE_AT && close(fds[i]) < 0 && requests[i].op == IO_WRITE) {
+				requests[i].result = -1;
+			}
+			fds[i] = -1;
+		}
+		__atomic_store_n(ring->cqHead, head, __ATOMIC_RELEASE);
+	}
+
+	/* Requests still open when the ring failed did not complete */
+	for (i = 0; i < nrRequests; i++) {
+		if (fds[i] >= 0) {
+			if (requests[i].op != IO_WRITE_AT) {
+				close(fds[i]);
+			}
+			requests[i].result = -1;
+		}
+	}
+	free(fds);
+	free(todo);
+	free(iovs);
+}
+#endif /* CRS_IO_URING */
+
+/**
+ * Performs one request with blocking calls, storing its result.
+ * @param arg The crs_io_request
+ */
+static void io_task(void *arg) {
+	struct crs_io_request *request = (struct crs_io_request *) arg;
+	int fd;
+	ssize_t nrRead, nrWritten;
+
+	if (request->op == IO_READ) {
+		fd = open(request->filePath, O_RDONLY);
+		if (fd < 0) {
+			request->result = -1;
+			return;
+		}
+		request->result = 0;
+		while ((size_t) request->result < request->nrBytes) {
+			nrRead = pread(fd, request->buf + request->result, request->nrBytes - request->result,
+					request->offset + request->result);
+			if (nrRead < 0 && errno == EINTR) {
+				continue;
+			}
+			if (nrRead < 0) {
+				request->result = -1;
+			}
+			if (nrRead <= 0) {
+				break;
+			}
+			request->result += nrRead;
+		}
+		close(fd);
+		return;
+	}
+
+	if (request->op == IO_WRITE_AT) {
+		request->result = 0;
+		while ((size_t) request->result < request->nrBytes) {
+			nrWritten = pwrite(request->fd, request->buf + request->result, request->nrBytes - request->result,
+					request->offset + request->result);
+			if (nrWritten < 0 && errno == EINTR) {
+				continue;
+			}
+			if (nrWritten <= 0) {
+				request->result = -1;
+				break;
+			}
+			request->result += nrWritten;
+		}
+		return;
+	}
+
+	if (request->op == IO_COPY
+			&& copy_file_bytes(request->srcFd, request->srcOffset, request->nrBytes, request->filePath) == 0) {
+		request->result = (ssize_t) request->nrBytes;
+		return;
+	}
+	if (write_binary_bytes(request->buf, request->nrBytes, request->filePath) < 0) {
+		request->result = -1;
+	} else {
+		request->result = (ssize_t) request->nrBytes;
+	}
+}
+
+/**
+ * The io_uring and thread pool perform_io runs requests on
+ */
+struct crs_io_context {
+#ifdef CRS_IO_URING
+	struct crs_uring ring; /* ring.fd is -1 until set up, and once unavailable or failed */
+	int ringTried; /* Whether setting up the ring was attempted */
+#endif
+	struct crs_thread_pool *pool; /* NULL until a batch needs threads */
+};
+
+/**
+ * Initialises an io context with nothing set up.
+ * @param ctx The context
+ */
+static void io_context_init(struct crs_io_context *ctx) {
+	memset(ctx, 0, sizeof(struct crs_io_context));
+#ifdef CRS_IO_URING
+	ctx->ring.fd = -1;
+#endif
+}
+
+/**
+ * Tears down what an io context has set up.
+ * @param ctx The context
+ */
+static void io_context_release(struct crs_io_context *ctx) {
+#ifdef CRS_IO_URING
+	uring_free(&(ctx->ring));
+#endif
+	if (ctx->pool != NULL) {
+		thread_pool_destroy(ctx->pool);
+		ctx->pool = NULL;
+	}
+}
+
+/**
+ * Creates an io context, nothing is set up until it is first used.
+ * @return The context, or NULL if unsuccessful
+ */
+struct crs_io_context *io_context_create(void) {
+	struct crs_io_context *ctx;
+
+	ctx = (struct crs_io_context *) malloc(sizeof(struct crs_io_context));
+	if (ctx != NULL) {
+		io_context_init(ctx);
+	}
+	return ctx;
+}
+
+/**
+ * Tears down the ring and thread pool of an io context and frees it. No requests may be in progress.
+ * @param ctx The context, or NULL
+ */
+void io_context_destroy(struct crs_io_context *ctx) {
+	if (ctx != NULL) {
+		io_context_release(ctx);
+		free(ctx);
+	}
+}
+
+/**
+ * Performs all the requests concurrently. The reads and writes are submitted together to an io_uring when the kernel
+ * provides one, otherwise every request runs on a thread pool of up to MAX_IO_THREADS threads. IO_COPY requests always
+ * run on the thread pool (copy_file_range has no io_uring operation), overlapping with the ring.
+ * @param ctx The io context to run the requests on, or NULL to set one up for this call only
+ * @param requests The requests, each result is set on return
+ * @param nrRequests The number of requests
+ * @return 0 if every request was successful (a read may be short), otherwise -1
+ */
+int perform_io(struct crs_io_context *ctx, struct crs_io_request *requests, int nrRequests) {
+	int i, nrThreads;
+	int useRing = 0;
+	int nrThreaded = 0;
+	struct crs_io_context local;
+	struct crs_task_group group;
+#ifdef CRS_IO_URING
+	int nrRing = 0;
+#endif
+
+	if (ctx == NULL) {
+		io_context_init(&local);
+		ctx = &local;
+	}
+
+#ifdef CRS_IO_URING
+	for (i = 0; i < nrRequests; i++) {
+		if (requests[i].op != IO_COPY) {
+			nrRing++;
+		}
+	}
+	if (nrRing > 0 && !ctx->ringTried) {
+		ctx->ringTried = 1;
+		uring_init(&(ctx->ring), (nrRing < IO_QUEUE_DEPTH) ? nrRing : IO_QUEUE_DEPTH);
+	}
+	useRing = (nrRing > 0 && ctx->ring.fd >= 0);
+#endif
+
+	for (i = 0; i < nrRequests; i++) {
+		if (!useRing || requests[i].op == IO_COPY) {
+			nrThreaded++;
+		}
+	}
+
+	/* The calling thread drives the ring, or takes a share of the tasks when there is none */
+	if (ctx->pool == NULL && (nrThreaded > 1 || (useRing && nrThreaded > 0))) {
+		nrThreads = nrThreaded + useRing;
+		ctx->pool = thread_pool_create((nrThreads < MAX_IO_THREADS) ? nrThreads : MAX_IO_THREADS);
+	}
+	task_group_init(&group);
+	for (i = 0; i < nrRequests; i++) {
+		if (useRing && requests[i].op != IO_COPY) {
+			continue;
+		}
+		if (ctx->pool == NULL || thread_pool_submit(ctx->pool, &group, io_task, &(requests[i])) < 0) {
+			io_task(&(requests[i]));
+		}
+	}
+
+#ifdef CRS_IO_URING
+	if (useRing) {
+		uring_perform(&(ctx->ring), requests, nrRequests);
+	}
+#endif
+
+	if (ctx->pool != NULL) {
+		thread_pool_wait(ctx->pool, &group);
+	}
+	if (ctx == &local) {
+		io_context_release(&local);
+	}
+
+	for (i = 0; i < nrRequests; i++) {
+		if (requests[i].result < 0) {
+			return -1;
+		}
+	}
+	return 0;
+}
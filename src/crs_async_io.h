@@ -0,0 +1,59 @@
+#ifndef CRS_ASYNC_IO_H_
+#define CRS_ASYNC_IO_H_
+
+#include <sys/types.h>
+
+#define IO_READ 0
+#define IO_WRITE 1
+#define IO_COPY 2
+#define IO_WRITE_AT 3
+
+#define IO_QUEUE_DEPTH 64
+#define MAX_IO_THREADS 16
+
+/**
+ * One file read or write
+ */
+struct crs_io_request {
+	int op;          /* IO_READ, IO_WRITE, IO_COPY or IO_WRITE_AT */
+	char *filePath;  /* The file to read, or to create (truncated) and write, unused by IO_WRITE_AT */
+	char *buf;       /* The buffer read into or written from (IO_COPY writes it if the kernel copy is unsupported) */
+	size_t nrBytes;  /* The number of bytes to write, or the maximum number of bytes to read */
+	off_t offset;    /* IO_READ, IO_WRITE_AT: the offset in the file to start reading or writing at */
+	int fd;          /* IO_WRITE_AT: the open file written, it is left open */
+	int srcFd;       /* IO_COPY: the file the bytes are copied from */
+	off_t srcOffset; /* IO_COPY: the offset of the bytes in srcFd */
+	ssize_t result;  /* Set on completion: the number of bytes transferred, or -1 */
+};
+
+/**
+ * The io_uring and thread pool perform_io runs requests on, kept across calls so a run submitting a batch per stripe
+ * or slice sets them up once. Both are set up by the first call needing them, sized for its batch. A context may only
+ * be used by one thread at a time.
+ */
+struct crs_io_context;
+
+/**
+ * Creates an io context, nothing is set up until it is first used.
+ * @return The context, or NULL if unsuccessful
+ */
+struct crs_io_context *io_context_create(void);
+
+/**
+ * Tears down the ring and thread pool of an io context and frees it. No requests may be in progress.
+ * @param ctx The context, or NULL
+ */
+void io_context_destroy(struct crs_io_context *ctx);
+
+/**
+ * Performs all the requests concurrently. The reads and writes are submitted together to an io_uring when the kernel
+ * provides one, otherwise every request runs on a thread pool of up to MAX_IO_THREADS threads. IO_COPY requests always
+ * run on the thread pool (copy_file_range has no io_uring operation), overlapping with the ring.
+ * @param ctx The io context to run the requests on, or NULL to set one up for this call only
+ * @param requests The requests, each result is set on return
+ * @param nrRequests The number of requests
+ * @return 0 if every request was successful (a read may be short), otherwise -1
+ */
+int perform_io(struct crs_io_context *ctx, struct crs_io_request *requests, int nrRequests);
+
+#endif /* CRS_ASYNC_IO_H_ */
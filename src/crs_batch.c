@@ -0,0 +1,324 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <fts.h>
+#include <sys/stat.h>
+#include "crs_file_io.h"
+#include "crs_spec_io.h"
+#include "crs_arena.h"
+#include "crs_thread_pool.h"
+#include "crs_erasure_codes.h"
+#include "crs_batch.h"
+
+/**
+ * The files of a batch and the state shared by its jobs
+ */
+struct crs_batch {
+	FTS *tree; /* The directory being walked, NULL when reading a manifest */
+	size_t rootLength; /* Length of the walked directory path, a prefix of every path in the tree */
+	FILE *manifest; /* The manifest being read, NULL when walking a directory */
+	char *line; /* The getline buffer of the manifest */
+	size_t lineSize;
+	char *dest;
+	struct stat destStat; /* Skipped when found in the walked directory */
+	struct crs_encoding_spec *spec; /* Copied for each file */
+	struct crs_options *opts; /* Copied for each file */
+	size_t jobBudget; /* Bytes of buffers each job may take, 0 for no limit */
+	unsigned long nrEncoded;
+	unsigned long nrFailed;
+	pthread_mutex_t lock; /* Guards the tree, the manifest and the counters */
+};
+
+/**
+ * Joins two paths with a slash.
+ * @param dir The first path
+ * @param name The second path
+ * @return The allocated path, or NULL if unsuccessful
+ */
+static char *join_path(char *dir, char *name) {
+	size_t len = strlen(dir) + strlen(name) + 2;
+	char *path = (char *) malloc(len);
+
+	if (path != NULL) {
+		snprintf(path, len, "%s/%s", dir, name);
+	}
+	return path;
+}
+
+/**
+ * Tells whether a listed path stays below the directory it is joined to.
+ * @param path The path, without leading slashes
+ * @return 1 if no component of the path is "..", otherwise 0
+ */
+static int stays_below(char *path) {
+	char *p;
+
+	for (p = path; p != NULL; p = strchr(p, '/')) {
+		if (*p == '/') {
+			p++;
+		}
+		if (strncmp(p, "..", 2) == 0 && (p[2] == '/' || p[2] == '\0')) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/**
+ * Creates the missing parent directories of a path.
+ * @param path The path
+ * @return 0 if successful, otherwise -1
+ */
+static int make_parents(char *path) {
+	int res = 0;
+	char *p;
+
+	for (p = strchr(path + 1, '/'); p != NULL && res == 0; p = strchr(p + 1, '/')) {
+		*p = '\0';
+		if (mkdir(path, S_IRWXU | S_IRWXG) < 0 && errno != EEXIST) {
+			fprintf(stderr, "Could not create directory: %s\n%s\n", path, strerror(errno));
+			res = -1;
+		}
+		*p = '/';
+	}
+	return res;
+}
+
+/**
+ * Takes the next file of the batch. Directories which can not be read and unsafe manifest entries are reported and
+ * counted as failed.
+ * @param batch The batch
+ * @param srcPath Where the allocated path of the file should be stored
+ * @param destPath Where the allocated path of its fragment directory should be stored
+ * @return 1 if a file was taken, 0 if there are none left, or -1 if unsuccessful
+ */
+static int next_file(struct crs_batch *batch, char **srcPath, char **destPath) {
+	int res = 0;
+	size_t len;
+	char *name;
+	FTSENT *ent;
+
+	pthread_mutex_lock(&(batch->lock));
+	while (res == 0 && batch->tree != NULL && (ent = fts_read(batch->tree)) != NULL) {
+		if (ent->fts_info == FTS_DNR || ent->fts_info == FTS_ERR || ent->fts_info == FTS_NS) {
+			fprintf(stderr, "Could not read: %s\n%s\n", ent->fts_path, strerror(ent->fts_errno));
+			batch->nrFailed++;
+		} else if (ent->fts_info == FTS_D && ent->fts_statp->st_dev == batch->destStat.st_dev
+				&& ent->fts_statp->st_ino == batch->destStat.st_ino) {
+			fts_set(batch->tree, ent, FTS_SKIP);
+		} else if (ent->fts_info == FTS_F) {
+			name = ent->fts_path + batch->rootLength;
+			name += strspn(name, "/");
+			*srcPath = strdup(ent->fts_path);
+			*destPath = join_path(batch->dest, name);
+			res = 1;
+		}
+	}
+	while (res == 0 && batch->manifest != NULL && getline(&(batch->line), &(batch->lineSize), batch->manifest) >= 0) {
+		len = strcspn(batch->line, "\r\n");
+		batch->line[len] = '\0';
+		name = batch->line + strspn(batch->line, "/");
+		if (*name == '\0') {
+			continue;
+		}
+		if (!stays_below(name)) {
+			fprintf(stderr, "Skipping a path leaving the destination: %s\n", batch->line);
+			batch->nrFailed++;
+			continue;
+		}
+		*srcPath = strdup(batch->line);
+		*destPath = join_path(batch->dest, name);
+		res = 1;
+	}
+	pthread_mutex_unlock(&(batch->lock));
+
+	if (res == 1 && (*srcPath == NULL || *destPath == NULL)) {
+		free(*srcPath);
+		free(*destPath);
+		return -1;
+	}
+	return res;
+}
+
+/**
+ * Encodes files of the batch until none are left, reusing one arena.
+ * @param arg The batch
+ * @return NULL
+ */
+static void *run_job(void *arg) {
+	int res;
+	size_t fileSize, rowSize;
+	char *srcPath, *destPath;
+	struct crs_batch *batch = (struct crs_batch *) arg;
+	struct crs_encoding_spec spec;
+	struct crs_options opts;
+	struct crs_arena arena;
+
+	arena_init(&arena);
+	while ((res = next_file(batch, &srcPath, &destPath)) > 0) {
+		spec = *(batch->spec);
+		opts = *(batch->opts);
+		opts.arena = &arena;
+
+		/* Stream the files whose rows would not fit in the share of the budget */
+		if (batch->jobBudget > 0 && !opts.mapInput && get_file_size(srcPath, &fileSize) == 0) {
+			rowSize = fileSize / spec.k + 1;
+			if (opts.stripeBudget > batch->jobBudget
+					|| (opts.stripeBudget == 0 && rowSize * (spec.k + spec.m) > batch->jobBudget)) {
+				opts.stripeBudget = batch->jobBudget;
+			}
+		}
+
+		res = make_parents(destPath);
+		if (res == 0) {
+			res = encode(srcPath, destPath, &spec, &opts);
+		}
+		if (res < 0) {
+			fprintf(stderr, "Could not encode: %s\n", srcPath);
+		}
+		pthread_mutex_lock(&(batch->lock));
+		if (res == 0) {
+			batch->nrEncoded++;
+		} else {
+			batch->nrFailed++;
+		}
+		pthread_mutex_unlock(&(batch->lock));
+		free(srcPath);
+		free(destPath);
+	}
+	if (res < 0) {
+		fprintf(stderr, "Could not take the next file\n%s\n", strerror(errno));
+		pthread_mutex_lock(&(batch->lock));
+		batch->nrFailed++;
+		pthread_mutex_unlock(&(batch->lock));
+	}
+	arena_free(&arena);
+	return NULL;
+}
+
+/**
+ * Closes the directory or manifest of a batch.
+ * @param batch The batch
+ */
+static void close_batch(struct crs_batch *batch) {
+	if (batch->tree != NULL) {
+		fts_close(batch->tree);
+	}
+	if (batch->manifest != NULL) {
+		fclose(batch->manifest);
+	}
+	free(batch->line);
+}
+
+/**
+ * Encodes every regular file below the directory src, or every file listed in the manifest src (one path per line), to
+ * its own fragment directory below dest: src/a/b is encoded to dest/a/b, a listed path p to dest/p. Missing parent
+ * directories are created. nrJobs files are encoded at the same time, each by a job keeping an arena between files,
+ * on one pool of opts->threads threads; the coding schedules are cached per (k, m, w) and shared by every file. A file
+ * is encoded in stripes when its data and coding rows would take more than its share (memoryBudget / nrJobs) of the
+ * memory budget. A file which can not be encoded is reported and the others are still encoded.
+ * @param src The directory to encode, or the manifest listing the files to encode
+ * @param dest The directory to encode to, created if missing
+ * @param spec The spec every file is encoded with (k, m, engine and optionally packetsize), left untouched
+ * @param opts The encoding options, the packet size is auto-tuned once for the whole batch
+ * @param nrJobs The number of files encoded at the same time
+ * @param memoryBudget The bytes of buffers the files encoded at the same time may take, 0 for no limit
+ * @return 0 if every file was encoded, otherwise -1
+ */
+int encode_batch(char *src, char *dest, struct crs_encoding_spec *spec, struct crs_options *opts, int nrJobs,
+		size_t memoryBudget) {
+
+	int i, nrStarted;
+	char *root;
+	char *paths[2];
+	pthread_t jobs[MAX_JOBS];
+	struct stat st;
+	struct crs_encoding_spec batchSpec = *spec;
+	struct crs_options batchOpts = *opts;
+	struct crs_options tuneOpts;
+	struct crs_batch batch;
+
+	if (nrJobs < 1 || nrJobs > MAX_JOBS) {
+		fprintf(stderr, "Error: Unsuitable number of jobs: %d\n", nrJobs);
+		return -1;
+	}
+	if (stat(src, &st) < 0) {
+		fprintf(stderr, "Could not read: %s\n%s\n", src, strerror(errno));
+		return -1;
+	}
+	memset(&batch, 0, sizeof(batch));
+	if ((mkdir(dest, S_IRWXU | S_IRWXG) < 0 && errno != EEXIST) || stat(dest, &(batch.destStat)) < 0) {
+		fprintf(stderr, "Could not create directory: %s\n%s\n", dest, strerror(errno));
+		return -1;
+	}
+
+	/* Tune once rather than for every file */
+	if (batchOpts.autotune && batchSpec.packetsize == 0) {
+		tuneOpts = batchOpts;
+		tuneOpts.threads = 1;
+		tuneOpts.stripeBudget = 0;
+		batchSpec.packetsize = choose_packetsize(&batchSpec, 0, &tuneOpts);
+		if (batchSpec.packetsize < 0) {
+			fprintf(stderr, "Error: Could not choose a packet size\n");
+			return -1;
+		}
+	}
+	/* autotune stays set, telling encode the packet size was tuned rather than requested */
+
+	batch.dest = dest;
+	batch.spec = &batchSpec;
+	batch.opts = &batchOpts;
+	batch.jobBudget = memoryBudget / nrJobs;
+	if (S_ISDIR(st.st_mode)) {
+		/* fts paths start with the root as given, without its trailing slashes */
+		root = strdup(src);
+		if (root == NULL) {
+			return -1;
+		}
+		for (i = strlen(root) - 1; i > 0 && root[i] == '/'; i--) {
+			root[i] = '\0';
+		}
+		paths[0] = root;
+		paths[1] = NULL;
+		batch.rootLength = strlen(root);
+		batch.tree = fts_open(paths, FTS_PHYSICAL | FTS_NOCHDIR, NULL);
+		free(root);
+	} else {
+		batch.manifest = fopen(src, "r");
+	}
+	if (batch.tree == NULL && batch.manifest == NULL) {
+		fprintf(stderr, "Could not read: %s\n%s\n", src, strerror(errno));
+		return -1;
+	}
+
+	if (batchOpts.pool == NULL && batchOpts.threads > 1) {
+		batchOpts.pool = thread_pool_create(batchOpts.threads);
+		if (batchOpts.pool == NULL) {
+			fprintf(stderr, "Could not create thread pool\n%s\n", strerror(errno));
+			close_batch(&batch);
+			return -1;
+		}
+	}
+	pthread_mutex_init(&(batch.lock), NULL);
+
+	/* The calling thread runs one of the jobs */
+	for (nrStarted = 0; nrStarted < nrJobs - 1; nrStarted++) {
+		if (pthread_create(jobs + nrStarted, NULL, run_job, &batch) != 0) {
+			break;
+		}
+	}
+	run_job(&batch);
+	for (i = 0; i < nrStarted; i++) {
+		pthread_join(jobs[i], NULL);
+	}
+	fprintf(stdout, "Encoded %lu files, %lu failed\n", batch.nrEncoded, batch.nrFailed);
+
+	pthread_mutex_destroy(&(batch.lock));
+	if (batchOpts.pool != NULL && batchOpts.pool != opts->pool) {
+		thread_pool_destroy(batchOpts.pool);
+	}
+	close_batch(&batch);
+	return (batch.nrFailed > 0) ? -1 : 0;
+}
@@ -0,0 +1,29 @@
+#ifndef CRS_BATCH_H_
+#define CRS_BATCH_H_
+
+#include <stddef.h>
+#include "crs_spec_io.h"
+#include "crs_erasure_codes.h"
+
+/* Files encoded at the same time */
+#define MAX_JOBS 256
+
+/**
+ * Encodes every regular file below the directory src, or every file listed in the manifest src (one path per line), to
+ * its own fragment directory below dest: src/a/b is encoded to dest/a/b, a listed path p to dest/p. Missing parent
+ * directories are created. nrJobs files are encoded at the same time, each by a job keeping an arena between files,
+ * on one pool of opts->threads threads; the coding schedules are cached per (k, m, w) and shared by every file. A file
+ * is encoded in stripes when its data and coding rows would take more than its share (memoryBudget / nrJobs) of the
+ * memory budget. A file which can not be encoded is reported and the others are still encoded.
+ * @param src The directory to encode, or the manifest listing the files to encode
+ * @param dest The directory to encode to, created if missing
+ * @param spec The spec every file is encoded with (k, m, engine and optionally packetsize), left untouched
+ * @param opts The encoding options, the packet size is auto-tuned once for the whole batch
+ * @param nrJobs The number of files encoded at the same time
+ * @param memoryBudget The bytes of buffers the files encoded at the same time may take, 0 for no limit
+ * @return 0 if every file was encoded, otherwise -1
+ */
+int encode_batch(char *src, char *dest, struct crs_encoding_spec *spec, struct crs_options *opts, int nrJobs,
+		size_t memoryBudget);
+
+#endif /* CRS_BATCH_H_ */
@@ -0,0 +1,479 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <getopt.h>
+#include <time.h>
+#include "crs_file_io.h"
+#include "crs_spec_io.h"
+#include "crs_schedule.h"
+#include "crs_engine.h"
+#include "crs_xor.h"
+#include "crs_gf8.h"
+#include "crs_arena.h"
+#include "crs_thread_pool.h"
+#include "crs_erasure_codes.h"
+
+#define BENCH_DEFAULT_ENGINES "crs,rs8"
+#define BENCH_DEFAULT_GEOMETRIES "4:2,6:3,10:4"
+#define BENCH_DEFAULT_SIZES "1M,64M"
+#define BENCH_DEFAULT_PACKETSIZES "0"
+#define BENCH_DEFAULT_THREADS "1"
+#define BENCH_DEFAULT_ERASURES "d1,d1+c1"
+#define BENCH_DEFAULT_WARMUPS 2
+#define BENCH_DEFAULT_RUNS 10
+#define BENCH_MAX_LIST 64
+
+/**
+ * The benchmark matrix, every list being comma separated
+ */
+struct bench_config {
+	char *engines; /* Engine names */
+	char *geometries; /* k:m pairs */
+	char *sizes; /* Object sizes, K, M and G suffixes accepted */
+	char *packetsizes; /* Packet sizes, 0 to choose one as an encode would */
+	char *threads; /* Thread counts */
+	char *erasures; /* Erasure patterns, fragment names joined by '+' (d1+c2) */
+	int warmups; /* Untimed runs before each measurement */
+	int runs; /* Timed runs of each measurement */
+	int json; /* Report JSON rather than CSV */
+};
+
+/**
+ * One measured case of the matrix
+ */
+struct bench_case {
+	struct crs_encoding_spec *spec;
+	size_t size; /* The object size */
+	int threads;
+	const char *op; /* "encode" or "decode" */
+	char *erasures; /* The erasure pattern decoded, "" when encoding */
+};
+
+static int nrReported = 0;
+
+/**
+ * Splits a comma separated list in place.
+ * @param list The list, modified
+ * @param items Where the BENCH_MAX_LIST item pointers should be stored
+ * @return The number of items
+ */
+static int split_list(char *list, char **items) {
+	int n = 0;
+	char *save;
+	char *item;
+
+	for (item = strtok_r(list, ",", &save); item != NULL && n < BENCH_MAX_LIST; item = strtok_r(NULL, ",", &save)) {
+		items[n] = item;
+		n++;
+	}
+	return n;
+}
+
+/**
+ * Parses an erasure pattern into a -1 terminated list of row indices.
+ * @param pattern The fragment names joined by '+' (d1 = 0, ..., c1 = k, ...)
+ * @param k The number of data rows
+ * @param m The number of coding rows
+ * @param erasures The m + 1 entries to fill
+ * @return The number of erasures, or -1 if the pattern names a fragment twice, a missing fragment, or more than m
+ */
+static int parse_erasures(char *pattern, int k, int m, int *erasures) {
+	int i, n, index;
+	char *p = pattern;
+	char *end;
+
+	for (n = 0; *p != '\0'; n++) {
+		if (n == m || (*p != 'd' && *p != 'c')) {
+			return -1;
+		}
+		index = (int) strtol(p + 1, &end, 10);
+		if (end == p + 1 || index <= 0 || index > ((*p == 'd') ? k : m) || (*end != '+' && *end != '\0')) {
+			return -1;
+		}
+		erasures[n] = (*p == 'd') ? index - 1 : k + index - 1;
+		for (i = 0; i < n; i++) {
+			if (erasures[i] == erasures[n]) {
+				return -1;
+			}
+		}
+		p = (*end == '+') ? end + 1 : end;
+	}
+	erasures[n] = -1;
+	return n;
+}
+
+/**
+ * Fills a row with pseudo random bytes.
+ * @param row The row
+ * @param size The size of the row
+ * @param seed The seed of the row
+ */
+static void fill_row(char *row, size_t size, uint64_t seed) {
+	size_t i;
+	uint64_t x = seed * 0x9E3779B97F4A7C15ull + 1;
+
+	for (i = 0; i < size; i++) {
+		x ^= x << 13;
+		x ^= x >> 7;
+		x ^= x << 17;
+		row[i] = (char) x;
+	}
+}
+
+/**
+ * Orders doubles ascending for qsort.
+ */
+static int compare_doubles(const void *a, const void *b) {
+	double x = *((const double *) a);
+	double y = *((const double *) b);
+	return (x > y) - (x < y);
+}
+
+/**
+ * Gives a percentile of sorted values.
+ * @param sorted The values in ascending order
+ * @param n The number of values
+ * @param percent The percentile
+ * @return The nearest rank percentile of the values
+ */
+static double percentile(double *sorted, int n, int percent) {
+	int rank = (percent * n + 99) / 100;
+	return sorted[(rank > 0) ? rank - 1 : 0];
+}
+
+/**
+ * Reports the throughput of one case as a CSV line or a JSON object.
+ * @param config The benchmark configuration
+ * @param bc The case
+ * @param gbps The throughput of each run in GB/s, sorted in place
+ */
+static void report(struct bench_config *config, struct bench_case *bc, double *gbps) {
+	int i;
+	double mean = 0;
+	const char *kernel = (bc->spec->engine == ENGINE_RS8) ? gf8_kernel_name() : xor_kernel_name();
+
+	for (i = 0; i < config->runs; i++) {
+		mean += gbps[i] / config->runs;
+	}
+	qsort(gbps, config->runs, sizeof(double), compare_doubles);
+
+	if (config->json) {
+		fprintf(stdout, "%s  {\"engine\": \"%s\", \"kernel\": \"%s\", \"k\": %d, \"m\": %d, \"size\": %lu, "
+				"\"packetsize\": %d, \"threads\": %d, \"op\": \"%s\", \"erasures\": \"%s\", \"runs\": %d, "
+				"\"gbps\": {\"mean\": %.3f, \"min\": %.3f, \"p10\": %.3f, \"p50\": %.3f, \"p90\": %.3f, "
+				"\"max\": %.3f}}", (nrReported == 0) ? "" : ",\n", engine_name(bc->spec->engine), kernel,
+				bc->spec->k, bc->spec->m, (unsigned long) bc->size, bc->spec->packetsize, bc->threads, bc->op,
+				bc->erasures, config->runs, mean, gbps[0], percentile(gbps, config->runs, 10),
+				percentile(gbps, config->runs, 50), percentile(gbps, config->runs, 90), gbps[config->runs - 1]);
+	} else {
+		if (nrReported == 0) {
+			fprintf(stdout, "engine,kernel,k,m,size,packetsize,threads,op,erasures,runs,"
+					"gbps_mean,gbps_min,gbps_p10,gbps_p50,gbps_p90,gbps_max\n");
+		}
+		fprintf(stdout, "%s,%s,%d,%d,%lu,%d,%d,%s,%s,%d,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f\n",
+				engine_name(bc->spec->engine), kernel, bc->spec->k, bc->spec->m, (unsigned long) bc->size,
+				bc->spec->packetsize, bc->threads, bc->op, bc->erasures, config->runs, mean, gbps[0],
+				percentile(gbps, config->runs, 10), percentile(gbps, config->runs, 50),
+				percentile(gbps, config->runs, 90), gbps[config->runs - 1]);
+	}
+	fflush(stdout);
+	nrReported++;
+}
+
+/**
+ * Times the encode, or the decode of an erasure pattern, of one case. Throughput is the object size over the time.
+ * @param config The benchmark configuration
+ * @param bc The case
+ * @param rows The k data rows followed by the m coding rows, encoded (for a decode)
+ * @param erasures The -1 terminated erasures to decode, NULL to encode
+ * @param pool The thread pool, or NULL
+ * @param gbps The config->runs throughputs to fill
+ * @return 0 if successful, otherwise -1
+ */
+static int time_runs(struct bench_config *config, struct bench_case *bc, char **rows, int *erasures,
+		struct crs_thread_pool *pool, double *gbps) {
+	int i, res = 0;
+	struct timespec start, end;
+	struct crs_encoding_spec *spec = bc->spec;
+
+	for (i = -config->warmups; i < config->runs && res == 0; i++) {
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		if (erasures == NULL) {
+			res = engine_encode(spec, rows, rows + spec->k, spec->width, pool);
+		} else {
+			res = engine_decode(spec, erasures, rows, rows + spec->k, spec->width, pool);
+		}
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		if (i >= 0) {
+			gbps[i] = bc->size / ((end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec));
+		}
+	}
+	return res;
+}
+
+/**
+ * Benchmarks the in memory encode of one object, then the decode of every erasure pattern. Each decode is checked
+ * against the encoded rows before it is timed.
+ * @param config The benchmark configuration
+ * @param spec The spec with k, m, engine and packetsize (0 to choose it) set
+ * @param size The object size
+ * @param threads The number of threads
+ * @param patterns The erasure patterns
+ * @param nrPatterns The number of erasure patterns
+ * @param arena The arena to carve the rows from
+ * @return 0 if successful, otherwise -1
+ */
+static int bench_object(struct bench_config *config, struct crs_encoding_spec *spec, size_t size, int threads,
+		char **patterns, int nrPatterns, struct crs_arena *arena) {
+	int i, j, res;
+	int *erasures;
+	char **rows, **saved;
+	double *gbps;
+	struct crs_options opts;
+	struct crs_thread_pool *pool = NULL;
+	struct bench_case bc;
+
+	init_options(&opts);
+	opts.threads = threads;
+	if (spec->packetsize == 0) {
+		spec->packetsize = choose_packetsize(spec, size, &opts);
+	}
+	if (spec->packetsize < 0 || fill_encoding_spec(spec, size) < 0 || engine_setup(spec) < 0) {
+		fprintf(stderr, "Skipping %s k=%d m=%d size=%lu: unsuitable geometry\n", engine_name(spec->engine), spec->k,
+				spec->m, (unsigned long) size);
+		return 0;
+	}
+
+	rows = arena_matrix(arena, 2 * (spec->k + spec->m), spec->width);
+	erasures = (int *) malloc((spec->m + 1) * sizeof(int));
+	gbps = (double *) malloc(config->runs * sizeof(double));
+	if (threads > 1) {
+		pool = thread_pool_create(threads);
+	}
+	if (rows == NULL || erasures == NULL || gbps == NULL || (threads > 1 && pool == NULL)) {
+		fprintf(stderr, "Could not allocate the benchmark buffers\n%s\n", strerror(errno));
+		free_spec(spec);
+		free(erasures);
+		free(gbps);
+		if (pool != NULL) {
+			thread_pool_destroy(pool);
+		}
+		return -1;
+	}
+	saved = rows + spec->k + spec->m;
+	for (i = 0; i < spec->k; i++) {
+		fill_row(rows[i], spec->width, i + 1);
+	}
+
+	bc.spec = spec;
+	bc.size = size;
+	bc.threads = threads;
+	bc.op = "encode";
+	bc.erasures = "";
+	res = time_runs(config, &bc, rows, NULL, pool, gbps);
+	if (res == 0) {
+		report(config, &bc, gbps);
+	}
+	for (i = 0; i < spec->k + spec->m; i++) {
+		memcpy(saved[i], rows[i], spec->width);
+	}
+
+	bc.op = "decode";
+	for (j = 0; j < nrPatterns && res == 0; j++) {
+		if (parse_erasures(patterns[j], spec->k, spec->m, erasures) < 0) {
+			fprintf(stderr, "Skipping erasures %s for k=%d m=%d\n", patterns[j], spec->k, spec->m);
+			continue;
+		}
+		for (i = 0; erasures[i] != -1; i++) {
+			memset(rows[erasures[i]], 0, spec->width);
+		}
+		res = engine_decode(spec, erasures, rows, rows + spec->k, spec->width, pool);
+		for (i = 0; erasures[i] != -1 && res == 0; i++) {
+			if (memcmp(rows[erasures[i]], saved[erasures[i]], spec->width) != 0) {
+				fprintf(stderr, "Error: %s decode of %s for k=%d m=%d is wrong\n", engine_name(spec->engine),
+						patterns[j], spec->k, spec->m);
+				res = -1;
+			}
+		}
+		bc.erasures = patterns[j];
+		if (res == 0) {
+			res = time_runs(config, &bc, rows, erasures, pool, gbps);
+		}
+		if (res == 0) {
+			report(config, &bc, gbps);
+		}
+	}
+
+	free_spec(spec);
+	free(erasures);
+	free(gbps);
+	if (pool != NULL) {
+		thread_pool_destroy(pool);
+	}
+	return res;
+}
+
+/**
+ * Runs every combination of the benchmark matrix.
+ * @param config The benchmark configuration
+ * @return 0 if successful, otherwise -1
+ */
+static int run_bench(struct bench_config *config) {
+	int e, g, s, p, t, res = 0;
+	int nrEngines, nrGeometries, nrSizes, nrPacketsizes, nrThreads, nrPatterns, threads, packetsize;
+	char *engines[BENCH_MAX_LIST], *geometries[BENCH_MAX_LIST], *sizes[BENCH_MAX_LIST];
+	char *packetsizes[BENCH_MAX_LIST], *threadCounts[BENCH_MAX_LIST], *patterns[BENCH_MAX_LIST];
+	size_t size;
+	struct crs_encoding_spec spec;
+	struct crs_arena arena;
+
+	nrEngines = split_list(config->engines, engines);
+	nrGeometries = split_list(config->geometries, geometries);
+	nrSizes = split_list(config->sizes, sizes);
+	nrPacketsizes = split_list(config->packetsizes, packetsizes);
+	nrThreads = split_list(config->threads, threadCounts);
+	nrPatterns = split_list(config->erasures, patterns);
+
+	if (config->json) {
+		fprintf(stdout, "[\n");
+	}
+	arena_init(&arena);
+	for (e = 0; e < nrEngines && res == 0; e++) {
+		for (g = 0; g < nrGeometries && res == 0; g++) {
+			for (s = 0; s < nrSizes && res == 0; s++) {
+				for (p = 0; p < nrPacketsizes && res == 0; p++) {
+					for (t = 0; t < nrThreads && res == 0; t++) {
+						spec.engine = find_engine(engines[e]);
+						spec.bitmatrix = NULL;
+						spec.checksums = NULL;
+						if (spec.engine < 0 || sscanf(geometries[g], "%d:%d", &(spec.k), &(spec.m)) != 2
+								|| spec.k <= 0 || spec.m <= 0 || spec.m > spec.k
+								|| str2size(sizes[s], &size) < 0 || size == 0
+								|| str2int(packetsizes[p], &packetsize) < 0 || packetsize < 0
+								|| packetsize % sizeof(long) != 0 || str2int(threadCounts[t], &threads) < 0
+								|| threads <= 0 || threads > MAX_THREADS) {
+							fprintf(stderr, "Error: Invalid case %s %s %s %s %s\n", engines[e], geometries[g],
+									sizes[s], packetsizes[p], threadCounts[t]);
+							res = -1;
+							break;
+						}
+						spec.packetsize = packetsize;
+						res = bench_object(config, &spec, size, threads, patterns, nrPatterns, &arena);
+					}
+				}
+			}
+		}
+	}
+	arena_free(&arena);
+	if (config->json) {
+		fprintf(stdout, "\n]\n");
+	}
+	return res;
+}
+
+/**
+ * Prints the usage to stdout.
+ * @param progName The name of the program binary
+ */
+static void print_usage(char *progName) {
+	fprintf(stdout, "Usage:\n");
+	fprintf(stdout, "\t%s [options]\n", progName);
+	fprintf(stdout, "Measures the in memory encode and decode throughput (object bytes per second) of every\n"
+			"combination of the options, on synthetic data. Lists are comma separated.\n");
+	fprintf(stdout, "Options:\n");
+	fprintf(stdout, "\t-E, --engines\t engines (default %s)\n", BENCH_DEFAULT_ENGINES);
+	fprintf(stdout, "\t-g, --geometries\t k:m pairs (default %s)\n", BENCH_DEFAULT_GEOMETRIES);
+	fprintf(stdout, "\t-S, --sizes\t object sizes, K, M and G suffixes are accepted (default %s)\n",
+			BENCH_DEFAULT_SIZES);
+	fprintf(stdout, "\t-p, --packetsizes\t packet sizes, 0 to choose as an encode would (default %s)\n",
+			BENCH_DEFAULT_PACKETSIZES);
+	fprintf(stdout, "\t-t, --threads\t thread counts (default %s)\n", BENCH_DEFAULT_THREADS);
+	fprintf(stdout, "\t-x, --erasures\t erasure patterns to decode, fragments joined by + (default %s)\n",
+			BENCH_DEFAULT_ERASURES);
+	fprintf(stdout, "\t-w, --warmups\t untimed runs before each measurement (default %d)\n", BENCH_DEFAULT_WARMUPS);
+	fprintf(stdout, "\t-r, --runs\t timed runs of each measurement (default %d)\n", BENCH_DEFAULT_RUNS);
+	fprintf(stdout, "\t-j, --json\t report JSON rather than CSV\n");
+}
+
+int main(int argc, char **argv) {
+	int c, res;
+	char defaultEngines[] = BENCH_DEFAULT_ENGINES;
+	char defaultGeometries[] = BENCH_DEFAULT_GEOMETRIES;
+	char defaultSizes[] = BENCH_DEFAULT_SIZES;
+	char defaultPacketsizes[] = BENCH_DEFAULT_PACKETSIZES;
+	char defaultThreads[] = BENCH_DEFAULT_THREADS;
+	char defaultErasures[] = BENCH_DEFAULT_ERASURES;
+	struct bench_config config;
+
+	static struct option longOptions[] = {
+		{ "engines", required_argument, NULL, 'E' },
+		{ "geometries", required_argument, NULL, 'g' },
+		{ "sizes", required_argument, NULL, 'S' },
+		{ "packetsizes", required_argument, NULL, 'p' },
+		{ "threads", required_argument, NULL, 't' },
+		{ "erasures", required_argument, NULL, 'x' },
+		{ "warmups", required_argument, NULL, 'w' },
+		{ "runs", required_argument, NULL, 'r' },
+		{ "json", no_argument, NULL, 'j' },
+		{ NULL, 0, NULL, 0 }
+	};
+
+	config.engines = defaultEngines;
+	config.geometries = defaultGeometries;
+	config.sizes = defaultSizes;
+	config.packetsizes = defaultPacketsizes;
+	config.threads = defaultThreads;
+	config.erasures = defaultErasures;
+	config.warmups = BENCH_DEFAULT_WARMUPS;
+	config.runs = BENCH_DEFAULT_RUNS;
+	config.json = 0;
+
+	while ((c = getopt_long(argc, argv, "E:g:S:p:t:x:w:r:j", longOptions, NULL)) != -1)
+		switch (c) {
+		case 'E':
+			config.engines = optarg;
+			break;
+		case 'g':
+			config.geometries = optarg;
+			break;
+		case 'S':
+			config.sizes = optarg;
+			break;
+		case 'p':
+			config.packetsizes = optarg;
+			break;
+		case 't':
+			config.threads = optarg;
+			break;
+		case 'x':
+			config.erasures = optarg;
+			break;
+		case 'w':
+			if (str2int(optarg, &(config.warmups)) < 0 || config.warmups < 0) {
+				print_usage(argv[0]);
+				return -1;
+			}
+			break;
+		case 'r':
+			if (str2int(optarg, &(config.runs)) < 0 || config.runs <= 0) {
+				print_usage(argv[0]);
+				return -1;
+			}
+			break;
+		case 'j':
+			config.json = 1;
+			break;
+		default:
+			print_usage(argv[0]);
+			return -1;
+		}
+	if (optind != argc) {
+		print_usage(argv[0]);
+		return -1;
+	}
+
+	res = run_bench(&config);
+	clear_schedule_cache();
+	return res;
+}
@@ -0,0 +1,263 @@
+#include <stdio.h>
+#include <string.h>
+#include <getopt.h>
+#include "crs_file_io.h"
+#include "crs_spec_io.h"
+#include "crs_engine.h"
+#include "crs_thread_pool.h"
+#include "crs_erasure_codes.h"
+#include "crs_batch.h"
+#include "crs_command.h"
+
+static const char *modeNames[] = { "decode", "encode", "reconstruct", "verify", "serve", "update" };
+
+/**
+ * Sets the mode of a command unless one was already given.
+ * @param cmd The command
+ * @param mode The mode
+ * @return 0 if successful, otherwise -1
+ */
+static int set_mode(struct crs_command *cmd, int mode) {
+	if (cmd->mode != -1) {
+		return -1;
+	}
+	cmd->mode = mode;
+	return 0;
+}
+
+/**
+ * Parses a command line with getopt, which is not reentrant: concurrent callers must hold a lock.
+ * @param argc The number of arguments
+ * @param argv The arguments, argv[0] being the program name. Pointers into them are kept and getopt may permute them
+ * @param cmd The command to fill
+ * @return 0 if successful, otherwise -1 (the usage should be printed)
+ */
+int parse_command(int argc, char **argv, struct crs_command *cmd) {
+	int c, i, res;
+	int connecting = 0;
+	char *range;
+	char offset[32];
+
+	static struct option longOptions[] = {
+		{ "packetsize", required_argument, NULL, 'p' },
+		{ "autotune", no_argument, NULL, 'a' },
+		{ "mmap", no_argument, NULL, 'M' },
+		{ "schedule-cache", required_argument, NULL, 'C' },
+		{ "range", required_argument, NULL, 'R' },
+		{ "verify", no_argument, NULL, 'V' },
+		{ "engine", required_argument, NULL, 'E' },
+		{ "stats", no_argument, NULL, 'S' },
+		{ "listen", required_argument, NULL, 'L' },
+		{ "connect", required_argument, NULL, 'c' },
+		{ "batch", no_argument, NULL, 'B' },
+		{ "jobs", required_argument, NULL, 'j' },
+		{ "memory-budget", required_argument, NULL, 'b' },
+		{ "update", required_argument, NULL, 'u' },
+		{ NULL, 0, NULL, 0 }
+	};
+
+	memset(cmd, 0, sizeof(struct crs_command));
+	cmd->mode = -1;
+	cmd->spec.engine = ENGINE_CRS;
+	init_options(&(cmd->opts));
+
+	/* Restart the scan, getopt keeps its position between command lines */
+	optind = 0;
+	while ((c = getopt_long(argc, argv, "edr:k:m:s:t:p:aMC:R:VE:SL:c:Bj:b:u:", longOptions, NULL)) != -1) {
+		res = 0;
+		switch (c) {
+		case 'e':
+			res = set_mode(cmd, MODE_ENCODE);
+			break;
+		case 'd':
+			res = set_mode(cmd, MODE_DECODE);
+			break;
+		case 'r':
+			res = set_mode(cmd, MODE_RECONSTRUCT);
+			cmd->out = optarg;
+			break;
+		case 'u':
+			res = set_mode(cmd, MODE_UPDATE);
+			if (res == 0) {
+				res = str2size(optarg, &(cmd->updateOffset));
+			}
+			break;
+		case 'L':
+			res = set_mode(cmd, MODE_SERVE);
+			cmd->socketPath = optarg;
+			break;
+		case 'c':
+			cmd->socketPath = optarg;
+			connecting = 1;
+			break;
+		case 'R':
+			/* The argument is left intact, a client forwards it as given */
+			range = strchr(optarg, ':');
+			if (range == NULL || range - optarg >= (long) sizeof(offset)) {
+				return -1;
+			}
+			memcpy(offset, optarg, range - optarg);
+			offset[range - optarg] = '\0';
+			cmd->range = optarg;
+			if (str2size(offset, &(cmd->rangeOffset)) < 0 || str2size(range + 1, &(cmd->rangeLength)) < 0) {
+				return -1;
+			}
+			break;
+		case 'k':
+			res = str2int(optarg, &(cmd->spec.k));
+			if (res < 0 || cmd->spec.k <= 0 || cmd->spec.k > MAX_K) {
+				return -1;
+			}
+			break;
+		case 'm':
+			res = str2int(optarg, &(cmd->spec.m));
+			if (res < 0 || cmd->spec.m <= 0 || cmd->spec.m > MAX_M) {
+				return -1;
+			}
+			break;
+		case 't':
+			res = str2int(optarg, &(cmd->opts.threads));
+			if (res < 0 || cmd->opts.threads <= 0 || cmd->opts.threads > MAX_THREADS) {
+				return -1;
+			}
+			break;
+		case 'p':
+			res = str2int(optarg, &(cmd->spec.packetsize));
+			if (res < 0 || cmd->spec.packetsize <= 0 || cmd->spec.packetsize % sizeof(long) != 0) {
+				return -1;
+			}
+			break;
+		case 'a':
+			cmd->opts.autotune = 1;
+			break;
+		case 'M':
+			cmd->opts.mapInput = 1;
+			break;
+		case 'V':
+			cmd->opts.verify = 1;
+			break;
+		case 'S':
+			cmd->stats = 1;
+			break;
+		case 'B':
+			cmd->batch = 1;
+			break;
+		case 'j':
+			res = str2int(optarg, &(cmd->jobs));
+			if (res < 0 || cmd->jobs <= 0 || cmd->jobs > MAX_JOBS) {
+				return -1;
+			}
+			break;
+		case 'b':
+			res = str2size(optarg, &(cmd->memoryBudget));
+			if (res < 0 || cmd->memoryBudget == 0) {
+				return -1;
+			}
+			break;
+		case 'E':
+			cmd->spec.engine = find_engine(optarg);
+			if (cmd->spec.engine < 0) {
+				return -1;
+			}
+			break;
+		case 'C':
+			cmd->cacheDir = optarg;
+			break;
+		case 's':
+			res = str2size(optarg, &(cmd->opts.stripeBudget));
+			if (res < 0 || cmd->opts.stripeBudget == 0) {
+				return -1;
+			}
+			break;
+		default:
+			return -1;
+		}
+		if (res < 0) {
+			return -1;
+		}
+	}
+
+	for (i = optind; i < argc; i++) {
+		if (i == optind) {
+			cmd->src = argv[i];
+		} else if (i == optind + 1) {
+			cmd->dest = argv[i];
+		} else {
+			return -1;
+		}
+	}
+
+	/* --verify on its own only checks the fragments */
+	if (cmd->mode == -1 && cmd->opts.verify) {
+		cmd->mode = MODE_VERIFY;
+	}
+
+	if (cmd->batch && cmd->mode != MODE_ENCODE) {
+		return -1;
+	}
+	if ((cmd->jobs > 0 || cmd->memoryBudget > 0) && !cmd->batch) {
+		return -1;
+	}
+	/* A range only narrows a reconstruct, other modes would silently act on the whole file */
+	if (cmd->range != NULL && cmd->mode != MODE_RECONSTRUCT) {
+		return -1;
+	}
+
+	switch (cmd->mode) {
+	case MODE_DECODE:
+		return (cmd->src == NULL) ? -1 : 0;
+	case MODE_ENCODE:
+	case MODE_UPDATE:
+		return (cmd->src == NULL || cmd->dest == NULL) ? -1 : 0;
+	case MODE_RECONSTRUCT:
+	case MODE_VERIFY:
+		return (cmd->src == NULL || cmd->dest != NULL) ? -1 : 0;
+	case MODE_SERVE:
+		/* The server's pool has a thread more than its workers, the one accepting connections, so t < MAX_THREADS */
+		return (cmd->src != NULL || connecting || cmd->opts.threads >= MAX_THREADS) ? -1 : 0;
+	default:
+		return -1;
+	}
+}
+
+/**
+ * Runs a parsed encode, decode, reconstruct, verify or update command.
+ * @param cmd The command
+ * @return 0 if successful, otherwise -1
+ */
+int run_command(struct crs_command *cmd) {
+	switch (cmd->mode) {
+	case MODE_DECODE:
+		return decode(cmd->src, &(cmd->spec), &(cmd->opts));
+	case MODE_ENCODE:
+		if (cmd->batch) {
+			return encode_batch(cmd->src, cmd->dest, &(cmd->spec), &(cmd->opts),
+					(cmd->jobs > 0) ? cmd->jobs : cmd->opts.threads, cmd->memoryBudget);
+		}
+		return encode(cmd->src, cmd->dest, &(cmd->spec), &(cmd->opts));
+	case MODE_RECONSTRUCT:
+		if (cmd->range != NULL) {
+			return reconstruct_range(cmd->src, cmd->out, cmd->rangeOffset, cmd->rangeLength, &(cmd->spec),
+					&(cmd->opts));
+		}
+		return reconstruct(cmd->src, cmd->out, &(cmd->spec), &(cmd->opts));
+	case MODE_VERIFY:
+		return verify(cmd->src, &(cmd->spec));
+	case MODE_UPDATE:
+		return update(cmd->src, cmd->dest, cmd->updateOffset, &(cmd->spec), &(cmd->opts));
+	default:
+		return -1;
+	}
+}
+
+/**
+ * Gives the name of a mode.
+ * @param mode MODE_DECODE, ...
+ * @return "decode", "encode", "reconstruct", "verify", "serve" or "update", or NULL if there is no such mode
+ */
+const char *mode_name(int mode) {
+	if (mode < 0 || mode > MODE_UPDATE) {
+		return NULL;
+	}
+	return modeNames[mode];
+}
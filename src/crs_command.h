@@ -0,0 +1,61 @@
+#ifndef CRS_COMMAND_H_
+#define CRS_COMMAND_H_
+
+#include <stddef.h>
+#include "crs_spec_io.h"
+#include "crs_erasure_codes.h"
+
+/* What a command does */
+#define MODE_DECODE 0
+#define MODE_ENCODE 1
+#define MODE_RECONSTRUCT 2
+#define MODE_VERIFY 3
+#define MODE_SERVE 4
+#define MODE_UPDATE 5
+
+/**
+ * A parsed command line
+ */
+struct crs_command {
+	int mode; /* MODE_DECODE, ..., -1 if none was given */
+	char *src; /* The file to encode, the fragment directory, or the file holding the new bytes of an update */
+	char *dest; /* The fragment directory to encode to or to update */
+	char *out; /* The file to reconstruct to */
+	char *range; /* The offset:length range to reconstruct, NULL for the whole file */
+	size_t rangeOffset;
+	size_t rangeLength;
+	size_t updateOffset; /* The offset in the original file of the bytes an update replaces */
+	char *cacheDir; /* The schedule cache directory, NULL for none */
+	char *socketPath; /* The socket to listen on (MODE_SERVE) or to send the command to, NULL for neither */
+	int stats; /* Report the phase timings and counters */
+	int batch; /* Encode every file of the src directory or manifest */
+	int jobs; /* Files encoded at the same time by a batch, 0 for as many as threads */
+	size_t memoryBudget; /* Bytes of buffers a batch may take, 0 for no limit */
+	struct crs_encoding_spec spec;
+	struct crs_options opts;
+};
+
+/**
+ * Parses a command line with getopt, which is not reentrant: concurrent callers must hold a lock.
+ * @param argc The number of arguments
+ * @param argv The arguments, argv[0] being the program name. Pointers into them are kept and getopt may permute them
+ * @param cmd The command to fill
+ * @return 0 if successful, otherwise -1 (the usage should be printed)
+ */
+int parse_command(int argc, char **argv, struct crs_command *cmd);
+
+/**
+ * Runs a parsed encode, decode, reconstruct, verify or update command.
+ * @param cmd The command
+ * @return 0 if successful, otherwise -1
+ */
+int run_command(struct crs_command *cmd);
+
+/**
+ * Gives the name of a mode.
+ * @param mode MODE_DECODE, ...
+ * @return "decode", "encode", "reconstruct", "verify", "serve" or "update", or NULL if there is no such mode
+ */
+const char *mode_name(int mode);
+
+#endif /* CRS_COMMAND_H_ */
@@ -0,0 +1,147 @@
+#include <string.h>
+#include <pthread.h>
+#include "crs_crc.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define CRS_CRC_SSE42
+#include <nmmintrin.h>
+#endif
+
+/* Reflected Castagnoli polynomial */
+#define CRC32C_POLY 0x82F63B78u
+
+static uint32_t crcTable[256];
+static uint32_t (*crcUpdate)(uint32_t crc, const unsigned char *bytes, size_t len);
+static pthread_once_t crcOnce = PTHREAD_ONCE_INIT;
+
+/**
+ * Updates an inverted checksum one byte at a time from the lookup table.
+ */
+static uint32_t crc32c_table(uint32_t crc, const unsigned char *bytes, size_t len) {
+	while (len > 0) {
+		crc = crcTable[(crc ^ *bytes) & 0xFF] ^ (crc >> 8);
+		bytes++;
+		len--;
+	}
+	return crc;
+}
+
+#ifdef CRS_CRC_SSE42
+/**
+ * Updates an inverted checksum eight bytes at a time with the SSE4.2 crc32 instruction.
+ */
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42(uint32_t crc, const unsigned char *bytes, size_t len) {
+	uint64_t crc64;
+	uint64_t word;
+
+	while (len > 0 && ((uintptr_t) bytes & 7) != 0) {
+		crc = _mm_crc32_u8(crc, *bytes);
+		bytes++;
+		len--;
+	}
+	crc64 = crc;
+	while (len >= 8) {
+		memcpy(&word, bytes, sizeof(word));
+		crc64 = _mm_crc32_u64(crc64, word);
+		bytes += 8;
+		len -= 8;
+	}
+	crc = (uint32_t) crc64;
+	while (len > 0) {
+		crc = _mm_crc32_u8(crc, *bytes);
+		bytes++;
+		len--;
+	}
+	return crc;
+}
+#endif
+
+/**
+ * Fills the lookup table and picks the fastest implementation the CPU supports.
+ */
+static void init_crc(void) {
+	uint32_t i, j, crc;
+
+	for (i = 0; i < 256; i++) {
+		crc = i;
+		for (j = 0; j < 8; j++) {
+			crc = (crc & 1) ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+		}
+		crcTable[i] = crc;
+	}
+
+	crcUpdate = crc32c_table;
+#ifdef CRS_CRC_SSE42
+	if (__builtin_cpu_supports("sse4.2")) {
+		crcUpdate = crc32c_sse42;
+	}
+#endif
+}
+
+/**
+ * Extends a CRC-32C (Castagnoli) checksum with len bytes of data. Start with crc = 0. The SSE4.2 crc32 instruction is
+ * used when the CPU has it, otherwise a lookup table.
+ * @param crc The checksum of the preceding bytes
+ * @param data The bytes to add
+ * @param len The number of bytes
+ * @return The checksum including data
+ */
+uint32_t crc32c(uint32_t crc, const void *data, size_t len) {
+	pthread_once(&crcOnce, init_crc);
+	return ~crcUpdate(~crc, (const unsigned char *) data, len);
+}
+
+/**
+ * Multiplies two polynomials modulo the Castagnoli polynomial, in the reflected bit order of the checksums.
+ */
+static uint32_t multiply_mod(uint32_t a, uint32_t b) {
+	uint32_t bit;
+	uint32_t product = 0;
+
+	for (bit = 1u << 31; bit != 0; bit >>= 1) {
+		if (a & bit) {
+			product ^= b;
+		}
+		b = (b & 1) ? (b >> 1) ^ CRC32C_POLY : b >> 1;
+	}
+	return product;
+}
+
+/**
+ * Gives x^(8 * len) modulo the Castagnoli polynomial, which carries a checksum register through len zero bytes.
+ */
+static uint32_t zero_bytes_operator(size_t len) {
+	uint32_t op = 1u << 31;
+	uint32_t square = 1u << 23;
+
+	/* Square and multiply, from x^8 (one zero byte) */
+	while (len > 0) {
+		if (len & 1) {
+			op = multiply_mod(op, square);
+		}
+		square = multiply_mod(square, square);
+		len >>= 1;
+	}
+	return op;
+}
+
+/**
+ * Gives the CRC-32C checksum of a message after some of its bytes change, from its checksum before, without reading
+ * the rest of the message. The checksum is linear in the message, so the change adds the checksum of the XOR of the
+ * old and new bytes, carried through the bytes which follow them.
+ * @param crc The checksum of the message before the change
+ * @param msgLen The length of the message
+ * @param offset The offset of the changed bytes in the message
+ * @param delta The XOR of the old and new bytes
+ * @param len The number of changed bytes
+ * @return The checksum of the changed message
+ */
+uint32_t crc32c_patch(uint32_t crc, size_t msgLen, size_t offset, const void *delta, size_t len) {
+	uint32_t change;
+
+	pthread_once(&crcOnce, init_crc);
+	/* The register started from 0 holds the checksum of the change without the inversions of crc32c */
+	change = crcUpdate(0, (const unsigned char *) delta, len);
+	return crc ^ multiply_mod(zero_bytes_operator(msgLen - offset - len), change);
+}
@@ -0,0 +1,30 @@
+#ifndef CRS_CRC_H_
+#define CRS_CRC_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Extends a CRC-32C (Castagnoli) checksum with len bytes of data. Start with crc = 0. The SSE4.2 crc32 instruction is
+ * used when the CPU has it, otherwise a lookup table.
+ * @param crc The checksum of the preceding bytes
+ * @param data The bytes to add
+ * @param len The number of bytes
+ * @return The checksum including data
+ */
+uint32_t crc32c(uint32_t crc, const void *data, size_t len);
+
+/**
+ * Gives the CRC-32C checksum of a message after some of its bytes change, from its checksum before, without reading
+ * the rest of the message. The checksum is linear in the message, so the change adds the checksum of the XOR of the
+ * old and new bytes, carried through the bytes which follow them.
+ * @param crc The checksum of the message before the change
+ * @param msgLen The length of the message
+ * @param offset The offset of the changed bytes in the message
+ * @param delta The XOR of the old and new bytes
+ * @param len The number of changed bytes
+ * @return The checksum of the changed message
+ */
+uint32_t crc32c_patch(uint32_t crc, size_t msgLen, size_t offset, const void *delta, size_t len);
+
+#endif /* CRS_CRC_H_ */
@@ -0,0 +1,282 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <cauchy.h>
+#include "crs_schedule.h"
+#include "crs_parallel.h"
+#include "crs_gf8.h"
+#include "crs_stats.h"
+#include "crs_engine.h"
+
+/**
+ * The operations of a coding engine
+ */
+struct crs_engine {
+	const char *name;
+	int (*setup)(struct crs_encoding_spec *spec);
+	int (*encode)(struct crs_encoding_spec *spec, char **data, char **coding, size_t size,
+			struct crs_thread_pool *pool);
+	int (*decode)(struct crs_encoding_spec *spec, int *erasures, char **data, char **coding, size_t size,
+			struct crs_thread_pool *pool);
+};
+
+/**
+ * Counts the packet XORs a schedule runs over size bytes of each row.
+ */
+static uint64_t schedule_xors(int **schedule, int w, int packetsize, size_t size) {
+	int i;
+	uint64_t nrXors = 0;
+
+	for (i = 0; schedule[i][0] >= 0; i++) {
+		nrXors += schedule[i][4];
+	}
+	return nrXors * (size / ((size_t) w * packetsize));
+}
+
+/**
+ * Copies the cached cauchy bitmatrix into the spec.
+ */
+static int crs_setup(struct crs_encoding_spec *spec) {
+	int *bitmatrix;
+	int **schedule;
+	struct crs_xor_schedule *compiled;
+	size_t bitmatrixSize = (size_t) spec->k * spec->m * spec->w * spec->w * sizeof(int);
+
+	if (get_encoding_schedule(spec->k, spec->m, spec->w, MATRIX_CAUCHY_GOOD, &bitmatrix, &schedule, &compiled) < 0) {
+		return -1;
+	}
+	spec->bitmatrix = (int *) malloc(bitmatrixSize);
+	if (spec->bitmatrix == NULL) {
+		return -1;
+	}
+	memcpy(spec->bitmatrix, bitmatrix, bitmatrixSize);
+	return 0;
+}
+
+/**
+ * Encodes with the cached encoding schedule of the geometry, refusing a spec whose bitmatrix is another one (a foreign
+ * spec decodes with its own bitmatrix, so coding it with the cached one would corrupt it).
+ */
+static int crs_encode(struct crs_encoding_spec *spec, char **data, char **coding, size_t size,
+		struct crs_thread_pool *pool) {
+	int *bitmatrix;
+	int **schedule;
+	struct crs_xor_schedule *compiled;
+
+	if (get_encoding_schedule(spec->k, spec->m, spec->w, MATRIX_CAUCHY_GOOD, &bitmatrix, &schedule, &compiled) < 0) {
+		return -1;
+	}
+	if (spec->bitmatrix != NULL && spec->bitmatrix != bitmatrix
+			&& memcmp(spec->bitmatrix, bitmatrix, (size_t) spec->k * spec->m * spec->w * spec->w * sizeof(int)) != 0) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (stats_enabled()) {
+		stats_add_xors(schedule_xors(schedule, spec->w, spec->packetsize, size));
+	}
+	return parallel_schedule_encode(spec->k, spec->m, spec->w, compiled, data, coding, size, spec->packetsize, pool);
+}
+
+/**
+ * Decodes with the cached decoding schedule of the erasure pattern.
+ */
+static int crs_decode(struct crs_encoding_spec *spec, int *erasures, char **data, char **coding, size_t size,
+		struct crs_thread_pool *pool) {
+	int res;
+	int **schedule;
+	struct crs_xor_schedule *compiled;
+	uint64_t start;
+
+	start = stats_start();
+	schedule = get_decoding_schedule(spec->k, spec->m, spec->w, spec->bitmatrix, erasures, &compiled);
+	stats_stop(PHASE_SETUP, start);
+	if (schedule == NULL) {
+		return -1;
+	}
+	if (stats_enabled()) {
+		stats_add_xors(schedule_xors(schedule, spec->w, spec->packetsize, size));
+	}
+	start = stats_start();
+	res = parallel_schedule_decode(spec->k, spec->m, spec->w, compiled, erasures, data, coding, size,
+			spec->packetsize, pool);
+	stats_stop(PHASE_CODE, start);
+	release_decoding_schedule(schedule);
+	return res;
+}
+
+/**
+ * Stores the cauchy GF(2^8) coding matrix in the spec.
+ */
+static int rs8_setup(struct crs_encoding_spec *spec) {
+	if (spec->k + spec->m > 256) {
+		errno = EINVAL;
+		return -1;
+	}
+	spec->bitmatrix = cauchy_good_general_coding_matrix(spec->k, spec->m, 8);
+	return (spec->bitmatrix == NULL) ? -1 : 0;
+}
+
+/**
+ * Encodes by multiplying the cached compiled coding matrix by the data rows.
+ */
+static int rs8_encode(struct crs_encoding_spec *spec, char **data, char **coding, size_t size,
+		struct crs_thread_pool *pool) {
+	int res;
+	int noErasures = -1;
+	struct crs_gf8_matrix *gm;
+
+	gm = get_gf8_matrix(spec->k, spec->m, spec->bitmatrix, &noErasures);
+	if (gm == NULL) {
+		return -1;
+	}
+	res = parallel_gf8_multiply(gm, data, coding, size, pool);
+	release_gf8_matrix(gm);
+	return res;
+}
+
+/**
+ * Decodes by multiplying the k rows decoding_rows picks as survivors by the cached matrix of the erasure pattern, which
+ * gives every erased row from them (see create_gf8_decoding_matrix).
+ */
+static int rs8_decode(struct crs_encoding_spec *spec, int *erasures, char **data, char **coding, size_t size,
+		struct crs_thread_pool *pool) {
+	int i, row, nrSurvivors, nrErased;
+	int res = -1;
+	int k = spec->k;
+	int *used;
+	char **in, **out;
+	uint64_t start;
+	struct crs_gf8_matrix *gm;
+
+	if (erasures[0] == -1) {
+		return 0;
+	}
+	start = stats_start();
+	gm = get_gf8_matrix(k, spec->m, spec->bitmatrix, erasures);
+	stats_stop(PHASE_SETUP, start);
+	if (gm == NULL) {
+		return -1;
+	}
+
+	used = (int *) calloc(k + spec->m, sizeof(int));
+	in = (char **) malloc(k * sizeof(char *));
+	out = (char **) malloc((k + spec->m) * sizeof(char *));
+	if (used != NULL && in != NULL && out != NULL) {
+		/* The survivors and the erased rows, both in row order like the rows of the matrix */
+		decoding_rows(k, spec->m, erasures, used);
+		for (i = 0; erasures[i] != -1; i++) {
+			used[erasures[i]] = -1;
+		}
+		nrSurvivors = 0;
+		nrErased = 0;
+		for (row = 0; row < k + spec->m; row++) {
+			if (used[row] == 1 && nrSurvivors < k) {
+				in[nrSurvivors] = (row < k) ? data[row] : coding[row - k];
+				nrSurvivors++;
+			} else if (used[row] == -1) {
+				out[nrErased] = (row < k) ? data[row] : coding[row - k];
+				nrErased++;
+			}
+		}
+		start = stats_start();
+		res = parallel_gf8_multiply(gm, in, out, size, pool);
+		stats_stop(PHASE_CODE, start);
+	}
+
+	release_gf8_matrix(gm);
+	free(used);
+	free(in);
+	free(out);
+	return res;
+}
+
+static const struct crs_engine engines[NR_ENGINES] = {
+	{ "crs", crs_setup, crs_encode, crs_decode },
+	{ "rs8", rs8_setup, rs8_encode, rs8_decode }
+};
+
+/**
+ * Gives the engine with the given name.
+ * @param name "crs" or "rs8"
+ * @return ENGINE_CRS or ENGINE_RS8, or -1 if there is no such engine
+ */
+int find_engine(const char *name) {
+	int i;
+
+	for (i = 0; i < NR_ENGINES; i++) {
+		if (strcmp(engines[i].name, name) == 0) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+/**
+ * Gives the name of an engine.
+ * @param engine ENGINE_CRS or ENGINE_RS8
+ * @return The name of the engine, or NULL if there is no such engine
+ */
+const char *engine_name(int engine) {
+	if (engine < 0 || engine >= NR_ENGINES) {
+		return NULL;
+	}
+	return engines[engine].name;
+}
+
+/**
+ * Prepares the spec for encoding with its engine by storing the coding matrix in spec->bitmatrix: the cauchy
+ * bitmatrix (from the schedule cache) for ENGINE_CRS, the cauchy GF(2^8) matrix for ENGINE_RS8.
+ * @param spec The spec with k, m, w and engine filled
+ * @return 0 if successful, otherwise -1 (errno is EINVAL if the engine can not code k + m files)
+ */
+int engine_setup(struct crs_encoding_spec *spec) {
+	int res;
+	uint64_t start;
+
+	spec->bitmatrix = NULL;
+	spec->checksums = NULL;
+	if (engine_name(spec->engine) == NULL) {
+		errno = EINVAL;
+		return -1;
+	}
+	start = stats_start();
+	res = engines[spec->engine].setup(spec);
+	stats_stop(PHASE_SETUP, start);
+	return res;
+}
+
+/**
+ * Encodes size bytes of each data row into the coding rows with the engine of the spec.
+ * @param spec The spec, prepared with engine_setup or read from a spec file
+ * @param data The data rows
+ * @param coding The coding rows
+ * @param size The number of bytes of each row to encode, a multiple of w * packetsize
+ * @param pool The thread pool to encode on, or NULL to encode in the calling thread
+ * @return 0 if successful, otherwise -1
+ */
+int engine_encode(struct crs_encoding_spec *spec, char **data, char **coding, size_t size,
+		struct crs_thread_pool *pool) {
+	int res;
+	uint64_t start;
+
+	start = stats_start();
+	res = engines[spec->engine].encode(spec, data, coding, size, pool);
+	stats_stop(PHASE_CODE, start);
+	return res;
+}
+
+/**
+ * Rebuilds the erased rows over size bytes of each row with the engine of the spec. Only the rows marked by
+ * decoding_rows are read or written, the others may be NULL.
+ * @param spec The spec read from a spec file
+ * @param erasures A -1 terminated array of at most m erased row indices (0 = d1, ..., k = c1, ..., k+m-1 = cm)
+ * @param data The data rows
+ * @param coding The coding rows
+ * @param size The number of bytes of each row to decode, a multiple of w * packetsize
+ * @param pool The thread pool to decode on, or NULL to decode in the calling thread
+ * @return 0 if successful, otherwise -1
+ */
+int engine_decode(struct crs_encoding_spec *spec, int *erasures, char **data, char **coding, size_t size,
+		struct crs_thread_pool *pool) {
+	return engines[spec->engine].decode(spec, erasures, data, coding, size, pool);
+}
@@ -0,0 +1,57 @@
+#ifndef CRS_ENGINE_H_
+#define CRS_ENGINE_H_
+
+#include <stddef.h>
+#include "crs_spec_io.h"
+#include "crs_thread_pool.h"
+
+/**
+ * Gives the engine with the given name.
+ * @param name "crs" or "rs8"
+ * @return ENGINE_CRS or ENGINE_RS8, or -1 if there is no such engine
+ */
+int find_engine(const char *name);
+
+/**
+ * Gives the name of an engine.
+ * @param engine ENGINE_CRS or ENGINE_RS8
+ * @return The name of the engine, or NULL if there is no such engine
+ */
+const char *engine_name(int engine);
+
+/**
+ * Prepares the spec for encoding with its engine by storing the coding matrix in spec->bitmatrix: the cauchy
+ * bitmatrix (from the schedule cache) for ENGINE_CRS, the cauchy GF(2^8) matrix for ENGINE_RS8.
+ * @param spec The spec with k, m, w and engine filled
+ * @return 0 if successful, otherwise -1 (errno is EINVAL if the engine can not code k + m files)
+ */
+int engine_setup(struct crs_encoding_spec *spec);
+
+/**
+ * Encodes size bytes of each data row into the coding rows with the engine of the spec.
+ * @param spec The spec, prepared with engine_setup or read from a spec file
+ * @param data The data rows
+ * @param coding The coding rows
+ * @param size The number of bytes of each row to encode, a multiple of w * packetsize
+ * @param pool The thread pool to encode on, or NULL to encode in the calling thread
+ * @return 0 if successful, otherwise -1 (errno is EINVAL if the spec's coding matrix is not the one the engine codes
+ * with)
+ */
+int engine_encode(struct crs_encoding_spec *spec, char **data, char **coding, size_t size,
+		struct crs_thread_pool *pool);
+
+/**
+ * Rebuilds the erased rows over size bytes of each row with the engine of the spec. Only the rows marked by
+ * decoding_rows are read or written, the others may be NULL.
+ * @param spec The spec read from a spec file
+ * @param erasures A -1 terminated array of at most m erased row indices (0 = d1, ..., k = c1, ..., k+m-1 = cm)
+ * @param data The data rows
+ * @param coding The coding rows
+ * @param size The number of bytes of each row to decode, a multiple of w * packetsize
+ * @param pool The thread pool to decode on, or NULL to decode in the calling thread
+ * @return 0 if successful, otherwise -1
+ */
+int engine_decode(struct crs_encoding_spec *spec, int *erasures, char **data, char **coding, size_t size,
+		struct crs_thread_pool *pool);
+
+#endif /* CRS_ENGINE_H_ */
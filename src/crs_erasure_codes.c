@@ -2,297 +2,1847 @@
 #include <string.h>
 #include <fcntl.h>
 #include <jerasure.h>
-#include <cauchy.h>
 #include <errno.h>
 #include <unistd.h>
+#include <limits.h>
+#include <time.h>
+#include <sys/mman.h>
 #include "crs_file_io.h"
+#include "crs_crc.h"
+#include "crs_arena.h"
 #include "crs_spec_io.h"
+#include "crs_parallel.h"
+#include "crs_schedule.h"
+#include "crs_engine.h"
+#include "crs_stats.h"
+#include "crs_pipeline.h"
 #include "crs_erasure_codes.h"
 
-int main(int argc, char **argv) {
-	int c, res, i;
-	int mode = -1;
-	char *src = NULL;
-	char *dest = NULL;
-	struct crs_encoding_spec spec;
-
-	spec.k = 0;
-	spec.m = 0;
-
-	while ((c = getopt(argc, argv, "edk:m:")) != -1)
-		switch (c) {
-		case 'e':
-			if (mode == -1) {
-				mode = 1;
-			} else {
-				print_usage(argv[0]);
-				return -1;
+/**
+ * Initialises the options to their defaults (the whole file is encoded in memory on one thread, with a packet size
+ * calculated from the cache size).
+ * @param opts The options to initialise
+ */
+void init_options(struct crs_options *opts) {
+	opts->stripeBudget = 0;
+	opts->threads = 1;
+	opts->autotune = 0;
+	opts->arena = NULL;
+	opts->mapInput = 0;
+	opts->verify = 0;
+	opts->pool = NULL;
+}
+
+/**
+ * Encodes the file at src to dest directory. Also writes the spec to a file in dest. Spec k and m values must be
+ * initialised, The rest will be filled.
+ * @param src The file to encode, or a stream (a pipe, or - for stdin) encoded as it is read (see encode_stream)
+ * @param dest The directory to create and fill with the data, coding and spec files.
+ * @param spec The spec (k and m) to be used in encoding
+ * @param opts The encoding options, or NULL for the defaults
+ * @return 0 if successful, otherwise -1
+ */
+int encode(char *src, char *dest, struct crs_encoding_spec *spec, struct crs_options *opts) {
+
+	int i, stream, res = 0;
+	size_t fileSize;
+	uint64_t start;
+	struct crs_options defaults, stripeOpts;
+	struct crs_encoding_spec probe;
+	struct crs_thread_pool *pool = NULL;
+	struct crs_arena localArena;
+	struct crs_arena *arena;
+
+	if (opts == NULL) {
+		init_options(&defaults);
+		opts = &defaults;
+	}
+
+	/* Check args are reasonable */
+	if (spec->k <= 0 || spec->k >= 9999 || spec->m <= 0 || spec->m > spec->k) {
+		fprintf(stderr, "Error: Unsuitable arguments used for crs_encode.encode\n");
+		return -1;
+	}
+	stream = is_stream(src);
+	if (opts->mapInput && (opts->stripeBudget > 0 || stream)) {
+		fprintf(stderr, "Error: A mapped input can not be encoded in stripes or read from a stream\n");
+		return -1;
+	}
+
+	/* The size of a stream is unknown until it ends, the packet size is chosen for a file filling the budget */
+	start = stats_start();
+	if (!stream && get_file_size(src, &fileSize) < 0) {
+		fprintf(stderr, "Could get size of file: %s\n%s\n", src, strerror(errno));
+		return -1;
+	}
+	if (stream || opts->stripeBudget > 0) {
+		stripeOpts = *opts;
+		if (stripeOpts.stripeBudget == 0) {
+			stripeOpts.stripeBudget = STREAM_STRIPE_BUDGET;
+		}
+		/* The budget is shared by the stripes in flight in the pipeline */
+		stripeOpts.stripeBudget /= PIPELINE_DEPTH;
+		opts = &stripeOpts;
+		if (stream) {
+			fileSize = opts->stripeBudget;
+		}
+	}
+
+	/* A requested packet size is changed when its blocks would pad the file past the last data file */
+	if (spec->packetsize > 0 && !opts->autotune && !stream && opts->stripeBudget == 0) {
+		probe = *spec;
+		if (fill_encoding_spec(&probe, fileSize) == 0 && probe.packetsize != spec->packetsize) {
+			fprintf(stderr, "Warning: %d byte packets would pad past the last data file, using %d byte packets\n",
+					spec->packetsize, probe.packetsize);
+		}
+	}
+	if (spec->packetsize == 0) {
+		spec->packetsize = choose_packetsize(spec, fileSize, opts);
+		if (spec->packetsize < 0) {
+			fprintf(stderr, "Error: Could not choose a packet size\n");
+			return -1;
+		}
+	}
+	stats_stop(PHASE_SPEC, start);
+
+	pool = opts->pool;
+	if (pool == NULL && opts->threads > 1) {
+		pool = thread_pool_create(opts->threads);
+		if (pool == NULL) {
+			fprintf(stderr, "Could not create thread pool\n%s\n", strerror(errno));
+			return -1;
+		}
+	}
+
+	arena = opts->arena;
+	if (arena == NULL) {
+		arena_init(&localArena);
+		arena = &localArena;
+	}
+
+	if (stream) {
+		res = encode_stream(src, dest, spec, &fileSize, opts->stripeBudget, pool, arena);
+	} else if (opts->stripeBudget > 0) {
+		res = encode_striped(src, dest, spec, fileSize, opts->stripeBudget, pool, arena);
+	} else if (opts->mapInput) {
+		res = encode_mapped(src, dest, spec, fileSize, pool, arena);
+	} else {
+		res = encode_in_memory(src, dest, spec, fileSize, pool, arena);
+	}
+	if (res == 0) {
+		stats_add_bytes(fileSize, 0);
+		for (i = 0; i < spec->k + spec->m; i++) {
+			stats_add_bytes(0, fragment_size(spec, i));
+		}
+	}
+
+	if (arena == &localArena) {
+		arena_free(&localArena);
+	}
+	if (pool != NULL && pool != opts->pool) {
+		thread_pool_destroy(pool);
+	}
+	return res;
+}
+
+/**
+ * Encodes the file at src to dest directory with the whole file held in memory.
+ * @param src The file to encode
+ * @param dest The directory to create and fill with the data, coding and spec files.
+ * @param spec The spec (k and m) to be used in encoding
+ * @param fileSize The size of the file at src
+ * @param pool The thread pool to encode on, or NULL to encode in the calling thread
+ * @param arena The arena to carve the data and coding matrices from
+ * @return 0 if successful, otherwise -1
+ */
+int encode_in_memory(char *src, char *dest, struct crs_encoding_spec *spec, size_t fileSize,
+		struct crs_thread_pool *pool, struct crs_arena *arena) {
+
+	int res = 0;
+	uint64_t start;
+	char **data = NULL;
+	char **coding = NULL;
+
+	/* Calculate encoding specs */
+	start = stats_start();
+	res = fill_encoding_spec(spec, fileSize);
+	stats_stop(PHASE_SPEC, start);
+	if (res < 0) {
+		fprintf(stderr, "Error: Could not calculate encoding specs\n");
+		return -1;
+	}
+
+	/* Alloc data and coding matrices */
+	data = arena_matrix(arena, spec->k + spec->m, spec->width);
+	if (data == NULL) {
+		fprintf(stderr, "Could not create data and coding matrices\n%s\n", strerror(errno));
+		return -1;
+	}
+	coding = data + spec->k;
+
+	/* Read data from file */
+	start = stats_start();
+	res = file2data_matrix(src, spec, data);
+	stats_stop(PHASE_READ, start);
+	if (res < 0) {
+		fprintf(stderr, "Could not create data matrix from input file\n%s\n", strerror(errno));
+		return -1;
+	}
+
+	/* Encode with the engine of the spec */
+	if (engine_setup(spec) < 0) {
+		fprintf(stderr, "Could not create coding matrix for the %s engine\n%s\n", engine_name(spec->engine),
+				strerror(errno));
+		return -1;
+	}
+	res = engine_encode(spec, data, coding, spec->width, pool);
+
+	if (res == 0) {
+		res = update_checksums(spec, data, coding, 0, pool);
+	}
+
+	if (res < 0) {
+		fprintf(stderr, "Could not encode\n%s\n", strerror(errno));
+	} else {
+		start = stats_start();
+		res = write_files(data, coding, spec, dest, src);
+		stats_stop(PHASE_WRITE, start);
+		if (res < 0) {
+			fprintf(stderr, "Could not write encoded files\n%s", strerror(errno));
+		}
+	}
+
+	free_spec(spec);
+	return res;
+}
+
+/**
+ * Encodes the file at src to dest directory reading it through a read only mapping. The data rows lying wholly within
+ * the file point into the mapping, only the padded last row and the coding rows are allocated.
+ * @param src The file to encode
+ * @param dest The directory to create and fill with the data, coding and spec files.
+ * @param spec The spec (k and m) to be used in encoding
+ * @param fileSize The size of the file at src
+ * @param pool The thread pool to encode on, or NULL to encode in the calling thread
+ * @param arena The arena to carve the last data row and the coding matrix from
+ * @return 0 if successful, otherwise -1
+ */
+int encode_mapped(char *src, char *dest, struct crs_encoding_spec *spec, size_t fileSize,
+		struct crs_thread_pool *pool, struct crs_arena *arena) {
+
+	int res = 0;
+	int nrTail;
+	uint64_t start;
+	char **data = NULL;
+	char **rows = NULL;
+	void *map;
+	size_t mapSize;
+
+	/* Calculate encoding specs */
+	start = stats_start();
+	res = fill_encoding_spec(spec, fileSize);
+	stats_stop(PHASE_SPEC, start);
+	if (res < 0) {
+		fprintf(stderr, "Error: Could not calculate encoding specs\n");
+		return -1;
+	}
+
+	/* Alloc the data rows not wholly within the file, followed by the coding matrix */
+	nrTail = spec->k - mapped_rows(spec, fileSize);
+	rows = arena_matrix(arena, nrTail + spec->m, spec->width);
+	data = (char **) malloc(spec->k * sizeof(char *));
+	if (rows == NULL || data == NULL) {
+		fprintf(stderr, "Could not create data and coding matrices\n%s\n", strerror(errno));
+		free(data);
+		return -1;
+	}
+
+	start = stats_start();
+	res = map_data_matrix(src, spec, data, rows, &map, &mapSize);
+	stats_stop(PHASE_READ, start);
+	if (res < 0) {
+		fprintf(stderr, "Could not map input file: %s\n%s\n", src, strerror(errno));
+		free(data);
+		return -1;
+	}
+
+	if (engine_setup(spec) < 0) {
+		fprintf(stderr, "Could not create coding matrix for the %s engine\n%s\n", engine_name(spec->engine),
+				strerror(errno));
+		res = -1;
+	} else {
+		res = engine_encode(spec, data, rows + nrTail, spec->width, pool);
+		if (res == 0) {
+			res = update_checksums(spec, data, rows + nrTail, 0, pool);
+		}
+		if (res < 0) {
+			fprintf(stderr, "Could not encode\n%s\n", strerror(errno));
+		} else {
+			start = stats_start();
+			res = write_files(data, rows + nrTail, spec, dest, src);
+			stats_stop(PHASE_WRITE, start);
+			if (res < 0) {
+				fprintf(stderr, "Could not write encoded files\n%s", strerror(errno));
+			}
+		}
+		free_spec(spec);
+	}
+
+	if (map != NULL) {
+		munmap(map, mapSize);
+	}
+	free(data);
+	return res;
+}
+
+/**
+ * A file being encoded stripe by stripe through a pipeline
+ */
+struct stripe_encoding {
+	FILE *f;
+	char *src;
+	char *dest;
+	int *fds; /* The k + m fragment files, open for the whole encoding */
+	struct crs_encoding_spec *spec;
+	char **rows; /* PIPELINE_DEPTH slots of k data rows followed by m coding rows */
+	size_t nrStripes; /* The stripes of the file, 0 to read until the input ends */
+	int preread; /* Whether the first stripe was read before the pipeline started */
+	size_t firstRead; /* The bytes of the first stripe read before the pipeline started */
+	size_t fileSize; /* The bytes read */
+	struct crs_thread_pool *pool;
+	struct crs_io_context *io; /* The write stage's ring and threads, kept for every stripe */
+};
+
+/**
+ * Reads the next stripe of the file (the read stage of encode_striped and encode_stream).
+ * @return 1 if it was the last stripe, 0 if more follow, or -1 if unsuccessful
+ */
+static int read_stripe_stage(void *ctx, int slot, size_t stripe) {
+	int res = 0;
+	size_t nrRead;
+	uint64_t start;
+	struct stripe_encoding *enc = (struct stripe_encoding *) ctx;
+	struct crs_encoding_spec *spec = enc->spec;
+
+	if (stripe == 0 && enc->preread) {
+		nrRead = enc->firstRead;
+	} else {
+		start = stats_start();
+		res = read_stripe(enc->f, enc->rows + slot * (spec->k + spec->m), spec, &nrRead);
+		stats_stop(PHASE_READ, start);
+	}
+	if (res < 0) {
+		fprintf(stderr, "Could not read input file: %s\n%s\n", enc->src, strerror(errno));
+		return -1;
+	}
+	enc->fileSize += nrRead;
+
+	/* A stream ends with a short stripe, an exact multiple of stripes being followed by an empty one */
+	if (enc->nrStripes > 0) {
+		return (stripe + 1 == enc->nrStripes) ? 1 : 0;
+	}
+	return (nrRead < spec->k * spec->stripeWidth) ? 1 : 0;
+}
+
+/**
+ * Encodes a stripe and extends the checksums with it (the code stage of encode_striped and encode_stream).
+ * @return 0 if successful, otherwise -1
+ */
+static int encode_stripe_stage(void *ctx, int slot, size_t stripe) {
+	int res;
+	struct stripe_encoding *enc = (struct stripe_encoding *) ctx;
+	struct crs_encoding_spec *spec = enc->spec;
+	char **data = enc->rows + slot * (spec->k + spec->m);
+
+	res = engine_encode(spec, data, data + spec->k, spec->stripeWidth, enc->pool);
+	if (res == 0) {
+		res = update_checksums(spec, data, data + spec->k, spec->stripeWidth, enc->pool);
+	}
+	if (res < 0) {
+		fprintf(stderr, "Could not encode\n%s\n", strerror(errno));
+	}
+	return res;
+}
+
+/**
+ * Writes an encoded stripe to the data and coding files (the write stage of encode_striped and encode_stream).
+ * @return 0 if successful, otherwise -1
+ */
+static int write_stripe_stage(void *ctx, int slot, size_t stripe) {
+	int res;
+	uint64_t start;
+	struct stripe_encoding *enc = (struct stripe_encoding *) ctx;
+	struct crs_encoding_spec *spec = enc->spec;
+	char **data = enc->rows + slot * (spec->k + spec->m);
+
+	start = stats_start();
+	res = write_stripe(data, data + spec->k, spec, enc->fds, stripe, enc->io);
+	stats_stop(PHASE_WRITE, start);
+	if (res < 0) {
+		fprintf(stderr, "Could not write encoded files\n%s\n", strerror(errno));
+	}
+	return res;
+}
+
+/**
+ * Encodes the file at src to dest directory one stripe at a time, so that at most stripeBudget bytes of data and
+ * coding buffers are held for each stripe. Each stripe is split into k consecutive chunks which are appended to the
+ * data files, the encoded chunks are appended to the coding files. The stripe width is recorded in the spec. The next
+ * stripe is read and the previous one written while a stripe is encoded, PIPELINE_DEPTH stripes being held at once.
+ * @param src The file to encode
+ * @param dest The directory to create and fill with the data, coding and spec files.
+ * @param spec The spec (k and m) to be used in encoding
+ * @param fileSize The size of the file at src
+ * @param stripeBudget The maximum number of bytes of data and coding buffers for one stripe
+ * @param pool The thread pool to encode on, or NULL to encode in the calling thread
+ * @param arena The arena to carve the stripe buffers from
+ * @return 0 if successful, otherwise -1
+ */
+int encode_striped(char *src, char *dest, struct crs_encoding_spec *spec, size_t fileSize, size_t stripeBudget,
+		struct crs_thread_pool *pool, struct crs_arena *arena) {
+
+	int res = 0;
+	uint64_t start;
+	struct stripe_encoding enc;
+	struct crs_pipeline pipeline = { read_stripe_stage, encode_stripe_stage, write_stripe_stage, &enc };
+
+	/* Calculate encoding specs */
+	start = stats_start();
+	res = fill_striped_encoding_spec(spec, fileSize, stripeBudget);
+	stats_stop(PHASE_SPEC, start);
+	if (res < 0) {
+		fprintf(stderr, "Error: Could not calculate encoding specs (stripe budget too small?)\n");
+		return -1;
+	}
+
+	/* Alloc stripe buffers */
+	memset(&enc, 0, sizeof(enc));
+	enc.rows = arena_matrix(arena, PIPELINE_DEPTH * (spec->k + spec->m), spec->stripeWidth);
+	if (enc.rows == NULL) {
+		fprintf(stderr, "Could not create data and coding matrices\n%s\n", strerror(errno));
+		return -1;
+	}
+
+	if (engine_setup(spec) < 0) {
+		fprintf(stderr, "Could not create coding matrix for the %s engine\n%s\n", engine_name(spec->engine),
+				strerror(errno));
+		return -1;
+	}
+
+	enc.f = fopen(src, "rb");
+	enc.fds = (int *) malloc((spec->k + spec->m) * sizeof(int));
+	if (enc.f == NULL) {
+		fprintf(stderr, "Could not open input file: %s\n%s\n", src, strerror(errno));
+		res = -1;
+	} else if (enc.fds == NULL) {
+		res = -1;
+	} else {
+		res = create_fragment_dir(dest, spec);
+		if (res == 0) {
+			res = create_fragment_files(dest, spec, enc.fds);
+		}
+		if (res < 0) {
+			fprintf(stderr, "Could not create encoded files in: %s\n%s\n", dest, strerror(errno));
+		}
+	}
+
+	if (res == 0) {
+		enc.src = src;
+		enc.dest = dest;
+		enc.spec = spec;
+		enc.nrStripes = spec->width / spec->stripeWidth;
+		enc.pool = pool;
+		/* Without a context of its own each stripe sets up its writes from scratch, which still works */
+		enc.io = io_context_create();
+		res = run_pipeline(&pipeline);
+		io_context_destroy(enc.io);
+		if (close_fragment_files(spec, enc.fds) < 0 && res == 0) {
+			fprintf(stderr, "Could not write encoded files\n%s\n", strerror(errno));
+			res = -1;
+		}
+	}
+
+	/* The spec written up front had no checksums, they are only complete now */
+	if (res == 0) {
+		start = stats_start();
+		res = write_fragment_spec(dest, spec);
+		stats_stop(PHASE_SPEC, start);
+		if (res < 0) {
+			fprintf(stderr, "Could not write spec file\n%s\n", strerror(errno));
+		}
+	}
+
+	if (enc.f != NULL) {
+		fclose(enc.f);
+	}
+	free(enc.fds);
+	free_spec(spec);
+
+	return res;
+}
+
+/**
+ * Encodes the stream src (a pipe, or - for stdin) to dest directory one stripe at a time like encode_striped, the
+ * stripes being read through the same pipeline. The width and end padding are only known once the input ends, they
+ * are recorded in the spec then. An input ending within the first stripe is encoded with the narrower stripes
+ * encode_striped would give a file of its size.
+ * @param src The stream to encode, - for stdin
+ * @param dest The directory to create and fill with the data, coding and spec files.
+ * @param spec The spec (k, m and packetsize) to be used in encoding
+ * @param fileSize Where the number of bytes read from src should be stored
+ * @param stripeBudget The maximum number of bytes of data and coding buffers for one stripe
+ * @param pool The thread pool to encode on, or NULL to encode in the calling thread
+ * @param arena The arena to carve the stripe buffers from
+ * @return 0 if successful, otherwise -1
+ */
+int encode_stream(char *src, char *dest, struct crs_encoding_spec *spec, size_t *fileSize, size_t stripeBudget,
+		struct crs_thread_pool *pool, struct crs_arena *arena) {
+
+	int i, res = 0;
+	size_t nrRead, width;
+	uint64_t start;
+	char *first;
+	char **data;
+	struct stripe_encoding enc;
+	struct crs_pipeline pipeline = { read_stripe_stage, encode_stripe_stage, write_stripe_stage, &enc };
+
+	/* A stripe as wide as the budget allows until the input is seen to end */
+	start = stats_start();
+	res = fill_striped_encoding_spec(spec, stripeBudget, stripeBudget);
+	stats_stop(PHASE_SPEC, start);
+	if (res < 0) {
+		fprintf(stderr, "Error: Could not calculate encoding specs (stripe budget too small?)\n");
+		return -1;
+	}
+
+	data = arena_matrix(arena, PIPELINE_DEPTH * (spec->k + spec->m), spec->stripeWidth);
+	if (data == NULL) {
+		fprintf(stderr, "Could not create data and coding matrices\n%s\n", strerror(errno));
+		return -1;
+	}
+
+	memset(&enc, 0, sizeof(enc));
+	enc.f = (strcmp(src, "-") == 0) ? stdin : fopen(src, "rb");
+	if (enc.f == NULL) {
+		fprintf(stderr, "Could not open input file: %s\n%s\n", src, strerror(errno));
+		return -1;
+	}
+
+	start = stats_start();
+	res = read_stripe(enc.f, data, spec, &nrRead);
+	stats_stop(PHASE_READ, start);
+
+	/* Narrow the stripe of an input which ended within it, laying the bytes read out again over the narrower rows */
+	if (res == 0 && nrRead < spec->k * spec->stripeWidth) {
+		first = (char *) malloc(nrRead + 1);
+		if (first == NULL) {
+			res = -1;
+		} else {
+			width = spec->stripeWidth;
+			for (i = 0; (size_t) i * width < nrRead; i++) {
+				memcpy(first + i * width, data[i], (nrRead - i * width < width) ? nrRead - i * width : width);
+			}
+			res = fill_striped_encoding_spec(spec, nrRead, stripeBudget);
+			if (res == 0) {
+				width = spec->stripeWidth;
+				data = arena_matrix(arena, PIPELINE_DEPTH * (spec->k + spec->m), width);
+				for (i = 0; data != NULL && i < spec->k; i++) {
+					memset(data[i], 0, width);
+					if ((size_t) i * width < nrRead) {
+						memcpy(data[i], first + i * width, (nrRead - i * width < width) ? nrRead - i * width : width);
+					}
+				}
+			}
+			free(first);
+		}
+	}
+	if (res < 0 || data == NULL) {
+		res = -1;
+		fprintf(stderr, "Could not read input file: %s\n%s\n", src, strerror(errno));
+	}
+
+	if (res == 0 && engine_setup(spec) < 0) {
+		fprintf(stderr, "Could not create coding matrix for the %s engine\n%s\n", engine_name(spec->engine),
+				strerror(errno));
+		res = -1;
+	}
+
+	/* The spec written up front describes a single stripe, it is rewritten once the input has ended */
+	spec->width = spec->stripeWidth;
+	spec->endPadding = 0;
+	if (res == 0) {
+		enc.fds = (int *) malloc((spec->k + spec->m) * sizeof(int));
+		res = (enc.fds == NULL) ? -1 : create_fragment_dir(dest, spec);
+		if (res < 0) {
+			fprintf(stderr, "Could not create directory: %s\n%s\n", dest, strerror(errno));
+		} else if (create_fragment_files(dest, spec, enc.fds) < 0) {
+			fprintf(stderr, "Could not create encoded files in: %s\n%s\n", dest, strerror(errno));
+			res = -1;
+		}
+	}
+
+	if (res == 0) {
+		enc.src = src;
+		enc.dest = dest;
+		enc.spec = spec;
+		enc.rows = data;
+		enc.pool = pool;
+		enc.preread = 1;
+		enc.firstRead = nrRead;
+		enc.io = io_context_create();
+		res = run_pipeline(&pipeline);
+		io_context_destroy(enc.io);
+		if (close_fragment_files(spec, enc.fds) < 0 && res == 0) {
+			fprintf(stderr, "Could not write encoded files\n%s\n", strerror(errno));
+			res = -1;
+		}
+	}
+	*fileSize = enc.fileSize;
+
+	/* The spec written up front had no checksums nor the final geometry, they are only complete now */
+	if (res == 0) {
+		spec->width = (*fileSize / (spec->k * spec->stripeWidth) + 1) * spec->stripeWidth;
+		spec->endPadding = spec->k * spec->width - *fileSize;
+		start = stats_start();
+		res = write_fragment_spec(dest, spec);
+		stats_stop(PHASE_SPEC, start);
+		if (res < 0) {
+			fprintf(stderr, "Could not write spec file\n%s\n", strerror(errno));
+		}
+	}
+
+	if (enc.f != stdin) {
+		fclose(enc.f);
+	}
+	free(enc.fds);
+	free_spec(spec);
+
+	return res;
+}
+
+/**
+ * Extends the checksums in the spec with the next bytes of every data and coding row, allocating zeroed checksums on
+ * the first call.
+ * @param spec The encoding specification
+ * @param data The data rows
+ * @param coding The coding rows
+ * @param size The number of bytes of each row to add, or 0 to add the whole file size of each row (see fragment_size)
+ * @param pool The thread pool to checksum on, or NULL to checksum in the calling thread
+ * @return 0 if successful, otherwise -1
+ */
+int update_checksums(struct crs_encoding_spec *spec, char **data, char **coding, size_t size,
+		struct crs_thread_pool *pool) {
+	int i, res;
+	char **rows;
+	size_t *sizes;
+	uint64_t start;
+
+	if (spec->checksums == NULL) {
+		spec->checksums = (uint32_t *) calloc(spec->k + spec->m, sizeof(uint32_t));
+		if (spec->checksums == NULL) {
+			return -1;
+		}
+	}
+	rows = (char **) malloc((spec->k + spec->m) * sizeof(char *));
+	sizes = (size_t *) malloc((spec->k + spec->m) * sizeof(size_t));
+	if (rows == NULL || sizes == NULL) {
+		free(rows);
+		free(sizes);
+		return -1;
+	}
+	for (i = 0; i < spec->k + spec->m; i++) {
+		rows[i] = (i < spec->k) ? data[i] : coding[i - spec->k];
+		sizes[i] = (size == 0) ? fragment_size(spec, i) : size;
+	}
+
+	start = stats_start();
+	res = parallel_crc32c(rows, sizes, spec->checksums, spec->k + spec->m, pool);
+	stats_stop(PHASE_CHECKSUM, start);
+	free(rows);
+	free(sizes);
+	return res;
+}
+
+/**
+ * Finds the data and coding files in the src directory. With opts->verify set the files found are then checked against
+ * the spec checksums, corrupt files being marked missing.
+ * @param src The directory containing the coding, data and spec files
+ * @param spec The encoding specification
+ * @param opts The decoding options, or NULL for the defaults
+ * @param present The k + m flags to fill (0 for missing or corrupt, 1 for present)
+ * @return 0 if successful, otherwise -1
+ */
+int find_intact_files(char *src, struct crs_encoding_spec *spec, struct crs_options *opts, int *present) {
+	int nrCorrupt;
+	uint64_t start;
+
+	start = stats_start();
+	if (find_files(src, spec, present) < 0) {
+		stats_stop(PHASE_VERIFY, start);
+		return -1;
+	}
+	if (opts == NULL || opts->verify == 0) {
+		stats_stop(PHASE_VERIFY, start);
+		return 0;
+	}
+	if (spec->checksums == NULL) {
+		stats_stop(PHASE_VERIFY, start);
+		fprintf(stderr, "Warning: The spec has no checksums, the fragments can not be verified\n");
+		return 0;
+	}
+	nrCorrupt = verify_files(src, spec, present);
+	stats_stop(PHASE_VERIFY, start);
+	if (nrCorrupt < 0) {
+		fprintf(stderr, "Could not verify fragments\n%s\n", strerror(errno));
+		return -1;
+	}
+	if (nrCorrupt > 0) {
+		fprintf(stderr, "%d corrupt fragment(s), treated as missing\n", nrCorrupt);
+	}
+	return 0;
+}
+
+/**
+ * Checks every fragment in the src directory against the checksums recorded in the spec and reports the missing and
+ * corrupt ones. Nothing is decoded or written.
+ * @param src The directory containing the coding, data and spec files
+ * @param spec An empty spec struct to read the spec file into
+ * @return 0 if every fragment is present and intact, otherwise -1
+ */
+int verify(char *src, struct crs_encoding_spec *spec) {
+	int res, i, nrMissing, nrCorrupt;
+	int *present;
+	uint64_t start;
+
+	start = stats_start();
+	res = read_fragment_spec(src, spec);
+	stats_stop(PHASE_SPEC, start);
+	if (res < 0) {
+		fprintf(stderr, "Could not read spec file\n%s", strerror(errno));
+		return -1;
+	}
+	if (spec->checksums == NULL) {
+		fprintf(stderr, "The spec has no checksums, the fragments can not be verified\n");
+		free_spec(spec);
+		return -1;
+	}
+
+	present = (int *) calloc(spec->k + spec->m, sizeof(int));
+	if (present == NULL || find_files(src, spec, present) < 0) {
+		free_spec(spec);
+		free(present);
+		return -1;
+	}
+
+	nrMissing = 0;
+	for (i = 0; i < spec->k + spec->m; i++) {
+		if (present[i] == 0) {
+			nrMissing++;
+		}
+	}
+	start = stats_start();
+	nrCorrupt = verify_files(src, spec, present);
+	stats_stop(PHASE_VERIFY, start);
+	if (nrCorrupt < 0) {
+		fprintf(stderr, "Could not verify fragments\n%s\n", strerror(errno));
+		res = -1;
+	} else {
+		for (i = 0; i < spec->k + spec->m; i++) {
+			if (present[i]) {
+				stats_add_bytes(fragment_size(spec, i), 0);
 			}
-			break;
-		case 'd':
-			if (mode == -1) {
-				mode = 0;
+		}
+		stats_set_erasures(nrMissing + nrCorrupt);
+		fprintf(stdout, "%d intact, %d missing, %d corrupt of %d fragments\n",
+				spec->k + spec->m - nrMissing - nrCorrupt, nrMissing, nrCorrupt, spec->k + spec->m);
+		if (nrMissing + nrCorrupt > spec->m) {
+			fprintf(stderr, "Too many fragments lost to decode\n");
+		}
+		res = (nrMissing + nrCorrupt > 0) ? -1 : 0;
+	}
+
+	free_spec(spec);
+	free(present);
+	return res;
+}
+
+/**
+ * A decode repairing the erased fragments, or writing the original file, slice by slice through a pipeline
+ */
+struct slice_repair {
+	char *src;
+	struct crs_encoding_spec *spec;
+	int *present;
+	int *erasures;
+	char **rows; /* PIPELINE_DEPTH slots of k + m rows, NULL for the fragments neither read nor rebuilt */
+	size_t sliceSize; /* A whole number of blocks */
+	struct crs_thread_pool *pool;
+	struct crs_io_context *io; /* The read stage's ring and threads, kept for every slice */
+	struct crs_reconstruction *out; /* The original file the data rows are written to, NULL to repair the fragments */
+	int firstRow; /* The data rows [firstRow, lastRow) written to out */
+	int lastRow;
+};
+
+/**
+ * Gives the size of a slice, the last slice of the fragments being narrower.
+ * @param repair The repair
+ * @param slice The slice index
+ * @return The size of the slice
+ */
+static size_t slice_size(struct slice_repair *repair, size_t slice) {
+	size_t offset = slice * repair->sliceSize;
+
+	return (repair->spec->width - offset < repair->sliceSize) ? repair->spec->width - offset : repair->sliceSize;
+}
+
+/**
+ * Reads the next slice of the fragments the decoding needs (the read stage of decode).
+ * @return 1 if it was the last slice, 0 if more follow, or -1 if unsuccessful
+ */
+static int read_slice_stage(void *ctx, int slot, size_t slice) {
+	int i, res;
+	uint64_t start;
+	struct slice_repair *repair = (struct slice_repair *) ctx;
+	struct crs_encoding_spec *spec = repair->spec;
+	char **rows = repair->rows + slot * (spec->k + spec->m);
+	size_t size = slice_size(repair, slice);
+
+	start = stats_start();
+	res = read_file_slices(repair->src, spec, repair->present, rows, slice * repair->sliceSize, size, repair->io);
+	stats_stop(PHASE_READ, start);
+	if (res < 0) {
+		fprintf(stderr, "Could not read fragments\n%s\n", strerror(errno));
+		return -1;
+	}
+	for (i = 0; i < spec->k + spec->m; i++) {
+		if (rows[i] != NULL && repair->present[i]) {
+			stats_add_bytes(size, 0);
+		}
+	}
+	return ((slice + 1) * repair->sliceSize >= spec->width) ? 1 : 0;
+}
+
+/**
+ * Rebuilds the erased rows over a slice (the code stage of decode).
+ * @return 0 if successful, otherwise -1
+ */
+static int decode_slice_stage(void *ctx, int slot, size_t slice) {
+	int res;
+	struct slice_repair *repair = (struct slice_repair *) ctx;
+	struct crs_encoding_spec *spec = repair->spec;
+	char **rows = repair->rows + slot * (spec->k + spec->m);
+
+	res = engine_decode(spec, repair->erasures, rows, rows + spec->k, slice_size(repair, slice), repair->pool);
+	if (res < 0) {
+		fprintf(stderr, "Could not decode\n%s\n", strerror(errno));
+	}
+	return res;
+}
+
+/**
+ * Writes a rebuilt slice to the erased fragments (the write stage of decode).
+ * @return 0 if successful, otherwise -1
+ */
+static int write_slice_stage(void *ctx, int slot, size_t slice) {
+	int res;
+	uint64_t start;
+	struct slice_repair *repair = (struct slice_repair *) ctx;
+	struct crs_encoding_spec *spec = repair->spec;
+
+	start = stats_start();
+	res = write_file_slices(repair->src, spec, repair->erasures, repair->rows + slot * (spec->k + spec->m),
+			slice * repair->sliceSize, slice_size(repair, slice));
+	stats_stop(PHASE_WRITE, start);
+	if (res < 0) {
+		fprintf(stderr, "Could not write repaired files\n%s\n", strerror(errno));
+	}
+	return res;
+}
+
+/**
+ * Writes a slice of the data rows to the original file (the write stage of reconstruct).
+ * @return 0 if successful, otherwise -1
+ */
+static int reconstruct_slice_stage(void *ctx, int slot, size_t slice) {
+	int res;
+	uint64_t start;
+	struct slice_repair *repair = (struct slice_repair *) ctx;
+	struct crs_encoding_spec *spec = repair->spec;
+
+	start = stats_start();
+	res = write_reconstructed_columns(repair->out, repair->firstRow, repair->lastRow,
+			repair->rows + slot * (spec->k + spec->m), slice * repair->sliceSize, slice_size(repair, slice));
+	stats_stop(PHASE_WRITE, start);
+	return res;
+}
+
+/**
+ * Repairs the erased fragments, or writes data rows of the original file, in slices of REPAIR_SLICE_SIZE bytes, the
+ * next slice being read and the previous one written while a slice is decoded.
+ * @param src The directory containing the coding, data and spec files
+ * @param spec The encoding specification
+ * @param opts The decoding options, or NULL for the defaults
+ * @param arena The arena to carve the slices from
+ * @param present The k + m flags of the files found by find_files
+ * @param erasures A -1 terminated array of at most m erased row indices
+ * @param out The original file to write the data rows to, or NULL to write the erased fragments
+ * @param row The data row written to out, or -1 for all of them
+ * @return 0 if successful, otherwise -1
+ */
+static int repair_slices(char *src, struct crs_encoding_spec *spec, struct crs_options *opts, struct crs_arena *arena,
+		int *present, int *erasures, struct crs_reconstruction *out, int row) {
+
+	int res, i, j, slot, nrUsed;
+	int *needed;
+	char **used;
+	size_t blockSize;
+	struct slice_repair repair;
+	struct crs_pipeline pipeline = { read_slice_stage, decode_slice_stage, write_slice_stage, &repair };
+
+	if (out != NULL) {
+		pipeline.write = reconstruct_slice_stage;
+	}
+	repair.out = out;
+	repair.firstRow = (row < 0) ? 0 : row;
+	repair.lastRow = (row < 0) ? spec->k : row + 1;
+
+	/*
+	 * Slices are whole blocks, a width coded as a single block is repaired in one slice. A stream written from every
+	 * row takes a stripe per slice, so that the stripes are written in order.
+	 */
+	blockSize = (size_t) spec->w * spec->packetsize;
+	repair.sliceSize = spec->width;
+	if (out != NULL && out->stream && row < 0) {
+		repair.sliceSize = spec->stripeWidth;
+	} else if (spec->width % blockSize == 0 && REPAIR_SLICE_SIZE < spec->width) {
+		repair.sliceSize = (REPAIR_SLICE_SIZE > blockSize) ? REPAIR_SLICE_SIZE - REPAIR_SLICE_SIZE % blockSize
+				: blockSize;
+	}
+
+	needed = (int *) calloc(spec->k + spec->m, sizeof(int));
+	repair.rows = (char **) calloc(PIPELINE_DEPTH * (spec->k + spec->m), sizeof(char *));
+	if (needed == NULL || repair.rows == NULL) {
+		free(needed);
+		free(repair.rows);
+		return -1;
+	}
+	nrUsed = decoding_rows(spec->k, spec->m, erasures, needed);
+	used = arena_matrix(arena, PIPELINE_DEPTH * nrUsed, repair.sliceSize);
+	if (used == NULL) {
+		fprintf(stderr, "Could not create data and coding matrices\n%s\n", strerror(errno));
+		free(needed);
+		free(repair.rows);
+		return -1;
+	}
+	j = 0;
+	for (slot = 0; slot < PIPELINE_DEPTH; slot++) {
+		for (i = 0; i < spec->k + spec->m; i++) {
+			if (needed[i]) {
+				repair.rows[slot * (spec->k + spec->m) + i] = used[j];
+				j++;
+			}
+		}
+	}
+	free(needed);
+
+	repair.pool = NULL;
+	if (opts != NULL && opts->pool != NULL) {
+		repair.pool = opts->pool;
+	} else if (opts != NULL && opts->threads > 1) {
+		repair.pool = thread_pool_create(opts->threads);
+		if (repair.pool == NULL) {
+			fprintf(stderr, "Could not create thread pool\n%s\n", strerror(errno));
+			free(repair.rows);
+			return -1;
+		}
+	}
+
+	repair.src = src;
+	repair.spec = spec;
+	repair.present = present;
+	repair.erasures = erasures;
+	repair.io = io_context_create();
+	res = run_pipeline(&pipeline);
+	io_context_destroy(repair.io);
+
+	if (repair.pool != NULL && repair.pool != opts->pool) {
+		thread_pool_destroy(repair.pool);
+	}
+	free(repair.rows);
+	return res;
+}
+
+/**
+ * Decodes (repairs) the file set in the src directory using the specified spec. Only the fragments the decoding
+ * schedule needs are read (the surviving data files and one coding file per erased data file), and rows are allocated
+ * only for them and the fragments being rebuilt. The fragments are repaired in slices of REPAIR_SLICE_SIZE bytes, the
+ * next slice being read and the previous one written while a slice is decoded.
+ * @param src The directory containing the coding, data and spec files.
+ * @param spec An empty spec struct to read the spec file into.
+ * @param opts The decoding options, or NULL for the defaults
+ * @return 0 if successful, otherwise -1
+ */
+int decode(char *src, struct crs_encoding_spec *spec, struct crs_options *opts) {
+	int res, i, j;
+	int *present;
+	int *erasures;
+	uint64_t start;
+	struct crs_arena localArena;
+	struct crs_arena *arena;
+
+	start = stats_start();
+	res = read_fragment_spec(src, spec);
+	stats_stop(PHASE_SPEC, start);
+	if (res < 0) {
+		fprintf(stderr, "Could not read spec file\n%s", strerror(errno));
+		return -1;
+	}
+
+	present = (int *) calloc(spec->k + spec->m, sizeof(int));
+	erasures = (int *) malloc((spec->k + spec->m + 1) * sizeof(int));
+	if (present == NULL || erasures == NULL || find_intact_files(src, spec, opts, present) < 0) {
+		free_spec(spec);
+		free(present);
+		free(erasures);
+		return -1;
+	}
+
+	j = 0;
+	for (i = 0; i < spec->k + spec->m; i++) {
+		if (present[i] == 0) {
+			/* Erased */
+			erasures[j] = i;
+			j++;
+		}
+	}
+	erasures[j] = -1;
+	stats_set_erasures(j);
+
+	if (j == 0) {
+		fprintf(stdout, "Nothing to do!\n");
+	} else if (j > spec->m) {
+		fprintf(stderr, "Could not create decoding schedule (too many erasures?)\n");
+		res = -1;
+	} else {
+		arena = (opts == NULL) ? NULL : opts->arena;
+		if (arena == NULL) {
+			arena_init(&localArena);
+			arena = &localArena;
+		}
+		fprintf(stdout, "Repairing files...\n");
+		res = repair_slices(src, spec, opts, arena, present, erasures, NULL, -1);
+		for (i = 0; erasures[i] != -1 && res == 0; i++) {
+			stats_add_bytes(0, fragment_size(spec, erasures[i]));
+		}
+		if (arena == &localArena) {
+			arena_free(&localArena);
+		}
+	}
+
+	free_spec(spec);
+	free(present);
+	free(erasures);
+	return res;
+}
+
+/**
+ * Reconstructs the original file from the fragments in the src directory. Present data files are copied to out inside
+ * the kernel, missing ones are decoded from the fewest fragments possible in slices of REPAIR_SLICE_SIZE bytes, as
+ * decode repairs them. Nothing is written to src. A stream out of a striped layout is written a stripe per slice; one
+ * of a contiguous layout is written a data file at a time, each missing one decoded in its own pass over the fragments.
+ * @param src The directory containing the coding, data and spec files
+ * @param out The file to reconstruct, or - for stdout
+ * @param spec An empty spec struct to read the spec file into
+ * @param opts The decoding options, or NULL for the defaults
+ * @return 0 if successful, otherwise -1
+ */
+int reconstruct(char *src, char *out, struct crs_encoding_spec *spec, struct crs_options *opts) {
+	int res, i, j;
+	char **rows;
+	int *present;
+	int *erasures;
+	uint64_t start;
+	struct crs_arena localArena;
+	struct crs_arena *arena = NULL;
+	struct crs_reconstruction rec;
+
+	start = stats_start();
+	res = read_fragment_spec(src, spec);
+	stats_stop(PHASE_SPEC, start);
+	if (res < 0) {
+		fprintf(stderr, "Could not read spec file\n%s", strerror(errno));
+		return -1;
+	}
+
+	present = (int *) calloc(spec->k + spec->m, sizeof(int));
+	erasures = (int *) malloc((spec->k + spec->m + 1) * sizeof(int));
+	rows = (char **) calloc(spec->k + spec->m, sizeof(char *));
+	if (present == NULL || erasures == NULL || rows == NULL || find_intact_files(src, spec, opts, present) < 0) {
+		free_spec(spec);
+		free(present);
+		free(erasures);
+		free(rows);
+		return -1;
+	}
+
+	j = data_erasures(spec, present, erasures);
+	stats_set_erasures(j);
+	if (j < 0) {
+		fprintf(stderr, "Could not create decoding schedule (too many erasures?)\n");
+		res = -1;
+	} else if (j == 0) {
+		start = stats_start();
+		res = write_reconstructed(src, out, spec, present, rows);
+		stats_stop(PHASE_WRITE, start);
+	} else if (open_reconstructed(src, out, spec, present, &rec) < 0) {
+		res = -1;
+	} else {
+		arena = (opts == NULL) ? NULL : opts->arena;
+		if (arena == NULL) {
+			arena_init(&localArena);
+			arena = &localArena;
+		}
+		if (!rec.stream || spec->stripeWidth > 0) {
+			res = repair_slices(src, spec, opts, arena, present, erasures, &rec, -1);
+		}
+		for (i = 0; i < spec->k && res == 0 && rec.stream && spec->stripeWidth == 0; i++) {
+			if (present[i]) {
+				start = stats_start();
+				res = write_reconstructed_columns(&rec, i, i + 1, rows, 0, spec->width);
+				stats_stop(PHASE_WRITE, start);
 			} else {
-				print_usage(argv[0]);
-				return -1;
+				res = repair_slices(src, spec, opts, arena, present, erasures, &rec, i);
 			}
-			break;
-		case 'k':
-			res = str2int(optarg, &(spec.k));
-			if (res < 0 || spec.k <= 0 || spec.k > MAX_K) {
-				print_usage(argv[0]);
-				return -1;
+		}
+		if (close_reconstructed(&rec) < 0) {
+			res = -1;
+		}
+	}
+
+	if (j >= 0) {
+		for (i = 0; i < spec->k && res == 0; i++) {
+			stats_add_bytes((present[i]) ? fragment_size(spec, i) : 0, fragment_size(spec, i));
+		}
+		if (res < 0) {
+			fprintf(stderr, "Could not write reconstructed file: %s\n%s\n", out, strerror(errno));
+		}
+	}
+
+	if (arena == &localArena) {
+		arena_free(&localArena);
+	}
+	free_spec(spec);
+	free(present);
+	free(erasures);
+	free(rows);
+	return res;
+}
+
+/**
+ * Lists the erasures the decoding of the data rows depends on: the missing data rows, and the missing coding rows up to
+ * the last coding row substituted for a missing data row. Later missing coding rows are left out so they are not
+ * rebuilt.
+ * @param spec The encoding specification
+ * @param present The k + m flags of the files found by find_files
+ * @param erasures The k + m + 1 entries to fill with the -1 terminated erasures
+ * @return The number of erasures, or -1 if there are too many to decode
+ */
+int data_erasures(struct crs_encoding_spec *spec, int *present, int *erasures) {
+	int i;
+	int j = 0;
+	int substitutes = 0;
+
+	for (i = 0; i < spec->k; i++) {
+		if (present[i] == 0) {
+			erasures[j] = i;
+			j++;
+			substitutes++;
+		}
+	}
+	for (i = spec->k; i < spec->k + spec->m && substitutes > 0; i++) {
+		if (present[i] == 0) {
+			erasures[j] = i;
+			j++;
+		} else {
+			substitutes--;
+		}
+	}
+	erasures[j] = -1;
+	return (substitutes > 0) ? -1 : j;
+}
+
+/**
+ * Gives the data row and column holding a byte of the original file.
+ * @param spec The encoding specification
+ * @param position The position of the byte in the original file
+ * @param row Where the data row index should be stored
+ * @param column Where the offset of the byte in the data row should be stored
+ * @return The number of bytes from position which follow it in the same row
+ */
+size_t locate_byte(struct crs_encoding_spec *spec, size_t position, int *row, size_t *column) {
+	size_t chunk = (spec->stripeWidth == 0) ? spec->width : spec->stripeWidth;
+	size_t stripe = position / (chunk * spec->k);
+	size_t inStripe = position % (chunk * spec->k);
+
+	*row = (int) (inStripe / chunk);
+	*column = stripe * chunk + inStripe % chunk;
+	return chunk - inStripe % chunk;
+}
+
+/**
+ * Reads length bytes of the original file, starting at offset, from the fragments in the src directory, window by
+ * window. A window holds at most REPAIR_SLICE_SIZE bytes, and the columns of its missing rows span at most
+ * REPAIR_SLICE_SIZE bytes, so the rows decoded for a window stay bounded however long the range is. Present data rows
+ * are read directly, missing ones are decoded over only the blocks spanning the window's columns, reading that column
+ * slice from the fewest fragments possible. Nothing is written to src.
+ * @param src The directory containing the coding, data and spec files
+ * @param offset The offset of the range in the original file
+ * @param length The length of the range
+ * @param buf The length bytes to read the range into, or REPAIR_SLICE_SIZE bytes to read each window into if outFd is set
+ * @param outFd The file each window is written to at its current position, or -1 to keep the range in buf
+ * @param spec An empty spec struct to read the spec file into
+ * @param opts The decoding options, or NULL for the defaults
+ * @return 0 if successful, otherwise -1
+ */
+static int read_range_windows(char *src, size_t offset, size_t length, char *buf, int outFd,
+		struct crs_encoding_spec *spec, struct crs_options *opts) {
+
+	int res, i, row, pathLen, nrErasures;
+	size_t done, piece, got, column, lo, hi, spanLo, spanHi, windowStart, windowEnd, blockSize, fileSize;
+	ssize_t nrRead;
+	uint64_t start;
+	char *filePath;
+	char *window;
+	char **rows;
+	int *present;
+	int *erasures;
+	int *fds;
+	struct crs_options windowOpts;
+	struct crs_arena localArena;
+	struct crs_arena *arena;
+
+	start = stats_start();
+	res = read_fragment_spec(src, spec);
+	stats_stop(PHASE_SPEC, start);
+	if (res < 0) {
+		fprintf(stderr, "Could not read spec file\n%s", strerror(errno));
+		return -1;
+	}
+	fileSize = (size_t) spec->k * spec->width - spec->endPadding;
+	if (offset > fileSize || length > fileSize - offset) {
+		fprintf(stderr, "Range beyond the end of the file (%lu bytes)\n", (unsigned long) fileSize);
+		free_spec(spec);
+		return -1;
+	}
+
+	pathLen = strlen(src) + MAX_FILENAME_LENGTH + 2;
+	filePath = (char *) calloc(pathLen, sizeof(char));
+	present = (int *) calloc(spec->k + spec->m, sizeof(int));
+	erasures = (int *) malloc((spec->k + spec->m + 1) * sizeof(int));
+	rows = (char **) calloc(spec->k + spec->m, sizeof(char *));
+	fds = (int *) malloc(spec->k * sizeof(int));
+	if (filePath == NULL || present == NULL || erasures == NULL || rows == NULL || fds == NULL
+			|| find_intact_files(src, spec, opts, present) < 0) {
+		free_spec(spec);
+		free(filePath);
+		free(present);
+		free(erasures);
+		free(rows);
+		free(fds);
+		return -1;
+	}
+	for (i = 0; i < spec->k; i++) {
+		fds[i] = -1;
+	}
+	nrErasures = data_erasures(spec, present, erasures);
+
+	/* Every window decodes with the same arena and thread pool */
+	if (opts == NULL) {
+		init_options(&windowOpts);
+	} else {
+		windowOpts = *opts;
+	}
+	arena = windowOpts.arena;
+	if (arena == NULL) {
+		arena_init(&localArena);
+		arena = &localArena;
+	}
+	if (windowOpts.pool == NULL && windowOpts.threads > 1) {
+		windowOpts.pool = thread_pool_create(windowOpts.threads);
+		if (windowOpts.pool == NULL) {
+			fprintf(stderr, "Could not create thread pool\n%s\n", strerror(errno));
+			res = -1;
+		}
+	}
+
+	blockSize = (size_t) spec->w * spec->packetsize;
+	for (windowStart = 0; windowStart < length && res == 0; windowStart = windowEnd) {
+		/* Columns of the missing rows the window covers */
+		lo = spec->width;
+		hi = 0;
+		for (done = windowStart; done < length && done - windowStart < REPAIR_SLICE_SIZE; done += piece) {
+			piece = locate_byte(spec, offset + done, &row, &column);
+			piece = (piece < length - done) ? piece : length - done;
+			piece = (piece < REPAIR_SLICE_SIZE - (done - windowStart)) ? piece : REPAIR_SLICE_SIZE - (done - windowStart);
+			if (present[row] == 0) {
+				spanLo = (column < lo) ? column : lo;
+				spanHi = (column + piece > hi) ? column + piece : hi;
+				if (done > windowStart && spanHi - spanLo > REPAIR_SLICE_SIZE) {
+					break;
+				}
+				lo = spanLo;
+				hi = spanHi;
 			}
-			break;
-		case 'm':
-			res = str2int(optarg, &(spec.m));
-			if (res < 0 || spec.m <= 0 || spec.m > MAX_M) {
-				print_usage(argv[0]);
-				return -1;
+		}
+		windowEnd = done;
+		window = (outFd < 0) ? buf + windowStart : buf;
+
+		/* Decode only the blocks spanning those columns */
+		if (hi > lo) {
+			lo -= lo % blockSize;
+			hi += (blockSize - hi % blockSize) % blockSize;
+			stats_set_erasures(nrErasures);
+			if (nrErasures < 0) {
+				fprintf(stderr, "Could not create decoding schedule (too many erasures?)\n");
+				res = -1;
+				break;
 			}
-			break;
-		case '?':
-			print_usage(argv[0]);
-			return -1;
-		default:
-			return -1;
-			break;
+			res = rebuild_rows(src, spec, &windowOpts, arena, present, erasures, rows, lo, hi - lo);
+		}
+
+		start = stats_start();
+		for (done = windowStart; done < windowEnd && res == 0; done += piece) {
+			piece = locate_byte(spec, offset + done, &row, &column);
+			piece = (piece < windowEnd - done) ? piece : windowEnd - done;
+			if (present[row] == 0) {
+				memcpy(window + (done - windowStart), rows[row] + (column - lo), piece);
+				continue;
+			}
+			if (fds[row] < 0) {
+				snprintf(filePath, pathLen, "%s/d%d", src, row + 1);
+				fds[row] = open(filePath, O_RDONLY);
+				if (fds[row] < 0) {
+					fprintf(stderr, "Could not open fragment: %s\n%s\n", filePath, strerror(errno));
+					res = -1;
+					break;
+				}
+			}
+			for (got = 0; got < piece; got += nrRead) {
+				nrRead = pread(fds[row], window + (done - windowStart) + got, piece - got, (off_t) (column + got));
+				if (nrRead < 0 && errno == EINTR) {
+					nrRead = 0;
+					continue;
+				}
+				if (nrRead < 0) {
+					fprintf(stderr, "Could not read fragment: %s/d%d\n%s\n", src, row + 1, strerror(errno));
+					res = -1;
+					break;
+				}
+				if (nrRead == 0) {
+					if (column + got < fragment_size(spec, row)) {
+						fprintf(stderr, "Fragment is truncated: %s/d%d\n", src, row + 1);
+						res = -1;
+						break;
+					}
+					/* Past the end of a trimmed data file, the rest is padding */
+					memset(window + (done - windowStart) + got, 0, piece - got);
+					break;
+				}
+				stats_add_bytes(nrRead, 0);
+			}
+		}
+		stats_stop(PHASE_READ, start);
+
+		if (res == 0 && outFd >= 0) {
+			start = stats_start();
+			res = write_fd_bytes(outFd, window, windowEnd - windowStart, -1);
+			stats_stop(PHASE_WRITE, start);
+			stats_add_bytes(0, (res == 0) ? windowEnd - windowStart : 0);
+			if (res < 0) {
+				fprintf(stderr, "Could not write range\n%s\n", strerror(errno));
+			}
+		}
+	}
+
+	for (i = 0; i < spec->k; i++) {
+		if (fds[i] >= 0) {
+			close(fds[i]);
 		}
+	}
+	if (windowOpts.pool != NULL && (opts == NULL || windowOpts.pool != opts->pool)) {
+		thread_pool_destroy(windowOpts.pool);
+	}
+	if (arena == &localArena) {
+		arena_free(&localArena);
+	}
+	free_spec(spec);
+	free(filePath);
+	free(present);
+	free(erasures);
+	free(rows);
+	free(fds);
+	return res;
+}
 
-	for (i = optind; i < argc; i++) {
-		if (i == optind) {
-			src = argv[i];
-		} else if (i == optind + 1) {
-			dest = argv[i];
-		} else {
-			print_usage(argv[0]);
-			return -1;
-		}
-	}
+/**
+ * Reads length bytes of the original file, starting at offset, from the fragments in the src directory. Present data
+ * rows are read directly, missing ones are decoded window by window over only the blocks spanning the requested
+ * columns, reading that column slice from the fewest fragments possible. Nothing is written to src.
+ * @param src The directory containing the coding, data and spec files
+ * @param offset The offset of the range in the original file
+ * @param length The length of the range
+ * @param buf The length bytes to read the range into
+ * @param spec An empty spec struct to read the spec file into
+ * @param opts The decoding options, or NULL for the defaults
+ * @return 0 if successful, otherwise -1
+ */
+int read_range(char *src, size_t offset, size_t length, char *buf, struct crs_encoding_spec *spec,
+		struct crs_options *opts) {
+	return read_range_windows(src, offset, length, buf, -1, spec, opts);
+}
 
-	switch (mode) {
-	case 0:
-		if (src == NULL) {
-			print_usage(argv[0]);
-			res = -1;
-		} else {
-			res = decode(src, &spec);
-		}
-		break;
-	case 1:
-		if (src == NULL || dest == NULL) {
-			print_usage(argv[0]);
-			res = -1;
-		} else {
-			res = encode(src, dest, &spec);
-		}
-		break;
-	default:
-		print_usage(argv[0]);
-		res = -1;
-		break;
+/**
+ * Writes length bytes of the original file, starting at offset, to out (see read_range). The range is streamed through
+ * a buffer of at most REPAIR_SLICE_SIZE bytes, each window written as soon as it is read.
+ * @param src The directory containing the coding, data and spec files
+ * @param out The file to write the range to, or - for stdout
+ * @param offset The offset of the range in the original file
+ * @param length The length of the range
+ * @param spec An empty spec struct to read the spec file into
+ * @param opts The decoding options, or NULL for the defaults
+ * @return 0 if successful, otherwise -1
+ */
+int reconstruct_range(char *src, char *out, size_t offset, size_t length, struct crs_encoding_spec *spec,
+		struct crs_options *opts) {
+	int res, outFd;
+	char *buf;
+
+	buf = (char *) malloc((length < REPAIR_SLICE_SIZE) ? length + 1 : REPAIR_SLICE_SIZE);
+	if (buf == NULL) {
+		fprintf(stderr, "Could not allocate range buffer\n%s\n", strerror(errno));
+		return -1;
 	}
-	if (res == 0) {
-		printf("Done!\n");
+	outFd = (strcmp(out, "-") == 0) ? STDOUT_FILENO : open(out, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (outFd < 0) {
+		fprintf(stderr, "Could not open range output: %s\n%s\n", out, strerror(errno));
+		free(buf);
+		return -1;
+	}
+	res = read_range_windows(src, offset, length, buf, outFd, spec, opts);
+	if (outFd != STDOUT_FILENO && close(outFd) < 0 && res == 0) {
+		fprintf(stderr, "Could not write range: %s\n%s\n", out, strerror(errno));
+		res = -1;
 	}
+	free(buf);
 	return res;
 }
 
 /**
- * Encodes the file at src to dest directory. Also writes the spec to a file in dest. Spec k and m values must be
- * initialised, The rest will be filled.
- * @param src The file to encode
- * @param dest The directory to create and fill with the data, coding and spec files.
- * @param spec The spec (k and m) to be used in encoding
+ * XORs the change of a coding row into its fragment and patches its checksum. Only the runs of changed bytes are read
+ * and written, runs less than UPDATE_MERGE_GAP bytes apart being merged: a coding byte only depends on the data bytes
+ * at the same offset in their packet, so a small update changes a few short runs of each coding block.
+ * @param fd The coding fragment, open for reading and writing
+ * @param change The change of the coding row over the columns [offset, offset + size)
+ * @param buf A buffer of size bytes
+ * @param offset The offset of the columns in the fragment
+ * @param size The number of columns
+ * @param spec The encoding specification
+ * @param row The coding row index (k = c1, ..., k+m-1 = cm)
  * @return 0 if successful, otherwise -1
  */
-int encode(char *src, char *dest, struct crs_encoding_spec *spec) {
+static int apply_coding_change(int fd, char *change, char *buf, size_t offset, size_t size,
+		struct crs_encoding_spec *spec, int row) {
 
 	int res = 0;
-	size_t fileSize;
-	char **data = NULL;
-	char **coding = NULL;
-	int *matrix;
-	int **schedule;
+	size_t i, runStart, runEnd;
+	uint64_t start;
 
-	/* Check args are reasonable */
-	if (spec->k <= 0 || spec->k >= 9999 || spec->m <= 0 || spec->m > spec->k) {
-		fprintf(stderr, "Error: Unsuitable arguments used for crs_encode.encode\n");
-		return -1;
+	for (runStart = 0; runStart < size && res == 0; runStart = runEnd) {
+		while (runStart < size && change[runStart] == 0) {
+			runStart++;
+		}
+		if (runStart == size) {
+			break;
+		}
+		runEnd = runStart + 1;
+		for (i = runEnd; i < size && i - runEnd < UPDATE_MERGE_GAP; i++) {
+			if (change[i] != 0) {
+				runEnd = i + 1;
+			}
+		}
+
+		start = stats_start();
+		res = (pread(fd, buf, runEnd - runStart, (off_t) (offset + runStart)) == (ssize_t) (runEnd - runStart)) ? 0 : -1;
+		stats_stop(PHASE_READ, start);
+		if (res < 0) {
+			break;
+		}
+		stats_add_bytes(runEnd - runStart, 0);
+		for (i = 0; i < runEnd - runStart; i++) {
+			buf[i] ^= change[runStart + i];
+		}
+		start = stats_start();
+		res = write_fd_bytes(fd, buf, runEnd - runStart, (off_t) (offset + runStart));
+		stats_stop(PHASE_WRITE, start);
+		if (res == 0) {
+			stats_add_bytes(0, runEnd - runStart);
+			if (spec->checksums != NULL) {
+				spec->checksums[row] = crc32c_patch(spec->checksums[row], fragment_size(spec, row), offset + runStart,
+						change + runStart, runEnd - runStart);
+			}
+		}
 	}
+	return res;
+}
 
-	/* Calculate encoding specs */
-	res = get_file_size(src, &fileSize);
+/**
+ * Replaces length bytes of the original file, starting at offset, with buf in the fragments of the src directory
+ * without encoding the file again. The coding is linear, so each coding row changes by the encoding of the change to
+ * the data rows: the old bytes are read from the data fragment and the new ones written over them, and the encoded XOR
+ * of the two is XORed into the bytes it changes in the blocks spanning the same columns of every coding fragment. A
+ * coding byte only depends on the data bytes at the same offset in their packet, so about (1 + m) * length bytes are
+ * written with the rs8 engine and (1 + m * w) * length bytes with the crs engine, whose coding packets each combine
+ * several data packets. The checksums in the spec are patched rather than recomputed. Every fragment must be present,
+ * the range can not extend the file and the spec's coding matrix must be the one the engine encodes with.
+ * Each piece of the range is written to its data fragment before the coding fragments are patched, and the spec is only
+ * replaced (atomically) once every fragment has been synced. An update interrupted before that leaves the old checksums
+ * in the spec, so --verify reports the fragments it changed as corrupt; as long as at most m of them were, decoding
+ * with --verify brings them back to their old contents, after which the update can be run again.
+ * @param src The directory containing the coding, data and spec files
+ * @param offset The offset of the range in the original file
+ * @param length The length of the range
+ * @param buf The length new bytes of the range
+ * @param spec An empty spec struct to read the spec file into
+ * @param opts The options (threads and verify), or NULL for the defaults
+ * @return 0 if successful, otherwise -1
+ */
+int update_range(char *src, size_t offset, size_t length, char *buf, struct crs_encoding_spec *spec,
+		struct crs_options *opts) {
+	int res, i, j, row;
+	int pathLen;
+	int changed = 0;
+	size_t done, piece, column, lo, hi, blockSize, fileSize;
+	uint64_t start;
+	char *filePath;
+	char **rows;
+	char *delta;
+	int *present;
+	int *fds;
+	struct crs_thread_pool *pool = NULL;
+	struct crs_arena localArena;
+	struct crs_arena *arena;
+
+	start = stats_start();
+	res = read_fragment_spec(src, spec);
+	stats_stop(PHASE_SPEC, start);
 	if (res < 0) {
-		fprintf(stderr, "Could get size of file: %s\n%s\n", src, strerror(errno));
+		fprintf(stderr, "Could not read spec file\n%s", strerror(errno));
 		return -1;
 	}
-	res = fill_encoding_spec(spec, fileSize);
-	if (res < 0) {
-		fprintf(stderr, "Error: Could not calculate encoding specs\n");
+	fileSize = (size_t) spec->k * spec->width - spec->endPadding;
+	if (offset > fileSize || length > fileSize - offset) {
+		fprintf(stderr, "Range beyond the end of the file (%lu bytes)\n", (unsigned long) fileSize);
+		free_spec(spec);
 		return -1;
 	}
 
-	/* Read data from file */
-	data = file2data_matrix(src, spec);
-	if (data == NULL) {
-		fprintf(stderr, "Could not create data matrix from input file\n%s\n", strerror(errno));
+	pathLen = strlen(src) + MAX_FILENAME_LENGTH + 2;
+	filePath = (char *) calloc(pathLen, sizeof(char));
+	present = (int *) calloc(spec->k + spec->m, sizeof(int));
+	fds = (int *) malloc((spec->k + spec->m) * sizeof(int));
+	if (filePath == NULL || present == NULL || fds == NULL || find_intact_files(src, spec, opts, present) < 0) {
+		free_spec(spec);
+		free(filePath);
+		free(present);
+		free(fds);
 		return -1;
 	}
 
-	/* Alloc coding matrix */
-	coding = calloc_matrix(spec->m, spec->width);
-	if (coding == NULL) {
-		fprintf(stderr, "Could not create coding matrix\n%s\n", strerror(errno));
-		matrix_free(data, spec->k);
-		return -1;
+	for (i = 0; i < spec->k + spec->m; i++) {
+		fds[i] = -1;
+	}
+	for (i = 0; i < spec->k + spec->m && res == 0; i++) {
+		if (i < spec->k) {
+			snprintf(filePath, pathLen, "%s/d%d", src, i + 1);
+		} else {
+			snprintf(filePath, pathLen, "%s/c%d", src, i - spec->k + 1);
+		}
+		/* A missing fragment would be rebuilt from the old contents of the others */
+		if (present[i] == 0) {
+			fprintf(stderr, "Could not update, missing or corrupt fragment: %s (decode first)\n", filePath);
+			res = -1;
+			break;
+		}
+		fds[i] = open(filePath, O_RDWR);
+		if (fds[i] < 0) {
+			fprintf(stderr, "Could not open fragment: %s\n%s\n", filePath, strerror(errno));
+			res = -1;
+		}
 	}
 
-	/* Create bitmatrix */
-	matrix = cauchy_good_general_coding_matrix(spec->k, spec->m, spec->w);
-	if (matrix == NULL) {
-		fprintf(stderr, "Could not create cauchy matrix\n%s\n", strerror(errno));
-		matrix_free(data, spec->k);
-		matrix_free(coding, spec->m);
-		return -1;
+	if (res == 0 && opts != NULL && opts->pool != NULL) {
+		pool = opts->pool;
+	} else if (res == 0 && opts != NULL && opts->threads > 1) {
+		pool = thread_pool_create(opts->threads);
+		if (pool == NULL) {
+			fprintf(stderr, "Could not create thread pool\n%s\n", strerror(errno));
+			res = -1;
+		}
 	}
-	spec->bitmatrix = jerasure_matrix_to_bitmatrix(spec->k, spec->m, spec->w, matrix);
-	if (spec->bitmatrix == NULL) {
-		fprintf(stderr, "Could not create bitmatrix\n%s\n", strerror(errno));
-		free(matrix);
-		matrix_free(data, spec->k);
-		matrix_free(coding, spec->m);
-		return -1;
+	arena = (opts == NULL) ? NULL : opts->arena;
+	if (arena == NULL) {
+		arena_init(&localArena);
+		arena = &localArena;
 	}
-	free(matrix);
 
-	/* Encode using schedule */
-	schedule = jerasure_smart_bitmatrix_to_schedule(spec->k, spec->m, spec->w, spec->bitmatrix);
-	if (schedule == NULL) {
-		fprintf(stderr, "Could not create schedule from bitmatrix\n%s\n", strerror(errno));
-		free(spec->bitmatrix);
-		matrix_free(data, spec->k);
-		matrix_free(coding, spec->m);
-		return -1;
+	/* Each piece of the range lies in one data row, it is applied over the blocks spanning its columns */
+	blockSize = (size_t) spec->w * spec->packetsize;
+	for (done = 0; done < length && res == 0; done += piece) {
+		piece = locate_byte(spec, offset + done, &row, &column);
+		piece = (piece < length - done) ? piece : length - done;
+		piece = (piece < REPAIR_SLICE_SIZE) ? piece : REPAIR_SLICE_SIZE;
+		lo = column - column % blockSize;
+		hi = column + piece + (blockSize - (column + piece) % blockSize) % blockSize;
+		hi = (hi < spec->width) ? hi : spec->width;
+
+		/* The k data rows hold the change (zero outside the piece), the m coding rows its encoding, the last row the
+		 * old coding bytes */
+		rows = arena_matrix(arena, spec->k + spec->m + 1, hi - lo);
+		if (rows == NULL) {
+			fprintf(stderr, "Could not create data and coding matrices\n%s\n", strerror(errno));
+			res = -1;
+			break;
+		}
+		for (i = 0; i < spec->k; i++) {
+			memset(rows[i], 0, hi - lo);
+		}
+		delta = rows[row] + (column - lo);
+
+		start = stats_start();
+		res = (pread(fds[row], delta, piece, (off_t) column) == (ssize_t) piece) ? 0 : -1;
+		stats_stop(PHASE_READ, start);
+		if (res < 0) {
+			fprintf(stderr, "Could not read data fragment %d\n%s\n", row + 1, strerror(errno));
+			break;
+		}
+		stats_add_bytes(piece, 0);
+		for (j = 0; (size_t) j < piece; j++) {
+			delta[j] ^= buf[done + j];
+		}
+
+		/* Encoded before anything is written, so a spec the engine can not code with is refused untouched */
+		res = engine_encode(spec, rows, rows + spec->k, hi - lo, pool);
+		if (res < 0 && errno == EINVAL) {
+			fprintf(stderr, "Could not update, the spec's coding matrix is not the one encoding uses\n");
+			break;
+		}
+		if (res < 0) {
+			fprintf(stderr, "Could not encode\n%s\n", strerror(errno));
+			break;
+		}
+
+		start = stats_start();
+		changed = 1;
+		res = write_fd_bytes(fds[row], buf + done, piece, (off_t) column);
+		stats_stop(PHASE_WRITE, start);
+		if (res < 0) {
+			fprintf(stderr, "Could not write data fragment %d\n%s\n", row + 1, strerror(errno));
+			break;
+		}
+		stats_add_bytes(0, piece);
+		if (spec->checksums != NULL) {
+			spec->checksums[row] = crc32c_patch(spec->checksums[row], fragment_size(spec, row), column, delta, piece);
+		}
+
+		for (i = spec->k; i < spec->k + spec->m && res == 0; i++) {
+			res = apply_coding_change(fds[i], rows[i], rows[spec->k + spec->m], lo, hi - lo, spec, i);
+			if (res < 0) {
+				fprintf(stderr, "Could not update coding fragment %d\n%s\n", i - spec->k + 1, strerror(errno));
+			}
+		}
 	}
-	jerasure_schedule_encode(spec->k, spec->m, spec->w, schedule, data, coding, spec->width, (spec->width / spec->w));
-	jerasure_free_schedule(schedule);
 
-	res = write_files(data, coding, spec, dest);
-	if (res < 0) {
-		fprintf(stderr, "Could not write encoded files\n%s", strerror(errno));
+	/* The fragments must be on disk before the spec vouches for them, otherwise the old spec is kept */
+	for (i = 0; i < spec->k + spec->m && changed; i++) {
+		start = stats_start();
+		if (fds[i] >= 0 && fdatasync(fds[i]) < 0) {
+			fprintf(stderr, "Could not sync the fragments\n%s\n", strerror(errno));
+			res = -1;
+			changed = 0;
+		}
+		stats_stop(PHASE_WRITE, start);
 	}
 
-	free(spec->bitmatrix);
-	matrix_free(data, spec->k);
-	matrix_free(coding, spec->m);
+	/* The checksums are patched as far as the fragments were written, even if a later piece failed */
+	if (spec->checksums != NULL && changed) {
+		start = stats_start();
+		if (write_fragment_spec(src, spec) < 0) {
+			fprintf(stderr, "Could not write spec file\n%s\n", strerror(errno));
+			res = -1;
+		}
+		stats_stop(PHASE_SPEC, start);
+	}
 
+	for (i = 0; i < spec->k + spec->m; i++) {
+		if (fds[i] >= 0 && close(fds[i]) < 0) {
+			res = -1;
+		}
+	}
+	if (pool != NULL && pool != opts->pool) {
+		thread_pool_destroy(pool);
+	}
+	if (arena == &localArena) {
+		arena_free(&localArena);
+	}
+	free_spec(spec);
+	free(filePath);
+	free(present);
+	free(fds);
 	return res;
 }
 
 /**
- * Decodes (repairs) the file set in the src directory using the specified spec.
- * @param src The directory containing the coding, data and spec files.
- * @param spec An empty spec struct to read the spec file into.
+ * Replaces the bytes of the original file starting at offset with the contents of src in the fragments of the dest
+ * directory (see update_range).
+ * @param src The file holding the new bytes, or - for stdin
+ * @param dest The directory containing the coding, data and spec files
+ * @param offset The offset in the original file of the first byte replaced
+ * @param spec An empty spec struct to read the spec file into
+ * @param opts The options (threads and verify), or NULL for the defaults
  * @return 0 if successful, otherwise -1
  */
-int decode(char *src, struct crs_encoding_spec *spec) {
-	int res, i, j;
-	char *filePath;
-	char **data;
-	char **coding;
-	int *present;
-	int *erasures;
-
-	int pathLen = strlen(src) + MAX_FILENAME_LENGTH + 2;
-	filePath = (char *) calloc(pathLen, sizeof(char));
+int update(char *src, char *dest, size_t offset, struct crs_encoding_spec *spec, struct crs_options *opts) {
+	int res;
+	size_t length;
+	char *buf;
+	uint64_t start;
 
-	/* Read spec file */
-	snprintf(filePath, pathLen, "%s/spec", src);
-	res = read_spec(filePath, spec);
-	free(filePath);
+	start = stats_start();
+	res = read_binary_bytes(src, &buf, &length);
+	stats_stop(PHASE_READ, start);
 	if (res < 0) {
-		fprintf(stderr, "Could not read spec file\n%s", strerror(errno));
+		fprintf(stderr, "Could not read the new bytes: %s\n%s\n", src, strerror(errno));
 		return -1;
 	}
+	stats_add_bytes(length, 0);
+	res = update_range(dest, offset, length, buf, spec, opts);
+	free(buf);
+	return res;
+}
 
-	present = (int *) calloc(spec->k, sizeof(int));
-	if (present == NULL) {
-		free(spec->bitmatrix);
-		return -1;
-	}
-	erasures = (int *) malloc((spec->k + spec->m + 1) * sizeof(int));
-	if (erasures == NULL) {
-		free(spec->bitmatrix);
-		free(present);
+/**
+ * Reads the column slice [offset, offset + size) of the fragments the decoding of the erasures needs and rebuilds the
+ * slice of the erased rows with the engine of the spec. The slice must be made of whole blocks (w * packetsize bytes).
+ * Rows of size bytes are carved from the arena only for the fragments read and rebuilt (see decoding_rows), the other
+ * row pointers are left NULL.
+ * @param src The directory containing the data and coding files
+ * @param spec The encoding specification
+ * @param opts The decoding options, or NULL for the defaults
+ * @param arena The arena to carve the rows from
+ * @param present The k + m flags of the files found by find_files
+ * @param erasures A -1 terminated array of at most m erased row indices
+ * @param rows The k data row pointers followed by the m coding row pointers, to fill
+ * @param offset The offset of the slice in the fragments
+ * @param size The size of the slice
+ * @return 0 if successful, otherwise -1
+ */
+int rebuild_rows(char *src, struct crs_encoding_spec *spec, struct crs_options *opts, struct crs_arena *arena,
+		int *present, int *erasures, char **rows, size_t offset, size_t size) {
+	int res, i, j, nrUsed;
+	int *needed;
+	char **used;
+	uint64_t start;
+	struct crs_thread_pool *pool = NULL;
+
+	needed = (int *) calloc(spec->k + spec->m, sizeof(int));
+	if (needed == NULL) {
 		return -1;
 	}
-
-	data = read_files(src, spec->k, spec->width, 'd', present);
-	if (data == NULL) {
-		free(spec->bitmatrix);
-		free(present);
-		free(erasures);
+	nrUsed = decoding_rows(spec->k, spec->m, erasures, needed);
+	used = arena_matrix(arena, nrUsed, size);
+	if (used == NULL) {
+		fprintf(stderr, "Could not create data and coding matrices\n%s\n", strerror(errno));
+		free(needed);
 		return -1;
 	}
 	j = 0;
-	for (i = 0; i < spec->k; i++) {
-		if (present[i] == 0) {
-			/* Erased */
-			erasures[j] = i;
+	for (i = 0; i < spec->k + spec->m; i++) {
+		rows[i] = NULL;
+		if (needed[i]) {
+			rows[i] = used[j];
 			j++;
-		} else {
-			/* Reset */
-			present[i] = 0;
 		}
 	}
+	free(needed);
 
-	coding = read_files(src, spec->m, spec->width, 'c', present);
-	if (coding == NULL) {
-		free(spec->bitmatrix);
-		free(present);
-		free(erasures);
-		matrix_free(data, spec->k);
-		return -1;
-	}
-	for (i = 0; i < spec->m; i++) {
-		if (present[i] == 0) {
-			/* Erased */
-			erasures[j] = i + spec->k;
-			j++;
+	start = stats_start();
+	res = read_file_slices(src, spec, present, rows, offset, size, NULL);
+	stats_stop(PHASE_READ, start);
+	for (i = 0; i < spec->k + spec->m; i++) {
+		if (rows[i] != NULL && present[i]) {
+			stats_add_bytes(size, 0);
 		}
 	}
-	erasures[j] = -1;
-	free(present);
-
-	if (erasures[0] == -1) {
-		fprintf(stdout, "Nothing to do!\n");
-	} else {
-		res = jerasure_schedule_decode_lazy(spec->k, spec->m, spec->w, spec->bitmatrix, erasures, data, coding, spec->width, (spec->width / spec->w),
-				1);
+	if (res < 0) {
+		fprintf(stderr, "Could not read fragments\n%s\n", strerror(errno));
+		return -1;
+	}
 
-		if (res == 0) {
-			fprintf(stdout, "Repairing files...\n");
-			res = repair_files(src, data, coding, spec, erasures);
+	if (opts != NULL && opts->pool != NULL) {
+		pool = opts->pool;
+	} else if (opts != NULL && opts->threads > 1) {
+		pool = thread_pool_create(opts->threads);
+		if (pool == NULL) {
+			fprintf(stderr, "Could not create thread pool\n%s\n", strerror(errno));
+			return -1;
 		}
 	}
 
-	free(spec->bitmatrix);
-	free(erasures);
-	matrix_free(data, spec->k);
-	matrix_free(coding, spec->m);
+	/* The CRS engine runs one cached schedule per erasure pattern, shared by every thread */
+	res = engine_decode(spec, erasures, rows, rows + spec->k, size, pool);
+	if (pool != NULL && pool != opts->pool) {
+		thread_pool_destroy(pool);
+	}
+	if (res < 0) {
+		fprintf(stderr, "Could not decode\n%s\n", strerror(errno));
+	}
 	return res;
 }
 
 /**
- * Calculates the encoding specifications from the size of the file to be encoded.
+ * Calculates the encoding specifications from the size of the file to be encoded. If spec->packetsize is set the
+ * width is a whole number of blocks of w * packetsize bytes, the packet size being reduced if the padding would
+ * otherwise spill past the last data file. If it is not set, or no packet size keeps the padding in the last data file,
+ * the whole width is coded as one block.
  * @param spec The spec struct to fill
  * @param filesize The size of the file to encode
  * @return 0 if successful, otherwise -1
  */
 int fill_encoding_spec(struct crs_encoding_spec *spec, size_t filesize) {
 
-	int res;
+	int res, packetsize;
+	size_t blockSize;
+
+	if (spec->packetsize > 0) {
+		/* Word size only depends on k + m as the width is chosen to be divisible by it */
+		spec->w = min_word_size(spec->k, spec->m);
+		if (spec->w > 32 || spec->packetsize % sizeof(long) != 0) {
+			return -1;
+		}
+
+		/* Width is a whole number of blocks, as long as the padding stays within the last data file. Smaller packets
+		 * are tried before giving up on blocks, a width in [filesize / k, filesize / (k - 1)) keeping it there */
+		for (packetsize = spec->packetsize; packetsize > 0; packetsize -= sizeof(long)) {
+			blockSize = (size_t) spec->w * packetsize;
+			spec->width = ((filesize + spec->k - 1) / spec->k + blockSize - 1) / blockSize * blockSize;
+			spec->endPadding = spec->k * spec->width - filesize;
+			if (spec->width > 0 && spec->endPadding < spec->width) {
+				spec->packetsize = packetsize;
+				spec->stripeWidth = 0;
+				return 0;
+			}
+		}
+	}
 
 	/* Set endPadding and set width */
 	res = calc_padding(filesize, spec);
@@ -306,9 +1856,219 @@ int fill_encoding_spec(struct crs_encoding_spec *spec, size_t filesize) {
 	if (res < 0) {
 		return -1;
 	}
+
+	/* The whole width is coded as a single block */
+	spec->packetsize = spec->width / spec->w;
+	spec->stripeWidth = 0;
+	return 0;
+}
+
+/**
+ * Calculates the encoding specifications for a striped encoding of a file, where each stripe of the file is split over
+ * the k data files and the data and coding buffers for one stripe fit within stripeBudget bytes.
+ * @param spec The spec struct to fill
+ * @param filesize The size of the file to encode
+ * @param stripeBudget The maximum number of bytes of data and coding buffers for one stripe
+ * @return 0 if successful, otherwise -1
+ */
+int fill_striped_encoding_spec(struct crs_encoding_spec *spec, size_t filesize, size_t stripeBudget) {
+
+	size_t blockSize;
+	size_t rowSize;
+	size_t nrStripes;
+
+	/* Word size only depends on k + m as the stripe width is chosen to be divisible by it */
+	spec->w = min_word_size(spec->k, spec->m);
+	if (spec->w > 32 || spec->packetsize % sizeof(long) != 0) {
+		return -1;
+	}
+
+	/* Stripe width is the largest number of blocks within the budget, but no wider than the file needs */
+	blockSize = spec->w * ((spec->packetsize > 0) ? spec->packetsize : sizeof(long));
+	rowSize = ((filesize + spec->k - 1) / spec->k + blockSize - 1) / blockSize * blockSize;
+	rowSize = (rowSize > 0) ? rowSize : blockSize;
+	spec->stripeWidth = stripeBudget / (spec->k + spec->m);
+	spec->stripeWidth -= spec->stripeWidth % blockSize;
+	if (spec->stripeWidth > rowSize) {
+		spec->stripeWidth = rowSize;
+	}
+	if (spec->stripeWidth > INT_MAX - (INT_MAX % blockSize)) {
+		spec->stripeWidth = INT_MAX - (INT_MAX % blockSize);
+	}
+	if (spec->stripeWidth == 0) {
+		return -1;
+	}
+	if (spec->packetsize == 0) {
+		spec->packetsize = spec->stripeWidth / spec->w;
+	}
+
+	/* A file filling its last stripe exactly gets no empty stripe after it (a stream adds one, see encode_stream) */
+	nrStripes = (filesize + spec->k * spec->stripeWidth - 1) / (spec->k * spec->stripeWidth);
+	nrStripes = (nrStripes > 0) ? nrStripes : 1;
+	spec->width = nrStripes * spec->stripeWidth;
+	spec->endPadding = spec->k * spec->width - filesize;
 	return 0;
 }
 
+/**
+ * Chooses the packet size for an encode when none was requested. The packet size is sized to the cache (or measured
+ * with autotune_packetsize, for the crs engine only), then reduced if needed so that the rows split between the
+ * threads and a block fits within the stripe budget.
+ * @param spec The spec with k, m and engine filled
+ * @param filesize The size of the file to encode
+ * @param opts The encoding options
+ * @return The packet size, or -1 if unsuccessful
+ */
+int choose_packetsize(struct crs_encoding_spec *spec, size_t filesize, struct crs_options *opts) {
+	int w = min_word_size(spec->k, spec->m);
+	int packetsize;
+	int limit;
+
+	if (w > 32) {
+		return -1;
+	}
+
+	if (opts->autotune && spec->engine == ENGINE_RS8) {
+		/* The GF(2^8) multiply walks whole rows, its speed does not depend on the packet size */
+		fprintf(stderr, "Warning: The rs8 engine does not use the packet size, auto-tuning skipped\n");
+		packetsize = calc_cache_packetsize(spec->k, spec->m, w);
+	} else if (opts->autotune) {
+		packetsize = autotune_packetsize(spec->k, spec->m, w);
+		if (packetsize < 0) {
+			return -1;
+		}
+		fprintf(stdout, "Auto-tuned packet size: %d bytes\n", packetsize);
+	} else {
+		packetsize = calc_cache_packetsize(spec->k, spec->m, w);
+	}
+
+	if (opts->threads > 1) {
+		limit = calc_parallel_packetsize(spec, filesize, opts->stripeBudget, opts->threads);
+		if (limit > 0 && limit < packetsize) {
+			packetsize = (limit < MIN_PACKETSIZE) ? MIN_PACKETSIZE : limit;
+		}
+	}
+	if (opts->stripeBudget > 0 && opts->stripeBudget / (spec->k + spec->m) / w < (size_t) packetsize) {
+		packetsize = opts->stripeBudget / (spec->k + spec->m) / w;
+		packetsize -= packetsize % sizeof(long);
+	}
+	return packetsize;
+}
+
+/**
+ * Calculates a packet size for which one block of every data and coding row (the data each pass of the schedule
+ * touches) fits in half of the L2 cache.
+ * @param k The number of data files
+ * @param m The number of coding files
+ * @param w The word size
+ * @return The packet size, between MIN_PACKETSIZE and MAX_PACKETSIZE
+ */
+int calc_cache_packetsize(int k, int m, int w) {
+	size_t packetsize = cache_size() / 2 / ((size_t) (k + m) * w);
+
+	packetsize -= packetsize % sizeof(long);
+	if (packetsize < MIN_PACKETSIZE) {
+		return MIN_PACKETSIZE;
+	}
+	if (packetsize > MAX_PACKETSIZE) {
+		return MAX_PACKETSIZE;
+	}
+	return (int) packetsize;
+}
+
+/**
+ * Measures the crs engine's encoding throughput of power of two packet sizes between MIN_PACKETSIZE and
+ * MAX_PACKETSIZE on synthetic data and returns the fastest.
+ * @param k The number of data files
+ * @param m The number of coding files
+ * @param w The word size
+ * @return The fastest packet size, or -1 if unsuccessful
+ */
+int autotune_packetsize(int k, int m, int w) {
+	int i, run, packetsize;
+	int best = -1;
+	double elapsed;
+	double bestElapsed = 0;
+	size_t rowSize;
+	char **rows;
+	int *bitmatrix;
+	int **schedule;
+	struct crs_xor_schedule *compiled;
+	struct timespec start, end;
+	struct crs_arena arena;
+
+	/* Rows hold a whole number of blocks of the largest packet size */
+	rowSize = AUTOTUNE_BYTES / (k + m);
+	rowSize -= rowSize % ((size_t) w * MAX_PACKETSIZE);
+	if (rowSize == 0) {
+		rowSize = (size_t) w * MAX_PACKETSIZE;
+	}
+
+	if (get_encoding_schedule(k, m, w, MATRIX_CAUCHY_GOOD, &bitmatrix, &schedule, &compiled) < 0) {
+		return -1;
+	}
+	arena_init(&arena);
+	rows = arena_matrix(&arena, k + m, rowSize);
+	if (rows == NULL) {
+		return -1;
+	}
+	for (i = 0; i < k; i++) {
+		memset(rows[i], i + 1, rowSize);
+	}
+
+	for (packetsize = MIN_PACKETSIZE; packetsize <= MAX_PACKETSIZE; packetsize <<= 1) {
+		for (run = 0; run < AUTOTUNE_RUNS; run++) {
+			clock_gettime(CLOCK_MONOTONIC, &start);
+			parallel_schedule_encode(k, m, w, compiled, rows, rows + k, rowSize, packetsize, NULL);
+			clock_gettime(CLOCK_MONOTONIC, &end);
+			elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+			if (best < 0 || elapsed < bestElapsed) {
+				best = packetsize;
+				bestElapsed = elapsed;
+			}
+		}
+	}
+
+	arena_free(&arena);
+	return best;
+}
+
+/**
+ * @return The size of the L2 cache in bytes, or DEFAULT_CACHE_SIZE if it can not be determined
+ */
+size_t cache_size(void) {
+	long size = -1;
+#ifdef _SC_LEVEL2_CACHE_SIZE
+	size = sysconf(_SC_LEVEL2_CACHE_SIZE);
+#endif
+	return (size > 0) ? (size_t) size : DEFAULT_CACHE_SIZE;
+}
+
+/**
+ * Calculates a packet size which splits each data row (or stripe of it) into enough blocks to share between nrThreads
+ * threads.
+ * @param spec The spec with k and m filled
+ * @param filesize The size of the file to encode
+ * @param stripeBudget The stripe budget, or 0 if the whole file is encoded in memory
+ * @param nrThreads The number of threads encoding
+ * @return The packet size, or 0 if the rows are too small to split
+ */
+int calc_parallel_packetsize(struct crs_encoding_spec *spec, size_t filesize, size_t stripeBudget, int nrThreads) {
+	size_t rowSize = filesize / spec->k;
+	size_t nrBlocks = (size_t) nrThreads * BLOCKS_PER_THREAD;
+	size_t w = min_word_size(spec->k, spec->m);
+	size_t packetsize;
+
+	if (stripeBudget > 0 && stripeBudget / (spec->k + spec->m) < rowSize) {
+		rowSize = stripeBudget / (spec->k + spec->m);
+	}
+
+	/* Rounded up so that nrBlocks blocks cover the row with little padding */
+	packetsize = (rowSize + w * nrBlocks - 1) / (w * nrBlocks);
+	packetsize = (packetsize + sizeof(long) - 1) / sizeof(long) * sizeof(long);
+	return (packetsize > INT_MAX / w) ? 0 : (int) packetsize;
+}
+
 /**
  * Calculates the end padding required to fill out the file data to the required size. Stores this information in the
  * given spec struct.
@@ -344,16 +2104,17 @@ int calc_min_w(struct crs_encoding_spec *spec) {
 }
 
 /**
- * Prints the usage to stdout.
- * @param progName The name of the program binary
+ * Calculates the minimum word size for k + m files, ignoring the width.
+ * @param k The number of data files
+ * @param m The number of coding files
+ * @return The smallest w for which 2^w >= k + m
  */
-void print_usage(char *progName) {
-	fprintf(stdout, "Usage:\n");
-	fprintf(stdout, "\t%s [options] [src] [dest]\n", progName);
-	fprintf(stdout, "Options:\n");
-	fprintf(stdout, "\t-e\t encode\n");
-	fprintf(stdout, "\t-d\t decode (when decoding only the source folder is required)\n");
-	fprintf(stdout, "\t-k\t the number of data files (when encoding only) 1 < k < %d\n", MAX_K + 1);
-	fprintf(stdout, "\t-m\t the number of coding files (when encoding only) 1 < m < %d\n", MAX_M + 1);
+int min_word_size(int k, int m) {
+	int n = 4;
+	int w = 2;
+	while (n < k + m) {
+		n <<= 1;
+		w++;
+	}
+	return w;
 }
-
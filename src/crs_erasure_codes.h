@@ -1,34 +1,357 @@
 #ifndef CRS_ERASURE_CODES_H_
 #define CRS_ERASURE_CODES_H_
 
+#include <stddef.h>
 #include "crs_spec_io.h"
+#include "crs_thread_pool.h"
+#include "crs_arena.h"
+
+/* Blocks each thread receives when splitting rows between threads */
+#define BLOCKS_PER_THREAD 4
+
+/* Packet size bounds, in bytes */
+#define MIN_PACKETSIZE 256
+#define MAX_PACKETSIZE (64 * 1024)
+
+/* Assumed L2 cache size when it can not be queried */
+#define DEFAULT_CACHE_SIZE (256 * 1024)
+
+/* Bytes of synthetic data and repetitions per candidate when auto-tuning the packet size */
+#define AUTOTUNE_BYTES (16 * 1024 * 1024)
+#define AUTOTUNE_RUNS 3
+
+/* Bytes of each fragment a decode repairs at a time */
+#define REPAIR_SLICE_SIZE (4 * 1024 * 1024)
+
+/* Unchanged bytes between two changed runs of a coding fragment below which an update rewrites them as one run */
+#define UPDATE_MERGE_GAP 512
+
+/* Stripe budget for encoding a stream when none was given */
+#define STREAM_STRIPE_BUDGET (64 * 1024 * 1024)
+
+/**
+ * Runtime options, these do not change the encoded output
+ */
+struct crs_options {
+	size_t stripeBudget; /* Max bytes of stripe buffers when encoding, 0 to encode the whole file in memory */
+	int threads; /* Number of threads to encode or decode with */
+	int autotune; /* Measure the fastest packet size instead of calculating it from the cache size */
+	struct crs_arena *arena; /* Buffers reused between operations, NULL to allocate them for this operation only */
+	int mapInput; /* Encode from a read only mapping of the file rather than a copy of it */
+	int verify; /* Check the fragments against the spec checksums before decoding, treating corrupt ones as missing */
+	struct crs_thread_pool *pool; /* Shared between operations, NULL to create a pool of threads threads per operation */
+};
+
+/**
+ * Initialises the options to their defaults (the whole file is encoded in memory on one thread, with a packet size
+ * calculated from the cache size).
+ * @param opts The options to initialise
+ */
+void init_options(struct crs_options *opts);
 
 /**
  * Encodes the file at src to dest directory. Also writes the spec to a file in dest. Spec k and m values must be
  * initialised, The rest will be filled.
+ * @param src The file to encode, or a stream (a pipe, or - for stdin) encoded as it is read (see encode_stream)
+ * @param dest The directory to create and fill with the data, coding and spec files.
+ * @param spec The spec (k and m) to be used in encoding
+ * @param opts The encoding options, or NULL for the defaults
+ * @return 0 if successful, otherwise -1
+ */
+int encode(char *src, char *dest, struct crs_encoding_spec *spec, struct crs_options *opts);
+
+/**
+ * Encodes the file at src to dest directory with the whole file held in memory.
+ * @param src The file to encode
+ * @param dest The directory to create and fill with the data, coding and spec files.
+ * @param spec The spec (k and m) to be used in encoding
+ * @param fileSize The size of the file at src
+ * @param pool The thread pool to encode on, or NULL to encode in the calling thread
+ * @param arena The arena to carve the data and coding matrices from
+ * @return 0 if successful, otherwise -1
+ */
+int encode_in_memory(char *src, char *dest, struct crs_encoding_spec *spec, size_t fileSize,
+		struct crs_thread_pool *pool, struct crs_arena *arena);
+
+/**
+ * Encodes the file at src to dest directory reading it through a read only mapping. The data rows lying wholly within
+ * the file point into the mapping, only the padded last row and the coding rows are allocated.
  * @param src The file to encode
  * @param dest The directory to create and fill with the data, coding and spec files.
  * @param spec The spec (k and m) to be used in encoding
+ * @param fileSize The size of the file at src
+ * @param pool The thread pool to encode on, or NULL to encode in the calling thread
+ * @param arena The arena to carve the last data row and the coding matrix from
  * @return 0 if successful, otherwise -1
  */
-int encode(char *src, char *dest, struct crs_encoding_spec *spec);
+int encode_mapped(char *src, char *dest, struct crs_encoding_spec *spec, size_t fileSize,
+		struct crs_thread_pool *pool, struct crs_arena *arena);
 
 /**
- * Decodes (repairs) the file set in the src directory using the specified spec.
+ * Encodes the file at src to dest directory one stripe at a time, so that at most stripeBudget bytes of data and
+ * coding buffers are held for each stripe. Each stripe is split into k consecutive chunks which are appended to the
+ * data files, the encoded chunks are appended to the coding files. The stripe width is recorded in the spec. The next
+ * stripe is read and the previous one written while a stripe is encoded, PIPELINE_DEPTH stripes being held at once.
+ * @param src The file to encode
+ * @param dest The directory to create and fill with the data, coding and spec files.
+ * @param spec The spec (k and m) to be used in encoding
+ * @param fileSize The size of the file at src
+ * @param stripeBudget The maximum number of bytes of data and coding buffers for one stripe
+ * @param pool The thread pool to encode on, or NULL to encode in the calling thread
+ * @param arena The arena to carve the stripe buffers from
+ * @return 0 if successful, otherwise -1
+ */
+int encode_striped(char *src, char *dest, struct crs_encoding_spec *spec, size_t fileSize, size_t stripeBudget,
+		struct crs_thread_pool *pool, struct crs_arena *arena);
+
+/**
+ * Encodes the stream src (a pipe, or - for stdin) to dest directory one stripe at a time like encode_striped, the
+ * stripes being read through the same pipeline. The width and end padding are only known once the input ends, they
+ * are recorded in the spec then. An input ending within the first stripe is encoded with the narrower stripes
+ * encode_striped would give a file of its size.
+ * @param src The stream to encode, - for stdin
+ * @param dest The directory to create and fill with the data, coding and spec files.
+ * @param spec The spec (k, m and packetsize) to be used in encoding
+ * @param fileSize Where the number of bytes read from src should be stored
+ * @param stripeBudget The maximum number of bytes of data and coding buffers for one stripe
+ * @param pool The thread pool to encode on, or NULL to encode in the calling thread
+ * @param arena The arena to carve the stripe buffers from
+ * @return 0 if successful, otherwise -1
+ */
+int encode_stream(char *src, char *dest, struct crs_encoding_spec *spec, size_t *fileSize, size_t stripeBudget,
+		struct crs_thread_pool *pool, struct crs_arena *arena);
+
+/**
+ * Extends the checksums in the spec with the next bytes of every data and coding row, allocating zeroed checksums on
+ * the first call.
+ * @param spec The encoding specification
+ * @param data The data rows
+ * @param coding The coding rows
+ * @param size The number of bytes of each row to add, or 0 to add the whole file size of each row (see fragment_size)
+ * @param pool The thread pool to checksum on, or NULL to checksum in the calling thread
+ * @return 0 if successful, otherwise -1
+ */
+int update_checksums(struct crs_encoding_spec *spec, char **data, char **coding, size_t size,
+		struct crs_thread_pool *pool);
+
+/**
+ * Finds the data and coding files in the src directory. With opts->verify set the files found are then checked against
+ * the spec checksums, corrupt files being marked missing.
+ * @param src The directory containing the coding, data and spec files
+ * @param spec The encoding specification
+ * @param opts The decoding options, or NULL for the defaults
+ * @param present The k + m flags to fill (0 for missing or corrupt, 1 for present)
+ * @return 0 if successful, otherwise -1
+ */
+int find_intact_files(char *src, struct crs_encoding_spec *spec, struct crs_options *opts, int *present);
+
+/**
+ * Checks every fragment in the src directory against the checksums recorded in the spec and reports the missing and
+ * corrupt ones. Nothing is decoded or written.
+ * @param src The directory containing the coding, data and spec files
+ * @param spec An empty spec struct to read the spec file into
+ * @return 0 if every fragment is present and intact, otherwise -1
+ */
+int verify(char *src, struct crs_encoding_spec *spec);
+
+/**
+ * Decodes (repairs) the file set in the src directory using the specified spec. Only the fragments the decoding
+ * schedule needs are read (the surviving data files and one coding file per erased data file), and rows are allocated
+ * only for them and the fragments being rebuilt. The fragments are repaired in slices of REPAIR_SLICE_SIZE bytes, the
+ * next slice being read and the previous one written while a slice is decoded.
  * @param src The directory containing the coding, data and spec files.
  * @param spec An empty spec struct to read the spec file into.
+ * @param opts The decoding options, or NULL for the defaults
+ * @return 0 if successful, otherwise -1
+ */
+int decode(char *src, struct crs_encoding_spec *spec, struct crs_options *opts);
+
+/**
+ * Reconstructs the original file from the fragments in the src directory. Present data files are copied to out inside
+ * the kernel, missing ones are decoded from the fewest fragments possible in slices of REPAIR_SLICE_SIZE bytes, as
+ * decode repairs them. Nothing is written to src. A stream out of a striped layout is written a stripe per slice; one
+ * of a contiguous layout is written a data file at a time, each missing one decoded in its own pass over the fragments.
+ * @param src The directory containing the coding, data and spec files
+ * @param out The file to reconstruct, or - for stdout
+ * @param spec An empty spec struct to read the spec file into
+ * @param opts The decoding options, or NULL for the defaults
+ * @return 0 if successful, otherwise -1
+ */
+int reconstruct(char *src, char *out, struct crs_encoding_spec *spec, struct crs_options *opts);
+
+/**
+ * Lists the erasures the decoding of the data rows depends on: the missing data rows, and the missing coding rows up to
+ * the last coding row substituted for a missing data row. Later missing coding rows are left out so they are not
+ * rebuilt.
+ * @param spec The encoding specification
+ * @param present The k + m flags of the files found by find_files
+ * @param erasures The k + m + 1 entries to fill with the -1 terminated erasures
+ * @return The number of erasures, or -1 if there are too many to decode
+ */
+int data_erasures(struct crs_encoding_spec *spec, int *present, int *erasures);
+
+/**
+ * Gives the data row and column holding a byte of the original file.
+ * @param spec The encoding specification
+ * @param position The position of the byte in the original file
+ * @param row Where the data row index should be stored
+ * @param column Where the offset of the byte in the data row should be stored
+ * @return The number of bytes from position which follow it in the same row
+ */
+size_t locate_byte(struct crs_encoding_spec *spec, size_t position, int *row, size_t *column);
+
+/**
+ * Reads length bytes of the original file, starting at offset, from the fragments in the src directory. Present data
+ * rows are read directly, missing ones are decoded window by window over only the blocks spanning the requested
+ * columns, reading that column slice from the fewest fragments possible. Nothing is written to src.
+ * @param src The directory containing the coding, data and spec files
+ * @param offset The offset of the range in the original file
+ * @param length The length of the range
+ * @param buf The length bytes to read the range into
+ * @param spec An empty spec struct to read the spec file into
+ * @param opts The decoding options, or NULL for the defaults
+ * @return 0 if successful, otherwise -1
+ */
+int read_range(char *src, size_t offset, size_t length, char *buf, struct crs_encoding_spec *spec,
+		struct crs_options *opts);
+
+/**
+ * Writes length bytes of the original file, starting at offset, to out (see read_range). The range is streamed through
+ * a buffer of at most REPAIR_SLICE_SIZE bytes, each window written as soon as it is read.
+ * @param src The directory containing the coding, data and spec files
+ * @param out The file to write the range to, or - for stdout
+ * @param offset The offset of the range in the original file
+ * @param length The length of the range
+ * @param spec An empty spec struct to read the spec file into
+ * @param opts The decoding options, or NULL for the defaults
+ * @return 0 if successful, otherwise -1
+ */
+int reconstruct_range(char *src, char *out, size_t offset, size_t length, struct crs_encoding_spec *spec,
+		struct crs_options *opts);
+
+/**
+ * Replaces length bytes of the original file, starting at offset, with buf in the fragments of the src directory
+ * without encoding the file again. The coding is linear, so each coding row changes by the encoding of the change to
+ * the data rows: the old bytes are read from the data fragment and the new ones written over them, and the encoded XOR
+ * of the two is XORed into the bytes it changes in the blocks spanning the same columns of every coding fragment. A
+ * coding byte only depends on the data bytes at the same offset in their packet, so about (1 + m) * length bytes are
+ * written with the rs8 engine and (1 + m * w) * length bytes with the crs engine, whose coding packets each combine
+ * several data packets. The checksums in the spec are patched rather than recomputed. Every fragment must be present,
+ * the range can not extend the file and the spec's coding matrix must be the one the engine encodes with.
+ * Each piece of the range is written to its data fragment before the coding fragments are patched, and the spec is only
+ * replaced (atomically) once every fragment has been synced. An update interrupted before that leaves the old checksums
+ * in the spec, so --verify reports the fragments it changed as corrupt; as long as at most m of them were, decoding
+ * with --verify brings them back to their old contents, after which the update can be run again.
+ * @param src The directory containing the coding, data and spec files
+ * @param offset The offset of the range in the original file
+ * @param length The length of the range
+ * @param buf The length new bytes of the range
+ * @param spec An empty spec struct to read the spec file into
+ * @param opts The options (threads and verify), or NULL for the defaults
  * @return 0 if successful, otherwise -1
  */
-int decode(char *src, struct crs_encoding_spec *spec);
+int update_range(char *src, size_t offset, size_t length, char *buf, struct crs_encoding_spec *spec,
+		struct crs_options *opts);
 
 /**
- * Calculates the encoding specifications from the size of the file to be encoded.
+ * Replaces the bytes of the original file starting at offset with the contents of src in the fragments of the dest
+ * directory (see update_range).
+ * @param src The file holding the new bytes, or - for stdin
+ * @param dest The directory containing the coding, data and spec files
+ * @param offset The offset in the original file of the first byte replaced
+ * @param spec An empty spec struct to read the spec file into
+ * @param opts The options (threads and verify), or NULL for the defaults
+ * @return 0 if successful, otherwise -1
+ */
+int update(char *src, char *dest, size_t offset, struct crs_encoding_spec *spec, struct crs_options *opts);
+
+/**
+ * Reads the column slice [offset, offset + size) of the fragments the decoding of the erasures needs and rebuilds the
+ * slice of the erased rows with the engine of the spec. The slice must be made of whole blocks (w * packetsize bytes).
+ * Rows of size bytes are carved from the arena only for the fragments read and rebuilt (see decoding_rows), the other
+ * row pointers are left NULL.
+ * @param src The directory containing the data and coding files
+ * @param spec The encoding specification
+ * @param opts The decoding options, or NULL for the defaults
+ * @param arena The arena to carve the rows from
+ * @param present The k + m flags of the files found by find_files
+ * @param erasures A -1 terminated array of at most m erased row indices
+ * @param rows The k data row pointers followed by the m coding row pointers, to fill
+ * @param offset The offset of the slice in the fragments
+ * @param size The size of the slice
+ * @return 0 if successful, otherwise -1
+ */
+int rebuild_rows(char *src, struct crs_encoding_spec *spec, struct crs_options *opts, struct crs_arena *arena,
+		int *present, int *erasures, char **rows, size_t offset, size_t size);
+
+/**
+ * Calculates the encoding specifications from the size of the file to be encoded. If spec->packetsize is set the
+ * width is a whole number of blocks of w * packetsize bytes, the packet size being reduced if the padding would
+ * otherwise spill past the last data file. If it is not set, or no packet size keeps the padding in the last data file,
+ * the whole width is coded as one block.
  * @param spec The spec struct to fill
  * @param filesize The size of the file to encode
  * @return 0 if successful, otherwise -1
  */
 int fill_encoding_spec(struct crs_encoding_spec *spec, size_t filesize);
 
+/**
+ * Calculates the encoding specifications for a striped encoding of a file, where each stripe of the file is split over
+ * the k data files and the data and coding buffers for one stripe fit within stripeBudget bytes.
+ * @param spec The spec struct to fill
+ * @param filesize The size of the file to encode
+ * @param stripeBudget The maximum number of bytes of data and coding buffers for one stripe
+ * @return 0 if successful, otherwise -1
+ */
+int fill_striped_encoding_spec(struct crs_encoding_spec *spec, size_t filesize, size_t stripeBudget);
+
+/**
+ * Chooses the packet size for an encode when none was requested. The packet size is sized to the cache (or measured
+ * with autotune_packetsize, for the crs engine only), then reduced if needed so that the rows split between the
+ * threads and a block fits within the stripe budget.
+ * @param spec The spec with k, m and engine filled
+ * @param filesize The size of the file to encode
+ * @param opts The encoding options
+ * @return The packet size, or -1 if unsuccessful
+ */
+int choose_packetsize(struct crs_encoding_spec *spec, size_t filesize, struct crs_options *opts);
+
+/**
+ * Calculates a packet size for which one block of every data and coding row (the data each pass of the schedule
+ * touches) fits in half of the L2 cache.
+ * @param k The number of data files
+ * @param m The number of coding files
+ * @param w The word size
+ * @return The packet size, between MIN_PACKETSIZE and MAX_PACKETSIZE
+ */
+int calc_cache_packetsize(int k, int m, int w);
+
+/**
+ * Measures the crs engine's encoding throughput of power of two packet sizes between MIN_PACKETSIZE and
+ * MAX_PACKETSIZE on synthetic data and returns the fastest.
+ * @param k The number of data files
+ * @param m The number of coding files
+ * @param w The word size
+ * @return The fastest packet size, or -1 if unsuccessful
+ */
+int autotune_packetsize(int k, int m, int w);
+
+/**
+ * @return The size of the L2 cache in bytes, or DEFAULT_CACHE_SIZE if it can not be determined
+ */
+size_t cache_size(void);
+
+/**
+ * Calculates a packet size which splits each data row (or stripe of it) into enough blocks to share between nrThreads
+ * threads.
+ * @param spec The spec with k and m filled
+ * @param filesize The size of the file to encode
+ * @param stripeBudget The stripe budget, or 0 if the whole file is encoded in memory
+ * @param nrThreads The number of threads encoding
+ * @return The packet size, or 0 if the rows are too small to split
+ */
+int calc_parallel_packetsize(struct crs_encoding_spec *spec, size_t filesize, size_t stripeBudget, int nrThreads);
+
 /**
  * Calculates the end padding required to fill out the file data to the required size. Stores this information in the
  * given spec struct.
@@ -46,9 +369,11 @@ int calc_padding(size_t filesize, struct crs_encoding_spec *spec);
 int calc_min_w(struct crs_encoding_spec *spec);
 
 /**
- * Prints the usage to stdout.
- * @param progName The name of the program binary
+ * Calculates the minimum word size for k + m files, ignoring the width.
+ * @param k The number of data files
+ * @param m The number of coding files
+ * @return The smallest w for which 2^w >= k + m
  */
-void print_usage(char *progName);
+int min_word_size(int k, int m);
 
 #endif /* CRS_ERASURE_CODES_H_ */
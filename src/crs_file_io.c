@@ -1,10 +1,28 @@
+#define _GNU_SOURCE
 #include <stdlib.h>
-#include <dirent.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <linux/fs.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <string.h>
 #include <limits.h>
+#include <stdint.h>
 #include <errno.h>
 #include "crs_file_io.h"
+#include "crs_async_io.h"
+#include "crs_thread_pool.h"
+#include "crs_crc.h"
+
+struct verify_task {
+	char *filePath;
+	size_t size;       /* The expected size of the file */
+	uint32_t checksum; /* The expected checksum of the file */
+	int corrupt;       /* Set on completion: 1 if the file does not match, 0 if it does, -1 if it could not be read */
+	int error;         /* The errno of the failure if corrupt is -1 */
+};
 
 /**
  * Fills the size pointer with the size of the file at filePath
@@ -31,64 +49,227 @@ int get_file_size(char *filePath, size_t *size) {
 }
 
 /**
- * Converts the file to a data matrix given the specification, spec
+ * Tells whether a file can only be read in order, its size being unknown until its end.
+ * @param filePath The path to the file, - for stdin
+ * @return 1 if the path is - or names a pipe, socket or device, otherwise 0
+ */
+int is_stream(char *filePath) {
+	struct stat fileStats;
+
+	if (strcmp(filePath, "-") == 0) {
+		return 1;
+	}
+	return stat(filePath, &fileStats) == 0 && !S_ISREG(fileStats.st_mode) && !S_ISDIR(fileStats.st_mode);
+}
+
+/**
+ * Reads the file into the data matrix given the specification, spec. Only the padding at the end of the last row is
+ * zeroed, the rest of the matrix is overwritten by the file.
  * @param src The path to the file
  * @param spec The specification to use
- * @return The resulting data matrix, or NULL if unsuccessful
+ * @param data The data matrix to fill (k rows of width bytes)
+ * @return 0 if successful, otherwise -1
  */
-char **file2data_matrix(char *src, struct crs_encoding_spec *spec) {
+int file2data_matrix(char *src, struct crs_encoding_spec *spec, char **data) {
 	FILE *f;
-	int i, res;
-	char **data;
+	int i;
+	int res = 0;
 	size_t bytesRead;
 
 	f = fopen(src, "rb");
 	if (f == NULL) {
-		return NULL;
-	}
-
-	/* Create data matrix */
-	data = calloc_matrix(spec->k, spec->width);
-	if (data == NULL) {
-		return NULL;
+		return -1;
 	}
 
 	/* Fill data matrix according to specs */
-	res = 0;
 	for (i = 0; i < spec->k; i++) {
 		bytesRead = fread(data[i], sizeof(char), spec->width, f);
-		if (bytesRead == 0) {
-			res = -1;
-			break;
+		if (bytesRead < spec->width) {
+			if (ferror(f)) {
+				res = -1;
+				break;
+			}
+			memset(data[i] + bytesRead, 0, spec->width - bytesRead);
 		}
 	}
 	fclose(f);
+	return res;
+}
 
-	if (res < 0) {
-		matrix_free(data, spec->k);
-		data = NULL;
+/**
+ * Maps the file at src read only and points the data rows lying wholly within the file into the mapping, so they are
+ * not copied. The remaining data rows (the last, padded, row) are copied into the tail buffers and zero padded.
+ * @param src The path to the file
+ * @param spec The specification to use
+ * @param data The k data row pointers to set
+ * @param tail Buffers of width bytes for the data rows not wholly within the file (see mapped_rows)
+ * @param map Where the start of the mapping is stored (NULL for an empty file)
+ * @param mapSize Where the size of the mapping is stored, for munmap
+ * @return 0 if successful, otherwise -1
+ */
+int map_data_matrix(char *src, struct crs_encoding_spec *spec, char **data, char **tail, void **map,
+		size_t *mapSize) {
+	int i, fd;
+	int nrTail = 0;
+	size_t offset, available;
+	struct stat fileStats;
+
+	fd = open(src, O_RDONLY);
+	if (fd < 0) {
+		return -1;
+	}
+	if (fstat(fd, &fileStats) < 0) {
+		close(fd);
+		return -1;
+	}
+
+	*map = NULL;
+	*mapSize = fileStats.st_size;
+	if (*mapSize > 0) {
+		*map = mmap(NULL, *mapSize, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (*map == MAP_FAILED) {
+			*map = NULL;
+			close(fd);
+			return -1;
+		}
+		madvise(*map, *mapSize, MADV_SEQUENTIAL);
+	}
+	close(fd);
+
+	for (i = 0; i < spec->k; i++) {
+		offset = i * spec->width;
+		if (offset + spec->width <= *mapSize) {
+			data[i] = (char *) *map + offset;
+		} else {
+			data[i] = tail[nrTail];
+			nrTail++;
+			available = (offset < *mapSize) ? *mapSize - offset : 0;
+			if (available > 0) {
+				memcpy(data[i], (char *) *map + offset, available);
+			}
+			memset(data[i] + available, 0, spec->width - available);
+		}
+	}
+	return 0;
+}
+
+/**
+ * @param spec The encoding specification
+ * @param fileSize The size of the file being encoded
+ * @return The number of data rows lying wholly within the file
+ */
+int mapped_rows(struct crs_encoding_spec *spec, size_t fileSize) {
+	size_t rows = fileSize / spec->width;
+	return (rows < (size_t) spec->k) ? (int) rows : spec->k;
+}
+
+/**
+ * Writes the path of data or coding file row to filePath.
+ * @param filePath The buffer of pathLen characters
+ * @param pathLen The size of filePath
+ * @param src The directory containing the files
+ * @param spec The encoding specification
+ * @param row The file index (0 = d1, 1 = d2, ..., k = c1, ..., k+m-1 = cm)
+ */
+static void fragment_path(char *filePath, size_t pathLen, char *src, struct crs_encoding_spec *spec, int row) {
+	if (row < spec->k) {
+		snprintf(filePath, pathLen, "%s/d%d", src, row + 1);
+	} else {
+		snprintf(filePath, pathLen, "%s/c%d", src, row - spec->k + 1);
 	}
-	return data;
 }
 
 /**
- * Writes the data in the data and coding matrices to files in the dest directory.
+ * Writes the data in the data and coding matrices to files in the dest directory. With a contiguous layout the data
+ * files are byte ranges of the source file, so when src is given they are cloned or copied inside the kernel and only
+ * the coding files pass through user memory. The data matrix is written instead where the kernel copy is unsupported.
  * @param data The data matrix
  * @param coding The coding matrix
  * @param spec The encoding specification
  * @param dest The destination directory
+ * @param src The encoded file, or NULL to write the data files from the data matrix
  * @return 0 if successful, otherwise -1
  */
-int write_files(char **data, char **coding, struct crs_encoding_spec *spec, char *dest) {
+int write_files(char **data, char **coding, struct crs_encoding_spec *spec, char *dest, char *src) {
 	int i, res;
+	int srcFd = -1;
+	int nrRows = spec->k + spec->m;
 	size_t pathLen;
-	char *filePath;
+	char *filePaths;
+	struct crs_io_request *requests;
+
+	res = create_fragment_dir(dest, spec);
+	if (res < 0) {
+		return -1;
+	}
+
+	pathLen = strlen(dest) + MAX_FILENAME_LENGTH + 2;
+	filePaths = (char *) calloc(nrRows * pathLen, sizeof(char));
+	requests = (struct crs_io_request *) calloc(nrRows, sizeof(struct crs_io_request));
+	if (filePaths == NULL || requests == NULL) {
+		free(filePaths);
+		free(requests);
+		return -1;
+	}
+
+	/* Data files are byte ranges of a contiguously laid out source, let the kernel copy them when it can */
+	if (src != NULL && spec->stripeWidth == 0) {
+		srcFd = open(src, O_RDONLY);
+	}
+
+	for (i = 0; i < nrRows; i++) {
+		requests[i].filePath = filePaths + i * pathLen;
+		if (i < spec->k) {
+			snprintf(requests[i].filePath, pathLen, "%s/d%d", dest, i + 1);
+			requests[i].op = (srcFd >= 0) ? IO_COPY : IO_WRITE;
+			requests[i].buf = data[i];
+			requests[i].srcFd = srcFd;
+			requests[i].srcOffset = (off_t) i * spec->width;
+		} else {
+			snprintf(requests[i].filePath, pathLen, "%s/c%d", dest, i - spec->k + 1);
+			requests[i].op = IO_WRITE;
+			requests[i].buf = coding[i - spec->k];
+		}
+		requests[i].nrBytes = fragment_size(spec, i);
+	}
+	res = perform_io(NULL, requests, nrRows);
+
+	if (srcFd >= 0) {
+		close(srcFd);
+	}
+	free(filePaths);
+	free(requests);
+	return res;
+}
+
+/**
+ * Creates the dest directory and writes the spec file to it.
+ * @param dest The destination directory
+ * @param spec The encoding specification
+ * @return 0 if successful, otherwise -1
+ */
+int create_fragment_dir(char *dest, struct crs_encoding_spec *spec) {
+	int res;
 
 	/* Create output directory */
 	res = mkdir(dest, S_IRWXU | S_IRWXG);
 	if (res < 0) {
 		return -1;
 	}
+	return write_fragment_spec(dest, spec);
+}
+
+/**
+ * Writes the spec file of the fragment directory dest, replacing any spec file already there atomically: the new spec
+ * is renamed over the old one and the directory is synced, so the spec is either the old or the new one after a crash.
+ * @param dest The destination directory
+ * @param spec The encoding specification
+ * @return 0 if successful, otherwise -1
+ */
+int write_fragment_spec(char *dest, struct crs_encoding_spec *spec) {
+	int res, dirFd;
+	size_t pathLen;
+	char *filePath;
 
 	pathLen = strlen(dest) + MAX_FILENAME_LENGTH + 2;
 	filePath = (char *) calloc(pathLen, sizeof(char));
@@ -99,42 +280,177 @@ int write_files(char **data, char **coding, struct crs_encoding_spec *spec, char
 	/* Write spec file */
 	snprintf(filePath, pathLen, "%s/spec", dest);
 	res = write_spec(spec, filePath);
-	if (res < 0) {
-		free(filePath);
+	free(filePath);
+
+	/* Make the rename durable */
+	if (res == 0) {
+		dirFd = open(dest, O_RDONLY | O_DIRECTORY);
+		res = (dirFd < 0 || fsync(dirFd) < 0) ? -1 : 0;
+		if (dirFd >= 0) {
+			close(dirFd);
+		}
+	}
+	return res;
+}
+
+/**
+ * Reads the spec file of the fragment directory src.
+ * @param src The directory containing the data, coding and spec files
+ * @param spec Where the spec file should be read into
+ * @return 0 if successful, otherwise -1
+ */
+int read_fragment_spec(char *src, struct crs_encoding_spec *spec) {
+	int res;
+	size_t pathLen;
+	char *filePath;
+
+	pathLen = strlen(src) + MAX_FILENAME_LENGTH + 2;
+	filePath = (char *) calloc(pathLen, sizeof(char));
+	if (filePath == NULL) {
 		return -1;
 	}
+	snprintf(filePath, pathLen, "%s/spec", src);
+	res = read_spec(filePath, spec);
+	free(filePath);
+	return res;
+}
 
-	/* Write data files */
-	for (i = 0; i < spec->k - 1; i++) {
-		snprintf(filePath, pathLen, "%s/d%d", dest, i + 1);
-		res = write_binary_bytes(data[i], spec->width, filePath);
-		if (res < 0) {
-			break;
+/**
+ * Reads the next stripe of the file f into the data matrix. Each of the k rows receives spec->stripeWidth bytes, the
+ * part of the stripe beyond the end of the file is zero filled.
+ * @param f The file being encoded
+ * @param data The data matrix (k rows of stripeWidth bytes)
+ * @param spec The encoding specification
+ * @param nrRead Where the number of bytes read from f should be stored, or NULL
+ * @return 0 if successful, otherwise -1
+ */
+int read_stripe(FILE *f, char **data, struct crs_encoding_spec *spec, size_t *nrRead) {
+	int i;
+	size_t bytesRead;
+
+	if (nrRead != NULL) {
+		*nrRead = 0;
+	}
+	for (i = 0; i < spec->k; i++) {
+		bytesRead = fread(data[i], sizeof(char), spec->stripeWidth, f);
+		if (nrRead != NULL) {
+			*nrRead += bytesRead;
+		}
+		if (bytesRead < spec->stripeWidth) {
+			if (ferror(f)) {
+				return -1;
+			}
+			memset(data[i] + bytesRead, 0, spec->stripeWidth - bytesRead);
 		}
 	}
-	if (res < 0) {
-		free(filePath);
+	return 0;
+}
+
+/**
+ * Creates (truncating) the data and coding files in the dest directory, to be written stripe by stripe.
+ * @param dest The destination directory, created by create_fragment_dir
+ * @param spec The encoding specification
+ * @param fds The k + m descriptors to fill (d1, ..., dk, c1, ..., cm), all -1 if unsuccessful
+ * @return 0 if successful, otherwise -1
+ */
+int create_fragment_files(char *dest, struct crs_encoding_spec *spec, int *fds) {
+	int i, err;
+	int res = 0;
+	size_t pathLen;
+	char *filePath;
+
+	for (i = 0; i < spec->k + spec->m; i++) {
+		fds[i] = -1;
+	}
+	pathLen = strlen(dest) + MAX_FILENAME_LENGTH + 2;
+	filePath = (char *) calloc(pathLen, sizeof(char));
+	if (filePath == NULL) {
 		return -1;
 	}
-	snprintf(filePath, pathLen, "%s/d%d", dest, i + 1);
-	res = write_binary_bytes(data[i], spec->width - spec->endPadding, filePath);
+
+	for (i = 0; i < spec->k + spec->m && res == 0; i++) {
+		fragment_path(filePath, pathLen, dest, spec, i);
+		fds[i] = open(filePath, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+		res = (fds[i] < 0) ? -1 : 0;
+	}
 	if (res < 0) {
-		free(filePath);
-		return -1;
+		err = errno;
+		close_fragment_files(spec, fds);
+		errno = err;
 	}
+	free(filePath);
+	return res;
+}
 
-	/* Write coding files */
-	for (i = 0; i < spec->m; i++) {
-		snprintf(filePath, pathLen, "%s/c%d", dest, i + 1);
-		res = write_binary_bytes(coding[i], spec->width, filePath);
-		if (res < 0) {
-			break;
+/**
+ * Closes the descriptors opened by create_fragment_files.
+ * @param spec The encoding specification
+ * @param fds The k + m descriptors, -1 for files not open; all are set to -1
+ * @return 0 if successful, otherwise -1 (a write may have failed)
+ */
+int close_fragment_files(struct crs_encoding_spec *spec, int *fds) {
+	int i;
+	int res = 0;
+
+	for (i = 0; i < spec->k + spec->m; i++) {
+		if (fds[i] >= 0 && close(fds[i]) < 0) {
+			res = -1;
 		}
+		fds[i] = -1;
 	}
-	free(filePath);
 	return res;
 }
 
+/**
+ * Writes one encoded stripe to the data and coding files, at the offset of the stripe in each file. The k + m writes
+ * are submitted together (see perform_io).
+ * @param data The data matrix (k rows of stripeWidth bytes)
+ * @param coding The coding matrix (m rows of stripeWidth bytes)
+ * @param spec The encoding specification
+ * @param fds The k + m descriptors from create_fragment_files
+ * @param stripe The index of the stripe
+ * @param io The io context to submit the writes on, or NULL to set one up for this call
+ * @return 0 if successful, otherwise -1
+ */
+int write_stripe(char **data, char **coding, struct crs_encoding_spec *spec, int *fds, size_t stripe,
+		struct crs_io_context *io) {
+	int i, res;
+	struct crs_io_request *requests;
+
+	requests = (struct crs_io_request *) calloc(spec->k + spec->m, sizeof(struct crs_io_request));
+	if (requests == NULL) {
+		return -1;
+	}
+	for (i = 0; i < spec->k + spec->m; i++) {
+		requests[i].op = IO_WRITE_AT;
+		requests[i].fd = fds[i];
+		requests[i].buf = (i < spec->k) ? data[i] : coding[i - spec->k];
+		requests[i].nrBytes = spec->stripeWidth;
+		requests[i].offset = (off_t) (stripe * spec->stripeWidth);
+	}
+	res = perform_io(io, requests, spec->k + spec->m);
+	free(requests);
+	return res;
+}
+
+/**
+ * Gives the size of a data or coding file. With a contiguous layout the data files are trimmed to the end of the source
+ * file (the end padding of a file smaller than k words may leave several data files short or empty), with a striped
+ * layout the padding is spread over the last stripe so every file is spec->width bytes.
+ * @param spec The encoding specification
+ * @param row The file index (0 = d1, 1 = d2, ..., k = c1, ..., k+m-1 = cm)
+ * @return The size of the file in bytes
+ */
+size_t fragment_size(struct crs_encoding_spec *spec, int row) {
+	size_t fileSize = (size_t) spec->k * spec->width - spec->endPadding;
+	size_t start = (size_t) row * spec->width;
+
+	if (spec->stripeWidth == 0 && row < spec->k && fileSize < start + spec->width) {
+		return (fileSize > start) ? fileSize - start : 0;
+	}
+	return spec->width;
+}
+
 /**
  * Writes nrBytes of data to a file at filePath
  * @param data The data to write
@@ -157,87 +473,332 @@ int write_binary_bytes(void *data, size_t nrBytes, char *filePath) {
 }
 
 /**
- * Reads maxNr of files from the src directory which begin with the given prefix character followed by a number.
- * The present array is updated with 1s for each file found. Used to read the data and coding files d1-d<k> and c1-c<m>.
- * @param src The source directory
- * @param maxNr The maximum number of files to read (k for data files, m for coding files)
- * @param fileSize The expected size of the files (the width of the matrix)
- * @param prefix The character prefix (d for data files and c for coding files)
- * @param present The empty binary array (filled with 0 for missing, 1 for present)
- * @return A matrix of maxNr rows and fileSize columns containing the files read
- */
-char **read_files(char *src, int maxNr, size_t fileSize, char prefix, int *present) {
-	char **data;
-	DIR *d;
-	struct dirent *dent;
-	FILE* f;
-	int res, fileNr;
-	char *filePath;
+ * Reads the whole file at filePath into an allocated buffer.
+ * @param filePath The file path to read, or - for stdin
+ * @param data Where the allocated buffer should be stored, to be freed by the caller
+ * @param nrBytes Where the number of bytes read should be stored
+ * @return 0 if successful, otherwise -1
+ */
+int read_binary_bytes(char *filePath, char **data, size_t *nrBytes) {
+	FILE *f;
+	size_t capacity = BOUNCE_BUFFER_SIZE;
+	size_t nrRead;
+	char *grown;
+	int res = 0;
 
-	int pathLen = strlen(src) + MAX_FILENAME_LENGTH + 2;
-	filePath = (char *) calloc(pathLen, sizeof(char));
+	f = (strcmp(filePath, "-") == 0) ? stdin : fopen(filePath, "rb");
+	if (f == NULL) {
+		return -1;
+	}
+	*nrBytes = 0;
+	*data = (char *) malloc(capacity);
+	while (*data != NULL) {
+		nrRead = fread(*data + *nrBytes, sizeof(char), capacity - *nrBytes, f);
+		*nrBytes += nrRead;
+		if (*nrBytes < capacity) {
+			break;
+		}
+		capacity *= 2;
+		grown = (char *) realloc(*data, capacity);
+		if (grown == NULL) {
+			free(*data);
+		}
+		*data = grown;
+	}
+	if (*data == NULL || ferror(f)) {
+		free(*data);
+		*data = NULL;
+		res = -1;
+	}
+	if (f != stdin) {
+		fclose(f);
+	}
+	return res;
+}
+
+/**
+ * Copies nrBytes of srcFd, starting at srcOffset, to destFd at destOffset without passing through user memory, cloning
+ * the range with FICLONERANGE when possible and copying it with copy_file_range otherwise.
+ * @param srcFd The file to copy from
+ * @param srcOffset The offset of the range in srcFd
+ * @param destFd The file to copy to
+ * @param destOffset The offset of the range in destFd
+ * @param nrBytes The number of bytes to copy
+ * @return 0 if successful, otherwise -1 (the caller should fall back to copying the bytes itself)
+ */
+int copy_file_range_bytes(int srcFd, off_t srcOffset, int destFd, off_t destOffset, size_t nrBytes) {
+	ssize_t copied;
+#ifdef FICLONERANGE
+	struct file_clone_range range;
 
-	data = calloc_matrix(maxNr, fileSize);
-	if (data == NULL) {
-		return NULL;
+	/* Share the extents when the filesystem supports reflinks and the range is block aligned */
+	range.src_fd = srcFd;
+	range.src_offset = (uint64_t) srcOffset;
+	range.src_length = (uint64_t) nrBytes;
+	range.dest_offset = (uint64_t) destOffset;
+	if (nrBytes > 0 && ioctl(destFd, FICLONERANGE, &range) == 0) {
+		return 0;
 	}
+#endif
 
-	d = opendir(src);
-	if (d == NULL) {
-		matrix_free(data, maxNr);
-		return NULL;
+	while (nrBytes > 0) {
+		copied = copy_file_range(srcFd, &srcOffset, destFd, &destOffset, nrBytes, 0);
+		if (copied <= 0) {
+			return -1;
+		}
+		nrBytes -= (size_t) copied;
 	}
+	return 0;
+}
 
-	while ((dent = readdir(d)) != NULL) {
-		if (dent->d_name[0] == prefix) {
-			res = str2int(&(dent->d_name[1]), &fileNr);
-			if (res < 0) {
-				break;
+/**
+ * Copies nrBytes of srcFd, starting at srcOffset, to a new file at filePath without passing through user memory. The
+ * range is cloned with FICLONERANGE on reflink capable filesystems, otherwise copied with copy_file_range.
+ * @param srcFd The file to copy from
+ * @param srcOffset The offset of the range in srcFd
+ * @param nrBytes The number of bytes to copy
+ * @param filePath The file path to write to
+ * @return 0 if successful, otherwise -1 (the caller should fall back to writing the bytes itself)
+ */
+int copy_file_bytes(int srcFd, off_t srcOffset, size_t nrBytes, char *filePath) {
+	int destFd;
+
+	destFd = open(filePath, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (destFd < 0) {
+		return -1;
+	}
+	if (copy_file_range_bytes(srcFd, srcOffset, destFd, 0, nrBytes) < 0) {
+		close(destFd);
+		return -1;
+	}
+	return close(destFd);
+}
+
+/**
+ * Writes nrBytes of data to the open file fd at offset.
+ * @param fd The file to write to
+ * @param data The data to write
+ * @param nrBytes The number of bytes to write
+ * @param offset The offset in the file, or -1 to write at the current position (for pipes)
+ * @return 0 if successful, otherwise -1
+ */
+int write_fd_bytes(int fd, void *data, size_t nrBytes, off_t offset) {
+	ssize_t written;
+	char *bytes = (char *) data;
+
+	while (nrBytes > 0) {
+		written = (offset < 0) ? write(fd, bytes, nrBytes) : pwrite(fd, bytes, nrBytes, offset);
+		if (written <= 0) {
+			return -1;
+		}
+		bytes += written;
+		if (offset >= 0) {
+			offset += written;
+		}
+		nrBytes -= (size_t) written;
+	}
+	return 0;
+}
+
+/**
+ * Copies a range of one file to another through a bounce buffer, for when the kernel can not copy between them.
+ * @return 0 if successful, otherwise -1
+ */
+static int bounce_copy(int srcFd, off_t srcOffset, int destFd, off_t destOffset, size_t nrBytes) {
+	char *buf;
+	ssize_t nrRead;
+	size_t chunk;
+	int res = 0;
+
+	buf = (char *) malloc(BOUNCE_BUFFER_SIZE);
+	if (buf == NULL) {
+		return -1;
+	}
+	while (nrBytes > 0 && res == 0) {
+		chunk = (nrBytes < BOUNCE_BUFFER_SIZE) ? nrBytes : BOUNCE_BUFFER_SIZE;
+		nrRead = pread(srcFd, buf, chunk, srcOffset);
+		if (nrRead <= 0) {
+			res = -1;
+		} else {
+			res = write_fd_bytes(destFd, buf, (size_t) nrRead, destOffset);
+			srcOffset += nrRead;
+			if (destOffset >= 0) {
+				destOffset += nrRead;
 			}
-			if (fileNr < 1 || fileNr > maxNr) {
-				res = -1;
-				break;
+			nrBytes -= (size_t) nrRead;
+		}
+	}
+	free(buf);
+	return res;
+}
+
+/**
+ * Copies a range of a file to the current position of a stream, through sendfile or else a bounce buffer.
+ * @return 0 if successful, otherwise -1
+ */
+static int stream_copy(int srcFd, off_t srcOffset, int destFd, size_t nrBytes) {
+	ssize_t sent;
+
+	while (nrBytes > 0) {
+		sent = sendfile(destFd, srcFd, &srcOffset, nrBytes);
+		if (sent <= 0) {
+			break;
+		}
+		nrBytes -= (size_t) sent;
+	}
+	return (nrBytes > 0) ? bounce_copy(srcFd, srcOffset, destFd, -1, nrBytes) : 0;
+}
+
+/**
+ * Opens out to write the original file to, along with the present data files copied into it. Nothing is written to the
+ * src directory. An out which is not a regular file (a pipe, or - for stdout) is written in order, without seeking.
+ * @param src The directory containing the data files
+ * @param out The file to reconstruct, or - for stdout
+ * @param spec The encoding specification
+ * @param present The k + m flags of the files found by find_files
+ * @param rec The reconstruction to fill, closed with close_reconstructed
+ * @return 0 if successful, otherwise -1
+ */
+int open_reconstructed(char *src, char *out, struct crs_encoding_spec *spec, int *present, struct crs_reconstruction *rec) {
+	int i;
+	size_t pathLen;
+	char *filePath;
+	struct stat outStats;
+
+	rec->spec = spec;
+	rec->fileSize = (size_t) spec->k * spec->width - spec->endPadding;
+	rec->fragmentFds = (int *) malloc(spec->k * sizeof(int));
+	pathLen = strlen(src) + MAX_FILENAME_LENGTH + 2;
+	filePath = (char *) calloc(pathLen, sizeof(char));
+	if (rec->fragmentFds == NULL || filePath == NULL) {
+		free(rec->fragmentFds);
+		free(filePath);
+		return -1;
+	}
+	rec->outFd = (strcmp(out, "-") == 0) ? dup(STDOUT_FILENO) : open(out, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	rec->stream = fstat(rec->outFd, &outStats) < 0 || !S_ISREG(outStats.st_mode);
+
+	for (i = 0; i < spec->k; i++) {
+		rec->fragmentFds[i] = -1;
+	}
+	for (i = 0; i < spec->k; i++) {
+		if (present[i] && rec->outFd >= 0) {
+			fragment_path(filePath, pathLen, src, spec, i);
+			rec->fragmentFds[i] = open(filePath, O_RDONLY);
+			if (rec->fragmentFds[i] < 0) {
+				free(filePath);
+				close_reconstructed(rec);
+				return -1;
 			}
-			snprintf(filePath, pathLen, "%s/%s", src, dent->d_name);
-			f = fopen(filePath, "rb");
-			if (f == NULL) {
-				res = -1;
+		}
+	}
+	free(filePath);
+	if (rec->outFd < 0) {
+		free(rec->fragmentFds);
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * Writes the bytes of the original file held by columns [offset, offset + size) of the data rows [firstRow, lastRow).
+ * Present data files are copied inside the kernel (through a bounce buffer where the kernel can not copy between the
+ * files), the rows of missing data files are written from data. Each data file contributes one chunk per stripe, a
+ * contiguous layout being a single stripe of width bytes, and the chunks are written stripe by stripe, so a stream is
+ * written in order when the columns hold whole stripes of every row, or a single row from its start.
+ * @param rec The reconstruction opened by open_reconstructed
+ * @param firstRow The first data row to write
+ * @param lastRow The data row after the last one to write
+ * @param data The slices of the data rows, columns [offset, offset + size) (rows of present data files are not accessed)
+ * @param offset The first column to write
+ * @param size The number of columns to write
+ * @return 0 if successful, otherwise -1
+ */
+int write_reconstructed_columns(struct crs_reconstruction *rec, int firstRow, int lastRow, char **data, size_t offset,
+		size_t size) {
+	int i;
+	int res = 0;
+	size_t chunk, column, last, outOffset, stripe, stripeBytes;
+	struct crs_encoding_spec *spec = rec->spec;
+
+	stripeBytes = (spec->stripeWidth == 0) ? spec->width : spec->stripeWidth;
+	for (stripe = offset - offset % stripeBytes; stripe < offset + size && res == 0; stripe += stripeBytes) {
+		column = (stripe > offset) ? stripe : offset;
+		last = (stripe + stripeBytes < offset + size) ? stripe + stripeBytes : offset + size;
+		for (i = firstRow; i < lastRow && res == 0; i++) {
+			outOffset = stripe * spec->k + i * stripeBytes + column - stripe;
+			if (outOffset >= rec->fileSize) {
 				break;
 			}
-			res = fread(data[fileNr - 1], sizeof(char), fileSize, f);
-			if (res == 0) {
-				res = -1;
-				fclose(f);
-				break;
+			chunk = (rec->fileSize - outOffset < last - column) ? rec->fileSize - outOffset : last - column;
+			if (rec->fragmentFds[i] < 0) {
+				res = write_fd_bytes(rec->outFd, data[i] + column - offset, chunk, rec->stream ? -1 : (off_t) outOffset);
+			} else if (rec->stream) {
+				res = stream_copy(rec->fragmentFds[i], (off_t) column, rec->outFd, chunk);
+			} else if (copy_file_range_bytes(rec->fragmentFds[i], (off_t) column, rec->outFd, (off_t) outOffset,
+					chunk) < 0) {
+				res = bounce_copy(rec->fragmentFds[i], (off_t) column, rec->outFd, (off_t) outOffset, chunk);
 			}
-			fclose(f);
-			present[fileNr - 1] = 1;
 		}
 	}
-	closedir(d);
-	free(filePath);
-	if (res < 0) {
-		matrix_free(data, maxNr);
-		data = NULL;
+	return res;
+}
+
+/**
+ * Closes the files of a reconstruction.
+ * @param rec The reconstruction opened by open_reconstructed
+ * @return 0 if successful, otherwise -1 (out could not be closed)
+ */
+int close_reconstructed(struct crs_reconstruction *rec) {
+	int i;
+	int res = 0;
+
+	for (i = 0; i < rec->spec->k; i++) {
+		if (rec->fragmentFds[i] >= 0) {
+			close(rec->fragmentFds[i]);
+		}
+	}
+	if (rec->outFd >= 0 && close(rec->outFd) < 0) {
+		res = -1;
 	}
-	return data;
+	free(rec->fragmentFds);
+	return res;
 }
 
 /**
- * Repairs the data and coding matrices with the specified erasures given the encoding spec. Writes the repaired files
- * to the src directory.
- * @param src The directory of files to be repaired
- * @param data The data matrix
- * @param coding The coding matrix
- * @param spec The encoding spec
- * @param A NULL terminates array of missing file indices (0 = d1, 1 = d2, ..., k = c1, ..., k+m-1 = cm)
+ * Writes the original file to out from the whole data rows, see write_reconstructed_columns.
+ * @param src The directory containing the data files
+ * @param out The file to reconstruct, or - for stdout
+ * @param spec The encoding specification
+ * @param present The k + m flags of the files found by find_files
+ * @param data The data rows, the rows of missing data files rebuilt (others are not accessed)
+ * @return 0 if successful, otherwise -1
+ */
+int write_reconstructed(char *src, char *out, struct crs_encoding_spec *spec, int *present, char **data) {
+	int res;
+	struct crs_reconstruction rec;
+
+	if (open_reconstructed(src, out, spec, present, &rec) < 0) {
+		return -1;
+	}
+	res = write_reconstructed_columns(&rec, 0, spec->k, data, 0, spec->width);
+	if (close_reconstructed(&rec) < 0) {
+		res = -1;
+	}
+	return res;
+}
+
+/**
+ * Checks which of the data and coding files d1-d<k> and c1-c<m> exist in the src directory, without opening them.
+ * @param src The source directory
+ * @param spec The encoding specification
+ * @param present The k + m flags to fill (0 for missing, 1 for present)
  * @return 0 if successful, otherwise -1
  */
-int repair_files(char *src, char **data, char **coding, struct crs_encoding_spec *spec, int *erasures) {
+int find_files(char *src, struct crs_encoding_spec *spec, int *present) {
+	int i;
 	char *filePath;
-	int row;
-	int res = 0;
-	int i = 0;
+	struct stat fileStats;
 
 	int pathLen = strlen(src) + MAX_FILENAME_LENGTH + 2;
 	filePath = (char *) calloc(pathLen, sizeof(char));
@@ -245,71 +806,244 @@ int repair_files(char *src, char **data, char **coding, struct crs_encoding_spec
 		return -1;
 	}
 
-	while (erasures[i] != -1) {
-		row = erasures[i];
-		if (row < spec->k - 1) {
-			snprintf(filePath, pathLen, "%s/d%d", src, row + 1);
-			res = write_binary_bytes(data[row], spec->width, filePath);
-		} else if (row == spec->k - 1) {
-			snprintf(filePath, pathLen, "%s/d%d", src, row + 1);
-			res = write_binary_bytes(data[row], spec->width - spec->endPadding, filePath);
+	for (i = 0; i < spec->k + spec->m; i++) {
+		fragment_path(filePath, pathLen, src, spec, i);
+		present[i] = (stat(filePath, &fileStats) == 0 && S_ISREG(fileStats.st_mode));
+	}
+	free(filePath);
+	return 0;
+}
+
+/**
+ * Checks the size and checksum of one file.
+ * @param arg The verify_task
+ */
+static void verify_fragment(void *arg) {
+	struct verify_task *task = (struct verify_task *) arg;
+	int fd;
+	void *map;
+	struct stat fileStats;
+	uint32_t crc = 0;
+
+	task->corrupt = -1;
+	fd = open(task->filePath, O_RDONLY);
+	if (fd < 0 || fstat(fd, &fileStats) < 0) {
+		task->error = errno;
+		if (fd >= 0) {
+			close(fd);
+		}
+		return;
+	}
+
+	if ((size_t) fileStats.st_size != task->size) {
+		task->corrupt = 1;
+	} else if (task->size > 0) {
+		map = mmap(NULL, task->size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (map == MAP_FAILED) {
+			task->error = errno;
 		} else {
-			snprintf(filePath, pathLen, "%s/c%d", src, row - spec->k + 1);
-			res = write_binary_bytes(coding[row - spec->k], spec->width, filePath);
+			madvise(map, task->size, MADV_SEQUENTIAL);
+			crc = crc32c(0, map, task->size);
+			munmap(map, task->size);
+			task->corrupt = (crc != task->checksum);
 		}
-		fprintf(stdout, "\t%s\n", filePath);
-		if (res < 0) {
-			break;
+	} else {
+		task->corrupt = (crc != task->checksum);
+	}
+	close(fd);
+}
+
+/**
+ * Checks the present data and coding files against the checksums recorded in the spec. Each file is mapped and
+ * checksummed on a thread pool of up to MAX_IO_THREADS threads. A file of the wrong size or with the wrong checksum is
+ * reported on stderr and marked missing in present so it is decoded around. Nothing is checked if the spec has no
+ * checksums.
+ * @param src The source directory
+ * @param spec The encoding specification
+ * @param present The k + m flags of the files found by find_files, corrupt files are cleared
+ * @return The number of corrupt files, or -1 if the files could not be checked
+ */
+int verify_files(char *src, struct crs_encoding_spec *spec, int *present) {
+	int i, nrTasks, nrThreads;
+	int nrCorrupt = 0;
+	size_t pathLen;
+	char *filePaths;
+	struct verify_task *tasks;
+	struct crs_thread_pool *pool = NULL;
+	struct crs_task_group group;
+
+	if (spec->checksums == NULL) {
+		return 0;
+	}
+
+	pathLen = strlen(src) + MAX_FILENAME_LENGTH + 2;
+	filePaths = (char *) calloc((spec->k + spec->m) * pathLen, sizeof(char));
+	tasks = (struct verify_task *) calloc(spec->k + spec->m, sizeof(struct verify_task));
+	if (filePaths == NULL || tasks == NULL) {
+		free(filePaths);
+		free(tasks);
+		return -1;
+	}
+
+	nrTasks = 0;
+	for (i = 0; i < spec->k + spec->m; i++) {
+		if (present[i]) {
+			tasks[nrTasks].filePath = filePaths + i * pathLen;
+			fragment_path(tasks[nrTasks].filePath, pathLen, src, spec, i);
+			tasks[nrTasks].size = fragment_size(spec, i);
+			tasks[nrTasks].checksum = spec->checksums[i];
+			nrTasks++;
 		}
-		i++;
 	}
-	free(filePath);
-	return res;
+
+	nrThreads = (nrTasks < MAX_IO_THREADS) ? nrTasks : MAX_IO_THREADS;
+	if (nrThreads > 1) {
+		pool = thread_pool_create(nrThreads);
+	}
+	task_group_init(&group);
+	for (i = 0; i < nrTasks; i++) {
+		if (pool == NULL || thread_pool_submit(pool, &group, verify_fragment, &(tasks[i])) < 0) {
+			verify_fragment(&(tasks[i]));
+		}
+	}
+	if (pool != NULL) {
+		thread_pool_wait(pool, &group);
+		thread_pool_destroy(pool);
+	}
+
+	nrTasks = 0;
+	for (i = 0; i < spec->k + spec->m && nrCorrupt >= 0; i++) {
+		if (present[i] == 0) {
+			continue;
+		}
+		if (tasks[nrTasks].corrupt < 0) {
+			errno = tasks[nrTasks].error;
+			nrCorrupt = -1;
+		} else if (tasks[nrTasks].corrupt) {
+			fprintf(stderr, "Corrupt fragment: %s\n", tasks[nrTasks].filePath);
+			present[i] = 0;
+			nrCorrupt++;
+		}
+		nrTasks++;
+	}
+
+	free(filePaths);
+	free(tasks);
+	return nrCorrupt;
 }
 
 /**
- * @param rows The number of rows to allocate
- * @param columns The size of each row
- * @return the empty byte matrix
+ * Reads the same column slice (size bytes from offset) of the present data and coding files which have a row into
+ * their rows, all reads being submitted together. The part of the slice beyond the end of a file is zero filled.
+ * @param src The source directory
+ * @param spec The encoding specification
+ * @param present The k + m flags of the files found by find_files
+ * @param rows The k data rows followed by the m coding rows, each size bytes, NULL for files not to be read
+ * @param offset The offset of the slice in each file
+ * @param size The size of the slice
+ * @param io The io context to submit the reads on, or NULL to set one up for this call
+ * @return 0 if successful, otherwise -1
  */
-char **calloc_matrix(int rows, int columns) {
-	int i;
+int read_file_slices(char *src, struct crs_encoding_spec *spec, int *present, char **rows, size_t offset,
+		size_t size, struct crs_io_context *io) {
+	int i, row;
+	size_t fragmentSize, expected;
 	int res = 0;
-	char **matrix;
+	int nrRequests = 0;
+	int nrRows = spec->k + spec->m;
+	char *filePaths;
+	struct crs_io_request *requests;
 
-	matrix = (char **) malloc(rows * sizeof(char *));
-	if (matrix == NULL) {
-		return NULL;
+	int pathLen = strlen(src) + MAX_FILENAME_LENGTH + 2;
+	filePaths = (char *) calloc((size_t) nrRows * pathLen, sizeof(char));
+	requests = (struct crs_io_request *) calloc(nrRows, sizeof(struct crs_io_request));
+	if (filePaths == NULL || requests == NULL) {
+		free(filePaths);
+		free(requests);
+		return -1;
 	}
-	for (i = 0; i < rows; i++) {
-		matrix[i] = (char *) calloc(columns, sizeof(char));
-		if (matrix[i] == NULL) {
+
+	for (row = 0; row < nrRows; row++) {
+		if (present[row] && rows[row] != NULL) {
+			requests[nrRequests].op = IO_READ;
+			requests[nrRequests].filePath = filePaths + (size_t) row * pathLen;
+			requests[nrRequests].buf = rows[row];
+			requests[nrRequests].nrBytes = size;
+			requests[nrRequests].offset = (off_t) offset;
+			fragment_path(requests[nrRequests].filePath, pathLen, src, spec, row);
+			nrRequests++;
+		}
+	}
+
+	res = perform_io(io, requests, nrRequests);
+	for (i = 0; i < nrRequests && res == 0; i++) {
+		row = (int) ((requests[i].filePath - filePaths) / pathLen);
+		/* Only the part of the slice past the end of a fragment may be missing, anything shorter is truncated */
+		fragmentSize = fragment_size(spec, row);
+		expected = (offset < fragmentSize) ? fragmentSize - offset : 0;
+		expected = (expected < size) ? expected : size;
+		if (requests[i].result < 0 || (size_t) requests[i].result < expected) {
 			res = -1;
 			break;
 		}
-	}
-	if (res < 0) {
-		/* Failed, rewind */
-		for (i--; i >= 0; i--) {
-			free(matrix[i]);
+		if ((size_t) requests[i].result < size) {
+			memset(requests[i].buf + requests[i].result, 0, size - (size_t) requests[i].result);
 		}
-		free(matrix);
-		matrix = NULL;
 	}
-	return matrix;
+	free(filePaths);
+	free(requests);
+	return res;
 }
 
 /**
- * Frees the byte matrix, matrix, consisting of 'rows' rows.
- * @param matrix
- * @param rows
+ * Writes the same column slice (size bytes from offset) of the erased files from their rows to the src directory, the
+ * files being created, or truncated, by the slice at offset 0 (and their paths printed). The part of the slice beyond
+ * the end of a file is not written.
+ * @param src The directory of files to be repaired
+ * @param spec The encoding spec
+ * @param erasures A -1 terminated array of missing file indices (0 = d1, 1 = d2, ..., k = c1, ..., k+m-1 = cm)
+ * @param rows The k data rows followed by the m coding rows, each size bytes
+ * @param offset The offset of the slice in each file
+ * @param size The size of the slice
+ * @return 0 if successful, otherwise -1
  */
-void matrix_free(char **matrix, int rows) {
-	int i;
-	for (i = 0; i < rows; i++) {
-		free(matrix[i]);
+int write_file_slices(char *src, struct crs_encoding_spec *spec, int *erasures, char **rows, size_t offset,
+		size_t size) {
+	int i, fd, flags;
+	int res = 0;
+	size_t nrBytes, fileSize;
+	size_t pathLen;
+	char *filePath;
+
+	pathLen = strlen(src) + MAX_FILENAME_LENGTH + 2;
+	filePath = (char *) calloc(pathLen, sizeof(char));
+	if (filePath == NULL) {
+		return -1;
+	}
+
+	flags = O_WRONLY | O_CREAT | ((offset == 0) ? O_TRUNC : 0);
+	for (i = 0; erasures[i] != -1 && res == 0; i++) {
+		fragment_path(filePath, pathLen, src, spec, erasures[i]);
+		fileSize = fragment_size(spec, erasures[i]);
+		nrBytes = (offset >= fileSize) ? 0 : (fileSize - offset < size) ? fileSize - offset : size;
+		if (nrBytes == 0 && offset > 0) {
+			continue;
+		}
+		if (offset == 0) {
+			fprintf(stdout, "\t%s\n", filePath);
+		}
+		fd = open(filePath, flags, 0666);
+		if (fd < 0) {
+			res = -1;
+			break;
+		}
+		res = write_fd_bytes(fd, rows[erasures[i]], nrBytes, (off_t) offset);
+		if (close(fd) < 0) {
+			res = -1;
+		}
 	}
-	free(matrix);
+	free(filePath);
+	return res;
 }
 
 /**
@@ -344,3 +1078,50 @@ int str2int(char *str, int *i) {
 	return 0;
 }
 
+/**
+ * Converts a null terminated array of characters to a size in bytes. An optional K, M or G suffix multiplies the
+ * value by 1024, 1024^2 or 1024^3.
+ * @param str The array of characters to be read.
+ * @param size A pointer specifying where the conversion should be stored.
+ * @return 0 if the conversion was successful, otherwise -1.
+ */
+int str2size(char *str, size_t *size) {
+	unsigned long long l;
+	unsigned long long multiplier = 1;
+	char *pEnd;
+
+	if (str == NULL || *str == '-') {
+		return -1;
+	}
+
+	errno = 0;
+
+	l = strtoull(str, &pEnd, 10);
+	if (pEnd == str || errno == ERANGE) {
+		return -1;
+	}
+	switch (*pEnd) {
+	case '\0':
+		break;
+	case 'K':
+	case 'k':
+		multiplier = 1ULL << 10;
+		pEnd++;
+		break;
+	case 'M':
+		multiplier = 1ULL << 20;
+		pEnd++;
+		break;
+	case 'G':
+		multiplier = 1ULL << 30;
+		pEnd++;
+		break;
+	default:
+		return -1;
+	}
+	if (*pEnd != '\0' || l > SIZE_MAX / multiplier) {
+		return -1;
+	}
+	*size = (size_t) (l * multiplier);
+	return 0;
+}
@@ -2,12 +2,26 @@
 #define CRS_FILE_IO_H_
 
 #include <stdio.h>
+#include <sys/types.h>
 #include "crs_spec_io.h"
+#include "crs_async_io.h"
 
 #define MAX_K 9999
 #define MAX_M MAX_K
 #define MAX_FILENAME_LENGTH 5 /* d1, ..., d9999 && c1, ..., c9999 */
 
+/* Buffer used to copy between files the kernel can not copy between */
+#define BOUNCE_BUFFER_SIZE (256 * 1024)
+
+/* The original file being written from its data files by a reconstruct */
+struct crs_reconstruction {
+	struct crs_encoding_spec *spec;
+	size_t fileSize;
+	int outFd;
+	int stream;       /* 1 if out is not a regular file, and so is written in order */
+	int *fragmentFds; /* The k data files, -1 for missing ones */
+};
+
 /**
  * Fills the size pointer with the size of the file at filePath
  * @param filePath The path to the file
@@ -17,60 +31,183 @@
 int get_file_size(char *filePath, size_t *size);
 
 /**
- * Converts the file to a data matrix given the specification, spec
+ * Tells whether a file can only be read in order, its size being unknown until its end.
+ * @param filePath The path to the file, - for stdin
+ * @return 1 if the path is - or names a pipe, socket or device, otherwise 0
+ */
+int is_stream(char *filePath);
+
+/**
+ * Reads the file into the data matrix given the specification, spec. Only the padding at the end of the last row is
+ * zeroed, the rest of the matrix is overwritten by the file.
  * @param src The path to the file
  * @param spec The specification to use
- * @return The resulting data matrix, or NULL if unsuccessful
+ * @param data The data matrix to fill (k rows of width bytes)
+ * @return 0 if successful, otherwise -1
  */
-char **file2data_matrix(char *src, struct crs_encoding_spec *spec);
+int file2data_matrix(char *src, struct crs_encoding_spec *spec, char **data);
 
 /**
- * @param rows The number of rows to allocate
- * @param columns The size of each row
- * @return the empty byte matrix
+ * Checks which of the data and coding files d1-d<k> and c1-c<m> exist in the src directory, without opening them.
+ * @param src The source directory
+ * @param spec The encoding specification
+ * @param present The k + m flags to fill (0 for missing, 1 for present)
+ * @return 0 if successful, otherwise -1
  */
-char **calloc_matrix(int rows, int columns);
+int find_files(char *src, struct crs_encoding_spec *spec, int *present);
 
 /**
- * Frees the byte matrix, matrix, consisting of 'rows' rows.
- * @param matrix
- * @param rows
+ * Checks the present data and coding files against the checksums recorded in the spec. Each file is mapped and
+ * checksummed on a thread pool of up to MAX_IO_THREADS threads. A file of the wrong size or with the wrong checksum is
+ * reported on stderr and marked missing in present so it is decoded around. Nothing is checked if the spec has no
+ * checksums.
+ * @param src The source directory
+ * @param spec The encoding specification
+ * @param present The k + m flags of the files found by find_files, corrupt files are cleared
+ * @return The number of corrupt files, or -1 if the files could not be checked
  */
-void matrix_free(char **matrix, int rows);
+int verify_files(char *src, struct crs_encoding_spec *spec, int *present);
 
 /**
- * Reads maxNr of files from the src directory which begin with the given prefix character followed by a number.
- * The present array is updated with 1s for each file found. Used to read the data and coding files d1-d<k> and c1-c<m>.
+ * Reads the same column slice (size bytes from offset) of the present data and coding files which have a row into
+ * their rows, all reads being submitted together. The part of the slice beyond the end of a file is zero filled.
  * @param src The source directory
- * @param maxNr The maximum number of files to read (k for data files, m for coding files)
- * @param fileSize The expected size of the files (the width of the matrix)
- * @param prefix The character prefix (d for data files and c for coding files)
- * @param present The empty binary array (filled with 0 for missing, 1 for present)
- * @return A matrix of maxNr rows and fileSize columns containing the files read
+ * @param spec The encoding specification
+ * @param present The k + m flags of the files found by find_files
+ * @param rows The k data rows followed by the m coding rows, each size bytes, NULL for files not to be read
+ * @param offset The offset of the slice in each file
+ * @param size The size of the slice
+ * @param io The io context to submit the reads on, or NULL to set one up for this call
+ * @return 0 if successful, otherwise -1
  */
-char **read_files(char *src, int maxNr, size_t fileSize, char prefix, int *present);
+int read_file_slices(char *src, struct crs_encoding_spec *spec, int *present, char **rows, size_t offset,
+		size_t size, struct crs_io_context *io);
 
 /**
- * Repairs the data and coding matrices with the specified erasures given the encoding spec. Writes the repaired files
- * to the src directory.
+ * Writes the same column slice (size bytes from offset) of the erased files from their rows to the src directory, the
+ * files being created, or truncated, by the slice at offset 0 (and their paths printed). The part of the slice beyond
+ * the end of a file is not written.
  * @param src The directory of files to be repaired
- * @param data The data matrix
- * @param coding The coding matrix
  * @param spec The encoding spec
- * @param A NULL terminates array of missing file indices (0 = d1, 1 = d2, ..., k = c1, ..., k+m-1 = cm)
+ * @param erasures A -1 terminated array of missing file indices (0 = d1, 1 = d2, ..., k = c1, ..., k+m-1 = cm)
+ * @param rows The k data rows followed by the m coding rows, each size bytes
+ * @param offset The offset of the slice in each file
+ * @param size The size of the slice
  * @return 0 if successful, otherwise -1
  */
-int repair_files(char *src, char **data, char **coding, struct crs_encoding_spec *spec, int *erasures);
+int write_file_slices(char *src, struct crs_encoding_spec *spec, int *erasures, char **rows, size_t offset,
+		size_t size);
 
 /**
- * Writes the data in the data and coding matrices to files in the dest directory.
+ * Maps the file at src read only and points the data rows lying wholly within the file into the mapping, so they are
+ * not copied. The remaining data rows (the last, padded, row) are copied into the tail buffers and zero padded.
+ * @param src The path to the file
+ * @param spec The specification to use
+ * @param data The k data row pointers to set
+ * @param tail Buffers of width bytes for the data rows not wholly within the file (see mapped_rows)
+ * @param map Where the start of the mapping is stored (NULL for an empty file)
+ * @param mapSize Where the size of the mapping is stored, for munmap
+ * @return 0 if successful, otherwise -1
+ */
+int map_data_matrix(char *src, struct crs_encoding_spec *spec, char **data, char **tail, void **map,
+		size_t *mapSize);
+
+/**
+ * @param spec The encoding specification
+ * @param fileSize The size of the file being encoded
+ * @return The number of data rows lying wholly within the file
+ */
+int mapped_rows(struct crs_encoding_spec *spec, size_t fileSize);
+
+/**
+ * Writes the data in the data and coding matrices to files in the dest directory. With a contiguous layout the data
+ * files are byte ranges of the source file, so when src is given they are cloned or copied inside the kernel and only
+ * the coding files pass through user memory. The data matrix is written instead where the kernel copy is unsupported.
  * @param data The data matrix
  * @param coding The coding matrix
  * @param spec The encoding specification
  * @param dest The destination directory
+ * @param src The encoded file, or NULL to write the data files from the data matrix
+ * @return 0 if successful, otherwise -1
+ */
+int write_files(char **data, char **coding, struct crs_encoding_spec *spec, char *dest, char *src);
+
+/**
+ * Creates the dest directory and writes the spec file to it.
+ * @param dest The destination directory
+ * @param spec The encoding specification
+ * @return 0 if successful, otherwise -1
+ */
+int create_fragment_dir(char *dest, struct crs_encoding_spec *spec);
+
+/**
+ * Writes the spec file of the fragment directory dest, replacing any spec file already there atomically: the new spec
+ * is renamed over the old one and the directory is synced, so the spec is either the old or the new one after a crash.
+ * @param dest The destination directory
+ * @param spec The encoding specification
+ * @return 0 if successful, otherwise -1
+ */
+int write_fragment_spec(char *dest, struct crs_encoding_spec *spec);
+
+/**
+ * Reads the spec file of the fragment directory src.
+ * @param src The directory containing the data, coding and spec files
+ * @param spec Where the spec file should be read into
+ * @return 0 if successful, otherwise -1
+ */
+int read_fragment_spec(char *src, struct crs_encoding_spec *spec);
+
+/**
+ * Reads the next stripe of the file f into the data matrix. Each of the k rows receives spec->stripeWidth bytes, the
+ * part of the stripe beyond the end of the file is zero filled.
+ * @param f The file being encoded
+ * @param data The data matrix (k rows of stripeWidth bytes)
+ * @param spec The encoding specification
+ * @param nrRead Where the number of bytes read from f should be stored, or NULL
+ * @return 0 if successful, otherwise -1
+ */
+int read_stripe(FILE *f, char **data, struct crs_encoding_spec *spec, size_t *nrRead);
+
+/**
+ * Creates (truncating) the data and coding files in the dest directory, to be written stripe by stripe.
+ * @param dest The destination directory, created by create_fragment_dir
+ * @param spec The encoding specification
+ * @param fds The k + m descriptors to fill (d1, ..., dk, c1, ..., cm), all -1 if unsuccessful
  * @return 0 if successful, otherwise -1
  */
-int write_files(char **data, char **coding, struct crs_encoding_spec *spec, char *dest);
+int create_fragment_files(char *dest, struct crs_encoding_spec *spec, int *fds);
+
+/**
+ * Closes the descriptors opened by create_fragment_files.
+ * @param spec The encoding specification
+ * @param fds The k + m descriptors, -1 for files not open; all are set to -1
+ * @return 0 if successful, otherwise -1 (a write may have failed)
+ */
+int close_fragment_files(struct crs_encoding_spec *spec, int *fds);
+
+/**
+ * Writes one encoded stripe to the data and coding files, at the offset of the stripe in each file. The k + m writes
+ * are submitted together (see perform_io).
+ * @param data The data matrix (k rows of stripeWidth bytes)
+ * @param coding The coding matrix (m rows of stripeWidth bytes)
+ * @param spec The encoding specification
+ * @param fds The k + m descriptors from create_fragment_files
+ * @param stripe The index of the stripe
+ * @param io The io context to submit the writes on, or NULL to set one up for this call
+ * @return 0 if successful, otherwise -1
+ */
+int write_stripe(char **data, char **coding, struct crs_encoding_spec *spec, int *fds, size_t stripe,
+		struct crs_io_context *io);
+
+/**
+ * Gives the size of a data or coding file. With a contiguous layout the data files are trimmed to the end of the source
+ * file (the end padding of a file smaller than k words may leave several data files short or empty), with a striped
+ * layout the padding is spread over the last stripe so every file is spec->width bytes.
+ * @param spec The encoding specification
+ * @param row The file index (0 = d1, 1 = d2, ..., k = c1, ..., k+m-1 = cm)
+ * @return The size of the file in bytes
+ */
+size_t fragment_size(struct crs_encoding_spec *spec, int row);
 
 /**
  * Writes nrBytes of data to a file at filePath
@@ -81,6 +218,95 @@ int write_files(char **data, char **coding, struct crs_encoding_spec *spec, char
  */
 int write_binary_bytes(void *data, size_t nrBytes, char *filePath);
 
+/**
+ * Reads the whole file at filePath into an allocated buffer.
+ * @param filePath The file path to read, or - for stdin
+ * @param data Where the allocated buffer should be stored, to be freed by the caller
+ * @param nrBytes Where the number of bytes read should be stored
+ * @return 0 if successful, otherwise -1
+ */
+int read_binary_bytes(char *filePath, char **data, size_t *nrBytes);
+
+/**
+ * Copies nrBytes of srcFd, starting at srcOffset, to a new file at filePath without passing through user memory. The
+ * range is cloned with FICLONERANGE on reflink capable filesystems, otherwise copied with copy_file_range.
+ * @param srcFd The file to copy from
+ * @param srcOffset The offset of the range in srcFd
+ * @param nrBytes The number of bytes to copy
+ * @param filePath The file path to write to
+ * @return 0 if successful, otherwise -1 (the caller should fall back to writing the bytes itself)
+ */
+int copy_file_bytes(int srcFd, off_t srcOffset, size_t nrBytes, char *filePath);
+
+/**
+ * Copies nrBytes of srcFd, starting at srcOffset, to destFd at destOffset without passing through user memory, cloning
+ * the range with FICLONERANGE when possible and copying it with copy_file_range otherwise.
+ * @param srcFd The file to copy from
+ * @param srcOffset The offset of the range in srcFd
+ * @param destFd The file to copy to
+ * @param destOffset The offset of the range in destFd
+ * @param nrBytes The number of bytes to copy
+ * @return 0 if successful, otherwise -1 (the caller should fall back to copying the bytes itself)
+ */
+int copy_file_range_bytes(int srcFd, off_t srcOffset, int destFd, off_t destOffset, size_t nrBytes);
+
+/**
+ * Writes nrBytes of data to the open file fd at offset.
+ * @param fd The file to write to
+ * @param data The data to write
+ * @param nrBytes The number of bytes to write
+ * @param offset The offset in the file, or -1 to write at the current position (for pipes)
+ * @return 0 if successful, otherwise -1
+ */
+int write_fd_bytes(int fd, void *data, size_t nrBytes, off_t offset);
+
+/**
+ * Opens out to write the original file to, along with the present data files copied into it. Nothing is written to the
+ * src directory. An out which is not a regular file (a pipe, or - for stdout) is written in order, without seeking.
+ * @param src The directory containing the data files
+ * @param out The file to reconstruct, or - for stdout
+ * @param spec The encoding specification
+ * @param present The k + m flags of the files found by find_files
+ * @param rec The reconstruction to fill, closed with close_reconstructed
+ * @return 0 if successful, otherwise -1
+ */
+int open_reconstructed(char *src, char *out, struct crs_encoding_spec *spec, int *present, struct crs_reconstruction *rec);
+
+/**
+ * Writes the bytes of the original file held by columns [offset, offset + size) of the data rows [firstRow, lastRow).
+ * Present data files are copied inside the kernel (through a bounce buffer where the kernel can not copy between the
+ * files), the rows of missing data files are written from data. Each data file contributes one chunk per stripe, a
+ * contiguous layout being a single stripe of width bytes, and the chunks are written stripe by stripe, so a stream is
+ * written in order when the columns hold whole stripes of every row, or a single row from its start.
+ * @param rec The reconstruction opened by open_reconstructed
+ * @param firstRow The first data row to write
+ * @param lastRow The data row after the last one to write
+ * @param data The slices of the data rows, columns [offset, offset + size) (rows of present data files are not accessed)
+ * @param offset The first column to write
+ * @param size The number of columns to write
+ * @return 0 if successful, otherwise -1
+ */
+int write_reconstructed_columns(struct crs_reconstruction *rec, int firstRow, int lastRow, char **data, size_t offset,
+		size_t size);
+
+/**
+ * Closes the files of a reconstruction.
+ * @param rec The reconstruction opened by open_reconstructed
+ * @return 0 if successful, otherwise -1 (out could not be closed)
+ */
+int close_reconstructed(struct crs_reconstruction *rec);
+
+/**
+ * Writes the original file to out from the whole data rows, see write_reconstructed_columns.
+ * @param src The directory containing the data files
+ * @param out The file to reconstruct, or - for stdout
+ * @param spec The encoding specification
+ * @param present The k + m flags of the files found by find_files
+ * @param data The data rows, the rows of missing data files rebuilt (others are not accessed)
+ * @return 0 if successful, otherwise -1
+ */
+int write_reconstructed(char *src, char *out, struct crs_encoding_spec *spec, int *present, char **data);
+
 /**
  * Converts a null terminated array of characters to an integer.
  * @param str The array of characters to be read.
@@ -92,4 +318,13 @@ int write_binary_bytes(void *data, size_t nrBytes, char *filePath);
  */
 int str2int(char *str, int *i);
 
+/**
+ * Converts a null terminated array of characters to a size in bytes. An optional K, M or G suffix multiplies the
+ * value by 1024, 1024^2 or 1024^3.
+ * @param str The array of characters to be read.
+ * @param size A pointer specifying where the conversion should be stored.
+ * @return 0 if the conversion was successful, otherwise -1.
+ */
+int str2size(char *str, size_t *size);
+
 #endif /* CRS_FILE_IO_H_ */
@@ -0,0 +1,298 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <galois.h>
+#include "crs_gf8.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define CRS_GF8_SIMD
+#include <immintrin.h>
+#endif
+
+/* Bytes of every region multiplied before moving on to the next output, so the inputs stay in the L1 cache */
+#define GF8_BLOCK_SIZE 4096
+
+/* Each element has a table of its products with the low nibbles, then one with the high nibbles, both 16 entries
+ * repeated to fill a 512 bit vector */
+#define GF8_NIBBLE_TABLE 64
+#define GF8_TABLE_SIZE (2 * GF8_NIBBLE_TABLE)
+
+struct crs_gf8_matrix {
+	int rows;
+	int cols;
+	unsigned char *tables; /* rows * cols tables of GF8_TABLE_SIZE bytes, row by row */
+};
+
+static size_t (*mulRow)(struct crs_gf8_matrix *gm, int row, char **in, char *out, size_t start, size_t stop);
+static const char *gf8Name;
+static pthread_once_t gf8Once = PTHREAD_ONCE_INIT;
+
+/**
+ * Multiplies one row of the matrix over bytes [start, stop) one byte at a time with the nibble tables.
+ * @return stop
+ */
+static size_t mul_row_scalar(struct crs_gf8_matrix *gm, int row, char **in, char *out, size_t start, size_t stop) {
+	int j;
+	size_t pos;
+	unsigned char acc, byte;
+	unsigned char *table;
+
+	for (pos = start; pos < stop; pos++) {
+		acc = 0;
+		table = gm->tables + (size_t) row * gm->cols * GF8_TABLE_SIZE;
+		for (j = 0; j < gm->cols; j++) {
+			byte = (unsigned char) in[j][pos];
+			acc ^= table[byte & 0x0F] ^ table[GF8_NIBBLE_TABLE + (byte >> 4)];
+			table += GF8_TABLE_SIZE;
+		}
+		out[pos] = (char) acc;
+	}
+	return stop;
+}
+
+#ifdef CRS_GF8_SIMD
+/**
+ * Multiplies one row of the matrix 16 bytes at a time with SSSE3 byte shuffles.
+ * @return The first byte not multiplied
+ */
+__attribute__((target("ssse3")))
+static size_t mul_row_ssse3(struct crs_gf8_matrix *gm, int row, char **in, char *out, size_t start, size_t stop) {
+	int j;
+	size_t pos;
+	unsigned char *table;
+	__m128i acc, x;
+	__m128i mask = _mm_set1_epi8(0x0F);
+
+	for (pos = start; pos + sizeof(__m128i) <= stop; pos += sizeof(__m128i)) {
+		acc = _mm_setzero_si128();
+		table = gm->tables + (size_t) row * gm->cols * GF8_TABLE_SIZE;
+		for (j = 0; j < gm->cols; j++) {
+			x = _mm_loadu_si128((__m128i *) (in[j] + pos));
+			acc = _mm_xor_si128(acc, _mm_shuffle_epi8(_mm_load_si128((__m128i *) table), _mm_and_si128(x, mask)));
+			acc = _mm_xor_si128(acc, _mm_shuffle_epi8(_mm_load_si128((__m128i *) (table + GF8_NIBBLE_TABLE)),
+					_mm_and_si128(_mm_srli_epi64(x, 4), mask)));
+			table += GF8_TABLE_SIZE;
+		}
+		_mm_storeu_si128((__m128i *) (out + pos), acc);
+	}
+	return pos;
+}
+
+/**
+ * Multiplies one row of the matrix 64 bytes at a time with AVX2 byte shuffles.
+ * @return The first byte not multiplied
+ */
+__attribute__((target("avx2")))
+static size_t mul_row_avx2(struct crs_gf8_matrix *gm, int row, char **in, char *out, size_t start, size_t stop) {
+	int j;
+	size_t pos;
+	unsigned char *table;
+	__m256i acc0, acc1, x0, x1, lo, hi;
+	__m256i mask = _mm256_set1_epi8(0x0F);
+
+	for (pos = start; pos + 2 * sizeof(__m256i) <= stop; pos += 2 * sizeof(__m256i)) {
+		acc0 = _mm256_setzero_si256();
+		acc1 = _mm256_setzero_si256();
+		table = gm->tables + (size_t) row * gm->cols * GF8_TABLE_SIZE;
+		for (j = 0; j < gm->cols; j++) {
+			lo = _mm256_load_si256((__m256i *) table);
+			hi = _mm256_load_si256((__m256i *) (table + GF8_NIBBLE_TABLE));
+			x0 = _mm256_loadu_si256((__m256i *) (in[j] + pos));
+			x1 = _mm256_loadu_si256((__m256i *) (in[j] + pos + 32));
+			acc0 = _mm256_xor_si256(acc0, _mm256_shuffle_epi8(lo, _mm256_and_si256(x0, mask)));
+			acc0 = _mm256_xor_si256(acc0, _mm256_shuffle_epi8(hi, _mm256_and_si256(_mm256_srli_epi64(x0, 4), mask)));
+			acc1 = _mm256_xor_si256(acc1, _mm256_shuffle_epi8(lo, _mm256_and_si256(x1, mask)));
+			acc1 = _mm256_xor_si256(acc1, _mm256_shuffle_epi8(hi, _mm256_and_si256(_mm256_srli_epi64(x1, 4), mask)));
+			table += GF8_TABLE_SIZE;
+		}
+		_mm256_storeu_si256((__m256i *) (out + pos), acc0);
+		_mm256_storeu_si256((__m256i *) (out + pos + 32), acc1);
+	}
+	return pos;
+}
+
+/**
+ * Multiplies one row of the matrix 128 bytes at a time with AVX-512BW byte shuffles.
+ * @return The first byte not multiplied
+ */
+__attribute__((target("avx512f,avx512bw")))
+static size_t mul_row_avx512(struct crs_gf8_matrix *gm, int row, char **in, char *out, size_t start, size_t stop) {
+	int j;
+	size_t pos;
+	unsigned char *table;
+	__m512i acc0, acc1, x0, x1, lo, hi;
+	__m512i mask = _mm512_set1_epi8(0x0F);
+
+	for (pos = start; pos + 2 * sizeof(__m512i) <= stop; pos += 2 * sizeof(__m512i)) {
+		acc0 = _mm512_setzero_si512();
+		acc1 = _mm512_setzero_si512();
+		table = gm->tables + (size_t) row * gm->cols * GF8_TABLE_SIZE;
+		for (j = 0; j < gm->cols; j++) {
+			lo = _mm512_load_si512(table);
+			hi = _mm512_load_si512(table + GF8_NIBBLE_TABLE);
+			x0 = _mm512_loadu_si512(in[j] + pos);
+			x1 = _mm512_loadu_si512(in[j] + pos + 64);
+			acc0 = _mm512_xor_si512(acc0, _mm512_shuffle_epi8(lo, _mm512_and_si512(x0, mask)));
+			acc0 = _mm512_xor_si512(acc0, _mm512_shuffle_epi8(hi, _mm512_and_si512(_mm512_srli_epi64(x0, 4), mask)));
+			acc1 = _mm512_xor_si512(acc1, _mm512_shuffle_epi8(lo, _mm512_and_si512(x1, mask)));
+			acc1 = _mm512_xor_si512(acc1, _mm512_shuffle_epi8(hi, _mm512_and_si512(_mm512_srli_epi64(x1, 4), mask)));
+			table += GF8_TABLE_SIZE;
+		}
+		_mm512_storeu_si512(out + pos, acc0);
+		_mm512_storeu_si512(out + pos + 64, acc1);
+	}
+	return pos;
+}
+#endif
+
+/**
+ * Picks the widest multiplication kernel the CPU supports.
+ */
+static void init_gf8(void) {
+	mulRow = mul_row_scalar;
+	gf8Name = "scalar";
+#ifdef CRS_GF8_SIMD
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512bw")) {
+		mulRow = mul_row_avx512;
+		gf8Name = "avx512";
+	} else if (__builtin_cpu_supports("avx2")) {
+		mulRow = mul_row_avx2;
+		gf8Name = "avx2";
+	} else if (__builtin_cpu_supports("ssse3")) {
+		mulRow = mul_row_ssse3;
+		gf8Name = "ssse3";
+	}
+#endif
+}
+
+/**
+ * Compiles a matrix of GF(2^8) elements into multiplication tables.
+ * @param matrix The rows x cols elements, row by row
+ * @param rows The number of rows (output regions)
+ * @param cols The number of columns (input regions)
+ * @return The compiled matrix, or NULL if unsuccessful
+ */
+struct crs_gf8_matrix *gf8_compile_matrix(int *matrix, int rows, int cols) {
+	int i, x;
+	unsigned char *table;
+	struct crs_gf8_matrix *gm;
+
+	gm = (struct crs_gf8_matrix *) malloc(sizeof(struct crs_gf8_matrix));
+	if (gm == NULL) {
+		return NULL;
+	}
+	gm->rows = rows;
+	gm->cols = cols;
+	if (posix_memalign((void **) &(gm->tables), GF8_NIBBLE_TABLE, (size_t) rows * cols * GF8_TABLE_SIZE) != 0) {
+		free(gm);
+		return NULL;
+	}
+
+	for (i = 0; i < rows * cols; i++) {
+		table = gm->tables + (size_t) i * GF8_TABLE_SIZE;
+		for (x = 0; x < GF8_NIBBLE_TABLE; x++) {
+			table[x] = (unsigned char) galois_single_multiply(matrix[i], x & 0x0F, 8);
+			table[GF8_NIBBLE_TABLE + x] = (unsigned char) galois_single_multiply(matrix[i], (x & 0x0F) << 4, 8);
+		}
+	}
+	return gm;
+}
+
+/**
+ * Frees a compiled matrix.
+ * @param gm The compiled matrix, may be NULL
+ */
+void gf8_free_matrix(struct crs_gf8_matrix *gm) {
+	if (gm == NULL) {
+		return;
+	}
+	free(gm->tables);
+	free(gm);
+}
+
+/**
+ * Multiplies the matrix by the input regions over bytes [offset, offset + size): out[i] = sum over j of
+ * matrix[i][j] * in[j]. Each output is accumulated in registers and written once. The kernel is picked once from the
+ * CPU: AVX-512BW, AVX2 or SSSE3 byte shuffles, or table lookups.
+ * @param gm The compiled matrix
+ * @param in The cols input regions
+ * @param out The rows output regions, none overlapping an input
+ * @param offset The offset of the bytes to multiply in every region
+ * @param size The number of bytes to multiply
+ */
+void gf8_multiply(struct crs_gf8_matrix *gm, char **in, char **out, size_t offset, size_t size) {
+	int i;
+	size_t block, stop, done;
+
+	pthread_once(&gf8Once, init_gf8);
+	for (block = offset; block < offset + size; block += GF8_BLOCK_SIZE) {
+		stop = (offset + size - block < GF8_BLOCK_SIZE) ? offset + size : block + GF8_BLOCK_SIZE;
+		for (i = 0; i < gm->rows; i++) {
+			done = mulRow(gm, i, in, out[i], block, stop);
+			mul_row_scalar(gm, i, in, out[i], done, stop);
+		}
+	}
+}
+
+/**
+ * Inverts a square GF(2^8) matrix by Gauss-Jordan elimination.
+ * @param matrix The n x n matrix, destroyed
+ * @param inverse The n x n elements to fill with the inverse
+ * @param n The size of the matrix
+ * @return 0 if successful, otherwise -1 (the matrix is singular)
+ */
+int gf8_invert_matrix(int *matrix, int *inverse, int n) {
+	int i, j, r, tmp, factor;
+
+	for (i = 0; i < n * n; i++) {
+		inverse[i] = (i / n == i % n);
+	}
+
+	for (i = 0; i < n; i++) {
+		/* Swap a row with a non zero pivot into place */
+		for (r = i; r < n && matrix[r * n + i] == 0; r++) {
+		}
+		if (r == n) {
+			return -1;
+		}
+		for (j = 0; r != i && j < n; j++) {
+			tmp = matrix[i * n + j];
+			matrix[i * n + j] = matrix[r * n + j];
+			matrix[r * n + j] = tmp;
+			tmp = inverse[i * n + j];
+			inverse[i * n + j] = inverse[r * n + j];
+			inverse[r * n + j] = tmp;
+		}
+
+		/* Scale the pivot to 1 */
+		factor = galois_single_divide(1, matrix[i * n + i], 8);
+		for (j = 0; j < n; j++) {
+			matrix[i * n + j] = galois_single_multiply(matrix[i * n + j], factor, 8);
+			inverse[i * n + j] = galois_single_multiply(inverse[i * n + j], factor, 8);
+		}
+
+		/* Clear the pivot column from every other row */
+		for (r = 0; r < n; r++) {
+			factor = matrix[r * n + i];
+			if (r == i || factor == 0) {
+				continue;
+			}
+			for (j = 0; j < n; j++) {
+				matrix[r * n + j] ^= galois_single_multiply(factor, matrix[i * n + j], 8);
+				inverse[r * n + j] ^= galois_single_multiply(factor, inverse[i * n + j], 8);
+			}
+		}
+	}
+	return 0;
+}
+
+/**
+ * Gives the name of the multiplication kernel picked for this CPU.
+ * @return "avx512", "avx2", "ssse3" or "scalar"
+ */
+const char *gf8_kernel_name(void) {
+	pthread_once(&gf8Once, init_gf8);
+	return gf8Name;
+}
@@ -0,0 +1,53 @@
+#ifndef CRS_GF8_H_
+#define CRS_GF8_H_
+
+#include <stddef.h>
+
+/**
+ * A GF(2^8) matrix compiled into split nibble multiplication tables, one pair of 16 entry tables per element
+ */
+struct crs_gf8_matrix;
+
+/**
+ * Compiles a matrix of GF(2^8) elements into multiplication tables.
+ * @param matrix The rows x cols elements, row by row
+ * @param rows The number of rows (output regions)
+ * @param cols The number of columns (input regions)
+ * @return The compiled matrix, or NULL if unsuccessful
+ */
+struct crs_gf8_matrix *gf8_compile_matrix(int *matrix, int rows, int cols);
+
+/**
+ * Frees a compiled matrix.
+ * @param gm The compiled matrix, may be NULL
+ */
+void gf8_free_matrix(struct crs_gf8_matrix *gm);
+
+/**
+ * Multiplies the matrix by the input regions over bytes [offset, offset + size): out[i] = sum over j of
+ * matrix[i][j] * in[j]. Each output is accumulated in registers and written once. The kernel is picked once from the
+ * CPU: AVX-512BW, AVX2 or SSSE3 byte shuffles, or table lookups.
+ * @param gm The compiled matrix
+ * @param in The cols input regions
+ * @param out The rows output regions, none overlapping an input
+ * @param offset The offset of the bytes to multiply in every region
+ * @param size The number of bytes to multiply
+ */
+void gf8_multiply(struct crs_gf8_matrix *gm, char **in, char **out, size_t offset, size_t size);
+
+/**
+ * Inverts a square GF(2^8) matrix by Gauss-Jordan elimination.
+ * @param matrix The n x n matrix, destroyed
+ * @param inverse The n x n elements to fill with the inverse
+ * @param n The size of the matrix
+ * @return 0 if successful, otherwise -1 (the matrix is singular)
+ */
+int gf8_invert_matrix(int *matrix, int *inverse, int n);
+
+/**
+ * Gives the name of the multiplication kernel picked for this CPU.
+ * @return "avx512", "avx2", "ssse3" or "scalar"
+ */
+const char *gf8_kernel_name(void);
+
+#endif /* CRS_GF8_H_ */
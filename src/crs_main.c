@@ -0,0 +1,202 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include "crs_file_io.h"
+#include "crs_schedule.h"
+#include "crs_thread_pool.h"
+#include "crs_stats.h"
+#include "crs_erasure_codes.h"
+#include "crs_batch.h"
+#include "crs_command.h"
+#include "crs_server.h"
+
+/**
+ * Prints the usage to stdout.
+ * @param progName The name of the program binary
+ */
+static void print_usage(char *progName) {
+	fprintf(stdout, "Usage:\n");
+	fprintf(stdout, "\t%s [options] [src] [dest]\n", progName);
+	fprintf(stdout, "Options:\n");
+	fprintf(stdout, "\t-e\t encode, a src of - (stdin) or a pipe is encoded in stripes as it is read\n");
+	fprintf(stdout, "\t-d\t decode (when decoding only the source folder is required)\n");
+	fprintf(stdout, "\t-r\t reconstruct the original file to the given path (- for stdout) from the source folder,\n"
+			"\t\t which is left untouched\n");
+	fprintf(stdout, "\t-R, --range\t with -r, only reconstruct the given offset:length byte range of the file, K, M\n"
+			"\t\t and G suffixes are accepted\n");
+	fprintf(stdout, "\t-u, --update\t replace the bytes of the original file from the given offset with the contents of\n"
+			"\t\t src (- for stdin) in the dest folder, patching the coding files in place; K, M and G suffixes are\n"
+			"\t\t accepted\n");
+	fprintf(stdout, "\t-V, --verify\t check the fragments against the checksums in the spec, with -d or -r corrupt\n"
+			"\t\t fragments are decoded like missing ones\n");
+	fprintf(stdout, "\t-k\t the number of data files (when encoding only) 1 < k < %d\n", MAX_K + 1);
+	fprintf(stdout, "\t-m\t the number of coding files (when encoding only) 1 < m < %d\n", MAX_M + 1);
+	fprintf(stdout, "\t-t\t the number of threads to encode or decode with 1 <= t <= %d\n", MAX_THREADS);
+	fprintf(stdout, "\t-p, --packetsize\t the packet size in bytes, a multiple of %d (when encoding only)\n",
+			(int) sizeof(long));
+	fprintf(stdout, "\t-a, --autotune\t measure the fastest packet size on this machine before encoding\n");
+	fprintf(stdout, "\t-E, --engine\t the coding engine (when encoding only): crs, cauchy reed-solomon with XOR\n"
+			"\t\t schedules (default), or rs8, reed-solomon over GF(2^8) with table multiplication (k + m <= 256)\n");
+	fprintf(stdout, "\t-M, --mmap\t encode from a read only mapping of the file instead of copying it into memory\n");
+	fprintf(stdout, "\t-s\t stream the file through stripe buffers of at most this many bytes, K, M and G suffixes are\n"
+			"\t\t accepted (when encoding only)\n");
+	fprintf(stdout, "\t-C, --schedule-cache\t directory in which encoding schedules are kept between runs\n");
+	fprintf(stdout, "\t-S, --stats\t print the time spent in each phase, the bytes read and written, the XOR operations,\n"
+			"\t\t the erasures and the peak RSS as one JSON line to stderr\n");
+	fprintf(stdout, "\t-B, --batch\t with -e, encode every file below the src directory, or listed one per line in the\n"
+			"\t\t src manifest, to its own fragment directory below dest, on one shared pool of -t threads\n");
+	fprintf(stdout, "\t-j, --jobs\t with -B, the number of files encoded at the same time 1 <= j <= %d (default: -t)\n",
+			MAX_JOBS);
+	fprintf(stdout, "\t-b, --memory-budget\t with -B, the bytes of buffers the files encoded at the same time may take,\n"
+			"\t\t files which would take more than their share are streamed in stripes; K, M and G suffixes are\n"
+			"\t\t accepted\n");
+	fprintf(stdout, "\t-L, --listen\t serve commands sent to this Unix domain socket until SIGINT or SIGTERM, with -t\n"
+			"\t\t the number of commands served at the same time 1 <= t < %d\n", MAX_THREADS);
+	fprintf(stdout, "\t-c, --connect\t send the command to the server listening on this socket, fd:0 and fd:1 name\n"
+			"\t\t this process' stdin and stdout\n");
+}
+
+/**
+ * Makes the path pointed to from within an argument absolute, keeping the part of the argument before it. A path of -
+ * is replaced by the descriptor it stands for.
+ * @param argc The number of arguments
+ * @param argv The arguments
+ * @param args The arguments to send, the argument holding the path is replaced by an allocated one
+ * @param path The path, within one of the arguments, or NULL
+ * @param cwd The working directory
+ * @param stdioName The name sent for a path of -, fd:0 or fd:1, or NULL if - is an ordinary path
+ * @return 0 if successful, otherwise -1
+ */
+static int absolute_arg(int argc, char **argv, char **args, char *path, char *cwd, char *stdioName) {
+	int i, stdio;
+	size_t j, len, prefix;
+
+	if (path == NULL || path[0] == '/' || strncmp(path, "fd:", 3) == 0) {
+		return 0;
+	}
+	stdio = stdioName != NULL && strcmp(path, "-") == 0;
+	for (i = 1; i < argc; i++) {
+		len = strlen(argv[i]);
+		for (j = 0; j < len; j++) {
+			if (argv[i] + j == path) {
+				break;
+			}
+		}
+		if (j == len) {
+			continue;
+		}
+		prefix = j;
+		len = prefix + strlen(stdio ? stdioName : cwd) + strlen(path) + 2;
+		args[i] = (char *) malloc(len);
+		if (args[i] == NULL) {
+			return -1;
+		}
+		memcpy(args[i], argv[i], prefix);
+		if (stdio) {
+			snprintf(args[i] + prefix, len - prefix, "%s", stdioName);
+		} else {
+			snprintf(args[i] + prefix, len - prefix, "%s/%s", cwd, path);
+		}
+		return 0;
+	}
+	return 0;
+}
+
+/**
+ * Tells whether a path names stdin or stdout, or a descriptor passed to the server.
+ * @param path The path, or NULL
+ * @return 1 if the path is - or starts with fd:, otherwise 0
+ */
+static int names_stdio(char *path) {
+	return path != NULL && (strcmp(path, "-") == 0 || strncmp(path, "fd:", 3) == 0);
+}
+
+/**
+ * Sends the command line to a server, passing stdin and stdout as fd:0 and fd:1 (a src or out of - being sent as the
+ * descriptor). Relative paths are made absolute since the server resolves them against its own working directory.
+ * @param argc The number of arguments
+ * @param argv The arguments
+ * @param cmd The command parsed from them
+ * @return The result of the command (0 if successful), otherwise -1
+ */
+static int send_to_server(int argc, char **argv, struct crs_command *cmd) {
+	int i, res;
+	int fds[2] = { STDIN_FILENO, STDOUT_FILENO };
+	char cwd[4096];
+	char **args;
+
+	if (getcwd(cwd, sizeof(cwd)) == NULL) {
+		fprintf(stderr, "Could not get the working directory\n%s\n", strerror(errno));
+		return -1;
+	}
+	args = (char **) malloc((argc + 1) * sizeof(char *));
+	if (args == NULL) {
+		return -1;
+	}
+	memcpy(args, argv, (argc + 1) * sizeof(char *));
+	res = absolute_arg(argc, argv, args, cmd->src, cwd, "fd:0");
+	if (res == 0) {
+		res = absolute_arg(argc, argv, args, cmd->dest, cwd, NULL);
+	}
+	if (res == 0) {
+		res = absolute_arg(argc, argv, args, cmd->out, cwd, "fd:1");
+	}
+	if (res == 0) {
+		res = send_command(cmd->socketPath, argc, args, fds, 2);
+	} else {
+		fprintf(stderr, "Could not make the paths absolute\n%s\n", strerror(errno));
+	}
+	for (i = 0; i < argc; i++) {
+		if (args[i] != argv[i]) {
+			free(args[i]);
+		}
+	}
+	free(args);
+	return res;
+}
+
+int main(int argc, char **argv) {
+	int res;
+	struct crs_command cmd;
+
+	if (parse_command(argc, argv, &cmd) < 0) {
+		print_usage(argv[0]);
+		return -1;
+	}
+
+	if (cmd.socketPath != NULL && cmd.mode != MODE_SERVE) {
+		res = send_to_server(argc, argv, &cmd);
+		/* stdout may be the output of the command */
+		if (res == 0 && !names_stdio(cmd.src) && !names_stdio(cmd.dest) && !names_stdio(cmd.out)) {
+			printf("Done!\n");
+		}
+		return res;
+	}
+
+	if (cmd.cacheDir != NULL && set_schedule_cache_dir(cmd.cacheDir) < 0) {
+		fprintf(stderr, "Could not use schedule cache directory: %s\n%s\n", cmd.cacheDir, strerror(errno));
+		return -1;
+	}
+
+	if (cmd.mode == MODE_SERVE) {
+		res = serve(cmd.socketPath, cmd.opts.threads);
+		clear_schedule_cache();
+		return res;
+	}
+
+	if (cmd.stats) {
+		stats_enable();
+	}
+	res = run_command(&cmd);
+	clear_schedule_cache();
+	if (cmd.stats) {
+		stats_report(stderr, mode_name(cmd.mode), &cmd.spec, res);
+	}
+	/* stdout may be the reconstructed file */
+	if (res == 0 && !names_stdio(cmd.out)) {
+		printf("Done!\n");
+	}
+	return res;
+}
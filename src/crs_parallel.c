@@ -0,0 +1,279 @@
+#include <stdlib.h>
+#include "crs_schedule.h"
+#include "crs_xor.h"
+#include "crs_crc.h"
+#include "crs_parallel.h"
+
+struct range_task {
+	struct crs_xor_schedule *schedule;
+	char **ptrs; /* Row pointers offset to the start of the range */
+	size_t size;
+	size_t blockSize;
+	int packetsize;
+	int result;
+};
+
+struct gf8_task {
+	struct crs_gf8_matrix *matrix;
+	char **in;
+	char **out;
+	size_t offset;
+	size_t size;
+};
+
+struct crc_task {
+	char *row;
+	size_t size;
+	uint32_t *checksum;
+};
+
+/**
+ * Runs the compiled schedule over each block of a range.
+ * @param arg The range_task
+ */
+static void schedule_range(void *arg) {
+	struct range_task *task = (struct range_task *) arg;
+
+	task->result = xor_run_schedule(task->schedule, task->ptrs, task->packetsize, task->blockSize,
+			task->size / task->blockSize);
+}
+
+/**
+ * Multiplies the matrix over one range.
+ * @param arg The gf8_task
+ */
+static void gf8_range(void *arg) {
+	struct gf8_task *task = (struct gf8_task *) arg;
+
+	gf8_multiply(task->matrix, task->in, task->out, task->offset, task->size);
+}
+
+/**
+ * Extends the checksum of one row.
+ * @param arg The crc_task
+ */
+static void crc_row(void *arg) {
+	struct crc_task *task = (struct crc_task *) arg;
+
+	*(task->checksum) = crc32c(*(task->checksum), task->row, task->size);
+}
+
+/**
+ * Runs the compiled schedule over size bytes of the rows. The rows are split into one range of whole blocks per thread,
+ * each range is processed concurrently on the thread pool with its own copy of the row pointers.
+ * @param rows The row pointers the schedule operates on, NULL for rows it does not use
+ * @param nrRows The number of row pointers
+ * @param schedule The compiled schedule, shared read only between the threads
+ * @param w The word size
+ * @param size The number of bytes of each row, a multiple of w * packetsize
+ * @param packetsize The packet size
+ * @param pool The thread pool, or NULL to run in the calling thread
+ * @return 0 if successful, otherwise -1
+ */
+static int run_schedule(char **rows, int nrRows, struct crs_xor_schedule *schedule, int w, size_t size,
+		int packetsize, struct crs_thread_pool *pool) {
+	size_t i, nrBlocks, nrRanges, blocksPerRange, blockSize, offset;
+	int j;
+	int res = 0;
+	struct range_task *tasks;
+	char **ptrs;
+	struct crs_task_group group;
+
+	blockSize = (size_t) w * packetsize;
+	nrBlocks = size / blockSize;
+	nrRanges = (pool == NULL) ? 1 : thread_pool_size(pool);
+	if (nrRanges > nrBlocks) {
+		nrRanges = nrBlocks;
+	}
+	if (nrRanges == 0) {
+		return 0;
+	}
+	blocksPerRange = (nrBlocks + nrRanges - 1) / nrRanges;
+	nrRanges = (nrBlocks + blocksPerRange - 1) / blocksPerRange;
+
+	tasks = (struct range_task *) malloc(nrRanges * sizeof(struct range_task));
+	ptrs = (char **) malloc(nrRanges * nrRows * sizeof(char *));
+	if (tasks == NULL || ptrs == NULL) {
+		free(tasks);
+		free(ptrs);
+		return -1;
+	}
+
+	task_group_init(&group);
+	for (i = 0; i < nrRanges; i++) {
+		offset = i * blocksPerRange * blockSize;
+		tasks[i].schedule = schedule;
+		tasks[i].ptrs = ptrs + i * nrRows;
+		tasks[i].size = (i == nrRanges - 1) ? nrBlocks * blockSize - offset : blocksPerRange * blockSize;
+		tasks[i].blockSize = blockSize;
+		tasks[i].packetsize = packetsize;
+		for (j = 0; j < nrRows; j++) {
+			tasks[i].ptrs[j] = (rows[j] == NULL) ? NULL : rows[j] + offset;
+		}
+
+		if (pool == NULL || thread_pool_submit(pool, &group, schedule_range, &(tasks[i])) < 0) {
+			schedule_range(&(tasks[i]));
+		}
+	}
+	if (pool != NULL) {
+		thread_pool_wait(pool, &group);
+	}
+	for (i = 0; i < nrRanges; i++) {
+		if (tasks[i].result < 0) {
+			res = -1;
+		}
+	}
+
+	free(ptrs);
+	free(tasks);
+	return res;
+}
+
+/**
+ * Encodes size bytes of each data row into the coding rows. The rows are split into ranges of whole blocks
+ * (w * packetsize bytes) which are encoded concurrently on the thread pool.
+ * @param k The number of data rows
+ * @param m The number of coding rows
+ * @param w The word size
+ * @param schedule The compiled encoding schedule (see get_encoding_schedule)
+ * @param data The data rows
+ * @param coding The coding rows
+ * @param size The number of bytes of each row to encode, a multiple of w * packetsize
+ * @param packetsize The packet size
+ * @param pool The thread pool to encode on, or NULL to encode in the calling thread
+ * @return 0 if successful, otherwise -1
+ */
+int parallel_schedule_encode(int k, int m, int w, struct crs_xor_schedule *schedule, char **data, char **coding,
+		size_t size, int packetsize, struct crs_thread_pool *pool) {
+	int i, res;
+	char **rows;
+
+	rows = (char **) malloc((k + m) * sizeof(char *));
+	if (rows == NULL) {
+		return -1;
+	}
+	for (i = 0; i < k; i++) {
+		rows[i] = data[i];
+	}
+	for (i = 0; i < m; i++) {
+		rows[k + i] = coding[i];
+	}
+
+	res = run_schedule(rows, k + m, schedule, w, size, packetsize, pool);
+	free(rows);
+	return res;
+}
+
+/**
+ * Rebuilds the erased rows over size bytes of each row. The rows are split into ranges of whole blocks
+ * (w * packetsize bytes) which are decoded concurrently on the thread pool, all sharing the one decoding schedule.
+ * @param k The number of data rows
+ * @param m The number of coding rows
+ * @param w The word size
+ * @param schedule The compiled decoding schedule for the erasures (see get_decoding_schedule)
+ * @param erasures A -1 terminated array of erased row indices (0 = d1, ..., k = c1, ..., k+m-1 = cm)
+ * @param data The data rows
+ * @param coding The coding rows
+ * @param size The number of bytes of each row to decode, a multiple of w * packetsize
+ * @param packetsize The packet size
+ * @param pool The thread pool to decode on, or NULL to decode in the calling thread
+ * @return 0 if successful, otherwise -1
+ */
+int parallel_schedule_decode(int k, int m, int w, struct crs_xor_schedule *schedule, int *erasures, char **data,
+		char **coding, size_t size, int packetsize, struct crs_thread_pool *pool) {
+	int res;
+	char **rows;
+
+	rows = decoding_ptrs(k, m, erasures, data, coding);
+	if (rows == NULL) {
+		return -1;
+	}
+
+	res = run_schedule(rows, k + m, schedule, w, size, packetsize, pool);
+	free(rows);
+	return res;
+}
+
+/**
+ * Multiplies a compiled GF(2^8) matrix by the input rows over size bytes (see gf8_multiply). The rows are split into
+ * one range per thread, in multiples of GF8_RANGE_ALIGNMENT bytes, multiplied concurrently on the thread pool.
+ * @param gm The compiled matrix, shared read only between the threads
+ * @param in The input rows, one per matrix column
+ * @param out The output rows, one per matrix row
+ * @param size The number of bytes of each row
+ * @param pool The thread pool to multiply on, or NULL to multiply in the calling thread
+ * @return 0 if successful, otherwise -1
+ */
+int parallel_gf8_multiply(struct crs_gf8_matrix *gm, char **in, char **out, size_t size, struct crs_thread_pool *pool) {
+	size_t i, nrRanges, rangeSize;
+	struct gf8_task *tasks;
+	struct crs_task_group group;
+
+	nrRanges = (pool == NULL) ? 1 : thread_pool_size(pool);
+	rangeSize = (size + nrRanges - 1) / nrRanges;
+	rangeSize = (rangeSize + GF8_RANGE_ALIGNMENT - 1) / GF8_RANGE_ALIGNMENT * GF8_RANGE_ALIGNMENT;
+	if (rangeSize == 0) {
+		return 0;
+	}
+	nrRanges = (size + rangeSize - 1) / rangeSize;
+
+	tasks = (struct gf8_task *) malloc(nrRanges * sizeof(struct gf8_task));
+	if (tasks == NULL) {
+		return -1;
+	}
+
+	task_group_init(&group);
+	for (i = 0; i < nrRanges; i++) {
+		tasks[i].matrix = gm;
+		tasks[i].in = in;
+		tasks[i].out = out;
+		tasks[i].offset = i * rangeSize;
+		tasks[i].size = (i == nrRanges - 1) ? size - i * rangeSize : rangeSize;
+		if (pool == NULL || thread_pool_submit(pool, &group, gf8_range, &(tasks[i])) < 0) {
+			gf8_range(&(tasks[i]));
+		}
+	}
+	if (pool != NULL) {
+		thread_pool_wait(pool, &group);
+	}
+
+	free(tasks);
+	return 0;
+}
+
+/**
+ * Extends the CRC-32C checksum of each row with its first sizes[i] bytes. Each row is checksummed as one task on the
+ * thread pool.
+ * @param rows The rows
+ * @param sizes The number of bytes of each row to add
+ * @param checksums The checksum of each row, updated in place
+ * @param nrRows The number of rows
+ * @param pool The thread pool to checksum on, or NULL to checksum in the calling thread
+ * @return 0 if successful, otherwise -1
+ */
+int parallel_crc32c(char **rows, size_t *sizes, uint32_t *checksums, int nrRows, struct crs_thread_pool *pool) {
+	int i;
+	struct crc_task *tasks;
+	struct crs_task_group group;
+
+	tasks = (struct crc_task *) malloc(nrRows * sizeof(struct crc_task));
+	if (tasks == NULL) {
+		return -1;
+	}
+
+	task_group_init(&group);
+	for (i = 0; i < nrRows; i++) {
+		tasks[i].row = rows[i];
+		tasks[i].size = sizes[i];
+		tasks[i].checksum = checksums + i;
+		if (pool == NULL || thread_pool_submit(pool, &group, crc_row, &(tasks[i])) < 0) {
+			crc_row(&(tasks[i]));
+		}
+	}
+	if (pool != NULL) {
+		thread_pool_wait(pool, &group);
+	}
+
+	free(tasks);
+	return 0;
+}
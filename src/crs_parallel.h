@@ -0,0 +1,72 @@
+#ifndef CRS_PARALLEL_H_
+#define CRS_PARALLEL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "crs_thread_pool.h"
+#include "crs_gf8.h"
+#include "crs_xor.h"
+
+/* Ranges multiplied by separate threads start on this boundary, so no cache line is shared between two threads */
+#define GF8_RANGE_ALIGNMENT 64
+
+/**
+ * Encodes size bytes of each data row into the coding rows. The rows are split into ranges of whole blocks
+ * (w * packetsize bytes) which are encoded concurrently on the thread pool.
+ * @param k The number of data rows
+ * @param m The number of coding rows
+ * @param w The word size
+ * @param schedule The compiled encoding schedule (see get_encoding_schedule)
+ * @param data The data rows
+ * @param coding The coding rows
+ * @param size The number of bytes of each row to encode, a multiple of w * packetsize
+ * @param packetsize The packet size
+ * @param pool The thread pool to encode on, or NULL to encode in the calling thread
+ * @return 0 if successful, otherwise -1
+ */
+int parallel_schedule_encode(int k, int m, int w, struct crs_xor_schedule *schedule, char **data, char **coding,
+		size_t size, int packetsize, struct crs_thread_pool *pool);
+
+/**
+ * Rebuilds the erased rows over size bytes of each row. The rows are split into ranges of whole blocks
+ * (w * packetsize bytes) which are decoded concurrently on the thread pool, all sharing the one decoding schedule.
+ * @param k The number of data rows
+ * @param m The number of coding rows
+ * @param w The word size
+ * @param schedule The compiled decoding schedule for the erasures (see get_decoding_schedule)
+ * @param erasures A -1 terminated array of erased row indices (0 = d1, ..., k = c1, ..., k+m-1 = cm)
+ * @param data The data rows
+ * @param coding The coding rows
+ * @param size The number of bytes of each row to decode, a multiple of w * packetsize
+ * @param packetsize The packet size
+ * @param pool The thread pool to decode on, or NULL to decode in the calling thread
+ * @return 0 if successful, otherwise -1
+ */
+int parallel_schedule_decode(int k, int m, int w, struct crs_xor_schedule *schedule, int *erasures, char **data,
+		char **coding, size_t size, int packetsize, struct crs_thread_pool *pool);
+
+/**
+ * Multiplies a compiled GF(2^8) matrix by the input rows over size bytes (see gf8_multiply). The rows are split into
+ * one range per thread, in multiples of GF8_RANGE_ALIGNMENT bytes, multiplied concurrently on the thread pool.
+ * @param gm The compiled matrix, shared read only between the threads
+ * @param in The input rows, one per matrix column
+ * @param out The output rows, one per matrix row
+ * @param size The number of bytes of each row
+ * @param pool The thread pool to multiply on, or NULL to multiply in the calling thread
+ * @return 0 if successful, otherwise -1
+ */
+int parallel_gf8_multiply(struct crs_gf8_matrix *gm, char **in, char **out, size_t size, struct crs_thread_pool *pool);
+
+/**
+ * Extends the CRC-32C checksum of each row with its first sizes[i] bytes. Each row is checksummed as one task on the
+ * thread pool.
+ * @param rows The rows
+ * @param sizes The number of bytes of each row to add
+ * @param checksums The checksum of each row, updated in place
+ * @param nrRows The number of rows
+ * @param pool The thread pool to checksum on, or NULL to checksum in the calling thread
+ * @return 0 if successful, otherwise -1
+ */
+int parallel_crc32c(char **rows, size_t *sizes, uint32_t *checksums, int nrRows, struct crs_thread_pool *pool);
+
+#endif /* CRS_PARALLEL_H_ */
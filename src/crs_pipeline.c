@@ -0,0 +1,157 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "crs_pipeline.h"
+
+/**
+ * The progress of a running pipeline
+ */
+struct crs_pipeline_run {
+	struct crs_pipeline *pipeline;
+	pthread_mutex_t lock;
+	pthread_cond_t progress; /* Broadcast when a stage finishes a stripe or fails */
+	size_t nrRead; /* Stripes read */
+	size_t nrCoded; /* Stripes coded */
+	size_t nrWritten; /* Stripes written */
+	size_t nrStripes; /* SIZE_MAX until the last stripe has been read */
+	int failed;
+};
+
+/**
+ * Waits until *ready exceeds stripe, the stripe is past the last one or a stage has failed.
+ * @param run The pipeline run
+ * @param ready The stripes the previous stage has finished
+ * @param stripe The stripe the calling stage works on next
+ * @return 1 if the stage may work on the stripe, otherwise 0
+ */
+static int wait_for(struct crs_pipeline_run *run, size_t *ready, size_t stripe) {
+	int res;
+
+	pthread_mutex_lock(&(run->lock));
+	while (!run->failed && stripe < run->nrStripes && *ready <= stripe) {
+		pthread_cond_wait(&(run->progress), &(run->lock));
+	}
+	res = !run->failed && stripe < run->nrStripes;
+	pthread_mutex_unlock(&(run->lock));
+	return res;
+}
+
+/**
+ * Records a stage finishing a stripe.
+ * @param run The pipeline run
+ * @param done The stripes the stage has finished
+ * @param stripe The stripe
+ * @param res The result of the stage
+ */
+static void finish(struct crs_pipeline_run *run, size_t *done, size_t stripe, int res) {
+	pthread_mutex_lock(&(run->lock));
+	if (res < 0) {
+		run->failed = 1;
+	} else {
+		*done = stripe + 1;
+		if (res == 1) {
+			run->nrStripes = stripe + 1;
+		}
+	}
+	pthread_cond_broadcast(&(run->progress));
+	pthread_mutex_unlock(&(run->lock));
+}
+
+/**
+ * Reads stripes into the slots freed by the write stage.
+ * @param arg The pipeline run
+ * @return NULL
+ */
+static void *read_stage(void *arg) {
+	int res;
+	size_t stripe;
+	size_t freed;
+	struct crs_pipeline_run *run = (struct crs_pipeline_run *) arg;
+
+	for (stripe = 0;; stripe++) {
+		/* The slot is free once the stripe PIPELINE_DEPTH before has been written */
+		pthread_mutex_lock(&(run->lock));
+		while (!run->failed && stripe >= run->nrWritten + PIPELINE_DEPTH) {
+			pthread_cond_wait(&(run->progress), &(run->lock));
+		}
+		freed = !run->failed;
+		pthread_mutex_unlock(&(run->lock));
+		if (!freed) {
+			break;
+		}
+		res = run->pipeline->read(run->pipeline->ctx, stripe % PIPELINE_DEPTH, stripe);
+		finish(run, &(run->nrRead), stripe, res);
+		if (res != 0) {
+			break;
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Writes the coded stripes.
+ * @param arg The pipeline run
+ * @return NULL
+ */
+static void *write_stage(void *arg) {
+	int res;
+	size_t stripe;
+	struct crs_pipeline_run *run = (struct crs_pipeline_run *) arg;
+
+	for (stripe = 0; wait_for(run, &(run->nrCoded), stripe); stripe++) {
+		res = run->pipeline->write(run->pipeline->ctx, stripe % PIPELINE_DEPTH, stripe);
+		finish(run, &(run->nrWritten), stripe, (res < 0) ? -1 : 0);
+	}
+	return NULL;
+}
+
+/**
+ * Runs stripes through the read, code and write stages until the read stage reports the last stripe, with the three
+ * stages working on different stripes at the same time: the stripes are read on one thread, coded on the calling
+ * thread and written on another thread, a slot being read again once its stripe has been written. A stage failing
+ * stops the others after the stripe they are working on.
+ * @param pipeline The stages
+ * @return 0 if every stripe was read, coded and written, otherwise -1
+ */
+int run_pipeline(struct crs_pipeline *pipeline) {
+	int res;
+	size_t stripe;
+	pthread_t reader, writer;
+	struct crs_pipeline_run run;
+
+	run.pipeline = pipeline;
+	run.nrRead = 0;
+	run.nrCoded = 0;
+	run.nrWritten = 0;
+	run.nrStripes = SIZE_MAX;
+	run.failed = 0;
+	pthread_mutex_init(&(run.lock), NULL);
+	pthread_cond_init(&(run.progress), NULL);
+
+	if (pthread_create(&reader, NULL, read_stage, &run) != 0) {
+		fprintf(stderr, "Could not start the read stage\n");
+		pthread_mutex_destroy(&(run.lock));
+		pthread_cond_destroy(&(run.progress));
+		return -1;
+	}
+	if (pthread_create(&writer, NULL, write_stage, &run) != 0) {
+		fprintf(stderr, "Could not start the write stage\n");
+		finish(&run, &(run.nrCoded), 0, -1);
+		pthread_join(reader, NULL);
+		pthread_mutex_destroy(&(run.lock));
+		pthread_cond_destroy(&(run.progress));
+		return -1;
+	}
+
+	for (stripe = 0; wait_for(&run, &(run.nrRead), stripe); stripe++) {
+		res = pipeline->code(pipeline->ctx, stripe % PIPELINE_DEPTH, stripe);
+		finish(&run, &(run.nrCoded), stripe, (res < 0) ? -1 : 0);
+	}
+
+	pthread_join(reader, NULL);
+	pthread_join(writer, NULL);
+	res = (run.failed || run.nrWritten != run.nrStripes) ? -1 : 0;
+	pthread_mutex_destroy(&(run.lock));
+	pthread_cond_destroy(&(run.progress));
+	return res;
+}
@@ -0,0 +1,30 @@
+#ifndef CRS_PIPELINE_H_
+#define CRS_PIPELINE_H_
+
+#include <stddef.h>
+
+/* Stripes in flight at once: one being read, one being coded and one being written */
+#define PIPELINE_DEPTH 3
+
+/**
+ * The stages a pipeline runs every stripe through. Each stage is called with the slot (0 to PIPELINE_DEPTH - 1) holding
+ * the stripe's buffers and the stripe index, and sees the stripes in order.
+ */
+struct crs_pipeline {
+	int (*read)(void *ctx, int slot, size_t stripe); /* Returns 0, 1 if the stripe read was the last, or -1 */
+	int (*code)(void *ctx, int slot, size_t stripe); /* Returns 0 if successful, otherwise -1 */
+	int (*write)(void *ctx, int slot, size_t stripe); /* Returns 0 if successful, otherwise -1 */
+	void *ctx; /* Passed to every stage */
+};
+
+/**
+ * Runs stripes through the read, code and write stages until the read stage reports the last stripe, with the three
+ * stages working on different stripes at the same time: the stripes are read on one thread, coded on the calling
+ * thread and written on another thread, a slot being read again once its stripe has been written. A stage failing
+ * stops the others after the stripe they are working on.
+ * @param pipeline The stages
+ * @return 0 if every stripe was read, coded and written, otherwise -1
+ */
+int run_pipeline(struct crs_pipeline *pipeline);
+
+#endif /* CRS_PIPELINE_H_ */
@@ -0,0 +1,981 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <jerasure.h>
+#include <galois.h>
+#include <cauchy.h>
+#include "crs_crc.h"
+#include "crs_spec_io.h"
+#include "crs_schedule.h"
+
+#define SCHEDULE_FILE_MAGIC 0x43535243 /* "CRSC", a file written with another byte order does not match */
+#define SCHEDULE_FILE_VERSION 2 /* Bumped whenever the schedule generated for a code changes */
+#define SCHEDULE_HEADER_INTS 7 /* magic, version, k, m, w, kind, nrOps */
+
+/**
+ * A cached encoding schedule
+ */
+struct schedule_entry {
+	int k;
+	int m;
+	int w;
+	int kind;
+	int *bitmatrix;
+	int **schedule;
+	struct crs_xor_schedule *compiled; /* The schedule compiled into fused XOR runs */
+	struct schedule_entry *next;
+};
+
+/**
+ * A cached decoding schedule (ENGINE_CRS) or compiled GF(2^8) decoding matrix (ENGINE_RS8)
+ */
+struct decoding_entry {
+	int engine;
+	int k;
+	int m;
+	int w;
+	char *erased; /* The k + m erased flags */
+	int *bitmatrix; /* Copy of the coding matrix the schedule or matrix was derived from */
+	int **schedule; /* NULL for ENGINE_RS8 */
+	struct crs_xor_schedule *compiled; /* The schedule compiled into fused XOR runs, NULL for ENGINE_RS8 */
+	struct crs_gf8_matrix *gf8; /* The compiled decoding matrix, NULL for ENGINE_CRS */
+	int refs; /* Number of unreleased get_decoding_schedule results */
+	struct decoding_entry *next;
+};
+
+static struct schedule_entry *encodingCache = NULL;
+static struct decoding_entry *decodingCache = NULL; /* Most recently used first */
+static struct decoding_entry *retired = NULL; /* Evicted while still in use */
+static int nrDecoding = 0;
+static char *cacheDir = NULL;
+static pthread_mutex_t cacheLock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * @param schedule A schedule
+ * @return The number of operations in the schedule
+ */
+static int schedule_length(int **schedule) {
+	int n = 0;
+
+	while (schedule[n][0] >= 0) {
+		n++;
+	}
+	return n;
+}
+
+/**
+ * Allocates a schedule of nrOps operations in the layout jerasure_free_schedule expects, the terminating operation set.
+ * @param nrOps The number of operations
+ * @return The schedule, or NULL if unsuccessful
+ */
+static int **alloc_schedule(int nrOps) {
+	int i;
+	int **schedule;
+
+	schedule = (int **) malloc((nrOps + 1) * sizeof(int *));
+	if (schedule == NULL) {
+		return NULL;
+	}
+	for (i = 0; i <= nrOps; i++) {
+		schedule[i] = (int *) malloc(5 * sizeof(int));
+		if (schedule[i] == NULL) {
+			while (i > 0) {
+				i--;
+				free(schedule[i]);
+			}
+			free(schedule);
+			return NULL;
+		}
+		schedule[i][0] = 0;
+	}
+	schedule[nrOps][0] = -1;
+	return schedule;
+}
+
+/**
+ * Gives the path of the cache file of an encoding schedule.
+ * @return The path (free with free), or NULL if unsuccessful
+ */
+static char *schedule_file_path(int k, int m, int w, int kind) {
+	size_t pathLen;
+	char *path;
+
+	pathLen = strlen(cacheDir) + 64;
+	path = (char *) malloc(pathLen);
+	if (path != NULL) {
+		snprintf(path, pathLen, "%s/enc-v%d-%d-%d-%d-%d.sched", cacheDir, SCHEDULE_FILE_VERSION, k, m, w, kind);
+	}
+	return path;
+}
+
+/**
+ * Loads an encoding schedule from the cache directory. Files that are truncated, corrupt (checksum mismatch), of another
+ * format version, or reference rows or bits outside the code (or write to data rows) are ignored.
+ * @param entry The entry with k, m, w and kind set, bitmatrix and schedule are filled
+ * @return 0 if successful, otherwise -1
+ */
+static int load_schedule(struct schedule_entry *entry) {
+	FILE *f;
+	char *path;
+	int32_t header[SCHEDULE_HEADER_INTS];
+	int32_t *ops = NULL;
+	unsigned char *bits = NULL;
+	uint32_t crc, storedCrc;
+	int i, j, nrOps;
+	int res = -1;
+	int nrBits = entry->k * entry->m * entry->w * entry->w;
+	int nrRows = entry->k + entry->m;
+
+	path = schedule_file_path(entry->k, entry->m, entry->w, entry->kind);
+	if (path == NULL) {
+		return -1;
+	}
+	f = fopen(path, "rb");
+	free(path);
+	if (f == NULL) {
+		return -1;
+	}
+
+	if (fread(header, sizeof(int32_t), SCHEDULE_HEADER_INTS, f) == SCHEDULE_HEADER_INTS
+			&& header[0] == SCHEDULE_FILE_MAGIC && header[1] == SCHEDULE_FILE_VERSION && header[2] == entry->k
+			&& header[3] == entry->m && header[4] == entry->w && header[5] == entry->kind && header[6] >= 0) {
+		nrOps = header[6];
+		bits = (unsigned char *) malloc(nrBits);
+		ops = (int32_t *) malloc((size_t) nrOps * 5 * sizeof(int32_t) + 1);
+		if (bits != NULL && ops != NULL && fread(bits, 1, nrBits, f) == (size_t) nrBits
+				&& fread(ops, sizeof(int32_t), (size_t) nrOps * 5, f) == (size_t) nrOps * 5
+				&& fread(&storedCrc, sizeof(uint32_t), 1, f) == 1) {
+			crc = crc32c(0, header, sizeof(header));
+			crc = crc32c(crc, bits, nrBits);
+			crc = crc32c(crc, ops, (size_t) nrOps * 5 * sizeof(int32_t));
+			res = (crc == storedCrc) ? 0 : -1;
+			for (i = 0; i < nrOps * 5 && res == 0; i += 5) {
+				if (ops[i] < 0 || ops[i] >= nrRows || ops[i + 1] < 0 || ops[i + 1] >= entry->w || ops[i + 2] < entry->k
+						|| ops[i + 2] >= nrRows || ops[i + 3] < 0 || ops[i + 3] >= entry->w
+						|| (ops[i + 4] != 0 && ops[i + 4] != 1)) {
+					res = -1;
+				}
+			}
+		}
+	}
+	fclose(f);
+
+	if (res == 0) {
+		entry->bitmatrix = (int *) malloc(nrBits * sizeof(int));
+		entry->schedule = alloc_schedule(nrOps);
+		if (entry->bitmatrix == NULL || entry->schedule == NULL) {
+			free(entry->bitmatrix);
+			if (entry->schedule != NULL) {
+				jerasure_free_schedule(entry->schedule);
+			}
+			res = -1;
+		} else {
+			for (i = 0; i < nrBits; i++) {
+				entry->bitmatrix[i] = bits[i];
+			}
+			for (i = 0; i < nrOps; i++) {
+				for (j = 0; j < 5; j++) {
+					entry->schedule[i][j] = ops[i * 5 + j];
+				}
+			}
+		}
+	}
+	free(bits);
+	free(ops);
+	return res;
+}
+
+/**
+ * Writes an encoding schedule to the cache directory. The file is written under a temporary name and renamed into
+ * place so concurrent processes never load a partial file.
+ * @param entry The entry to persist
+ * @return 0 if successful, otherwise -1
+ */
+static int store_schedule(struct schedule_entry *entry) {
+	FILE *f;
+	char *path, *tmpPath;
+	size_t pathLen;
+	int32_t header[SCHEDULE_HEADER_INTS];
+	int32_t op[5];
+	unsigned char bit;
+	uint32_t crc;
+	int i, j;
+	int ok = 1;
+	int nrBits = entry->k * entry->m * entry->w * entry->w;
+	int nrOps = schedule_length(entry->schedule);
+
+	path = schedule_file_path(entry->k, entry->m, entry->w, entry->kind);
+	if (path == NULL) {
+		return -1;
+	}
+	pathLen = strlen(path) + 32;
+	tmpPath = (char *) malloc(pathLen);
+	if (tmpPath == NULL) {
+		free(path);
+		return -1;
+	}
+	snprintf(tmpPath, pathLen, "%s.%ld", path, (long) getpid());
+	f = fopen(tmpPath, "wb");
+	if (f == NULL) {
+		free(path);
+		free(tmpPath);
+		return -1;
+	}
+
+	header[0] = SCHEDULE_FILE_MAGIC;
+	header[1] = SCHEDULE_FILE_VERSION;
+	header[2] = entry->k;
+	header[3] = entry->m;
+	header[4] = entry->w;
+	header[5] = entry->kind;
+	header[6] = nrOps;
+	ok &= fwrite(header, sizeof(int32_t), SCHEDULE_HEADER_INTS, f) == SCHEDULE_HEADER_INTS;
+	crc = crc32c(0, header, sizeof(header));
+	for (i = 0; i < nrBits; i++) {
+		bit = (unsigned char) entry->bitmatrix[i];
+		ok &= fwrite(&bit, 1, 1, f) == 1;
+		crc = crc32c(crc, &bit, 1);
+	}
+	for (i = 0; i < nrOps; i++) {
+		for (j = 0; j < 5; j++) {
+			op[j] = entry->schedule[i][j];
+		}
+		ok &= fwrite(op, sizeof(int32_t), 5, f) == 5;
+		crc = crc32c(crc, op, sizeof(op));
+	}
+	ok &= fwrite(&crc, sizeof(uint32_t), 1, f) == 1;
+	ok &= fclose(f) == 0;
+
+	if (ok) {
+		ok = (rename(tmpPath, path) == 0);
+	}
+	if (!ok) {
+		unlink(tmpPath);
+	}
+	free(path);
+	free(tmpPath);
+	return ok ? 0 : -1;
+}
+
+/**
+ * Generates the coding bitmatrix and smart encoding schedule of an entry.
+ * @param entry The entry with k, m, w and kind set, bitmatrix and schedule are filled
+ * @return 0 if successful, otherwise -1
+ */
+static int generate_schedule(struct schedule_entry *entry) {
+	int *matrix;
+
+	if (entry->kind != MATRIX_CAUCHY_GOOD) {
+		errno = EINVAL;
+		return -1;
+	}
+	matrix = cauchy_good_general_coding_matrix(entry->k, entry->m, entry->w);
+	if (matrix == NULL) {
+		return -1;
+	}
+	entry->bitmatrix = jerasure_matrix_to_bitmatrix(entry->k, entry->m, entry->w, matrix);
+	free(matrix);
+	if (entry->bitmatrix == NULL) {
+		return -1;
+	}
+	entry->schedule = jerasure_smart_bitmatrix_to_schedule(entry->k, entry->m, entry->w, entry->bitmatrix);
+	if (entry->schedule == NULL) {
+		free(entry->bitmatrix);
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * Frees a decoding cache entry.
+ * @param entry The entry
+ */
+static void free_decoding_entry(struct decoding_entry *entry) {
+	xor_free_schedule(entry->compiled);
+	if (entry->schedule != NULL) {
+		jerasure_free_schedule(entry->schedule);
+	}
+	gf8_free_matrix(entry->gf8);
+	free(entry->bitmatrix);
+	free(entry->erased);
+	free(entry);
+}
+
+/**
+ * Removes the least recently used decoding schedule from the cache, the caller holding cacheLock. It is freed
+ * immediately if unused, otherwise retired until its last release.
+ */
+static void evict_least_recent(void) {
+	struct decoding_entry *entry = decodingCache;
+	struct decoding_entry *prev = NULL;
+
+	while (entry->next != NULL) {
+		prev = entry;
+		entry = entry->next;
+	}
+	if (prev == NULL) {
+		decodingCache = NULL;
+	} else {
+		prev->next = NULL;
+	}
+	nrDecoding--;
+
+	if (entry->refs == 0) {
+		free_decoding_entry(entry);
+	} else {
+		entry->next = retired;
+		retired = entry;
+	}
+}
+
+/**
+ * Sets the directory encoding schedules are persisted to, so later processes load them instead of generating them.
+ * @param dir The cache directory (created if missing), or NULL to only cache schedules within the process
+ * @return 0 if successful, otherwise -1
+ */
+int set_schedule_cache_dir(char *dir) {
+	char *copy = NULL;
+
+	if (dir != NULL) {
+		if (mkdir(dir, S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH) < 0 && errno != EEXIST) {
+			return -1;
+		}
+		copy = strdup(dir);
+		if (copy == NULL) {
+			return -1;
+		}
+	}
+	pthread_mutex_lock(&cacheLock);
+	free(cacheDir);
+	cacheDir = copy;
+	pthread_mutex_unlock(&cacheLock);
+	return 0;
+}
+
+/**
+ * Gives the coding bitmatrix and smart encoding schedule of a (k, m, w, kind) code, and the schedule compiled into
+ * fused XOR runs. They are generated (or loaded from the cache directory) and compiled the first time the code is
+ * requested and shared by every later request of the process; callers must neither modify nor free them. Thread safe.
+ * @param k The number of data rows
+ * @param m The number of coding rows
+ * @param w The word size
+ * @param kind The coding matrix kind (MATRIX_CAUCHY_GOOD)
+ * @param bitmatrix Where the coding bitmatrix (k * w columns, m * w rows) should be stored
+ * @param schedule Where the encoding schedule should be stored
+ * @param compiled Where the compiled encoding schedule should be stored
+ * @return 0 if successful, otherwise -1
+ */
+int get_encoding_schedule(int k, int m, int w, int kind, int **bitmatrix, int ***schedule,
+		struct crs_xor_schedule **compiled) {
+	struct schedule_entry *entry;
+
+	pthread_mutex_lock(&cacheLock);
+	for (entry = encodingCache; entry != NULL; entry = entry->next) {
+		if (entry->k == k && entry->m == m && entry->w == w && entry->kind == kind) {
+			break;
+		}
+	}
+
+	if (entry == NULL) {
+		entry = (struct schedule_entry *) malloc(sizeof(struct schedule_entry));
+		if (entry == NULL) {
+			pthread_mutex_unlock(&cacheLock);
+			return -1;
+		}
+		entry->k = k;
+		entry->m = m;
+		entry->w = w;
+		entry->kind = kind;
+		if (cacheDir == NULL || load_schedule(entry) < 0) {
+			if (generate_schedule(entry) < 0) {
+				free(entry);
+				pthread_mutex_unlock(&cacheLock);
+				return -1;
+			}
+			if (cacheDir != NULL) {
+				/* Failing to persist only costs later processes the generation */
+				store_schedule(entry);
+			}
+		}
+		entry->compiled = xor_compile_schedule(entry->schedule);
+		if (entry->compiled == NULL) {
+			jerasure_free_schedule(entry->schedule);
+			free(entry->bitmatrix);
+			free(entry);
+			pthread_mutex_unlock(&cacheLock);
+			return -1;
+		}
+		entry->next = encodingCache;
+		encodingCache = entry;
+	}
+
+	*bitmatrix = entry->bitmatrix;
+	*schedule = entry->schedule;
+	*compiled = entry->compiled;
+	pthread_mutex_unlock(&cacheLock);
+	return 0;
+}
+
+/**
+ * Frees every cached encoding and decoding schedule and GF(2^8) matrix. No schedule or matrix obtained from the caches
+ * may still be in use.
+ */
+void clear_schedule_cache(void) {
+	struct schedule_entry *entry;
+	struct decoding_entry *decoding;
+
+	pthread_mutex_lock(&cacheLock);
+	while (encodingCache != NULL) {
+		entry = encodingCache;
+		encodingCache = entry->next;
+		xor_free_schedule(entry->compiled);
+		jerasure_free_schedule(entry->schedule);
+		free(entry->bitmatrix);
+		free(entry);
+	}
+	while (decodingCache != NULL) {
+		decoding = decodingCache;
+		decodingCache = decoding->next;
+		free_decoding_entry(decoding);
+	}
+	while (retired != NULL) {
+		decoding = retired;
+		retired = decoding->next;
+		free_decoding_entry(decoding);
+	}
+	nrDecoding = 0;
+	pthread_mutex_unlock(&cacheLock);
+}
+
+/**
+ * Gives the cache entry of an erasure pattern of a code, creating it on a miss and evicting the least recently used
+ * entry beyond DECODING_CACHE_SIZE. Entries are keyed by (engine, k, m, w, erasure bitmap) and reused only when the
+ * coding matrix matches.
+ * @param engine ENGINE_CRS for a decoding schedule, ENGINE_RS8 for a compiled GF(2^8) matrix
+ * @param k The number of data rows
+ * @param m The number of coding rows
+ * @param w The word size (8 for ENGINE_RS8)
+ * @param matrix The coding bitmatrix (ENGINE_CRS) or the m x k GF(2^8) coding matrix (ENGINE_RS8)
+ * @param erasures A -1 terminated array of erased row indices
+ * @return The entry, its reference count incremented, or NULL if the erasures can not be decoded
+ */
+static struct decoding_entry *acquire_decoding_entry(int engine, int k, int m, int w, int *matrix, int *erasures) {
+	int i;
+	size_t matrixSize;
+	char *erased;
+	struct decoding_entry *entry;
+	struct decoding_entry *prev = NULL;
+
+	matrixSize = ((engine == ENGINE_RS8) ? (size_t) k * m : (size_t) k * m * w * w) * sizeof(int);
+	erased = (char *) calloc(k + m, sizeof(char));
+	if (erased == NULL) {
+		return NULL;
+	}
+	for (i = 0; erasures[i] != -1; i++) {
+		if (erasures[i] < 0 || erasures[i] >= k + m) {
+			free(erased);
+			return NULL;
+		}
+		erased[erasures[i]] = 1;
+	}
+
+	pthread_mutex_lock(&cacheLock);
+	for (entry = decodingCache; entry != NULL; prev = entry, entry = entry->next) {
+		if (entry->engine == engine && entry->k == k && entry->m == m && entry->w == w
+				&& memcmp(entry->erased, erased, k + m) == 0 && memcmp(entry->bitmatrix, matrix, matrixSize) == 0) {
+			break;
+		}
+	}
+
+	if (entry != NULL) {
+		/* Hit, move to the front */
+		free(erased);
+		if (prev != NULL) {
+			prev->next = entry->next;
+			entry->next = decodingCache;
+			decodingCache = entry;
+		}
+	} else {
+		entry = (struct decoding_entry *) calloc(1, sizeof(struct decoding_entry));
+		if (entry != NULL) {
+			entry->bitmatrix = (int *) malloc(matrixSize);
+			if (engine == ENGINE_RS8) {
+				entry->gf8 = create_gf8_decoding_matrix(k, m, matrix, erasures);
+			} else {
+				entry->schedule = create_decoding_schedule(k, m, w, matrix, erasures);
+				entry->compiled = (entry->schedule == NULL) ? NULL : xor_compile_schedule(entry->schedule);
+			}
+		}
+		if (entry == NULL || entry->bitmatrix == NULL || (entry->compiled == NULL && entry->gf8 == NULL)) {
+			if (entry != NULL) {
+				free_decoding_entry(entry);
+			}
+			free(erased);
+			pthread_mutex_unlock(&cacheLock);
+			return NULL;
+		}
+		memcpy(entry->bitmatrix, matrix, matrixSize);
+		entry->engine = engine;
+		entry->k = k;
+		entry->m = m;
+		entry->w = w;
+		entry->erased = erased;
+		entry->refs = 0;
+		entry->next = decodingCache;
+		decodingCache = entry;
+		nrDecoding++;
+		if (nrDecoding > DECODING_CACHE_SIZE) {
+			evict_least_recent();
+		}
+	}
+
+	entry->refs++;
+	pthread_mutex_unlock(&cacheLock);
+	return entry;
+}
+
+/**
+ * Releases the cache entry holding a schedule or matrix obtained from acquire_decoding_entry. It is freed once it is
+ * both released and evicted.
+ * @param key The schedule or compiled GF(2^8) matrix of the entry
+ */
+static void release_decoding_entry(void *key) {
+	struct decoding_entry *entry;
+	struct decoding_entry *prev = NULL;
+
+	pthread_mutex_lock(&cacheLock);
+	for (entry = decodingCache; entry != NULL; entry = entry->next) {
+		if ((void *) entry->schedule == key || (void *) entry->gf8 == key) {
+			entry->refs--;
+			pthread_mutex_unlock(&cacheLock);
+			return;
+		}
+	}
+	for (entry = retired; entry != NULL; prev = entry, entry = entry->next) {
+		if ((void *) entry->schedule == key || (void *) entry->gf8 == key) {
+			entry->refs--;
+			if (entry->refs == 0) {
+				if (prev == NULL) {
+					retired = entry->next;
+				} else {
+					prev->next = entry->next;
+				}
+				free_decoding_entry(entry);
+			}
+			break;
+		}
+	}
+	pthread_mutex_unlock(&cacheLock);
+}
+
+/**
+ * Gives the decoding schedule of an erasure pattern (see create_decoding_schedule), and the schedule compiled into
+ * fused XOR runs. The schedules of the DECODING_CACHE_SIZE most recently used patterns are kept, keyed by (k, m, w,
+ * erasure bitmap) and reused only when the bitmatrix matches, so objects sharing an erasure pattern pay for the matrix
+ * inversion and the compilation once. Thread safe.
+ * @param k The number of data rows
+ * @param m The number of coding rows
+ * @param w The word size
+ * @param bitmatrix The coding bitmatrix (k * w columns, m * w rows)
+ * @param erasures A -1 terminated array of erased row indices
+ * @param compiled Where the compiled schedule should be stored, valid until the schedule is released
+ * @return The schedule (release with release_decoding_schedule), or NULL if the erasures can not be decoded
+ */
+int **get_decoding_schedule(int k, int m, int w, int *bitmatrix, int *erasures, struct crs_xor_schedule **compiled) {
+	struct decoding_entry *entry;
+
+	entry = acquire_decoding_entry(ENGINE_CRS, k, m, w, bitmatrix, erasures);
+	if (entry == NULL) {
+		return NULL;
+	}
+	*compiled = entry->compiled;
+	return entry->schedule;
+}
+
+/**
+ * Releases a schedule obtained from get_decoding_schedule. It is freed once it is both released and evicted.
+ * @param schedule The schedule
+ */
+void release_decoding_schedule(int **schedule) {
+	release_decoding_entry(schedule);
+}
+
+/**
+ * Gives the compiled GF(2^8) matrix which rebuilds the erased rows of an ENGINE_RS8 code (see
+ * create_gf8_decoding_matrix), or its compiled coding matrix when nothing is erased. The matrices share the
+ * DECODING_CACHE_SIZE most recently used entries with the decoding schedules, keyed by (k, m, erasure bitmap) and
+ * reused only when the coding matrix matches, so stripes and objects sharing a pattern pay for the inversion and the
+ * table compilation once. Thread safe.
+ * @param k The number of data rows
+ * @param m The number of coding rows
+ * @param matrix The m x k GF(2^8) coding matrix
+ * @param erasures A -1 terminated array of erased row indices, empty for the coding matrix
+ * @return The compiled matrix (release with release_gf8_matrix), or NULL if the erasures can not be decoded
+ */
+struct crs_gf8_matrix *get_gf8_matrix(int k, int m, int *matrix, int *erasures) {
+	struct decoding_entry *entry;
+
+	entry = acquire_decoding_entry(ENGINE_RS8, k, m, 8, matrix, erasures);
+	return (entry == NULL) ? NULL : entry->gf8;
+}
+
+/**
+ * Releases a matrix obtained from get_gf8_matrix. It is freed once it is both released and evicted.
+ * @param gm The compiled matrix
+ */
+void release_gf8_matrix(struct crs_gf8_matrix *gm) {
+	release_decoding_entry(gm);
+}
+
+/**
+ * Assigns the rows used when decoding. For i < k, rowIds[i] is the row standing in position i: i itself if data row i
+ * survived, otherwise the next unused surviving coding row. rowIds[k], rowIds[k + 1], ... are the erased data rows
+ * followed by the erased coding rows. indToRow is the inverse mapping.
+ * @param k The number of data rows
+ * @param m The number of coding rows
+ * @param erased The k + m erased flags
+ * @param rowIds The k + m row ids to fill
+ * @param indToRow The k + m positions to fill
+ */
+static void setup_decoding_ids(int k, int m, int *erased, int *rowIds, int *indToRow) {
+	int i;
+	int next = k; /* Next surviving coding row to substitute */
+	int pos = k; /* Next position for an erased row */
+
+	for (i = 0; i < k; i++) {
+		if (erased[i] == 0) {
+			rowIds[i] = i;
+			indToRow[i] = i;
+		} else {
+			while (erased[next]) {
+				next++;
+			}
+			rowIds[i] = next;
+			indToRow[next] = i;
+			next++;
+			rowIds[pos] = i;
+			indToRow[i] = pos;
+			pos++;
+		}
+	}
+	for (i = k; i < k + m; i++) {
+		if (erased[i]) {
+			rowIds[pos] = i;
+			indToRow[i] = pos;
+			pos++;
+		}
+	}
+}
+
+/**
+ * Fills the rows of the decoding bitmatrix which rebuild the erased data rows from the surviving rows, by inverting
+ * the bitmatrix of the surviving rows.
+ * @param k The number of data rows
+ * @param w The word size
+ * @param bitmatrix The coding bitmatrix
+ * @param rowIds The row ids from setup_decoding_ids
+ * @param nrErasedData The number of erased data rows
+ * @param decoding The decoding bitmatrix, its first nrErasedData rows of blocks are filled
+ * @return 0 if successful, otherwise -1 (the surviving rows are not independent or out of memory)
+ */
+static int fill_data_decoding_rows(int k, int w, int *bitmatrix, int *rowIds, int nrErasedData, int *decoding) {
+	int i, x;
+	int rowInts = k * w * w; /* ints per row of blocks */
+	int *survivors;
+	int *inverse;
+	int res;
+
+	survivors = (int *) malloc(k * rowInts * sizeof(int));
+	inverse = (int *) malloc(k * rowInts * sizeof(int));
+	if (survivors == NULL || inverse == NULL) {
+		free(survivors);
+		free(inverse);
+		return -1;
+	}
+
+	for (i = 0; i < k; i++) {
+		if (rowIds[i] == i) {
+			/* Identity block for a surviving data row */
+			memset(survivors + i * rowInts, 0, rowInts * sizeof(int));
+			for (x = 0; x < w; x++) {
+				survivors[i * rowInts + x * k * w + i * w + x] = 1;
+			}
+		} else {
+			memcpy(survivors + i * rowInts, bitmatrix + (rowIds[i] - k) * rowInts, rowInts * sizeof(int));
+		}
+	}
+
+	res = jerasure_invert_bitmatrix(survivors, inverse, k * w);
+	if (res == 0) {
+		for (i = 0; i < nrErasedData; i++) {
+			memcpy(decoding + i * rowInts, inverse + rowIds[k + i] * rowInts, rowInts * sizeof(int));
+		}
+	}
+	free(survivors);
+	free(inverse);
+	return (res == 0) ? 0 : -1;
+}
+
+/**
+ * Fills the row of the decoding bitmatrix which rebuilds an erased coding row. The coding row's bitmatrix columns for
+ * erased data rows are replaced by the decoding rows of those data rows, so it is expressed in surviving rows only.
+ * @param k The number of data rows
+ * @param w The word size
+ * @param bitmatrix The coding bitmatrix
+ * @param rowIds The row ids from setup_decoding_ids
+ * @param indToRow The positions from setup_decoding_ids
+ * @param codingRow The erased coding row (0 = c1)
+ * @param decoding The decoding bitmatrix with the erased data rows already filled
+ * @param row The row of blocks to fill
+ */
+static void fill_coding_decoding_row(int k, int w, int *bitmatrix, int *rowIds, int *indToRow, int codingRow,
+		int *decoding, int *row) {
+	int i, j, x, z;
+	int rowInts = k * w * w;
+	int *coding = bitmatrix + codingRow * rowInts;
+	int *erasedData;
+
+	memcpy(row, coding, rowInts * sizeof(int));
+	for (i = 0; i < k; i++) {
+		if (rowIds[i] != i) {
+			for (j = 0; j < w; j++) {
+				memset(row + j * k * w + i * w, 0, w * sizeof(int));
+			}
+		}
+	}
+
+	for (i = 0; i < k; i++) {
+		if (rowIds[i] != i) {
+			erasedData = decoding + (indToRow[i] - k) * rowInts;
+			for (j = 0; j < w; j++) {
+				for (x = 0; x < w; x++) {
+					if (coding[j * k * w + i * w + x]) {
+						for (z = 0; z < k * w; z++) {
+							row[j * k * w + z] ^= erasedData[x * k * w + z];
+						}
+					}
+				}
+			}
+		}
+	}
+}
+
+/**
+ * Creates the schedule which rebuilds the erased rows from the first k surviving rows (data rows first). The schedule
+ * only depends on the erasure pattern so it can be shared, read only, by every thread decoding part of the rows. It
+ * operates on the row pointers set up by decoding_ptrs.
+ * @param k The number of data rows
+ * @param m The number of coding rows
+ * @param w The word size
+ * @param bitmatrix The coding bitmatrix (k * w columns, m * w rows)
+ * @param erasures A -1 terminated array of erased row indices (0 = d1, ..., k = c1, ..., k+m-1 = cm)
+ * @return The schedule (free with jerasure_free_schedule), or NULL if the erasures can not be decoded
+ */
+int **create_decoding_schedule(int k, int m, int w, int *bitmatrix, int *erasures) {
+	int i;
+	int nrErasedData = 0;
+	int nrErasedCoding = 0;
+	int rowInts = k * w * w;
+	int *erased;
+	int *rowIds;
+	int *indToRow;
+	int *decoding;
+	int **schedule = NULL;
+
+	erased = jerasure_erasures_to_erased(k, m, erasures);
+	if (erased == NULL) {
+		/* More than m erasures */
+		return NULL;
+	}
+	for (i = 0; erasures[i] != -1; i++) {
+		if (erasures[i] < k) {
+			nrErasedData++;
+		} else {
+			nrErasedCoding++;
+		}
+	}
+
+	rowIds = (int *) malloc((k + m) * sizeof(int));
+	indToRow = (int *) malloc((k + m) * sizeof(int));
+	decoding = (int *) malloc((nrErasedData + nrErasedCoding) * rowInts * sizeof(int));
+	if (rowIds != NULL && indToRow != NULL && decoding != NULL) {
+		setup_decoding_ids(k, m, erased, rowIds, indToRow);
+		if (nrErasedData == 0 || fill_data_decoding_rows(k, w, bitmatrix, rowIds, nrErasedData, decoding) == 0) {
+			for (i = 0; i < nrErasedCoding; i++) {
+				fill_coding_decoding_row(k, w, bitmatrix, rowIds, indToRow, rowIds[k + nrErasedData + i] - k,
+						decoding, decoding + (nrErasedData + i) * rowInts);
+			}
+			schedule = jerasure_smart_bitmatrix_to_schedule(k, nrErasedData + nrErasedCoding, w, decoding);
+		}
+	}
+
+	free(erased);
+	free(rowIds);
+	free(indToRow);
+	free(decoding);
+	return schedule;
+}
+
+/**
+ * Creates the GF(2^8) matrix which rebuilds the erased rows from the k surviving rows decoding_rows picks (in row
+ * order). The survivors give the data through the inverse of their rows of the generator matrix (identity over the
+ * coding matrix): an erased data row is a row of that inverse, an erased coding row its coding matrix row times the
+ * inverse.
+ * With nothing erased the coding matrix itself is compiled.
+ * @param k The number of data rows
+ * @param m The number of coding rows
+ * @param matrix The m x k GF(2^8) coding matrix
+ * @param erasures A -1 terminated array of erased row indices (0 = d1, ..., k = c1, ..., k+m-1 = cm)
+ * @return The compiled matrix, a row per erased row in row order (free with gf8_free_matrix), or NULL if undecodable
+ */
+struct crs_gf8_matrix *create_gf8_decoding_matrix(int k, int m, int *matrix, int *erasures) {
+	int i, j, t, row, nrErased, nrSurvivors;
+	int *used, *erased, *generator, *inverse, *decoding;
+	struct crs_gf8_matrix *gm = NULL;
+
+	if (erasures[0] == -1) {
+		return gf8_compile_matrix(matrix, m, k);
+	}
+
+	used = (int *) calloc(k + m, sizeof(int));
+	erased = (int *) calloc(k + m, sizeof(int));
+	generator = (int *) malloc((size_t) k * k * sizeof(int));
+	inverse = (int *) malloc((size_t) k * k * sizeof(int));
+	decoding = (int *) malloc((size_t) (k + m) * k * sizeof(int));
+	if (used == NULL || erased == NULL || generator == NULL || inverse == NULL || decoding == NULL) {
+		nrErased = -1;
+	} else {
+		for (nrErased = 0; erasures[nrErased] != -1; nrErased++) {
+			erased[erasures[nrErased]] = 1;
+		}
+		decoding_rows(k, m, erasures, used);
+	}
+
+	/* The surviving rows of the generator matrix */
+	nrSurvivors = 0;
+	for (row = 0; nrErased > 0 && row < k + m && nrSurvivors < k; row++) {
+		if (used[row] == 0 || erased[row]) {
+			continue;
+		}
+		for (j = 0; j < k; j++) {
+			generator[nrSurvivors * k + j] = (row < k) ? (row == j) : matrix[(row - k) * k + j];
+		}
+		nrSurvivors++;
+	}
+
+	/* One row per erased row in row order, as the cache key is the erasure bitmap and not the order of erasures */
+	if (nrErased > 0 && nrSurvivors == k && gf8_invert_matrix(generator, inverse, k) == 0) {
+		for (i = 0, row = 0; i < nrErased; i++, row++) {
+			while (erased[row] == 0) {
+				row++;
+			}
+			for (j = 0; j < k; j++) {
+				if (row < k) {
+					decoding[i * k + j] = inverse[row * k + j];
+					continue;
+				}
+				decoding[i * k + j] = 0;
+				for (t = 0; t < k; t++) {
+					decoding[i * k + j] ^= galois_single_multiply(matrix[(row - k) * k + t], inverse[t * k + j], 8);
+				}
+			}
+		}
+		gm = gf8_compile_matrix(decoding, nrErased, k);
+	}
+
+	free(used);
+	free(erased);
+	free(generator);
+	free(inverse);
+	free(decoding);
+	return gm;
+}
+
+/**
+ * Sets up the row pointers a decoding schedule operates on. Positions 0 to k-1 hold the surviving rows used for
+ * decoding (erased data rows are replaced by the first unused surviving coding rows), the following positions hold the
+ * erased data rows then the erased coding rows.
+ * @param k The number of data rows
+ * @param m The number of coding rows
+ * @param erasures A -1 terminated array of erased row indices
+ * @param data The data rows
+ * @param coding The coding rows
+ * @return The k + m row pointers (free with free), or NULL if unsuccessful
+ */
+char **decoding_ptrs(int k, int m, int *erasures, char **data, char **coding) {
+	int i;
+	int *erased;
+	int *rowIds;
+	int *indToRow;
+	char **ptrs;
+
+	erased = jerasure_erasures_to_erased(k, m, erasures);
+	if (erased == NULL) {
+		return NULL;
+	}
+	rowIds = (int *) malloc((k + m) * sizeof(int));
+	indToRow = (int *) malloc((k + m) * sizeof(int));
+	ptrs = (char **) malloc((k + m) * sizeof(char *));
+	if (rowIds != NULL && indToRow != NULL && ptrs != NULL) {
+		for (i = 0; i < k + m; i++) {
+			rowIds[i] = -1;
+		}
+		setup_decoding_ids(k, m, erased, rowIds, indToRow);
+		for (i = 0; i < k + m; i++) {
+			if (rowIds[i] < 0) {
+				/* Fewer than m erasures */
+				ptrs[i] = NULL;
+			} else {
+				ptrs[i] = (rowIds[i] < k) ? data[rowIds[i]] : coding[rowIds[i] - k];
+			}
+		}
+	} else {
+		free(ptrs);
+		ptrs = NULL;
+	}
+	free(erased);
+	free(rowIds);
+	free(indToRow);
+	return ptrs;
+}
+
+/**
+ * Marks the rows a decoding schedule reads or writes: every data row, the erased coding rows and the surviving coding
+ * rows standing in for erased data rows (the first ones, as in decoding_ptrs). The other coding rows need neither be
+ * read nor allocated.
+ * @param k The number of data rows
+ * @param m The number of coding rows
+ * @param erasures A -1 terminated array of erased row indices
+ * @param used The k + m flags to fill (1 if the row is used, otherwise 0)
+ * @return The number of rows used
+ */
+int decoding_rows(int k, int m, int *erasures, int *used) {
+	int i;
+	int nrErasedData = 0;
+	int nrUsed = k;
+
+	for (i = 0; i < k + m; i++) {
+		used[i] = (i < k);
+	}
+	for (i = 0; erasures[i] != -1; i++) {
+		if (erasures[i] < k) {
+			nrErasedData++;
+		} else {
+			used[erasures[i]] = 1;
+			nrUsed++;
+		}
+	}
+	for (i = k; i < k + m && nrErasedData > 0; i++) {
+		if (used[i] == 0) {
+			used[i] = 1;
+			nrUsed++;
+			nrErasedData--;
+		}
+	}
+	return nrUsed;
+}
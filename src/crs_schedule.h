@@ -0,0 +1,135 @@
+#ifndef CRS_SCHEDULE_H_
+#define CRS_SCHEDULE_H_
+
+#include "crs_xor.h"
+#include "crs_gf8.h"
+
+/* Coding matrix kinds, part of the encoding schedule cache key */
+#define MATRIX_CAUCHY_GOOD 0
+
+/* Number of erasure patterns whose decoding schedules or GF(2^8) matrices are kept */
+#define DECODING_CACHE_SIZE 64
+
+/**
+ * Sets the directory encoding schedules are persisted to, so later processes load them instead of generating them.
+ * @param dir The cache directory (created if missing), or NULL to only cache schedules within the process
+ * @return 0 if successful, otherwise -1
+ */
+int set_schedule_cache_dir(char *dir);
+
+/**
+ * Gives the coding bitmatrix and smart encoding schedule of a (k, m, w, kind) code, and the schedule compiled into
+ * fused XOR runs. They are generated (or loaded from the cache directory) and compiled the first time the code is
+ * requested and shared by every later request of the process; callers must neither modify nor free them. Thread safe.
+ * @param k The number of data rows
+ * @param m The number of coding rows
+ * @param w The word size
+ * @param kind The coding matrix kind (MATRIX_CAUCHY_GOOD)
+ * @param bitmatrix Where the coding bitmatrix (k * w columns, m * w rows) should be stored
+ * @param schedule Where the encoding schedule should be stored
+ * @param compiled Where the compiled encoding schedule should be stored
+ * @return 0 if successful, otherwise -1
+ */
+int get_encoding_schedule(int k, int m, int w, int kind, int **bitmatrix, int ***schedule,
+		struct crs_xor_schedule **compiled);
+
+/**
+ * Frees every cached encoding and decoding schedule and GF(2^8) matrix. No schedule or matrix obtained from the caches
+ * may still be in use.
+ */
+void clear_schedule_cache(void);
+
+/**
+ * Gives the decoding schedule of an erasure pattern (see create_decoding_schedule), and the schedule compiled into
+ * fused XOR runs. The schedules of the DECODING_CACHE_SIZE most recently used patterns are kept, keyed by (k, m, w,
+ * erasure bitmap) and reused only when the bitmatrix matches, so objects sharing an erasure pattern pay for the matrix
+ * inversion and the compilation once. Thread safe.
+ * @param k The number of data rows
+ * @param m The number of coding rows
+ * @param w The word size
+ * @param bitmatrix The coding bitmatrix (k * w columns, m * w rows)
+ * @param erasures A -1 terminated array of erased row indices
+ * @param compiled Where the compiled schedule should be stored, valid until the schedule is released
+ * @return The schedule (release with release_decoding_schedule), or NULL if the erasures can not be decoded
+ */
+int **get_decoding_schedule(int k, int m, int w, int *bitmatrix, int *erasures, struct crs_xor_schedule **compiled);
+
+/**
+ * Releases a schedule obtained from get_decoding_schedule. It is freed once it is both released and evicted.
+ * @param schedule The schedule
+ */
+void release_decoding_schedule(int **schedule);
+
+/**
+ * Gives the compiled GF(2^8) matrix which rebuilds the erased rows of an ENGINE_RS8 code (see
+ * create_gf8_decoding_matrix), or its compiled coding matrix when nothing is erased. The matrices share the
+ * DECODING_CACHE_SIZE most recently used entries with the decoding schedules, keyed by (k, m, erasure bitmap) and
+ * reused only when the coding matrix matches, so stripes and objects sharing a pattern pay for the inversion and the
+ * table compilation once. Thread safe.
+ * @param k The number of data rows
+ * @param m The number of coding rows
+ * @param matrix The m x k GF(2^8) coding matrix
+ * @param erasures A -1 terminated array of erased row indices, empty for the coding matrix
+ * @return The compiled matrix (release with release_gf8_matrix), or NULL if the erasures can not be decoded
+ */
+struct crs_gf8_matrix *get_gf8_matrix(int k, int m, int *matrix, int *erasures);
+
+/**
+ * Releases a matrix obtained from get_gf8_matrix. It is freed once it is both released and evicted.
+ * @param gm The compiled matrix
+ */
+void release_gf8_matrix(struct crs_gf8_matrix *gm);
+
+/**
+ * Creates the schedule which rebuilds the erased rows from the first k surviving rows (data rows first). The schedule
+ * only depends on the erasure pattern so it can be shared, read only, by every thread decoding part of the rows. It
+ * operates on the row pointers set up by decoding_ptrs.
+ * @param k The number of data rows
+ * @param m The number of coding rows
+ * @param w The word size
+ * @param bitmatrix The coding bitmatrix (k * w columns, m * w rows)
+ * @param erasures A -1 terminated array of erased row indices (0 = d1, ..., k = c1, ..., k+m-1 = cm)
+ * @return The schedule (free with jerasure_free_schedule), or NULL if the erasures can not be decoded
+ */
+int **create_decoding_schedule(int k, int m, int w, int *bitmatrix, int *erasures);
+
+/**
+ * Creates the GF(2^8) matrix which rebuilds the erased rows from the k surviving rows decoding_rows picks (in row
+ * order). The survivors give the data through the inverse of their rows of the generator matrix (identity over the
+ * coding matrix): an erased data row is a row of that inverse, an erased coding row its coding matrix row times the
+ * inverse.
+ * With nothing erased the coding matrix itself is compiled.
+ * @param k The number of data rows
+ * @param m The number of coding rows
+ * @param matrix The m x k GF(2^8) coding matrix
+ * @param erasures A -1 terminated array of erased row indices (0 = d1, ..., k = c1, ..., k+m-1 = cm)
+ * @return The compiled matrix, a row per erased row in row order (free with gf8_free_matrix), or NULL if undecodable
+ */
+struct crs_gf8_matrix *create_gf8_decoding_matrix(int k, int m, int *matrix, int *erasures);
+
+/**
+ * Sets up the row pointers a decoding schedule operates on. Positions 0 to k-1 hold the surviving rows used for
+ * decoding (erased data rows are replaced by the first unused surviving coding rows), the following positions hold the
+ * erased data rows then the erased coding rows.
+ * @param k The number of data rows
+ * @param m The number of coding rows
+ * @param erasures A -1 terminated array of erased row indices
+ * @param data The data rows
+ * @param coding The coding rows
+ * @return The k + m row pointers (free with free), or NULL if unsuccessful
+ */
+char **decoding_ptrs(int k, int m, int *erasures, char **data, char **coding);
+
+/**
+ * Marks the rows a decoding schedule reads or writes: every data row, the erased coding rows and the surviving coding
+ * rows standing in for erased data rows (the first ones, as in decoding_ptrs). The other coding rows need neither be
+ * read nor allocated.
+ * @param k The number of data rows
+ * @param m The number of coding rows
+ * @param erasures A -1 terminated array of erased row indices
+ * @param used The k + m flags to fill (1 if the row is used, otherwise 0)
+ * @return The number of rows used
+ */
+int decoding_rows(int k, int m, int *erasures, int *used);
+
+#endif /* CRS_SCHEDULE_H_ */
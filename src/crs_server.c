@@ -0,0 +1,508 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "crs_arena.h"
+#include "crs_thread_pool.h"
+#include "crs_command.h"
+#include "crs_server.h"
+
+/**
+ * The state shared by the commands being served
+ */
+struct crs_server {
+	struct crs_arena *arenas; /* One per command served at the same time */
+	int *freeArenas; /* Indices of the arenas not in use */
+	int nrFree;
+	pthread_mutex_t lock; /* Guards the free arenas and getopt */
+};
+
+/**
+ * An accepted connection, to be served on the pool
+ */
+struct server_connection {
+	struct crs_server *server;
+	int fd;
+};
+
+/**
+ * A union aligning a control message buffer able to hold SERVER_MAX_FDS descriptors
+ */
+union fd_control {
+	char buf[CMSG_SPACE(SERVER_MAX_FDS * sizeof(int))];
+	struct cmsghdr align;
+};
+
+static volatile sig_atomic_t stopping = 0;
+
+/**
+ * Stops the server once the commands accepted are served.
+ */
+static void handle_stop(int sig) {
+	stopping = 1;
+}
+
+/**
+ * Receives a command line and the descriptors passed with it.
+ * @param fd The connection
+ * @param buf The SERVER_MAX_REQUEST bytes to receive into
+ * @param fds The SERVER_MAX_FDS descriptors to fill
+ * @param nrFds Where the number of descriptors received should be stored
+ * @return The number of arguments, or -1 if the command line is empty, too long, cut short or passes more than
+ * SERVER_MAX_FDS descriptors (the extra ones are closed)
+ */
+static int receive_command(int fd, char *buf, int *fds, int *nrFds) {
+	int i, n, argc, extra;
+	int tooMany = 0;
+	size_t size = 0;
+	ssize_t nrRead;
+	union fd_control control;
+	struct iovec iov;
+	struct msghdr msg;
+	struct cmsghdr *cmsg;
+
+	*nrFds = 0;
+	while (size < SERVER_MAX_REQUEST) {
+		iov.iov_base = buf + size;
+		iov.iov_len = SERVER_MAX_REQUEST - size;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = control.buf;
+		msg.msg_controllen = sizeof(control.buf);
+		nrRead = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+		if (nrRead < 0 && errno == EINTR) {
+			continue;
+		}
+		if (nrRead <= 0) {
+			return -1;
+		}
+		for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+			if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) {
+				continue;
+			}
+			n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+			for (i = 0; i < n; i++) {
+				if (*nrFds < SERVER_MAX_FDS) {
+					memcpy(fds + *nrFds, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+					(*nrFds)++;
+				} else {
+					memcpy(&extra, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+					close(extra);
+					tooMany = 1;
+				}
+			}
+		}
+		if (tooMany || (msg.msg_flags & MSG_CTRUNC) != 0) {
+			return -1;
+		}
+
+		/* Complete once an empty argument ends the arguments */
+		argc = 0;
+		for (i = 0; i < (int) (size + nrRead); i++) {
+			if (buf[i] != '\0') {
+				continue;
+			}
+			if (i == 0 || buf[i - 1] == '\0') {
+				return (argc > 0) ? argc : -1;
+			}
+			argc++;
+		}
+		size += nrRead;
+	}
+	return -1;
+}
+
+/**
+ * Replaces the fd:N arguments with the /proc/self/fd path of the N-th descriptor received.
+ * @param argc The number of arguments
+ * @param argv The arguments
+ * @param paths The argc paths to fill, allocated for the replaced arguments and NULL for the others
+ * @param fds The descriptors received
+ * @param nrFds The number of descriptors received
+ * @return 0 if successful, otherwise -1 (an argument names a descriptor which was not passed)
+ */
+static int resolve_fds(int argc, char **argv, char **paths, int *fds, int nrFds) {
+	int i, n, len;
+	char *end;
+	char *path;
+
+	for (i = 1; i < argc; i++) {
+		if (strncmp(argv[i], "fd:", 3) != 0) {
+			continue;
+		}
+		n = (int) strtol(argv[i] + 3, &end, 10);
+		if (end == argv[i] + 3 || n < 0 || n >= nrFds || (*end != '\0' && *end != '/')) {
+			return -1;
+		}
+		len = strlen(end) + 32;
+		path = (char *) malloc(len);
+		if (path == NULL) {
+			return -1;
+		}
+		snprintf(path, len, "/proc/self/fd/%d%s", fds[n], end);
+		paths[i] = path;
+		argv[i] = path;
+	}
+	return 0;
+}
+
+/**
+ * Runs one command line received on a connection and replies with its result.
+ * @param arg The server_connection, freed
+ */
+static void serve_connection(void *arg) {
+	int i, argc, res, arena, err;
+	int nrFds = 0;
+	int fds[SERVER_MAX_FDS];
+	char *buf, *p;
+	char **argv = NULL;
+	char **paths = NULL;
+	char reply[256];
+	struct crs_command cmd;
+	struct server_connection *conn = (struct server_connection *) arg;
+	struct crs_server *server = conn->server;
+
+	buf = (char *) malloc(SERVER_MAX_REQUEST);
+	argc = (buf == NULL) ? -1 : receive_command(conn->fd, buf, fds, &nrFds);
+	if (argc > 0) {
+		argv = (char **) malloc((argc + 1) * sizeof(char *));
+		paths = (char **) calloc(argc, sizeof(char *));
+	}
+	if (argc <= 0 || argv == NULL || paths == NULL) {
+		res = -1;
+		err = EINVAL;
+	} else {
+		for (i = 0, p = buf; i < argc; i++, p += strlen(p) + 1) {
+			argv[i] = p;
+		}
+		argv[argc] = NULL;
+		res = resolve_fds(argc, argv, paths, fds, nrFds);
+		err = EINVAL;
+	}
+
+	arena = -1;
+	if (res == 0) {
+		pthread_mutex_lock(&(server->lock));
+		res = parse_command(argc, argv, &cmd);
+		if (res == 0) {
+			server->nrFree--;
+			arena = server->freeArenas[server->nrFree];
+		}
+		pthread_mutex_unlock(&(server->lock));
+	}
+	if (res == 0 && (cmd.mode == MODE_SERVE || cmd.cacheDir != NULL)) {
+		res = -1;
+	} else if (res == 0) {
+		cmd.opts.arena = server->arenas + arena;
+		errno = 0;
+		res = run_command(&cmd);
+		err = errno;
+	}
+
+	if (res == 0) {
+		snprintf(reply, sizeof(reply), "0 OK\n");
+	} else {
+		snprintf(reply, sizeof(reply), "%d %s\n", res, (err == 0) ? "Failed" : strerror(err));
+	}
+	if (write(conn->fd, reply, strlen(reply)) < 0) {
+		fprintf(stderr, "Could not reply to a client\n%s\n", strerror(errno));
+	}
+
+	if (arena >= 0) {
+		pthread_mutex_lock(&(server->lock));
+		server->freeArenas[server->nrFree] = arena;
+		server->nrFree++;
+		pthread_mutex_unlock(&(server->lock));
+	}
+	for (i = 0; paths != NULL && i < argc; i++) {
+		free(paths[i]);
+	}
+	for (i = 0; i < nrFds; i++) {
+		close(fds[i]);
+	}
+	close(conn->fd);
+	free(argv);
+	free(paths);
+	free(buf);
+	free(conn);
+}
+
+/**
+ * Creates the listening socket, replacing a stale socket at its path. A socket a server still answers on is left alone.
+ * @param socketPath The path of the socket
+ * @return The socket, or -1 if unsuccessful (EADDRINUSE if the path is taken)
+ */
+static int listen_socket(char *socketPath) {
+	int fd;
+	struct sockaddr_un addr;
+	struct stat st;
+	int probe;
+
+	if (strlen(socketPath) >= sizeof(addr.sun_path)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, socketPath);
+	if (stat(socketPath, &st) == 0) {
+		if (!S_ISSOCK(st.st_mode)) {
+			errno = EADDRINUSE;
+			return -1;
+		}
+		/* Only a socket nothing listens on any more is stale */
+		probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		if (probe < 0) {
+			return -1;
+		}
+		if (connect(probe, (struct sockaddr *) &addr, sizeof(addr)) == 0) {
+			close(probe);
+			errno = EADDRINUSE;
+			return -1;
+		}
+		if (errno != ECONNREFUSED) {
+			close(probe);
+			return -1;
+		}
+		close(probe);
+		unlink(socketPath);
+	}
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		return -1;
+	}
+	if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0 || listen(fd, SERVER_BACKLOG) < 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/**
+ * Serves encode, decode, reconstruct and verify commands sent to a Unix domain socket until SIGINT or SIGTERM, then
+ * finishes the commands accepted and removes the socket. Commands run on a pool of nrWorkers threads, each with an
+ * arena kept between commands, and share the cached coding and decoding schedules. Commands may not set the schedule
+ * cache directory, --stats is ignored.
+ * @param socketPath The path to create the socket at, a stale socket there is replaced, a live one is an error
+ * @param nrWorkers The number of commands served at the same time, less than MAX_THREADS
+ * @return 0 if successful, otherwise -1
+ */
+int serve(char *socketPath, int nrWorkers) {
+	int i, fd, listenFd, res = 0;
+	sigset_t stopSignals, waitMask;
+	struct sigaction action;
+	struct pollfd pfd;
+	struct crs_server server;
+	struct crs_thread_pool *pool;
+	struct crs_task_group group;
+	struct server_connection *conn;
+	struct timeval timeout;
+
+	/* The stop signals are only delivered while waiting for a connection, so none is missed between two waits */
+	sigemptyset(&stopSignals);
+	sigaddset(&stopSignals, SIGINT);
+	sigaddset(&stopSignals, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &stopSignals, &waitMask);
+	sigdelset(&waitMask, SIGINT);
+	sigdelset(&waitMask, SIGTERM);
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = handle_stop;
+	sigaction(SIGINT, &action, NULL);
+	sigaction(SIGTERM, &action, NULL);
+	signal(SIGPIPE, SIG_IGN);
+
+	listenFd = listen_socket(socketPath);
+	if (listenFd < 0) {
+		fprintf(stderr, "Could not listen on socket: %s\n%s\n", socketPath, strerror(errno));
+		return -1;
+	}
+
+	/* The thread waiting on the group at shutdown also serves commands, hence one more arena than workers */
+	server.arenas = (struct crs_arena *) malloc((nrWorkers + 1) * sizeof(struct crs_arena));
+	server.freeArenas = (int *) malloc((nrWorkers + 1) * sizeof(int));
+	pool = thread_pool_create(nrWorkers + 1);
+	if (server.arenas == NULL || server.freeArenas == NULL || pool == NULL) {
+		fprintf(stderr, "Could not create worker pool\n%s\n", strerror(errno));
+		free(server.arenas);
+		free(server.freeArenas);
+		if (pool != NULL) {
+			thread_pool_destroy(pool);
+		}
+		close(listenFd);
+		unlink(socketPath);
+		return -1;
+	}
+	for (i = 0; i <= nrWorkers; i++) {
+		arena_init(server.arenas + i);
+		server.freeArenas[i] = i;
+	}
+	server.nrFree = nrWorkers + 1;
+	pthread_mutex_init(&(server.lock), NULL);
+	task_group_init(&group);
+	fprintf(stdout, "Listening on %s with %d workers\n", socketPath, nrWorkers);
+	fflush(stdout);
+
+	timeout.tv_sec = SERVER_RECEIVE_TIMEOUT;
+	timeout.tv_usec = 0;
+	pfd.fd = listenFd;
+	pfd.events = POLLIN;
+	while (!stopping) {
+		if (ppoll(&pfd, 1, NULL, &waitMask) < 0) {
+			if (errno != EINTR) {
+				fprintf(stderr, "Could not wait for connections\n%s\n", strerror(errno));
+				res = -1;
+				break;
+			}
+			continue;
+		}
+		fd = accept4(listenFd, NULL, NULL, SOCK_CLOEXEC);
+		if (fd < 0) {
+			fprintf(stderr, "Could not accept connection\n%s\n", strerror(errno));
+			continue;
+		}
+		/* A client sending nothing would otherwise hold a worker forever */
+		if (setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) < 0) {
+			fprintf(stderr, "Could not set connection timeout\n%s\n", strerror(errno));
+			close(fd);
+			continue;
+		}
+		conn = (struct server_connection *) malloc(sizeof(struct server_connection));
+		if (conn != NULL) {
+			conn->server = &server;
+			conn->fd = fd;
+		}
+		if (conn == NULL || thread_pool_submit(pool, &group, serve_connection, conn) < 0) {
+			fprintf(stderr, "Could not queue connection\n%s\n", strerror(errno));
+			free(conn);
+			close(fd);
+		}
+	}
+
+	close(listenFd);
+	unlink(socketPath);
+	thread_pool_wait(pool, &group);
+	thread_pool_destroy(pool);
+	for (i = 0; i <= nrWorkers; i++) {
+		arena_free(server.arenas + i);
+	}
+	pthread_mutex_destroy(&(server.lock));
+	free(server.arenas);
+	free(server.freeArenas);
+	pthread_sigmask(SIG_UNBLOCK, &stopSignals, NULL);
+	return res;
+}
+
+/**
+ * Sends a command line to a server and waits for its result, printing the message of a failure to stderr.
+ * @param socketPath The socket of the server
+ * @param argc The number of arguments
+ * @param argv The arguments, argv[0] being the program name
+ * @param fds The file descriptors to pass, named fd:0, fd:1, ... in the arguments
+ * @param nrFds The number of file descriptors to pass, at most SERVER_MAX_FDS
+ * @return The result of the command (0 if successful), or -1 if it could not be sent
+ */
+int send_command(char *socketPath, int argc, char **argv, int *fds, int nrFds) {
+	int i, fd, res;
+	size_t size, done, len;
+	ssize_t n;
+	char *buf;
+	char reply[256];
+	union fd_control control;
+	struct sockaddr_un addr;
+	struct iovec iov;
+	struct msghdr msg;
+	struct cmsghdr *cmsg;
+
+	if (strlen(socketPath) >= sizeof(addr.sun_path) || nrFds > SERVER_MAX_FDS) {
+		errno = EINVAL;
+		return -1;
+	}
+	size = 1;
+	for (i = 0; i < argc; i++) {
+		size += strlen(argv[i]) + 1;
+	}
+	if (size > SERVER_MAX_REQUEST) {
+		errno = E2BIG;
+		return -1;
+	}
+	buf = (char *) malloc(size);
+	if (buf == NULL) {
+		return -1;
+	}
+	for (i = 0, done = 0; i < argc; i++) {
+		len = strlen(argv[i]) + 1;
+		memcpy(buf + done, argv[i], len);
+		done += len;
+	}
+	buf[done] = '\0';
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, socketPath);
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0 || connect(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+		fprintf(stderr, "Could not connect to server: %s\n%s\n", socketPath, strerror(errno));
+		if (fd >= 0) {
+			close(fd);
+		}
+		free(buf);
+		return -1;
+	}
+
+	/* The descriptors go with the first bytes */
+	iov.iov_base = buf;
+	iov.iov_len = size;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	if (nrFds > 0) {
+		memset(control.buf, 0, sizeof(control.buf));
+		msg.msg_control = control.buf;
+		msg.msg_controllen = CMSG_SPACE(nrFds * sizeof(int));
+		cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(nrFds * sizeof(int));
+		memcpy(CMSG_DATA(cmsg), fds, nrFds * sizeof(int));
+	}
+	n = sendmsg(fd, &msg, MSG_NOSIGNAL);
+	for (done = (n < 0) ? 0 : n; n >= 0 && done < size; done += n) {
+		n = send(fd, buf + done, size - done, MSG_NOSIGNAL);
+	}
+	free(buf);
+	if (n < 0) {
+		fprintf(stderr, "Could not send command to server\n%s\n", strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	for (done = 0; done < sizeof(reply) - 1; done += n) {
+		n = read(fd, reply + done, sizeof(reply) - 1 - done);
+		if (n <= 0) {
+			break;
+		}
+	}
+	close(fd);
+	reply[done] = '\0';
+	if (sscanf(reply, "%d", &res) != 1) {
+		fprintf(stderr, "No reply from server\n");
+		return -1;
+	}
+	if (res != 0) {
+		len = strcspn(reply, "\n");
+		reply[len] = '\0';
+		fprintf(stderr, "Server: %s\n", (strchr(reply, ' ') == NULL) ? reply : strchr(reply, ' ') + 1);
+	}
+	return res;
+}
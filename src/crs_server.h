@@ -0,0 +1,42 @@
+#ifndef CRS_SERVER_H_
+#define CRS_SERVER_H_
+
+/*
+ * Protocol: a client connects to the Unix domain (stream) socket and sends one command line, each argument (argv[0]
+ * included) followed by a NUL byte, then one more NUL byte. File descriptors passed with SCM_RIGHTS alongside the
+ * first bytes are named in arguments as fd:N, the N-th descriptor passed, optionally followed by a path within it
+ * (fd:0/sub/file). The server runs the command and replies with one line, "<result> <message>\n", then closes the
+ * connection. Relative paths are relative to the working directory of the server.
+ */
+
+/* Bytes of a command line */
+#define SERVER_MAX_REQUEST (64 * 1024)
+/* File descriptors passed with a command line */
+#define SERVER_MAX_FDS 8
+#define SERVER_BACKLOG 128
+/* Seconds a connection may stay silent while sending its command line */
+#define SERVER_RECEIVE_TIMEOUT 30
+
+/**
+ * Serves encode, decode, reconstruct and verify commands sent to a Unix domain socket until SIGINT or SIGTERM, then
+ * finishes the commands accepted and removes the socket. Commands run on a pool of nrWorkers threads, each with an
+ * arena kept between commands, and share the cached coding and decoding schedules. Commands may not set the schedule
+ * cache directory, --stats is ignored.
+ * @param socketPath The path to create the socket at, a stale socket there is replaced, a live one is an error
+ * @param nrWorkers The number of commands served at the same time, less than MAX_THREADS
+ * @return 0 if successful, otherwise -1
+ */
+int serve(char *socketPath, int nrWorkers);
+
+/**
+ * Sends a command line to a server and waits for its result, printing the message of a failure to stderr.
+ * @param socketPath The socket of the server
+ * @param argc The number of arguments
+ * @param argv The arguments, argv[0] being the program name
+ * @param fds The file descriptors to pass, named fd:0, fd:1, ... in the arguments
+ * @param nrFds The number of file descriptors to pass, at most SERVER_MAX_FDS
+ * @return The result of the command (0 if successful), or -1 if it could not be sent
+ */
+int send_command(char *socketPath, int argc, char **argv, int *fds, int nrFds);
+
+#endif /* CRS_SERVER_H_ */
@@ -8,127 +8,406 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "crs_crc.h"
+#include "crs_file_io.h"
 #include "crs_spec_io.h"
 
+#define MAX_SPEC_W 32
+
+static void put_u16(unsigned char *buf, uint16_t value) {
+	buf[0] = (unsigned char) value;
+	buf[1] = (unsigned char) (value >> 8);
+}
+
+static void put_u32(unsigned char *buf, uint32_t value) {
+	put_u16(buf, (uint16_t) value);
+	put_u16(buf + 2, (uint16_t) (value >> 16));
+}
+
+static void put_u64(unsigned char *buf, uint64_t value) {
+	put_u32(buf, (uint32_t) value);
+	put_u32(buf + 4, (uint32_t) (value >> 32));
+}
+
+static uint16_t get_u16(const unsigned char *buf) {
+	return (uint16_t) (buf[0] | (buf[1] << 8));
+}
+
+static uint32_t get_u32(const unsigned char *buf) {
+	return get_u16(buf) | ((uint32_t) get_u16(buf + 2) << 16);
+}
+
+static uint64_t get_u64(const unsigned char *buf) {
+	return get_u32(buf) | ((uint64_t) get_u32(buf + 4) << 32);
+}
+
 /**
- * Reads the spec file at src to spec
- * @param src The spec file path
- * @param spec Where the spec file should be read into
+ * Reads the whole file at src into a new buffer with a single read.
+ * @param src The file path
+ * @param size Where the size of the file should be stored
+ * @return The buffer (to be freed by the caller), or NULL if unsuccessful
+ */
+static unsigned char *load_file(char *src, size_t *size) {
+	int fd;
+	struct stat fileStats;
+	unsigned char *buf;
+	ssize_t nrRead;
+	size_t done = 0;
+
+	fd = open(src, O_RDONLY);
+	if (fd < 0) {
+		return NULL;
+	}
+	if (fstat(fd, &fileStats) < 0) {
+		close(fd);
+		return NULL;
+	}
+	buf = (unsigned char *) malloc(fileStats.st_size + 1);
+	if (buf == NULL) {
+		close(fd);
+		return NULL;
+	}
+	while (done < (size_t) fileStats.st_size) {
+		nrRead = read(fd, buf + done, fileStats.st_size - done);
+		if (nrRead <= 0) {
+			break;
+		}
+		done += nrRead;
+	}
+	close(fd);
+	*size = done;
+	return buf;
+}
+
+/**
+ * @param spec The spec with k, m, w and engine set
+ * @return The number of elements in the coding matrix
+ */
+static size_t matrix_elements(struct crs_encoding_spec *spec) {
+	if (spec->engine == ENGINE_RS8) {
+		return (size_t) spec->m * spec->k;
+	}
+	return (size_t) spec->w * spec->m * spec->w * spec->k;
+}
+
+/**
+ * @param spec The spec with k, m, w and engine set
+ * @return The number of bytes the coding matrix takes in a v2 spec file
+ */
+static size_t matrix_bytes(struct crs_encoding_spec *spec) {
+	if (spec->engine == ENGINE_RS8) {
+		return matrix_elements(spec);
+	}
+	return (matrix_elements(spec) + 7) / 8;
+}
+
+/**
+ * Parses a version 1 spec (host byte order, one byte per bitmatrix element).
+ * @param buf The spec file contents
+ * @param size The size of the spec file
+ * @param spec Where the spec should be read into
  * @return 0 if successful, otherwise -1
  */
-int read_spec(char *src, struct crs_encoding_spec *spec) {
-	int i;
-	FILE *f;
-	char bitBuf;
-	size_t nrRead;
-	size_t bitmatrixSize;
-
-	f = fopen(src, "rb");
-	if (f == NULL) {
+static int parse_spec_v1(unsigned char *buf, size_t size, struct crs_encoding_spec *spec) {
+	size_t i, offset, bitmatrixSize;
+
+	offset = 3 * sizeof(int) + 2 * sizeof(size_t);
+	if (size < offset) {
 		return -1;
 	}
-	nrRead = fread(&(spec->k), sizeof(int), 1, f);
-	if (nrRead != 1) {
-		fclose(f);
+	spec->engine = ENGINE_CRS;
+	spec->checksums = NULL;
+	memcpy(&(spec->k), buf, sizeof(int));
+	memcpy(&(spec->m), buf + sizeof(int), sizeof(int));
+	memcpy(&(spec->w), buf + 2 * sizeof(int), sizeof(int));
+	memcpy(&(spec->width), buf + 3 * sizeof(int), sizeof(size_t));
+	memcpy(&(spec->endPadding), buf + 3 * sizeof(int) + sizeof(size_t), sizeof(size_t));
+	if (spec->k <= 0 || spec->m <= 0 || spec->w <= 0 || spec->w > MAX_SPEC_W) {
 		return -1;
 	}
 
-	nrRead = fread(&(spec->m), sizeof(int), 1, f);
-	if (nrRead != 1) {
-		fclose(f);
+	bitmatrixSize = matrix_elements(spec);
+	if (size - offset < bitmatrixSize) {
 		return -1;
 	}
+	spec->bitmatrix = (int *) malloc(bitmatrixSize * sizeof(int));
+	if (spec->bitmatrix == NULL) {
+		return -1;
+	}
+	for (i = 0; i < bitmatrixSize; i++) {
+		spec->bitmatrix[i] = (char) buf[offset + i];
+	}
+	offset += bitmatrixSize;
 
-	nrRead = fread(&(spec->w), sizeof(int), 1, f);
-	if (nrRead != 1) {
-		fclose(f);
+	/* Layout, absent from specs written before striped encoding was supported */
+	if (size - offset < sizeof(int)) {
+		spec->packetsize = spec->width / spec->w;
+		spec->stripeWidth = 0;
+		return 0;
+	}
+	if (size - offset < sizeof(int) + sizeof(size_t)) {
+		free(spec->bitmatrix);
 		return -1;
 	}
+	memcpy(&(spec->packetsize), buf + offset, sizeof(int));
+	memcpy(&(spec->stripeWidth), buf + offset + sizeof(int), sizeof(size_t));
+	return 0;
+}
 
-	nrRead = fread(&(spec->width), sizeof(size_t), 1, f);
-	if (nrRead != 1) {
-		fclose(f);
+/**
+ * Parses a version 2 spec, verifying its checksum.
+ * @param buf The spec file contents
+ * @param size The size of the spec file
+ * @param spec Where the spec should be read into
+ * @return 0 if successful, otherwise -1
+ */
+static int parse_spec_v2(unsigned char *buf, size_t size, struct crs_encoding_spec *spec) {
+	size_t i, headerSize, packedSize, nrChecksums;
+	uint32_t crc;
+	unsigned char *packed;
+
+	if (size < SPEC_MIN_HEADER_SIZE || get_u16(buf + 4) != SPEC_VERSION) {
+		return -1;
+	}
+	headerSize = get_u16(buf + 6);
+	packedSize = get_u32(buf + 48);
+	nrChecksums = (headerSize >= SPEC_HEADER_SIZE) ? get_u32(buf + 56) : 0;
+	if (headerSize < SPEC_MIN_HEADER_SIZE || size < headerSize || size - headerSize < packedSize
+			|| (size - headerSize - packedSize) / 4 < nrChecksums) {
 		return -1;
 	}
 
-	nrRead = fread(&(spec->endPadding), sizeof(size_t), 1, f);
-	if (nrRead != 1) {
-		fclose(f);
+	crc = get_u32(buf + 52);
+	put_u32(buf + 52, 0);
+	if (crc32c(0, buf, headerSize + packedSize + nrChecksums * 4) != crc) {
 		return -1;
 	}
 
-	bitmatrixSize = spec->w * spec->m * spec->w * spec->k;
-	spec->bitmatrix = (int *) malloc(bitmatrixSize * sizeof(int));
-	for (i = 0; i < bitmatrixSize; i++) {
-		nrRead = fread(&bitBuf, sizeof(char), 1, f);
-		if (nrRead != 1) {
-			fclose(f);
-			free(spec->bitmatrix);
-			return -1;
-		}
-		spec->bitmatrix[i] = bitBuf;
+	spec->k = (int) get_u32(buf + 8);
+	spec->m = (int) get_u32(buf + 12);
+	spec->w = (int) get_u32(buf + 16);
+	spec->packetsize = (int) get_u32(buf + 20);
+	spec->width = (size_t) get_u64(buf + 24);
+	spec->endPadding = (size_t) get_u64(buf + 32);
+	spec->stripeWidth = (size_t) get_u64(buf + 40);
+	spec->engine = (headerSize >= SPEC_HEADER_SIZE) ? (int) get_u32(buf + 60) : ENGINE_CRS;
+	if (spec->k <= 0 || spec->m <= 0 || spec->w <= 0 || spec->w > MAX_SPEC_W
+			|| spec->engine < 0 || spec->engine >= NR_ENGINES || packedSize != matrix_bytes(spec)
+			|| (spec->engine == ENGINE_RS8 && spec->k + spec->m > 256)
+			|| (nrChecksums != 0 && nrChecksums != (size_t) (spec->k + spec->m))) {
+		return -1;
 	}
 
-	fclose(f);
+	spec->bitmatrix = (int *) malloc(matrix_elements(spec) * sizeof(int));
+	spec->checksums = NULL;
+	if (nrChecksums > 0) {
+		spec->checksums = (uint32_t *) malloc(nrChecksums * sizeof(uint32_t));
+	}
+	if (spec->bitmatrix == NULL || (nrChecksums > 0 && spec->checksums == NULL)) {
+		free_spec(spec);
+		return -1;
+	}
+	packed = buf + headerSize;
+	for (i = 0; i < matrix_elements(spec); i++) {
+		if (spec->engine == ENGINE_RS8) {
+			spec->bitmatrix[i] = packed[i];
+		} else {
+			spec->bitmatrix[i] = (packed[i / 8] >> (i % 8)) & 1;
+		}
+	}
+	for (i = 0; i < nrChecksums; i++) {
+		spec->checksums[i] = get_u32(packed + packedSize + i * 4);
+	}
 	return 0;
 }
 
 /**
- * Writes the encoding specification to file.
- * @param spec The spec struct
- * @param dest The file destination
- * @return 0 if successful, otherwise -1
+ * Checks that the geometry of a parsed spec is one the encoder could have written, so that a spec which is well formed
+ * but inconsistent can not make the coding divide by zero, underflow a fragment size or index past the rows.
+ * @param spec The parsed spec
+ * @return 0 if the geometry is consistent, otherwise -1
  */
-int write_spec(struct crs_encoding_spec *spec, char *dest) {
-	int i;
-	FILE* f;
-	size_t nrWritten;
-	size_t bitmatrixSize = spec->w * spec->m * spec->w * spec->k;
-	char bitToWrite;
+static int check_geometry(struct crs_encoding_spec *spec) {
+	size_t blockSize;
 
-	/* Write spec to disk */
-	f = fopen(dest, "wb");
-	if (f == NULL) {
+	if (spec->k > MAX_K || spec->m > MAX_M || (size_t) (spec->k + spec->m) > ((size_t) 1 << spec->w)
+			|| spec->packetsize <= 0) {
 		return -1;
 	}
-	nrWritten = fwrite(&(spec->k), sizeof(int), 1, f);
-	if (nrWritten != 1) {
-		fclose(f);
+	/* The width is a whole number of blocks (or stripes), the padding lies within the data files */
+	blockSize = (size_t) spec->w * spec->packetsize;
+	if (spec->width == 0 || spec->width % blockSize != 0 || spec->width > SIZE_MAX / spec->k
+			|| spec->endPadding > (size_t) spec->k * spec->width) {
 		return -1;
 	}
-
-	nrWritten = fwrite(&(spec->m), sizeof(int), 1, f);
-	if (nrWritten != 1) {
-		fclose(f);
+	if (spec->stripeWidth != 0 && (spec->stripeWidth % blockSize != 0 || spec->width % spec->stripeWidth != 0)) {
 		return -1;
 	}
+	return 0;
+}
 
-	nrWritten = fwrite(&(spec->w), sizeof(int), 1, f);
-	if (nrWritten != 1) {
-		fclose(f);
-		return -1;
+/**
+ * Parses a spec in the v2 or v1 format, rejecting specs whose geometry the encoder could not have written.
+ * @param buf The spec bytes, the v2 checksum field is zeroed while verifying it
+ * @param size The number of spec bytes
+ * @param spec Where the spec should be read into
+ * @return 0 if successful, otherwise -1 (errno is EINVAL)
+ */
+int parse_spec(unsigned char *buf, size_t size, struct crs_encoding_spec *spec) {
+	int res;
+
+	if (size >= 4 && memcmp(buf, SPEC_MAGIC, 4) == 0) {
+		res = parse_spec_v2(buf, size, spec);
+	} else {
+		res = parse_spec_v1(buf, size, spec);
+	}
+	if (res == 0 && check_geometry(spec) < 0) {
+		free_spec(spec);
+		res = -1;
 	}
+	if (res < 0) {
+		errno = EINVAL;
+	}
+	return res;
+}
+
+/**
+ * Reads the spec file at src to spec. The file is loaded with a single read, both the v2 and v1 formats are accepted.
+ * @param src The spec file path
+ * @param spec Where the spec file should be read into
+ * @return 0 if successful, otherwise -1
+ */
+int read_spec(char *src, struct crs_encoding_spec *spec) {
+	int res;
+	size_t size;
+	unsigned char *buf;
 
-	nrWritten = fwrite(&(spec->width), sizeof(size_t), 1, f);
-	if (nrWritten != 1) {
-		fclose(f);
+	buf = load_file(src, &size);
+	if (buf == NULL) {
 		return -1;
 	}
+	res = parse_spec(buf, size, spec);
+	free(buf);
+	return res;
+}
+
+/**
+ * Gives the size of the spec in the current (v2) format.
+ * @param spec The spec struct
+ * @return The number of bytes pack_spec writes
+ */
+size_t spec_size(struct crs_encoding_spec *spec) {
+	size_t nrChecksums = (spec->checksums == NULL) ? 0 : (size_t) (spec->k + spec->m);
+
+	return SPEC_HEADER_SIZE + matrix_bytes(spec) + nrChecksums * 4;
+}
+
+/**
+ * Packs the encoding specification in the current (v2) format.
+ * @param spec The spec struct
+ * @param buf The spec_size bytes to fill
+ */
+void pack_spec(struct crs_encoding_spec *spec, unsigned char *buf) {
+	size_t i;
+	size_t size = spec_size(spec);
+	size_t packedSize = matrix_bytes(spec);
+	size_t nrChecksums = (spec->checksums == NULL) ? 0 : (size_t) (spec->k + spec->m);
+
+	memset(buf, 0, size);
+	memcpy(buf, SPEC_MAGIC, 4);
+	put_u16(buf + 4, SPEC_VERSION);
+	put_u16(buf + 6, SPEC_HEADER_SIZE);
+	put_u32(buf + 8, (uint32_t) spec->k);
+	put_u32(buf + 12, (uint32_t) spec->m);
+	put_u32(buf + 16, (uint32_t) spec->w);
+	put_u32(buf + 20, (uint32_t) spec->packetsize);
+	put_u64(buf + 24, spec->width);
+	put_u64(buf + 32, spec->endPadding);
+	put_u64(buf + 40, spec->stripeWidth);
+	put_u32(buf + 48, (uint32_t) packedSize);
+	put_u32(buf + 56, (uint32_t) nrChecksums);
+	put_u32(buf + 60, (uint32_t) spec->engine);
+	for (i = 0; i < matrix_elements(spec); i++) {
+		if (spec->engine == ENGINE_RS8) {
+			buf[SPEC_HEADER_SIZE + i] = (unsigned char) spec->bitmatrix[i];
+		} else if (spec->bitmatrix[i]) {
+			buf[SPEC_HEADER_SIZE + i / 8] |= (unsigned char) (1 << (i % 8));
+		}
+	}
+	for (i = 0; i < nrChecksums; i++) {
+		put_u32(buf + SPEC_HEADER_SIZE + packedSize + i * 4, spec->checksums[i]);
+	}
+	put_u32(buf + 52, crc32c(0, buf, size));
+}
 
-	nrWritten = fwrite(&(spec->endPadding), sizeof(size_t), 1, f);
-	if (nrWritten != 1) {
-		fclose(f);
+/**
+ * Writes the encoding specification to file in the current (v2) format. The spec is written and synced to a temporary
+ * file next to dest which is then renamed over it, so an interrupted write leaves any previous spec file intact.
+ * @param spec The spec struct
+ * @param dest The file destination
+ * @return 0 if successful, otherwise -1
+ */
+int write_spec(struct crs_encoding_spec *spec, char *dest) {
+	int fd, res, err;
+	size_t size, done, pathLen;
+	ssize_t nrWritten;
+	char *tmpPath;
+	unsigned char *buf;
+
+	size = spec_size(spec);
+	pathLen = strlen(dest) + sizeof(SPEC_TMP_SUFFIX);
+	buf = (unsigned char *) malloc(size);
+	tmpPath = (char *) malloc(pathLen);
+	if (buf == NULL || tmpPath == NULL) {
+		free(buf);
+		free(tmpPath);
 		return -1;
 	}
+	pack_spec(spec, buf);
+	snprintf(tmpPath, pathLen, "%s%s", dest, SPEC_TMP_SUFFIX);
 
-	for (i = 0; i < bitmatrixSize; i++) {
-		bitToWrite = (char) spec->bitmatrix[i];
-		nrWritten = fwrite(&bitToWrite, sizeof(char), 1, f);
-		if (nrWritten != 1) {
-			fclose(f);
-			return -1;
+	/* Write spec to disk */
+	fd = open(tmpPath, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	res = (fd < 0) ? -1 : 0;
+	for (done = 0; res == 0 && done < size; done += nrWritten) {
+		nrWritten = write(fd, buf + done, size - done);
+		if (nrWritten < 0 && errno == EINTR) {
+			nrWritten = 0;
+		} else if (nrWritten <= 0) {
+			res = -1;
 		}
 	}
-	fclose(f);
-	return 0;
+	if (res == 0) {
+		res = fsync(fd);
+	}
+	if (fd >= 0 && close(fd) != 0) {
+		res = -1;
+	}
+	if (res == 0) {
+		res = rename(tmpPath, dest);
+	}
+	if (res < 0 && fd >= 0) {
+		err = errno;
+		unlink(tmpPath);
+		errno = err;
+	}
+	free(buf);
+	free(tmpPath);
+	return res;
+}
+
+/**
+ * Frees the bitmatrix and checksums of the spec.
+ * @param spec The spec
+ */
+void free_spec(struct crs_encoding_spec *spec) {
+	free(spec->bitmatrix);
+	free(spec->checksums);
+	spec->bitmatrix = NULL;
+	spec->checksums = NULL;
 }
@@ -1,6 +1,9 @@
 #ifndef SRC_CRS_SPEC_IO_H_
 #define SRC_CRS_SPEC_IO_H_
 
+#include <stddef.h>
+#include <stdint.h>
+
 /**
  * The encoding specification
  */
@@ -13,11 +16,54 @@ struct crs_encoding_spec {
 	int w;
 	size_t width; /* in bytes */
 	size_t endPadding; /* in bytes */
-	int *bitmatrix;
+	int packetsize; /* in bytes, width / w when the whole width is coded as a single block */
+	size_t stripeWidth; /* bytes of each fragment per stripe, 0 if fragments are contiguous slices of the file */
+	int engine; /* The coding engine, ENGINE_CRS or ENGINE_RS8 (required) */
+	int *bitmatrix; /* The coding bitmatrix (ENGINE_CRS), or the m x k GF(2^8) coding matrix (ENGINE_RS8) */
+	uint32_t *checksums; /* CRC-32C of each data then coding file, NULL if not recorded */
 };
 
+/* Cauchy Reed-Solomon over GF(2^w), encoded with bitmatrix XOR schedules */
+#define ENGINE_CRS 0
+/* Reed-Solomon over GF(2^8), encoded with split nibble multiplication tables */
+#define ENGINE_RS8 1
+#define NR_ENGINES 2
+
+/*
+ * Spec file format v2, every field little-endian:
+ *   0  magic "CRSS"       4  u16 version       6  u16 headerSize
+ *   8  u32 k             12  u32 m            16  u32 w            20  u32 packetsize
+ *  24  u64 width         32  u64 endPadding   40  u64 stripeWidth
+ *  48  u32 bitmatrixSize (bytes)              52  u32 crc
+ *  56  u32 nrChecksums (0 or k + m)            60  u32 engine
+ * followed, at headerSize, by the coding matrix, then by the nrChecksums u32 fragment checksums. The ENGINE_CRS
+ * bitmatrix is packed 8 elements per byte (least significant bit first), the ENGINE_RS8 matrix takes one byte per
+ * element. The crc is the CRC-32C of the header, with the crc field zeroed, the coding matrix and the fragment
+ * checksums. Readers skip header bytes they do not know, so fields may be appended before the matrix without a version
+ * change (files with a 56 byte header have no fragment checksums and use ENGINE_CRS).
+ *
+ * Version 1 files (k, m, w, width, endPadding in host byte order, one byte per bitmatrix element, then optionally
+ * packetsize and stripeWidth) are still read.
+ */
+#define SPEC_MAGIC "CRSS"
+#define SPEC_VERSION 2
+#define SPEC_HEADER_SIZE 64
+#define SPEC_MIN_HEADER_SIZE 56
+
+/* Appended to the spec file path to name the file a new spec is written to before replacing it */
+#define SPEC_TMP_SUFFIX ".tmp"
+
 /**
- * Reads the spec file at src to spec
+ * Parses a spec in the v2 or v1 format, rejecting specs whose geometry the encoder could not have written.
+ * @param buf The spec bytes, the v2 checksum field is zeroed while verifying it
+ * @param size The number of spec bytes
+ * @param spec Where the spec should be read into
+ * @return 0 if successful, otherwise -1 (errno is EINVAL)
+ */
+int parse_spec(unsigned char *buf, size_t size, struct crs_encoding_spec *spec);
+
+/**
+ * Reads the spec file at src to spec. The file is loaded with a single read, both the v2 and v1 formats are accepted.
  * @param src The spec file path
  * @param spec Where the spec file should be read into
  * @return 0 if successful, otherwise -1
@@ -25,11 +71,32 @@ struct crs_encoding_spec {
 int read_spec(char *src, struct crs_encoding_spec *spec);
 
 /**
- * Writes the encoding specification to file.
+ * Gives the size of the spec in the current (v2) format.
+ * @param spec The spec struct
+ * @return The number of bytes pack_spec writes
+ */
+size_t spec_size(struct crs_encoding_spec *spec);
+
+/**
+ * Packs the encoding specification in the current (v2) format.
+ * @param spec The spec struct
+ * @param buf The spec_size bytes to fill
+ */
+void pack_spec(struct crs_encoding_spec *spec, unsigned char *buf);
+
+/**
+ * Writes the encoding specification to file in the current (v2) format. The spec is written and synced to a temporary
+ * file next to dest which is then renamed over it, so an interrupted write leaves any previous spec file intact.
  * @param spec The spec struct
  * @param dest The file destination
  * @return 0 if successful, otherwise -1
  */
 int write_spec(struct crs_encoding_spec *spec, char *dest);
 
+/**
+ * Frees the bitmatrix and checksums of the spec.
+ * @param spec The spec
+ */
+void free_spec(struct crs_encoding_spec *spec);
+
 #endif /* SRC_CRS_SPEC_IO_H_ */
@@ -0,0 +1,134 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/resource.h>
+#include "crs_engine.h"
+#include "crs_stats.h"
+
+static const char *phaseNames[NR_PHASES] = { "spec", "verify", "read", "setup", "code", "checksum", "write" };
+
+static int enabled = 0;
+static uint64_t startTime;
+static uint64_t phaseTimes[NR_PHASES];
+static uint64_t bytesRead;
+static uint64_t bytesWritten;
+static uint64_t xors;
+static int erasures;
+
+/**
+ * @return The monotonic clock in nanoseconds
+ */
+static uint64_t now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/**
+ * Starts collecting stats: the phase timings and counters are zeroed and the total time starts. Until this is called
+ * the stats functions do nothing.
+ */
+void stats_enable(void) {
+	int i;
+
+	for (i = 0; i < NR_PHASES; i++) {
+		phaseTimes[i] = 0;
+	}
+	bytesRead = 0;
+	bytesWritten = 0;
+	xors = 0;
+	erasures = 0;
+	enabled = 1;
+	startTime = now();
+}
+
+/**
+ * Tells whether stats are being collected.
+ * @return 1 if stats are being collected, otherwise 0
+ */
+int stats_enabled(void) {
+	return enabled;
+}
+
+/**
+ * Gives the start time of a phase, to be passed to stats_stop.
+ * @return The monotonic clock in nanoseconds, or 0 if stats are not being collected
+ */
+uint64_t stats_start(void) {
+	return enabled ? now() : 0;
+}
+
+/**
+ * Adds the time since start to a phase. Only the calling thread of an operation times phases, the pool threads do not;
+ * the times of operations run at the same time add up.
+ * @param phase The phase (PHASE_SPEC, ...)
+ * @param start The time returned by stats_start
+ */
+void stats_stop(int phase, uint64_t start) {
+	if (enabled) {
+		__atomic_fetch_add(&phaseTimes[phase], now() - start, __ATOMIC_RELAXED);
+	}
+}
+
+/**
+ * Counts bytes read from and written to files.
+ * @param nrRead The number of bytes read
+ * @param nrWritten The number of bytes written
+ */
+void stats_add_bytes(size_t nrRead, size_t nrWritten) {
+	if (enabled) {
+		__atomic_fetch_add(&bytesRead, nrRead, __ATOMIC_RELAXED);
+		__atomic_fetch_add(&bytesWritten, nrWritten, __ATOMIC_RELAXED);
+	}
+}
+
+/**
+ * Counts XOR operations of packets run by schedules.
+ * @param nrXors The number of packet XORs
+ */
+void stats_add_xors(uint64_t nrXors) {
+	if (enabled) {
+		__atomic_fetch_add(&xors, nrXors, __ATOMIC_RELAXED);
+	}
+}
+
+/**
+ * Records the number of erased (missing or corrupt) fragments.
+ * @param nrErasures The number of erasures
+ */
+void stats_set_erasures(int nrErasures) {
+	if (enabled) {
+		erasures = nrErasures;
+	}
+}
+
+/**
+ * Prints the stats as one JSON line: the operation and its geometry, the counters, the peak RSS, and the milliseconds
+ * spent in each phase and in total.
+ * @param f The stream to print to
+ * @param op The name of the operation
+ * @param spec The spec of the operation, its k, m, w, width, endPadding, packetsize and engine are reported
+ * @param res The result of the operation
+ */
+void stats_report(FILE *f, const char *op, struct crs_encoding_spec *spec, int res) {
+	int i;
+	uint64_t total = now() - startTime;
+	const char *engine = engine_name(spec->engine);
+	struct rusage usage;
+
+	if (getrusage(RUSAGE_SELF, &usage) < 0) {
+		usage.ru_maxrss = 0;
+	}
+	fprintf(f, "{\"op\": \"%s\", \"status\": %d, \"engine\": \"%s\", \"k\": %d, \"m\": %d, \"w\": %d, "
+			"\"packetsize\": %d, \"file_size\": %lu, \"erasures\": %d, \"bytes_read\": %lu, \"bytes_written\": %lu, "
+			"\"xor_ops\": %lu, \"peak_rss_kb\": %ld, \"phases_ms\": {", op, res, (engine == NULL) ? "" : engine,
+			spec->k, spec->m, spec->w, spec->packetsize, (unsigned long) ((size_t) spec->k * spec->width
+			- spec->endPadding), erasures, (unsigned long) bytesRead, (unsigned long) bytesWritten,
+			(unsigned long) xors, (long) usage.ru_maxrss);
+	for (i = 0; i < NR_PHASES; i++) {
+		fprintf(f, "\"%s\": %.3f, ", phaseNames[i], phaseTimes[i] / 1e6);
+	}
+	fprintf(f, "\"total\": %.3f}}\n", total / 1e6);
+	fflush(f);
+}
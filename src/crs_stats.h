@@ -0,0 +1,74 @@
+#ifndef CRS_STATS_H_
+#define CRS_STATS_H_
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "crs_spec_io.h"
+
+/* Phases timed by the stats report */
+#define PHASE_SPEC 0 /* Sizing the input and calculating, reading or writing the spec */
+#define PHASE_VERIFY 1 /* Finding the fragments and checking their checksums */
+#define PHASE_READ 2 /* Reading the input or the fragments */
+#define PHASE_SETUP 3 /* Generating the coding matrix, bitmatrix and schedule, or the decoding ones */
+#define PHASE_CODE 4 /* Running the encode or decode */
+#define PHASE_CHECKSUM 5 /* Checksumming the fragments */
+#define PHASE_WRITE 6 /* Writing the fragments or the reconstructed file */
+#define NR_PHASES 7
+
+/**
+ * Starts collecting stats: the phase timings and counters are zeroed and the total time starts. Until this is called
+ * the stats functions do nothing.
+ */
+void stats_enable(void);
+
+/**
+ * Tells whether stats are being collected.
+ * @return 1 if stats are being collected, otherwise 0
+ */
+int stats_enabled(void);
+
+/**
+ * Gives the start time of a phase, to be passed to stats_stop.
+ * @return The monotonic clock in nanoseconds, or 0 if stats are not being collected
+ */
+uint64_t stats_start(void);
+
+/**
+ * Adds the time since start to a phase. Only the calling thread of an operation times phases, the pool threads do not;
+ * the times of operations run at the same time add up.
+ * @param phase The phase (PHASE_SPEC, ...)
+ * @param start The time returned by stats_start
+ */
+void stats_stop(int phase, uint64_t start);
+
+/**
+ * Counts bytes read from and written to files.
+ * @param nrRead The number of bytes read
+ * @param nrWritten The number of bytes written
+ */
+void stats_add_bytes(size_t nrRead, size_t nrWritten);
+
+/**
+ * Counts XOR operations of packets run by schedules.
+ * @param nrXors The number of packet XORs
+ */
+void stats_add_xors(uint64_t nrXors);
+
+/**
+ * Records the number of erased (missing or corrupt) fragments.
+ * @param nrErasures The number of erasures
+ */
+void stats_set_erasures(int nrErasures);
+
+/**
+ * Prints the stats as one JSON line: the operation and its geometry, the counters, the peak RSS, and the milliseconds
+ * spent in each phase and in total.
+ * @param f The stream to print to
+ * @param op The name of the operation
+ * @param spec The spec of the operation, its k, m, w, width, endPadding, packetsize and engine are reported
+ * @param res The result of the operation
+ */
+void stats_report(FILE *f, const char *op, struct crs_encoding_spec *spec, int res);
+
+#endif /* CRS_STATS_H_ */
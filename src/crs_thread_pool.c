@@ -0,0 +1,209 @@
+#include <stdlib.h>
+#include <pthread.h>
+#include "crs_thread_pool.h"
+
+struct crs_task {
+	void (*fn)(void *);
+	void *arg;
+	struct crs_task_group *group;
+	struct crs_task *next;
+};
+
+struct crs_thread_pool {
+	pthread_mutex_t lock;
+	pthread_cond_t work; /* Signalled when a task is queued or on shutdown */
+	pthread_cond_t done; /* Broadcast when a task group completes */
+	struct crs_task *head;
+	struct crs_task *tail;
+	int shutdown;
+	int nrThreads;
+	int nrWorkers;
+	pthread_t *workers;
+};
+
+/**
+ * Removes the first task from the queue. The pool lock must be held.
+ * @param pool The thread pool
+ * @return The task, or NULL if the queue is empty
+ */
+static struct crs_task *dequeue(struct crs_thread_pool *pool) {
+	struct crs_task *task = pool->head;
+	if (task != NULL) {
+		pool->head = task->next;
+		if (pool->head == NULL) {
+			pool->tail = NULL;
+		}
+	}
+	return task;
+}
+
+/**
+ * Executes the task with the pool lock released and marks it completed. The pool lock must be held.
+ * @param pool The thread pool
+ * @param task The task to execute, freed afterwards
+ */
+static void run_task(struct crs_thread_pool *pool, struct crs_task *task) {
+	struct crs_task_group *group = task->group;
+
+	pthread_mutex_unlock(&(pool->lock));
+	task->fn(task->arg);
+	free(task);
+	pthread_mutex_lock(&(pool->lock));
+
+	group->pending--;
+	if (group->pending == 0) {
+		pthread_cond_broadcast(&(pool->done));
+	}
+}
+
+static void *worker_main(void *arg) {
+	struct crs_thread_pool *pool = (struct crs_thread_pool *) arg;
+	struct crs_task *task;
+
+	pthread_mutex_lock(&(pool->lock));
+	for (;;) {
+		task = dequeue(pool);
+		if (task != NULL) {
+			run_task(pool, task);
+		} else if (pool->shutdown) {
+			break;
+		} else {
+			pthread_cond_wait(&(pool->work), &(pool->lock));
+		}
+	}
+	pthread_mutex_unlock(&(pool->lock));
+	return NULL;
+}
+
+/**
+ * Creates a thread pool using nrThreads threads. The thread waiting on a task group also executes queued tasks, so
+ * nrThreads - 1 worker threads are started.
+ * @param nrThreads The number of threads to use (1 runs every task in the waiting thread)
+ * @return The thread pool, or NULL if unsuccessful
+ */
+struct crs_thread_pool *thread_pool_create(int nrThreads) {
+	int i;
+	struct crs_thread_pool *pool;
+
+	if (nrThreads <= 0 || nrThreads > MAX_THREADS) {
+		return NULL;
+	}
+
+	pool = (struct crs_thread_pool *) calloc(1, sizeof(struct crs_thread_pool));
+	if (pool == NULL) {
+		return NULL;
+	}
+	pool->workers = (pthread_t *) calloc(nrThreads, sizeof(pthread_t));
+	if (pool->workers == NULL) {
+		free(pool);
+		return NULL;
+	}
+	pthread_mutex_init(&(pool->lock), NULL);
+	pthread_cond_init(&(pool->work), NULL);
+	pthread_cond_init(&(pool->done), NULL);
+	pool->nrThreads = nrThreads;
+
+	for (i = 0; i < nrThreads - 1; i++) {
+		if (pthread_create(&(pool->workers[i]), NULL, worker_main, pool) != 0) {
+			break;
+		}
+		pool->nrWorkers++;
+	}
+	if (pool->nrWorkers != nrThreads - 1) {
+		thread_pool_destroy(pool);
+		return NULL;
+	}
+	return pool;
+}
+
+/**
+ * Stops the worker threads and frees the thread pool. No tasks may be pending.
+ * @param pool The thread pool
+ */
+void thread_pool_destroy(struct crs_thread_pool *pool) {
+	int i;
+
+	pthread_mutex_lock(&(pool->lock));
+	pool->shutdown = 1;
+	pthread_cond_broadcast(&(pool->work));
+	pthread_mutex_unlock(&(pool->lock));
+
+	for (i = 0; i < pool->nrWorkers; i++) {
+		pthread_join(pool->workers[i], NULL);
+	}
+	pthread_mutex_destroy(&(pool->lock));
+	pthread_cond_destroy(&(pool->work));
+	pthread_cond_destroy(&(pool->done));
+	free(pool->workers);
+	free(pool);
+}
+
+/**
+ * @param pool The thread pool
+ * @return The number of threads the pool was created with
+ */
+int thread_pool_size(struct crs_thread_pool *pool) {
+	return pool->nrThreads;
+}
+
+/**
+ * Initialises an empty task group.
+ * @param group The task group
+ */
+void task_group_init(struct crs_task_group *group) {
+	group->pending = 0;
+}
+
+/**
+ * Queues fn(arg) for execution as part of group.
+ * @param pool The thread pool
+ * @param group The task group the task belongs to
+ * @param fn The function to execute
+ * @param arg The argument passed to fn
+ * @return 0 if successful, otherwise -1
+ */
+int thread_pool_submit(struct crs_thread_pool *pool, struct crs_task_group *group, void (*fn)(void *), void *arg) {
+	struct crs_task *task;
+
+	task = (struct crs_task *) malloc(sizeof(struct crs_task));
+	if (task == NULL) {
+		return -1;
+	}
+	task->fn = fn;
+	task->arg = arg;
+	task->group = group;
+	task->next = NULL;
+
+	pthread_mutex_lock(&(pool->lock));
+	if (pool->tail == NULL) {
+		pool->head = task;
+	} else {
+		pool->tail->next = task;
+	}
+	pool->tail = task;
+	group->pending++;
+	pthread_cond_signal(&(pool->work));
+	pthread_mutex_unlock(&(pool->lock));
+	return 0;
+}
+
+/**
+ * Waits until every task in group has completed. The calling thread executes queued tasks while waiting, so tasks may
+ * themselves submit to and wait on the same pool.
+ * @param pool The thread pool
+ * @param group The task group
+ */
+void thread_pool_wait(struct crs_thread_pool *pool, struct crs_task_group *group) {
+	struct crs_task *task;
+
+	pthread_mutex_lock(&(pool->lock));
+	while (group->pending > 0) {
+		task = dequeue(pool);
+		if (task != NULL) {
+			run_task(pool, task);
+		} else {
+			pthread_cond_wait(&(pool->done), &(pool->lock));
+		}
+	}
+	pthread_mutex_unlock(&(pool->lock));
+}
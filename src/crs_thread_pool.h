@@ -0,0 +1,62 @@
+#ifndef CRS_THREAD_POOL_H_
+#define CRS_THREAD_POOL_H_
+
+#define MAX_THREADS 1024
+
+/**
+ * A fixed size pool of worker threads executing queued tasks
+ */
+struct crs_thread_pool;
+
+/**
+ * A set of tasks which can be waited on together
+ */
+struct crs_task_group {
+	int pending; /* Number of submitted tasks not yet completed */
+};
+
+/**
+ * Creates a thread pool using nrThreads threads. The thread waiting on a task group also executes queued tasks, so
+ * nrThreads - 1 worker threads are started.
+ * @param nrThreads The number of threads to use (1 runs every task in the waiting thread)
+ * @return The thread pool, or NULL if unsuccessful
+ */
+struct crs_thread_pool *thread_pool_create(int nrThreads);
+
+/**
+ * Stops the worker threads and frees the thread pool. No tasks may be pending.
+ * @param pool The thread pool
+ */
+void thread_pool_destroy(struct crs_thread_pool *pool);
+
+/**
+ * @param pool The thread pool
+ * @return The number of threads the pool was created with
+ */
+int thread_pool_size(struct crs_thread_pool *pool);
+
+/**
+ * Initialises an empty task group.
+ * @param group The task group
+ */
+void task_group_init(struct crs_task_group *group);
+
+/**
+ * Queues fn(arg) for execution as part of group.
+ * @param pool The thread pool
+ * @param group The task group the task belongs to
+ * @param fn The function to execute
+ * @param arg The argument passed to fn
+ * @return 0 if successful, otherwise -1
+ */
+int thread_pool_submit(struct crs_thread_pool *pool, struct crs_task_group *group, void (*fn)(void *), void *arg);
+
+/**
+ * Waits until every task in group has completed. The calling thread executes queued tasks while waiting, so tasks may
+ * themselves submit to and wait on the same pool.
+ * @param pool The thread pool
+ * @param group The task group
+ */
+void thread_pool_wait(struct crs_thread_pool *pool, struct crs_task_group *group);
+
+#endif /* CRS_THREAD_POOL_H_ */
@@ -0,0 +1,258 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "crs_xor.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define CRS_XOR_SIMD
+#include <immintrin.h>
+#endif
+
+/**
+ * Operations sharing a destination packet, executed as dst = (dst ^) sources[0] ^ ... ^ sources[nrSources - 1]
+ */
+struct crs_xor_run {
+	int dstRow;
+	int dstPacket;
+	int accumulate; /* 1 if the destination is XORed into, 0 if it is overwritten */
+	int first; /* Index of the first source in the source list */
+	int nrSources;
+};
+
+struct crs_xor_schedule {
+	struct crs_xor_run *runs;
+	int nrRuns;
+	int *sources; /* Row, packet pairs of every run */
+	int maxSources; /* The most sources of any run */
+};
+
+static void (*xorRegion)(char *dst, char **srcs, int nrSrcs, int accumulate, size_t size);
+static const char *xorName;
+static pthread_once_t xorOnce = PTHREAD_ONCE_INIT;
+
+/**
+ * XORs bytes [offset, size) of the sources into dst eight bytes at a time.
+ */
+static void xor_words(char *dst, char **srcs, int nrSrcs, int accumulate, size_t offset, size_t size) {
+	int i;
+	uint64_t acc, word;
+	unsigned char byte;
+
+	for (; offset + sizeof(uint64_t) <= size; offset += sizeof(uint64_t)) {
+		memcpy(&acc, accumulate ? dst + offset : srcs[0] + offset, sizeof(uint64_t));
+		for (i = accumulate ? 0 : 1; i < nrSrcs; i++) {
+			memcpy(&word, srcs[i] + offset, sizeof(uint64_t));
+			acc ^= word;
+		}
+		memcpy(dst + offset, &acc, sizeof(uint64_t));
+	}
+	for (; offset < size; offset++) {
+		byte = accumulate ? dst[offset] : srcs[0][offset];
+		for (i = accumulate ? 0 : 1; i < nrSrcs; i++) {
+			byte ^= srcs[i][offset];
+		}
+		dst[offset] = byte;
+	}
+}
+
+/**
+ * XORs the sources into dst with 64 bit words.
+ */
+static void xor_scalar(char *dst, char **srcs, int nrSrcs, int accumulate, size_t size) {
+	xor_words(dst, srcs, nrSrcs, accumulate, 0, size);
+}
+
+#ifdef CRS_XOR_SIMD
+/**
+ * XORs the sources into dst four 256 bit vectors at a time, the tail with 64 bit words.
+ */
+__attribute__((target("avx2")))
+static void xor_avx2(char *dst, char **srcs, int nrSrcs, int accumulate, size_t size) {
+	size_t offset;
+	int i;
+	char *src;
+	__m256i a0, a1, a2, a3;
+
+	for (offset = 0; offset + 4 * sizeof(__m256i) <= size; offset += 4 * sizeof(__m256i)) {
+		src = accumulate ? dst + offset : srcs[0] + offset;
+		a0 = _mm256_loadu_si256((__m256i *) src);
+		a1 = _mm256_loadu_si256((__m256i *) (src + 32));
+		a2 = _mm256_loadu_si256((__m256i *) (src + 64));
+		a3 = _mm256_loadu_si256((__m256i *) (src + 96));
+		for (i = accumulate ? 0 : 1; i < nrSrcs; i++) {
+			src = srcs[i] + offset;
+			a0 = _mm256_xor_si256(a0, _mm256_loadu_si256((__m256i *) src));
+			a1 = _mm256_xor_si256(a1, _mm256_loadu_si256((__m256i *) (src + 32)));
+			a2 = _mm256_xor_si256(a2, _mm256_loadu_si256((__m256i *) (src + 64)));
+			a3 = _mm256_xor_si256(a3, _mm256_loadu_si256((__m256i *) (src + 96)));
+		}
+		_mm256_storeu_si256((__m256i *) (dst + offset), a0);
+		_mm256_storeu_si256((__m256i *) (dst + offset + 32), a1);
+		_mm256_storeu_si256((__m256i *) (dst + offset + 64), a2);
+		_mm256_storeu_si256((__m256i *) (dst + offset + 96), a3);
+	}
+	xor_words(dst, srcs, nrSrcs, accumulate, offset, size);
+}
+
+/**
+ * XORs the sources into dst four 512 bit vectors at a time, the tail with 64 bit words.
+ */
+__attribute__((target("avx512f")))
+static void xor_avx512(char *dst, char **srcs, int nrSrcs, int accumulate, size_t size) {
+	size_t offset;
+	int i;
+	char *src;
+	__m512i a0, a1, a2, a3;
+
+	for (offset = 0; offset + 4 * sizeof(__m512i) <= size; offset += 4 * sizeof(__m512i)) {
+		src = accumulate ? dst + offset : srcs[0] + offset;
+		a0 = _mm512_loadu_si512(src);
+		a1 = _mm512_loadu_si512(src + 64);
+		a2 = _mm512_loadu_si512(src + 128);
+		a3 = _mm512_loadu_si512(src + 192);
+		for (i = accumulate ? 0 : 1; i < nrSrcs; i++) {
+			src = srcs[i] + offset;
+			a0 = _mm512_xor_si512(a0, _mm512_loadu_si512(src));
+			a1 = _mm512_xor_si512(a1, _mm512_loadu_si512(src + 64));
+			a2 = _mm512_xor_si512(a2, _mm512_loadu_si512(src + 128));
+			a3 = _mm512_xor_si512(a3, _mm512_loadu_si512(src + 192));
+		}
+		_mm512_storeu_si512(dst + offset, a0);
+		_mm512_storeu_si512(dst + offset + 64, a1);
+		_mm512_storeu_si512(dst + offset + 128, a2);
+		_mm512_storeu_si512(dst + offset + 192, a3);
+	}
+	xor_words(dst, srcs, nrSrcs, accumulate, offset, size);
+}
+#endif
+
+/**
+ * Picks the widest XOR kernel the CPU supports.
+ */
+static void init_xor(void) {
+	xorRegion = xor_scalar;
+	xorName = "scalar";
+#ifdef CRS_XOR_SIMD
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f")) {
+		xorRegion = xor_avx512;
+		xorName = "avx512";
+	} else if (__builtin_cpu_supports("avx2")) {
+		xorRegion = xor_avx2;
+		xorName = "avx2";
+	}
+#endif
+}
+
+/**
+ * Compiles a schedule (as produced by jerasure_smart_bitmatrix_to_schedule) into fused runs. Consecutive operations
+ * XORing into the same destination packet are merged with the copy or XOR starting them, an operation reading its own
+ * destination starts a new run so the result is identical to running the operations one at a time.
+ * @param schedule The -1 terminated schedule
+ * @return The compiled schedule, or NULL if unsuccessful
+ */
+struct crs_xor_schedule *xor_compile_schedule(int **schedule) {
+	int nrOps, op, selfRead;
+	struct crs_xor_schedule *xs;
+	struct crs_xor_run *run = NULL;
+
+	for (nrOps = 0; schedule[nrOps][0] >= 0; nrOps++) {
+	}
+
+	xs = (struct crs_xor_schedule *) malloc(sizeof(struct crs_xor_schedule));
+	if (xs == NULL) {
+		return NULL;
+	}
+	xs->runs = (struct crs_xor_run *) malloc((nrOps + 1) * sizeof(struct crs_xor_run));
+	xs->sources = (int *) malloc((2 * nrOps + 1) * sizeof(int));
+	if (xs->runs == NULL || xs->sources == NULL) {
+		xor_free_schedule(xs);
+		return NULL;
+	}
+	xs->nrRuns = 0;
+	xs->maxSources = 0;
+
+	for (op = 0; op < nrOps; op++) {
+		selfRead = (schedule[op][0] == schedule[op][2] && schedule[op][1] == schedule[op][3]);
+		if (run == NULL || schedule[op][4] == 0 || selfRead || run->dstRow != schedule[op][2]
+				|| run->dstPacket != schedule[op][3]) {
+			run = &(xs->runs[xs->nrRuns]);
+			xs->nrRuns++;
+			run->dstRow = schedule[op][2];
+			run->dstPacket = schedule[op][3];
+			run->accumulate = (schedule[op][4] != 0);
+			run->first = op;
+			run->nrSources = 0;
+		}
+		xs->sources[2 * op] = schedule[op][0];
+		xs->sources[2 * op + 1] = schedule[op][1];
+		run->nrSources++;
+		if (run->nrSources > xs->maxSources) {
+			xs->maxSources = run->nrSources;
+		}
+	}
+	return xs;
+}
+
+/**
+ * Frees a compiled schedule.
+ * @param xs The compiled schedule, may be NULL
+ */
+void xor_free_schedule(struct crs_xor_schedule *xs) {
+	if (xs == NULL) {
+		return;
+	}
+	free(xs->runs);
+	free(xs->sources);
+	free(xs);
+}
+
+/**
+ * Runs the compiled schedule over consecutive blocks of the rows. The XOR kernel is picked once from the CPU: AVX-512,
+ * AVX2, or 64 bit words.
+ * @param xs The compiled schedule
+ * @param ptrs The row pointers the schedule operates on, NULL for rows it does not use
+ * @param packetsize The packet size
+ * @param blockSize The size of a block (w * packetsize)
+ * @param nrBlocks The number of blocks to run the schedule over
+ * @return 0 if successful, otherwise -1
+ */
+int xor_run_schedule(struct crs_xor_schedule *xs, char **ptrs, int packetsize, size_t blockSize, size_t nrBlocks) {
+	int i, j;
+	int *source;
+	size_t block, offset;
+	char **srcs;
+	struct crs_xor_run *run;
+
+	pthread_once(&xorOnce, init_xor);
+	srcs = (char **) malloc((xs->maxSources + 1) * sizeof(char *));
+	if (srcs == NULL) {
+		return -1;
+	}
+
+	for (block = 0; block < nrBlocks; block++) {
+		offset = block * blockSize;
+		for (i = 0; i < xs->nrRuns; i++) {
+			run = &(xs->runs[i]);
+			source = xs->sources + 2 * run->first;
+			for (j = 0; j < run->nrSources; j++) {
+				srcs[j] = ptrs[source[2 * j]] + offset + (size_t) source[2 * j + 1] * packetsize;
+			}
+			xorRegion(ptrs[run->dstRow] + offset + (size_t) run->dstPacket * packetsize, srcs, run->nrSources,
+					run->accumulate, packetsize);
+		}
+	}
+
+	free(srcs);
+	return 0;
+}
+
+/**
+ * Gives the name of the XOR kernel picked for this CPU.
+ * @return "avx512", "avx2" or "scalar"
+ */
+const char *xor_kernel_name(void) {
+	pthread_once(&xorOnce, init_xor);
+	return xorName;
+}
@@ -0,0 +1,45 @@
+#ifndef CRS_XOR_H_
+#define CRS_XOR_H_
+
+#include <stddef.h>
+
+/**
+ * A jerasure schedule compiled into runs of operations sharing a destination packet, each run being executed as one
+ * fused XOR of all its sources so the destination is written once
+ */
+struct crs_xor_schedule;
+
+/**
+ * Compiles a schedule (as produced by jerasure_smart_bitmatrix_to_schedule) into fused runs. Consecutive operations
+ * XORing into the same destination packet are merged with the copy or XOR starting them, an operation reading its own
+ * destination starts a new run so the result is identical to running the operations one at a time.
+ * @param schedule The -1 terminated schedule
+ * @return The compiled schedule, or NULL if unsuccessful
+ */
+struct crs_xor_schedule *xor_compile_schedule(int **schedule);
+
+/**
+ * Frees a compiled schedule.
+ * @param xs The compiled schedule, may be NULL
+ */
+void xor_free_schedule(struct crs_xor_schedule *xs);
+
+/**
+ * Runs the compiled schedule over consecutive blocks of the rows. The XOR kernel is picked once from the CPU: AVX-512,
+ * AVX2, or 64 bit words.
+ * @param xs The compiled schedule
+ * @param ptrs The row pointers the schedule operates on, NULL for rows it does not use
+ * @param packetsize The packet size
+ * @param blockSize The size of a block (w * packetsize)
+ * @param nrBlocks The number of blocks to run the schedule over
+ * @return 0 if successful, otherwise -1
+ */
+int xor_run_schedule(struct crs_xor_schedule *xs, char **ptrs, int packetsize, size_t blockSize, size_t nrBlocks);
+
+/**
+ * Gives the name of the XOR kernel picked for this CPU.
+ * @return "avx512", "avx2" or "scalar"
+ */
+const char *xor_kernel_name(void);
+
+#endif /* CRS_XOR_H_ */